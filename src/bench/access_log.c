@@ -0,0 +1,61 @@
+/*
+Measures what the access log costs a request: formatting a typical entry into the calling thread's slot, with the background thread writing
+them out to a file meanwhile. Run with a path to log somewhere other than /dev/null. Nothing real logs as fast as this loop, so with a real
+file most entries get dropped once the slot fills, which is the cost of a drop rather than a write.
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../shared/access_log.h"
+
+#define NUM_ITERATIONS 2000000
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+	char *path = argc > 1 ? argv[1] : "/dev/null";
+	string error;
+	string_init(&error);
+	string address, method, uri;
+	string_init_cstr(&address, "192.168.100.200");
+	string_init_cstr(&method, "GET");
+	string_init_cstr(&uri, "/api/v1/users/12345/orders?page=2&sort=created");
+	access_log_entry entry = {0};
+	entry.address = &address;
+	entry.port = 54321;
+	entry.method = &method;
+	entry.uri = &uri;
+	entry.status_code = 200;
+
+	printf("%-10s %12s %12s\n", "sample", "ns/request", "dropped");
+	uint64_t samples[] = {1, 10};
+	for (size_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+		access_log log;
+		if (access_log_init(&log, path, 1, samples[s], &error)) {
+			fprintf(stderr, "%s\n", string_get_cstr(&error));
+			return 1;
+		}
+		uint64_t start = now_ns();
+		for (int i = 0; i < NUM_ITERATIONS; i++) {
+			entry.bytes = 1000 + i % 4096;
+			entry.parse_ns = 1200 + i % 700;
+			entry.queue_ns = 3000 + i % 1100;
+			entry.handler_ns = 25000 + i % 9000;
+			entry.write_ns = 8000 + i % 3000;
+			access_log_write(&log, 0, &entry);
+		}
+		double ns = (double)(now_ns() - start) / NUM_ITERATIONS;
+		printf("%-10llu %12.1f %12llu\n", (unsigned long long)samples[s], ns, (unsigned long long)access_log_get_num_dropped(&log));
+		access_log_dealloc(&log);
+	}
+	string_dealloc(&address);
+	string_dealloc(&method);
+	string_dealloc(&uri);
+	string_dealloc(&error);
+	return 0;
+}
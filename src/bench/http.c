@@ -0,0 +1,671 @@
+/*
+An HTTP/1.1 load generator, run against an http_server in the same process on 127.0.0.1, or against one already running with --port.
+
+Each client thread drives its share of the connections from its own epoll. In the default closed loop every connection keeps --pipeline
+requests outstanding, sending another as each response comes back, so the server sets the pace. With --rate it's an open loop instead,
+requests fall due at a fixed rate whether or not the server is keeping up, and latency is measured from when each was due rather than when
+it was sent, so a server that falls behind shows it in the percentiles rather than just getting fewer requests.
+
+Without keep-alive each connection sends one request with Connection: close and waits for the server to close it before reconnecting, so
+the TIME_WAIT sockets pile up on the server's side rather than using up the client's ports. The blocking model never keeps connections
+alive, so it's always benchmarked that way.
+
+Results cover --duration seconds after --warmup seconds, with latency percentiles from a histogram, so they're within about 3%. Allocations
+are counted by wrapping malloc, calloc and realloc at link time, and divided by the requests completed over the same time, which is almost
+all the server's since the clients don't allocate once they're connected.
+
+--perf-counters turns on the server's hardware counters and prints what each request's parse, handler and serialize phases averaged, where
+perf_event_open is available.
+
+--baseline compares the throughput and allocations against a baseline and exits non-0 if either regressed, with throughput allowed to be
+--tolerance percent lower, and --write-baseline writes a new one. Throughput is absolute, so a baseline only holds for the machine it was
+written on, see src/bench/CMakeLists.txt for re-capturing it on another.
+*/
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../shared/histogram.h"
+#include "../shared/http.h"
+#include "../shared/log.h"
+#include "../shared/perf_counters.h"
+#include "perf_baseline.h"
+
+#define MAX_PIPELINE 64
+#define MAX_EVENTS 256
+#define DEFAULT_TOLERANCE_PERCENT 25
+// some buffers grow during the measurement as bigger batches turn up
+#define ALLOCATION_SLACK 0.5
+
+typedef struct {
+	char *backend;
+	int server_threads;
+	// 0 to start a server in this process
+	uint16_t port;
+	int client_threads;
+	int connections;
+	int keep_alive;
+	int pipeline;
+	// requests per second over all threads, 0 for a closed loop
+	uint64_t rate;
+	size_t request_size;
+	size_t response_size;
+	double warmup;
+	double duration;
+	int json;
+	char *baseline;
+	char *write_baseline;
+	double tolerance;
+	int perf_counters;
+} bench_options;
+
+typedef struct {
+	int socket;
+	int connecting;
+	// the server is expected to close the connection, nothing more is sent on it
+	int closing;
+	// the request has been sent, without keep-alive there's only one per connection
+	int sent;
+	buffer out;
+	size_t out_offset;
+	int want_write;
+	buffer in;
+	// when each outstanding request was due, oldest first
+	uint64_t due[MAX_PIPELINE];
+	size_t first_due;
+	size_t num_outstanding;
+} client_connection;
+
+typedef struct {
+	pthread_t thread;
+	int epoll;
+	int timer;
+	client_connection *connections;
+	size_t num_connections;
+	// open loop, the next request to send was due at this time
+	uint64_t next_due_ns;
+	uint64_t interval_ns;
+	histogram latencies;
+	uint64_t num_completed;
+	uint64_t num_errors;
+	uint64_t bytes_received;
+} client_thread;
+
+static bench_options options;
+static struct sockaddr_in server_address;
+static string request_text;
+static char *response_body;
+static uint64_t measure_start_ns;
+static uint64_t measure_end_ns;
+static int stopping;
+static uint64_t num_allocations;
+
+void *__real_malloc(size_t size);
+void *__wrap_malloc(size_t size) {
+	__atomic_add_fetch(&num_allocations, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+void *__real_calloc(size_t count, size_t size);
+void *__wrap_calloc(size_t count, size_t size) {
+	__atomic_add_fetch(&num_allocations, 1, __ATOMIC_RELAXED);
+	return __real_calloc(count, size);
+}
+
+void *__real_realloc(void *data, size_t size);
+void *__wrap_realloc(void *data, size_t size) {
+	__atomic_add_fetch(&num_allocations, 1, __ATOMIC_RELAXED);
+	return __real_realloc(data, size);
+}
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int handle(void *data, http_request *request, http_response *response) {
+	http_header *header = http_headers_get_cstr(http_response_get_headers(response), "Content-Type", 1);
+	string_set_cstr(http_header_append_value(header), "text/plain");
+	stream_write(http_response_get_body(response), response_body, options.response_size, NULL);
+	return 0;
+}
+
+void usage(char *name) {
+	printf("usage: %s [options]\n", name);
+	printf("    --backend NAME         server io_backend, blocking, epoll or io_uring, default epoll\n");
+	printf("    --server-threads N     server worker threads, default 2\n");
+	printf("    --port PORT            benchmark a server that's already running on 127.0.0.1 rather than starting one\n");
+	printf("    --threads N            client threads, default 1\n");
+	printf("    --connections N        connections over all client threads, default 16\n");
+	printf("    --keep-alive 0|1       reuse connections, default 1\n");
+	printf("    --pipeline N           requests outstanding on each connection with keep-alive, default 1, at most %i\n", MAX_PIPELINE);
+	printf("    --rate N               open loop at N requests per second, default 0 for a closed loop\n");
+	printf("    --request-size N       request body bytes, sent as a POST when not 0, default 0\n");
+	printf("    --response-size N      response body bytes, default 12\n");
+	printf("    --warmup SECONDS       time before measuring, default 0.5\n");
+	printf("    --duration SECONDS     time measured, default 2\n");
+	printf("    --json                 print the results as a JSON object\n");
+	printf("    --baseline FILE        exit non-0 if throughput or allocations regressed from the baseline\n");
+	printf("    --tolerance PERCENT    how much lower throughput can be than the baseline, default %i\n", DEFAULT_TOLERANCE_PERCENT);
+	printf("    --write-baseline FILE  write the results as a new baseline\n");
+	printf("    --perf-counters        count cycles, instructions, cache and branch misses in each phase of the server's requests\n");
+}
+
+int parse_options(int argc, char **argv) {
+	static struct option long_options[] = {
+		{"backend", required_argument, 0, 'b'},		  {"server-threads", required_argument, 0, 's'},
+		{"port", required_argument, 0, 'p'},		  {"threads", required_argument, 0, 't'},
+		{"connections", required_argument, 0, 'c'},	  {"keep-alive", required_argument, 0, 'k'},
+		{"pipeline", required_argument, 0, 'P'},	  {"rate", required_argument, 0, 'r'},
+		{"request-size", required_argument, 0, 'q'},  {"response-size", required_argument, 0, 'R'},
+		{"warmup", required_argument, 0, 'w'},		  {"duration", required_argument, 0, 'd'},
+		{"json", no_argument, 0, 'j'},				  {"baseline", required_argument, 0, 'B'},
+		{"tolerance", required_argument, 0, 'T'},	  {"write-baseline", required_argument, 0, 'W'},
+		{"perf-counters", no_argument, 0, 'C'},		  {"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}};
+	options.backend = "epoll";
+	options.server_threads = 2;
+	options.client_threads = 1;
+	options.connections = 16;
+	options.keep_alive = 1;
+	options.pipeline = 1;
+	options.response_size = 12;
+	options.warmup = 0.5;
+	options.duration = 2;
+	options.tolerance = DEFAULT_TOLERANCE_PERCENT;
+	int c;
+	while ((c = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			options.backend = optarg;
+			break;
+		case 's':
+			options.server_threads = atoi(optarg);
+			break;
+		case 'p':
+			options.port = atoi(optarg);
+			break;
+		case 't':
+			options.client_threads = atoi(optarg);
+			break;
+		case 'c':
+			options.connections = atoi(optarg);
+			break;
+		case 'k':
+			options.keep_alive = atoi(optarg);
+			break;
+		case 'P':
+			options.pipeline = atoi(optarg);
+			break;
+		case 'r':
+			options.rate = strtoull(optarg, NULL, 10);
+			break;
+		case 'q':
+			options.request_size = strtoull(optarg, NULL, 10);
+			break;
+		case 'R':
+			options.response_size = strtoull(optarg, NULL, 10);
+			break;
+		case 'w':
+			options.warmup = atof(optarg);
+			break;
+		case 'd':
+			options.duration = atof(optarg);
+			break;
+		case 'j':
+			options.json = 1;
+			break;
+		case 'B':
+			options.baseline = optarg;
+			break;
+		case 'T':
+			options.tolerance = atof(optarg);
+			break;
+		case 'W':
+			options.write_baseline = optarg;
+			break;
+		case 'C':
+			options.perf_counters = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.client_threads < 1 || options.connections < options.client_threads || options.pipeline < 1 ||
+		options.pipeline > MAX_PIPELINE || options.server_threads < 1 || options.duration <= 0 || options.warmup < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!options.port && !strcmp(options.backend, "blocking")) {
+		// the blocking model closes every connection after its response
+		options.keep_alive = 0;
+	}
+	if (!options.keep_alive) {
+		options.pipeline = 1;
+	}
+	return 0;
+}
+
+// the same request over and over, with Content-Length bytes of body if there is one
+void build_request() {
+	string_init(&request_text);
+	string_set_cstr(&request_text, options.request_size ? "POST" : "GET");
+	string_append_cstr(&request_text, " /bench HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: bench_http\r\n");
+	if (!options.keep_alive) {
+		string_append_cstr(&request_text, "Connection: close\r\n");
+	}
+	if (options.request_size) {
+		string_append_cstrf(&request_text, "Content-Length: %zu\r\n", options.request_size);
+	}
+	string_append_cstr(&request_text, "\r\n");
+	string_set_length(&request_text, string_get_length(&request_text) + options.request_size, 'x');
+}
+
+void connection_close(client_thread *thread, client_connection *connection) {
+	if (connection->socket >= 0) {
+		close(connection->socket);
+	}
+	connection->socket = -1;
+	// anything still outstanding is never going to be answered
+	if (now_ns() >= measure_start_ns && now_ns() < measure_end_ns) {
+		thread->num_errors += connection->num_outstanding;
+	}
+	connection->num_outstanding = 0;
+	connection->first_due = 0;
+	buffer_clear(&connection->out);
+	buffer_clear(&connection->in);
+	connection->out_offset = 0;
+}
+
+int connection_open(client_thread *thread, client_connection *connection) {
+	connection->socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (connection->socket < 0) {
+		return 1;
+	}
+	int one = 1;
+	setsockopt(connection->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	connection->connecting = 1;
+	connection->closing = 0;
+	connection->sent = 0;
+	connection->want_write = 1;
+	if (connect(connection->socket, (struct sockaddr *)&server_address, sizeof(server_address)) && errno != EINPROGRESS) {
+		close(connection->socket);
+		connection->socket = -1;
+		return 1;
+	}
+	// writable once connected
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT;
+	event.data.ptr = connection;
+	return epoll_ctl(thread->epoll, EPOLL_CTL_ADD, connection->socket, &event);
+}
+
+void connection_reopen(client_thread *thread, client_connection *connection) {
+	connection_close(thread, connection);
+	if (!__atomic_load_n(&stopping, __ATOMIC_RELAXED) && connection_open(thread, connection)) {
+		fprintf(stderr, "failed to connect, %s\n", strerror(errno));
+		exit(1);
+	}
+}
+
+void connection_set_want_write(client_thread *thread, client_connection *connection, int want_write) {
+	if (connection->want_write == want_write) {
+		return;
+	}
+	connection->want_write = want_write;
+	struct epoll_event event;
+	event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+	event.data.ptr = connection;
+	epoll_ctl(thread->epoll, EPOLL_CTL_MOD, connection->socket, &event);
+}
+
+// sends as much of what's queued as the socket takes
+void connection_flush(client_thread *thread, client_connection *connection) {
+	while (connection->out_offset < buffer_get_length(&connection->out)) {
+		ssize_t result = send(connection->socket, connection->out.data + connection->out_offset,
+							  buffer_get_length(&connection->out) - connection->out_offset, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				connection_set_want_write(thread, connection, 1);
+				return;
+			}
+			connection_reopen(thread, connection);
+			return;
+		}
+		connection->out_offset += result;
+	}
+	buffer_clear(&connection->out);
+	connection->out_offset = 0;
+	connection_set_want_write(thread, connection, 0);
+}
+
+// queues requests while the connection has room for them and, with an open loop, while they're due
+void connection_fill(client_thread *thread, client_connection *connection, uint64_t now) {
+	if (connection->socket < 0 || connection->connecting || connection->closing) {
+		return;
+	}
+	int queued = 0;
+	while (connection->num_outstanding < (size_t)options.pipeline && !(connection->sent && !options.keep_alive)) {
+		uint64_t due = now;
+		if (options.rate) {
+			if (thread->next_due_ns > now) {
+				break;
+			}
+			due = thread->next_due_ns;
+			thread->next_due_ns += thread->interval_ns;
+		}
+		buffer_append_bytes(&connection->out, string_get_cstr(&request_text), string_get_length(&request_text));
+		connection->due[(connection->first_due + connection->num_outstanding) % MAX_PIPELINE] = due;
+		connection->num_outstanding++;
+		connection->sent = 1;
+		queued = 1;
+	}
+	if (queued) {
+		connection_flush(thread, connection);
+	}
+}
+
+/*
+Finds the length of the response at the start of data, if all of it has arrived.
+
+Returns the length, 0 if it's incomplete, or -1 if it isn't a response that can be read.
+*/
+ssize_t find_response(char *data, size_t length, int *status_code) {
+	char *end_of_headers = memmem(data, length, "\r\n\r\n", 4);
+	if (!end_of_headers) {
+		return 0;
+	}
+	if (length < 12 || memcmp(data, "HTTP/1.", 7)) {
+		return -1;
+	}
+	*status_code = atoi(data + 9);
+	size_t header_length = end_of_headers + 4 - data;
+	size_t content_length = 0;
+	// every header line ends in \r\n, up to and including the one that ends the headers
+	char *line = (char *)memchr(data, '\n', header_length) + 1;
+	while (line < end_of_headers) {
+		if (!strncasecmp(line, "Content-Length:", 15)) {
+			content_length = strtoull(line + 15, NULL, 10);
+		}
+		line = (char *)memchr(line, '\n', end_of_headers + 2 - line) + 1;
+	}
+	return header_length + content_length <= length ? (ssize_t)(header_length + content_length) : 0;
+}
+
+void connection_read(client_thread *thread, client_connection *connection) {
+	char chunk[16384];
+	int closed = 0;
+	while (1) {
+		ssize_t result = recv(connection->socket, chunk, sizeof(chunk), 0);
+		if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+		if (result <= 0) {
+			// the last response can come in the same read as the close
+			closed = 1;
+			break;
+		}
+		buffer_append_bytes(&connection->in, chunk, result);
+	}
+	uint64_t now = now_ns();
+	size_t consumed = 0;
+	while (connection->num_outstanding > 0) {
+		int status_code;
+		ssize_t length = find_response((char *)connection->in.data + consumed, buffer_get_length(&connection->in) - consumed, &status_code);
+		if (length == 0) {
+			break;
+		}
+		if (length < 0) {
+			connection_reopen(thread, connection);
+			return;
+		}
+		consumed += length;
+		uint64_t due = connection->due[connection->first_due];
+		connection->first_due = (connection->first_due + 1) % MAX_PIPELINE;
+		connection->num_outstanding--;
+		if (now >= measure_start_ns && now < measure_end_ns) {
+			if (status_code >= 200 && status_code < 300) {
+				thread->num_completed++;
+				histogram_record(&thread->latencies, now - due);
+			} else {
+				thread->num_errors++;
+			}
+			thread->bytes_received += length;
+		}
+	}
+	if (consumed > 0) {
+		size_t remaining = buffer_get_length(&connection->in) - consumed;
+		memmove(connection->in.data, connection->in.data + consumed, remaining);
+		buffer_set_length(&connection->in, remaining);
+	}
+	if (closed) {
+		// expected after the response without keep-alive, otherwise whatever was outstanding is lost
+		connection_reopen(thread, connection);
+	} else if (!options.keep_alive && connection->sent && connection->num_outstanding == 0) {
+		// wait for the server to close it
+		connection->closing = 1;
+	}
+}
+
+void *client_thread_main(void *data) {
+	client_thread *thread = data;
+	struct epoll_event events[MAX_EVENTS];
+	while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+		uint64_t now = now_ns();
+		for (size_t i = 0; i < thread->num_connections; i++) {
+			connection_fill(thread, &thread->connections[i], now);
+		}
+		if (options.rate && thread->next_due_ns > now) {
+			// epoll_wait only times out to the millisecond, the timer wakes this up when the next request falls due to the nanosecond
+			struct itimerspec due = {{0, 0}, {thread->next_due_ns / 1000000000, thread->next_due_ns % 1000000000}};
+			timerfd_settime(thread->timer, TFD_TIMER_ABSTIME, &due, NULL);
+		}
+		// when requests are due but every connection is full, a response coming in is what makes room for the next
+		int num_events = epoll_wait(thread->epoll, events, MAX_EVENTS, 100);
+		for (int i = 0; i < num_events; i++) {
+			client_connection *connection = events[i].data.ptr;
+			if (!connection) {
+				uint64_t expirations;
+				read(thread->timer, &expirations, sizeof(expirations));
+				continue;
+			}
+			if (connection->socket < 0) {
+				continue;
+			}
+			if (connection->connecting && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+				int error = 0;
+				socklen_t error_length = sizeof(error);
+				getsockopt(connection->socket, SOL_SOCKET, SO_ERROR, &error, &error_length);
+				if (error) {
+					fprintf(stderr, "failed to connect, %s\n", strerror(error));
+					exit(1);
+				}
+				connection->connecting = 0;
+				connection_set_want_write(thread, connection, 0);
+				continue;
+			}
+			if (events[i].events & EPOLLOUT) {
+				connection_flush(thread, connection);
+			}
+			if (connection->socket >= 0 && (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+				connection_read(thread, connection);
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	if (parse_options(argc, argv)) {
+		return 1;
+	}
+	perf_baseline baseline;
+	string error;
+	string_init(&error);
+	if (perf_baseline_init(&baseline, options.baseline, &error)) {
+		fprintf(stderr, "%s\n", string_get_cstr(&error));
+		return 1;
+	}
+	// the server's logging would be most of what's measured
+	log_set_level(LOG_LEVEL_ERROR);
+	response_body = malloc(options.response_size + 1);
+	memset(response_body, 'x', options.response_size);
+	build_request();
+
+	http_server server;
+	uint16_t port = options.port;
+	if (!port) {
+		http_server_config config;
+		http_server_config_init(&config);
+		string_set_cstr(&config.address, "127.0.0.1");
+		config.port = 0;
+		config.num_threads = options.server_threads;
+		string_set_cstr(&config.io_backend, options.backend);
+		config.keep_alive_timeout_ms = 60000;
+		config.perf_counters = options.perf_counters;
+		config.max_body_size = options.request_size > config.max_body_size ? options.request_size : config.max_body_size;
+		if (http_server_init(&server, handle, NULL, &config)) {
+			fprintf(stderr, "failed to start the %s server\n", options.backend);
+			http_server_config_dealloc(&config);
+			return 1;
+		}
+		http_server_config_dealloc(&config);
+		port = tcp_socket_wrapper_get_port(&server.socket);
+	}
+	memset(&server_address, 0, sizeof(server_address));
+	server_address.sin_family = AF_INET;
+	server_address.sin_addr.s_addr = inet_addr("127.0.0.1");
+	server_address.sin_port = htons(port);
+
+	uint64_t start_ns = now_ns();
+	measure_start_ns = start_ns + (uint64_t)(options.warmup * 1e9);
+	measure_end_ns = measure_start_ns + (uint64_t)(options.duration * 1e9);
+	client_thread *threads = calloc(options.client_threads, sizeof(client_thread));
+	for (int i = 0; i < options.client_threads; i++) {
+		client_thread *thread = &threads[i];
+		thread->epoll = epoll_create1(EPOLL_CLOEXEC);
+		thread->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		struct epoll_event timer_event;
+		timer_event.events = EPOLLIN;
+		timer_event.data.ptr = NULL;
+		epoll_ctl(thread->epoll, EPOLL_CTL_ADD, thread->timer, &timer_event);
+		// the connections are shared out as evenly as they go
+		thread->num_connections = options.connections / options.client_threads + (i < options.connections % options.client_threads);
+		thread->connections = calloc(thread->num_connections, sizeof(client_connection));
+		if (options.rate) {
+			thread->interval_ns = 1000000000ull * options.client_threads / options.rate;
+			// staggered so the threads don't all send at once
+			thread->next_due_ns = start_ns + thread->interval_ns * i / options.client_threads;
+		}
+		histogram_init(&thread->latencies);
+		for (size_t j = 0; j < thread->num_connections; j++) {
+			client_connection *connection = &thread->connections[j];
+			buffer_init(&connection->out);
+			buffer_init(&connection->in);
+			if (connection_open(thread, connection)) {
+				fprintf(stderr, "failed to connect, %s\n", strerror(errno));
+				return 1;
+			}
+		}
+		pthread_create(&thread->thread, NULL, client_thread_main, thread);
+	}
+	usleep((useconds_t)((measure_start_ns - start_ns) / 1000));
+	uint64_t allocations = __atomic_load_n(&num_allocations, __ATOMIC_RELAXED);
+	usleep((useconds_t)((measure_end_ns - measure_start_ns) / 1000));
+	allocations = __atomic_load_n(&num_allocations, __ATOMIC_RELAXED) - allocations;
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+
+	histogram latencies;
+	histogram_init(&latencies);
+	uint64_t num_completed = 0, num_errors = 0, bytes_received = 0;
+	for (int i = 0; i < options.client_threads; i++) {
+		client_thread *thread = &threads[i];
+		pthread_join(thread->thread, NULL);
+		histogram_merge(&latencies, &thread->latencies);
+		num_completed += thread->num_completed;
+		num_errors += thread->num_errors;
+		bytes_received += thread->bytes_received;
+		for (size_t j = 0; j < thread->num_connections; j++) {
+			client_connection *connection = &thread->connections[j];
+			if (connection->socket >= 0) {
+				close(connection->socket);
+			}
+			buffer_dealloc(&connection->out);
+			buffer_dealloc(&connection->in);
+		}
+		free(thread->connections);
+		close(thread->timer);
+		close(thread->epoll);
+	}
+	free(threads);
+
+	double requests_per_second = num_completed / options.duration;
+	double p50 = histogram_get_percentile(&latencies, 50) / 1e3;
+	double p90 = histogram_get_percentile(&latencies, 90) / 1e3;
+	double p99 = histogram_get_percentile(&latencies, 99) / 1e3;
+	double p999 = histogram_get_percentile(&latencies, 99.9) / 1e3;
+	double max = histogram_get_max(&latencies) / 1e3;
+	double allocations_per_request = num_completed ? (double)allocations / num_completed : 0;
+	char *backend = options.port ? "external" : options.backend;
+	if (options.json) {
+		printf("{\"backend\": \"%s\", \"connections\": %i, \"keep_alive\": %i, \"pipeline\": %i, \"rate\": %llu, \"requests\": %llu, "
+			   "\"errors\": %llu, \"requests_per_second\": %.1f, \"mb_per_second\": %.2f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+			   "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f, \"allocs_per_request\": %.2f}\n",
+			   backend, options.connections, options.keep_alive, options.pipeline, (unsigned long long)options.rate,
+			   (unsigned long long)num_completed, (unsigned long long)num_errors, requests_per_second,
+			   bytes_received / options.duration / 1e6, p50, p90, p99, p999, max, allocations_per_request);
+	} else {
+		printf("%-10s %6s %5s %5s %12s %8s %10s %10s %10s %10s %10s %10s\n", "backend", "conns", "keep", "pipe", "requests/s", "errors",
+			   "p50 us", "p90 us", "p99 us", "p999 us", "max us", "allocs/req");
+		printf("%-10s %6i %5i %5i %12.1f %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.2f\n", backend, options.connections,
+			   options.keep_alive, options.pipeline, requests_per_second, (unsigned long long)num_errors, p50, p90, p99, p999, max,
+			   allocations_per_request);
+	}
+	if (options.perf_counters && perf_counters_is_enabled()) {
+		// the warmup's requests are in there too, and with --json they go to stderr to keep stdout JSON
+		string counters;
+		string_init(&counters);
+		perf_counters_write(&counters);
+		fprintf(options.json ? stderr : stdout, "%s", string_get_cstr(&counters));
+		string_dealloc(&counters);
+	}
+
+	// named by backend, the rest of the configuration is whatever the baseline was written with
+	char name[64];
+	snprintf(name, sizeof(name), "%s.requests_per_second", backend);
+	perf_baseline_check_higher(&baseline, name, requests_per_second, options.tolerance);
+	snprintf(name, sizeof(name), "%s.allocs_per_request", backend);
+	perf_baseline_check_lower(&baseline, name, allocations_per_request, 0, ALLOCATION_SLACK);
+	int result = num_completed == 0;
+	if (options.write_baseline && perf_baseline_write_cstr(&baseline, options.write_baseline, &error)) {
+		fprintf(stderr, "%s\n", string_get_cstr(&error));
+		result = 1;
+	}
+	if (perf_baseline_get_num_failed(&baseline)) {
+		fprintf(stderr, "%zu regressed\n", perf_baseline_get_num_failed(&baseline));
+		result = 1;
+	}
+	perf_baseline_dealloc(&baseline);
+	string_dealloc(&error);
+
+	if (!options.port) {
+		http_server_dealloc(&server);
+	}
+	string_dealloc(&request_text);
+	free(response_body);
+	return result;
+}
@@ -0,0 +1,214 @@
+/*
+Compares the blocking model, where the accept thread hands each connection to a worker that blocks reading and writing it, with the
+io_loop backends, where a loop thread does all the socket I/O and workers only run handlers.
+
+Requests are sequential, one per connection the same as the server handles them, and report latency percentiles. Syscalls per request
+counts the socket calls the server's threads make, plus io_uring_enter, by wrapping them at link time. Futex calls made waking threads
+aren't counted, which flatters the blocking model as it has the most thread hand offs.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../shared/http.h"
+
+#define NUM_REQUESTS 2000
+
+static char request_text[] = "GET /hello HTTP/1.1\r\nHost: localhost\r\nUser-Agent: bench_io\r\n\r\n";
+
+static volatile uint64_t server_syscalls;
+// the client runs on the main thread and its calls aren't counted
+static __thread int is_client;
+
+#define COUNT_SYSCALL()                                                                                                                    \
+	if (!is_client) {                                                                                                                      \
+		__atomic_fetch_add(&server_syscalls, 1, __ATOMIC_RELAXED);                                                                         \
+	}
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+	COUNT_SYSCALL();
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+	COUNT_SYSCALL();
+	return __real_write(fd, buf, count);
+}
+
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags) {
+	COUNT_SYSCALL();
+	return __real_recv(fd, buf, len, flags);
+}
+
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags) {
+	COUNT_SYSCALL();
+	return __real_send(fd, buf, len, flags);
+}
+
+int __real_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+int __wrap_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+	COUNT_SYSCALL();
+	return __real_accept(fd, addr, addrlen);
+}
+
+int __real_accept4(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+int __wrap_accept4(int fd, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+	COUNT_SYSCALL();
+	return __real_accept4(fd, addr, addrlen, flags);
+}
+
+int __real_close(int fd);
+int __wrap_close(int fd) {
+	COUNT_SYSCALL();
+	return __real_close(fd);
+}
+
+int __real_shutdown(int fd, int how);
+int __wrap_shutdown(int fd, int how) {
+	COUNT_SYSCALL();
+	return __real_shutdown(fd, how);
+}
+
+int __real_setsockopt(int fd, int level, int name, const void *value, socklen_t length);
+int __wrap_setsockopt(int fd, int level, int name, const void *value, socklen_t length) {
+	COUNT_SYSCALL();
+	return __real_setsockopt(fd, level, name, value, length);
+}
+
+int __real_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+	COUNT_SYSCALL();
+	return __real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+	COUNT_SYSCALL();
+	return __real_epoll_ctl(epfd, op, fd, event);
+}
+
+long __real_syscall(long number, ...);
+long __wrap_syscall(long number, ...) {
+	COUNT_SYSCALL();
+	va_list args;
+	va_start(args, number);
+	long a = va_arg(args, long), b = va_arg(args, long), c = va_arg(args, long);
+	long d = va_arg(args, long), e = va_arg(args, long), f = va_arg(args, long);
+	va_end(args);
+	return __real_syscall(number, a, b, c, d, e, f);
+}
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int handle(void *data, http_request *request, http_response *response) {
+	http_header *header = http_headers_get_cstr(http_response_get_headers(response), "Content-Type", 1);
+	string_set_cstr(http_header_append_value(header), "text/plain");
+	stream_write(http_response_get_body(response), "hello world\n", 12, NULL);
+	return 0;
+}
+
+/*
+Sends a request on a new connection and reads until the server closes it.
+
+Returns 0 on success.
+*/
+int do_request(uint16_t port) {
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s == -1) {
+		return 1;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	int result = 1;
+	size_t request_len = sizeof(request_text) - 1;
+	if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) || write(s, request_text, request_len) != (ssize_t)request_len) {
+		goto DONE;
+	}
+	char response[4096];
+	size_t total = 0;
+	ssize_t read_len;
+	while ((read_len = read(s, response, sizeof(response))) > 0) {
+		total += read_len;
+	}
+	if (read_len == 0 && total > 0) {
+		result = 0;
+	}
+DONE:
+	close(s);
+	return result;
+}
+
+int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+void measure(char *io_backend) {
+	http_server_config config;
+	http_server_config_init(&config);
+	string_set_cstr(&config.address, "127.0.0.1");
+	config.port = 0;
+	config.num_threads = 2;
+	string_set_cstr(&config.io_backend, io_backend);
+	http_server server;
+	if (http_server_init(&server, handle, NULL, &config)) {
+		printf("%-10s unavailable\n", io_backend);
+		http_server_config_dealloc(&config);
+		return;
+	}
+	uint16_t port = tcp_socket_wrapper_get_port(&server.socket);
+
+	for (int i = 0; i < 50; i++) {
+		do_request(port);
+	}
+
+	uint64_t latencies[NUM_REQUESTS];
+	uint64_t syscalls_start = __atomic_load_n(&server_syscalls, __ATOMIC_RELAXED);
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_REQUESTS; i++) {
+		uint64_t request_start = now_ns();
+		if (do_request(port)) {
+			fprintf(stderr, "%s request failed, %s\n", io_backend, strerror(errno));
+			exit(1);
+		}
+		latencies[i] = now_ns() - request_start;
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	// the last response is read before the server closes the socket, give it a moment to finish
+	usleep(10000);
+	uint64_t syscalls = __atomic_load_n(&server_syscalls, __ATOMIC_RELAXED) - syscalls_start;
+	qsort(latencies, NUM_REQUESTS, sizeof(uint64_t), compare_uint64);
+	printf("%-10s %10.1f %10.1f %10.1f %12.0f %14.2f\n", io_backend, latencies[NUM_REQUESTS / 2] / 1e3,
+		   latencies[NUM_REQUESTS * 99 / 100] / 1e3, latencies[NUM_REQUESTS - 1] / 1e3, NUM_REQUESTS / seconds,
+		   (double)syscalls / NUM_REQUESTS);
+
+	http_server_dealloc(&server);
+	http_server_config_dealloc(&config);
+}
+
+int main() {
+	is_client = 1;
+	printf("%-10s %10s %10s %10s %12s %14s\n", "backend", "p50 us", "p99 us", "max us", "requests/s", "syscalls/req");
+	measure("blocking");
+	measure("epoll");
+	measure("io_uring");
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+Measures JSON throughput in GB/s, both for indexing alone and for indexing plus reading every value in the document. Writing is compared
+against building the same output with string_append_cstrf.
+
+Any files given on the command line are measured, otherwise a couple of synthetic documents are generated, one shaped like an API response
+with lots of short strings and one that's mostly numbers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../shared/json.h"
+
+#define TARGET_BYTES (1ull << 29)
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void generate_records(string *s) {
+	string_set_cstr(s, "{\"statuses\": [\n");
+	for (int i = 0; i < 2000; i++) {
+		string_append_cstrf(s,
+							"%s  {\"id\": %i, \"created_at\": \"Sun Aug 31 00:29:%02i +0000 2014\", \"text\": \"message number %i with "
+							"some \\\"quoted\\\" text and a \\u00e9 in it\", \"truncated\": false, \"user\": {\"id\": %i, \"name\": "
+							"\"user%i\", \"screen_name\": \"screen_name_%i\", \"followers_count\": %i, \"verified\": %s, \"url\": "
+							"null}, \"entities\": {\"hashtags\": [\"one\", \"two\"], \"urls\": [], \"coordinates\": [%i.25, -%i.5]}, "
+							"\"retweet_count\": %i, \"lang\": \"en\"}",
+							i > 0 ? ",\n" : "", 500000000 + i, i % 60, i, 1000 + i, i, i, i * 7, i % 3 ? "false" : "true", i % 90,
+							i % 180, i % 100);
+	}
+	string_append_cstr(s, "\n]}\n");
+}
+
+void generate_numbers(string *s) {
+	string_set_cstr(s, "[");
+	for (int i = 0; i < 100000; i++) {
+		string_append_cstrf(s, "%s[%.6f, %i, -%i.%ie-3]", i > 0 ? "," : "", i * 1.1, i * 31, i, i % 1000);
+	}
+	string_append_cstr(s, "]");
+}
+
+/*
+Reads everything in the document so the on-demand parts of parsing are included in the timing.
+
+Returns the number of values visited.
+*/
+size_t visit(json_value *value) {
+	size_t count = 1;
+	json_value key, element;
+	json_iterator it;
+	char *s;
+	size_t len;
+	double d;
+	switch (json_value_get_type(value)) {
+	case JSON_TYPE_OBJECT:
+	case JSON_TYPE_ARRAY:
+		json_value_iterate(value, &it);
+		int result;
+		while ((result = json_iterator_next(&it, &key, &element)) > 0) {
+			if (json_value_get_type(value) == JSON_TYPE_OBJECT) {
+				json_value_get_cstr_len(&key, &s, &len);
+			}
+			count += visit(&element);
+		}
+		if (result < 0) {
+			fprintf(stderr, "malformed document\n");
+			exit(1);
+		}
+		break;
+	case JSON_TYPE_STRING:
+		json_value_get_cstr_len(value, &s, &len);
+		break;
+	case JSON_TYPE_NUMBER:
+		json_value_get_double(value, &d);
+		break;
+	default:
+		break;
+	}
+	return count;
+}
+
+void measure(char *name, char *input, size_t input_len) {
+	json_document doc;
+	json_document_init(&doc);
+	size_t repetitions = TARGET_BYTES / input_len + 1;
+
+	// warm up, which also sizes all of the document's buffers
+	json_value root;
+	if (json_document_parse(&doc, input, input_len) || json_document_get_root(&doc, &root)) {
+		fprintf(stderr, "%s failed to parse\n", name);
+		exit(1);
+	}
+	size_t num_values = visit(&root);
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < repetitions; i++) {
+		json_document_parse(&doc, input, input_len);
+	}
+	double index_seconds = (now_ns() - start) / 1e9;
+
+	start = now_ns();
+	for (size_t i = 0; i < repetitions; i++) {
+		json_document_parse(&doc, input, input_len);
+		json_document_get_root(&doc, &root);
+		visit(&root);
+	}
+	double full_seconds = (now_ns() - start) / 1e9;
+
+	double gb = (double)input_len * repetitions / 1e9;
+	printf("%-20s %10zu %10zu %12.2f %12.2f\n", name, input_len, num_values, gb / index_seconds, gb / full_seconds);
+	json_document_dealloc(&doc);
+}
+
+#define NUM_WRITE_RECORDS 1000000
+
+void measure_write() {
+	buffer b;
+	buffer_init(&b);
+	stream out;
+	stream_init_buffer(&out, &b, 0);
+	json_writer w;
+	json_writer_init(&w, &out, 0);
+	uint64_t start = now_ns();
+	json_writer_begin_array(&w);
+	for (int i = 0; i < NUM_WRITE_RECORDS; i++) {
+		json_writer_begin_object(&w);
+		json_writer_key_cstr(&w, "id");
+		json_writer_int64(&w, 500000000 + i);
+		json_writer_key_cstr(&w, "name");
+		json_writer_cstr(&w, "some \"quoted\" name");
+		json_writer_key_cstr(&w, "score");
+		json_writer_double(&w, i * 0.25);
+		json_writer_key_cstr(&w, "active");
+		json_writer_bool(&w, i % 2);
+		json_writer_end_object(&w);
+	}
+	json_writer_end_array(&w);
+	json_writer_flush(&w, NULL);
+	double writer_seconds = (now_ns() - start) / 1e9;
+	size_t writer_len = buffer_get_length(&b);
+	json_writer_dealloc(&w);
+	stream_dealloc(&out, NULL);
+	buffer_dealloc(&b);
+
+	string s;
+	string_init(&s);
+	start = now_ns();
+	string_append_cstr(&s, "[");
+	for (int i = 0; i < NUM_WRITE_RECORDS; i++) {
+		string_append_cstrf(&s, "%s{\"id\":%i,\"name\":\"%s\",\"score\":%.17g,\"active\":%s}", i > 0 ? "," : "", 500000000 + i,
+							"some \\\"quoted\\\" name", i * 0.25, i % 2 ? "true" : "false");
+	}
+	string_append_cstr(&s, "]");
+	double printf_seconds = (now_ns() - start) / 1e9;
+	size_t printf_len = string_get_length(&s);
+	string_dealloc(&s);
+
+	printf("\n%-20s %10s %12s %12s\n", "write", "bytes", "ns/record", "GB/s");
+	printf("%-20s %10zu %12.1f %12.2f\n", "json_writer", writer_len, writer_seconds * 1e9 / NUM_WRITE_RECORDS,
+		   writer_len / writer_seconds / 1e9);
+	printf("%-20s %10zu %12.1f %12.2f\n", "string_append_cstrf", printf_len, printf_seconds * 1e9 / NUM_WRITE_RECORDS,
+		   printf_len / printf_seconds / 1e9);
+}
+
+int main(int argc, char **argv) {
+	printf("%-20s %10s %10s %12s %12s\n", "input", "bytes", "values", "index GB/s", "full GB/s");
+	if (argc > 1) {
+		for (int i = 1; i < argc; i++) {
+			FILE *f = fopen(argv[i], "rb");
+			if (!f) {
+				fprintf(stderr, "failed to open %s\n", argv[i]);
+				return 1;
+			}
+			string s;
+			string_init(&s);
+			char chunk[65536];
+			size_t read;
+			while ((read = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+				string_append_cstr_len(&s, chunk, read);
+			}
+			fclose(f);
+			measure(argv[i], string_get_cstr(&s), string_get_length(&s));
+			string_dealloc(&s);
+		}
+		return 0;
+	}
+
+	string s;
+	string_init(&s);
+	generate_records(&s);
+	measure("records", string_get_cstr(&s), string_get_length(&s));
+	generate_numbers(&s);
+	measure("numbers", string_get_cstr(&s), string_get_length(&s));
+	string_dealloc(&s);
+
+	measure_write();
+	return 0;
+}
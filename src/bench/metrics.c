@@ -0,0 +1,83 @@
+/*
+Compares updating a metric from several threads at once against every thread doing an atomic add on one shared counter, which is what the
+per-thread shards are there to avoid. Then times recording into a histogram, and the clocks a duration could be measured with.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../shared/metrics.h"
+
+#define NUM_ITERATIONS 10000000
+
+metrics_id sharded;
+metrics_id latency;
+int64_t shared;
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void *add_sharded(void *data) {
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		metrics_add(sharded, 1);
+	}
+	return NULL;
+}
+
+void *add_shared(void *data) {
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		__atomic_fetch_add(&shared, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+double run(void *(*add)(void *), int num_threads) {
+	pthread_t threads[16];
+	uint64_t start = now_ns();
+	for (int i = 0; i < num_threads; i++) {
+		pthread_create(&threads[i], NULL, add, NULL);
+	}
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	return (double)(now_ns() - start) / NUM_ITERATIONS;
+}
+
+double time_clock(clockid_t clock) {
+	struct timespec ts;
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		clock_gettime(clock, &ts);
+	}
+	return (double)(now_ns() - start) / NUM_ITERATIONS;
+}
+
+int main() {
+	metrics_register_cstr("bench_total", "Benchmark.", METRICS_TYPE_COUNTER, &sharded);
+	metrics_register_cstr("bench_seconds", "Benchmark.", METRICS_TYPE_HISTOGRAM, &latency);
+	printf("%-10s %14s %14s\n", "threads", "sharded ns/op", "atomic ns/op");
+	int thread_counts[] = {1, 2, 4, 8};
+	for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+		double sharded_ns = run(add_sharded, thread_counts[t]);
+		double shared_ns = run(add_shared, thread_counts[t]);
+		printf("%-10i %14.2f %14.2f\n", thread_counts[t], sharded_ns, shared_ns);
+	}
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		// spread over the range request phases take
+		metrics_record(latency, 1000 + (i * 7919ull) % 10000000);
+	}
+	printf("\n%-30s %8.2f\n", "histogram record ns/op", (double)(now_ns() - start) / NUM_ITERATIONS);
+	printf("%-30s %8.2f\n", "CLOCK_MONOTONIC ns/op", time_clock(CLOCK_MONOTONIC));
+	printf("%-30s %8.2f\n", "CLOCK_MONOTONIC_COARSE ns/op", time_clock(CLOCK_MONOTONIC_COARSE));
+	struct timespec resolution;
+	clock_getres(CLOCK_MONOTONIC_COARSE, &resolution);
+	printf("%-30s %8.2f\n", "CLOCK_MONOTONIC_COARSE res us", resolution.tv_nsec / 1000.0);
+	// keeps the adds from being optimized out
+	return metrics_get(sharded) + shared == 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+
+#include "../shared/stream.h"
+#include "perf_baseline.h"
+
+#define MAX_BASELINE_SIZE (1024 * 1024)
+
+int perf_baseline_init(perf_baseline *baseline, char *path, string *error) {
+	buffer_init(&baseline->contents);
+	json_document_init(&baseline->document);
+	baseline->loaded = 0;
+	string_init(&baseline->measured);
+	baseline->num_measured = 0;
+	baseline->num_failed = 0;
+	if (!path) {
+		return 0;
+	}
+
+	stream file;
+	if (stream_init_file_cstr(&file, path, "rb", error)) {
+		return 1;
+	}
+	int result = 0;
+	if (stream_read_all_into_buffer(&file, &baseline->contents, MAX_BASELINE_SIZE, 4096, error) < 0) {
+		result = 1;
+		goto DONE;
+	}
+	if (json_document_parse(&baseline->document, (char *)baseline->contents.data, buffer_get_length(&baseline->contents)) ||
+		json_document_get_root(&baseline->document, &baseline->root) || json_value_get_type(&baseline->root) != JSON_TYPE_OBJECT) {
+		if (error) {
+			string_set_cstrf(error, "baseline %s isn't a JSON object", path);
+		}
+		result = 1;
+		goto DONE;
+	}
+	baseline->loaded = 1;
+
+DONE:
+	stream_dealloc(&file, NULL);
+	return result;
+}
+
+void perf_baseline_dealloc(perf_baseline *baseline) {
+	json_document_dealloc(&baseline->document);
+	buffer_dealloc(&baseline->contents);
+	string_dealloc(&baseline->measured);
+}
+
+/*
+private
+
+Records the measurement for writing, and looks up what it's compared against.
+@returns 0 if there's a baseline for it, non-0 if not
+*/
+int perf_baseline_get(perf_baseline *baseline, char *name, double value, double *expected) {
+	string_append_cstrf(&baseline->measured, "%s\n  \"%s\": %.3f", baseline->num_measured ? "," : "", name, value);
+	baseline->num_measured++;
+	if (!baseline->loaded) {
+		return 1;
+	}
+	json_value member;
+	if (json_value_object_get_cstr(&baseline->root, name, &member) || json_value_get_double(&member, expected)) {
+		fprintf(stderr, "perf: %-48s %14.3f, no baseline\n", name, value);
+		return 1;
+	}
+	return 0;
+}
+
+// private
+void perf_baseline_report(perf_baseline *baseline, char *name, double value, double expected, double limit, int failed) {
+	double change = expected ? (value - expected) * 100 / expected : 0;
+	fprintf(stderr, "perf: %-48s %14.3f, baseline %14.3f (%+.1f%%), limit %14.3f %s\n", name, value, expected, change, limit,
+			failed ? "FAILED" : "ok");
+	baseline->num_failed += failed;
+}
+
+void perf_baseline_check_lower(perf_baseline *baseline, char *name, double value, double tolerance_percent, double slack) {
+	double expected;
+	if (perf_baseline_get(baseline, name, value, &expected)) {
+		return;
+	}
+	double limit = expected * (1 + tolerance_percent / 100) + slack;
+	perf_baseline_report(baseline, name, value, expected, limit, value > limit);
+}
+
+void perf_baseline_check_higher(perf_baseline *baseline, char *name, double value, double tolerance_percent) {
+	double expected;
+	if (perf_baseline_get(baseline, name, value, &expected)) {
+		return;
+	}
+	double limit = expected * (1 - tolerance_percent / 100);
+	perf_baseline_report(baseline, name, value, expected, limit, value < limit);
+}
+
+size_t perf_baseline_get_num_failed(perf_baseline *baseline) {
+	return baseline->num_failed;
+}
+
+int perf_baseline_write_cstr(perf_baseline *baseline, char *path, string *error) {
+	stream file;
+	if (stream_init_file_cstr(&file, path, "wb", error)) {
+		return 1;
+	}
+	// one measurement a line, so changes to a baseline read well in a diff
+	int result = stream_write_cstr(&file, "{", error) < 0 || stream_write_str(&file, &baseline->measured, error) < 0 ||
+				 stream_write_cstr(&file, "\n}\n", error) < 0;
+	if (stream_dealloc(&file, error)) {
+		result = 1;
+	}
+	return result;
+}
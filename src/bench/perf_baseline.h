@@ -0,0 +1,64 @@
+/*
+Compares benchmark results against a baseline checked in with the source, so a regression fails the perf tests rather than waiting for
+someone to notice. A baseline is a JSON object of measurement names to numbers, e.g. "http_request_parse.median_ns", written by the
+benchmark itself with --write-baseline on a quiet machine.
+
+Timings and throughput are allowed to be worse by a tolerance, since they vary from run to run and machine to machine. Allocation counts
+don't vary, so they're only allowed a little slack for the odd buffer that grows during the measurement. Measurements missing from the
+baseline are reported but don't fail, so a new benchmark doesn't fail until it has a baseline.
+*/
+
+#ifndef perf_baseline_h
+#define perf_baseline_h
+
+#include "../shared/json.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	buffer contents;
+	json_document document;
+	json_value root;
+	int loaded;
+	// every measurement checked, formatted as members of the JSON object for --write-baseline
+	string measured;
+	size_t num_measured;
+	size_t num_failed;
+} perf_baseline;
+
+/**
+ * @param path the baseline to compare against, or NULL to only collect measurements
+ * @returns 0 on success, non-0 if the file can't be read or isn't a JSON object
+ */
+int perf_baseline_init(perf_baseline *baseline, char *path, string *error);
+void perf_baseline_dealloc(perf_baseline *baseline);
+
+/**
+ * Checks a measurement where lower is better, like time or allocations. It fails when it's over the baseline by more than
+ * tolerance_percent, plus slack in the measurement's own units. Prints the comparison to stderr.
+ */
+void perf_baseline_check_lower(perf_baseline *baseline, char *name, double value, double tolerance_percent, double slack);
+
+/**
+ * Checks a measurement where higher is better, like throughput. It fails when it's under the baseline by more than tolerance_percent.
+ */
+void perf_baseline_check_higher(perf_baseline *baseline, char *name, double value, double tolerance_percent);
+
+/**
+ * @returns the number of checks that failed
+ */
+size_t perf_baseline_get_num_failed(perf_baseline *baseline);
+
+/**
+ * Writes everything checked so far as a new baseline.
+ * @returns 0 on success, non-0 if the file couldn't be written
+ */
+int perf_baseline_write_cstr(perf_baseline *baseline, char *path, string *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,91 @@
+/*
+Measures route matching time as the number of registered routes grows. Since matching walks the radix tree by path character the time per
+match should stay roughly flat from 10 routes to 10000.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../shared/router.h"
+
+#define NUM_ITERATIONS 1000000
+
+int route(void *data, http_request *request, http_response *response, router_match *match) {
+	return 0;
+}
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void add_routes(router *r, int num_routes) {
+	char pattern[256];
+	for (int i = 0; i < num_routes; i++) {
+		switch (i % 4) {
+		case 0:
+			snprintf(pattern, sizeof(pattern), "/api/v1/resource%i", i / 4);
+			break;
+		case 1:
+			snprintf(pattern, sizeof(pattern), "/api/v1/resource%i/:id", i / 4);
+			break;
+		case 2:
+			snprintf(pattern, sizeof(pattern), "/api/v1/resource%i/:id/items/:item", i / 4);
+			break;
+		case 3:
+			snprintf(pattern, sizeof(pattern), "/static%i/*path", i / 4);
+			break;
+		}
+		if (router_add_cstr(r, "GET", pattern, route, NULL)) {
+			fprintf(stderr, "failed to add route %s\n", pattern);
+		}
+	}
+}
+
+int main() {
+	// all of these exist with even the smallest route table, so every run does the same work
+	char *paths[] = {
+		"/api/v1/resource1",
+		"/api/v1/resource2/12345",
+		"/api/v1/resource1/12345/items/678",
+		"/static2/css/site/main.css",
+		// not found
+		"/api/v2/resource1",
+	};
+	size_t num_paths = sizeof(paths) / sizeof(paths[0]);
+	size_t path_lens[sizeof(paths) / sizeof(paths[0])];
+	for (size_t i = 0; i < num_paths; i++) {
+		path_lens[i] = strlen(paths[i]);
+	}
+
+	int route_counts[] = {12, 100, 1000, 10000};
+	printf("%10s %12s\n", "routes", "ns/match");
+	for (size_t i = 0; i < sizeof(route_counts) / sizeof(route_counts[0]); i++) {
+		router r;
+		router_init(&r);
+		add_routes(&r, route_counts[i]);
+
+		router_match match;
+		size_t matched = 0;
+		// warm up
+		for (int j = 0; j < NUM_ITERATIONS / 10; j++) {
+			size_t k = j % num_paths;
+			matched += router_match_cstr_len(&r, "GET", 3, paths[k], path_lens[k], &match) == ROUTER_MATCH_SUCCESS;
+		}
+		uint64_t start = now_ns();
+		for (int j = 0; j < NUM_ITERATIONS; j++) {
+			size_t k = j % num_paths;
+			matched += router_match_cstr_len(&r, "GET", 3, paths[k], path_lens[k], &match) == ROUTER_MATCH_SUCCESS;
+		}
+		uint64_t elapsed = now_ns() - start;
+		printf("%10i %12.1f\n", route_counts[i], (double)elapsed / NUM_ITERATIONS);
+		if (matched != (NUM_ITERATIONS + NUM_ITERATIONS / 10) / num_paths * (num_paths - 1)) {
+			fprintf(stderr, "unexpected number of matches %zu\n", matched);
+		}
+
+		router_dealloc(&r);
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+Measures request latency over loopback with each socket option turned on in turn, starting from everything off. Every request is a new
+connection, the same as the server handles them, so connection setup is part of the measurement.
+
+Without TCP_NODELAY the small writes that make up a response can sit behind a delayed acknowledgement, which shows up as p99 latencies in
+the tens of milliseconds. The other options are smaller effects and mostly only show up at p99 or on a real network.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../shared/http.h"
+
+#define NUM_REQUESTS 200
+
+static char request_text[] = "GET /hello HTTP/1.1\r\nHost: localhost\r\nUser-Agent: bench_socket_options\r\n\r\n";
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int handle(void *data, http_request *request, http_response *response) {
+	http_header *header = http_headers_get_cstr(http_response_get_headers(response), "Content-Type", 1);
+	string_set_cstr(http_header_append_value(header), "text/plain");
+	stream_write(http_response_get_body(response), "hello world\n", 12, NULL);
+	return 0;
+}
+
+/*
+Sends a request on a new connection and reads until the server closes it.
+
+Returns 0 on success.
+*/
+int do_request(uint16_t port, int fast_open) {
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s == -1) {
+		return 1;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	int result = 1;
+	size_t request_len = sizeof(request_text) - 1;
+	if (fast_open) {
+		// the request goes out with the SYN once the client has a cookie from an earlier connection
+		if (sendto(s, request_text, request_len, MSG_FASTOPEN, (struct sockaddr *)&addr, sizeof(addr)) != (ssize_t)request_len) {
+			goto DONE;
+		}
+	} else {
+		if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) || write(s, request_text, request_len) != (ssize_t)request_len) {
+			goto DONE;
+		}
+	}
+	char response[4096];
+	size_t total = 0;
+	ssize_t read_len;
+	while ((read_len = read(s, response, sizeof(response))) > 0) {
+		total += read_len;
+	}
+	if (read_len == 0 && total > 0) {
+		result = 0;
+	}
+DONE:
+	close(s);
+	return result;
+}
+
+int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(uint64_t *)a, y = *(uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+void measure(char *name, tcp_socket_wrapper_options *options) {
+	http_server_config config;
+	http_server_config_init(&config);
+	string_set_cstr(&config.address, "127.0.0.1");
+	config.port = 0;
+	config.num_threads = 2;
+	config.socket_options = *options;
+	http_server server;
+	if (http_server_init(&server, handle, NULL, &config)) {
+		fprintf(stderr, "%s failed to start the server\n", name);
+		exit(1);
+	}
+	uint16_t port = tcp_socket_wrapper_get_port(&server.socket);
+	int fast_open = options->fast_open_queue_length > 0;
+
+	// warm up, which also gets the client a fast open cookie
+	for (int i = 0; i < 10; i++) {
+		do_request(port, fast_open);
+	}
+
+	uint64_t latencies[NUM_REQUESTS];
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_REQUESTS; i++) {
+		uint64_t request_start = now_ns();
+		if (do_request(port, fast_open)) {
+			fprintf(stderr, "%s request failed, %s\n", name, strerror(errno));
+			exit(1);
+		}
+		latencies[i] = now_ns() - request_start;
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	qsort(latencies, NUM_REQUESTS, sizeof(uint64_t), compare_uint64);
+	printf("%-20s %10.1f %10.1f %10.1f %10.1f %12.0f\n", name, latencies[NUM_REQUESTS / 2] / 1e3, latencies[NUM_REQUESTS * 99 / 100] / 1e3,
+		   latencies[NUM_REQUESTS - 1] / 1e3, latencies[0] / 1e3, NUM_REQUESTS / seconds);
+
+	http_server_dealloc(&server);
+	http_server_config_dealloc(&config);
+}
+
+int main() {
+	tcp_socket_wrapper_options options;
+	tcp_socket_wrapper_options_init(&options);
+	options.no_delay = 0;
+
+	printf("%-20s %10s %10s %10s %10s %12s\n", "options", "p50 us", "p99 us", "max us", "min us", "requests/s");
+	measure("none", &options);
+	options.no_delay = 1;
+	measure("+no_delay", &options);
+	options.quick_ack = 1;
+	measure("+quick_ack", &options);
+	options.defer_accept_seconds = 1;
+	measure("+defer_accept", &options);
+	options.fast_open_queue_length = 256;
+	measure("+fast_open", &options);
+	options.receive_buffer_size = 256 * 1024;
+	options.send_buffer_size = 256 * 1024;
+	measure("+buffers", &options);
+	options.busy_poll_microseconds = 50;
+	measure("+busy_poll", &options);
+	return 0;
+}
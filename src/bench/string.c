@@ -0,0 +1,80 @@
+/*
+Measures formatting and parsing integers with the string routines against snprintf and sscanf, which is what the HTTP code used to do for
+every Content-Length. The values are spread over the sizes Content-Length usually takes, from a handful of bytes up to gigabytes.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../shared/string.h"
+
+#define NUM_ITERATIONS 10000000
+#define NUM_VALUES 64
+
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main() {
+	uint64_t values[NUM_VALUES];
+	char texts[NUM_VALUES][STRING_MAX_INT64_LENGTH + 1];
+	size_t text_lens[NUM_VALUES];
+	uint64_t v = 7;
+	for (int i = 0; i < NUM_VALUES; i++) {
+		values[i] = v % 10000000000ull;
+		text_lens[i] = snprintf(texts[i], sizeof(texts[i]), "%llu", (unsigned long long)values[i]);
+		v = v * 6364136223846793005ull + 1442695040888963407ull;
+		// keep the lengths mixed rather than all 10 digits
+		v >>= i % 32;
+	}
+
+	// the checksums stop the compiler throwing the work away, and have to agree between the two ways of doing it
+	printf("%-10s %12s %12s %8s\n", "", "printf ns", "string ns", "speedup");
+
+	char tmp[STRING_MAX_INT64_LENGTH + 1];
+	uint64_t checksum_printf = 0;
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		checksum_printf += snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long)values[i % NUM_VALUES]) + tmp[0];
+	}
+	double printf_ns = (double)(now_ns() - start) / NUM_ITERATIONS;
+	uint64_t checksum_string = 0;
+	start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		char *end = tmp + sizeof(tmp);
+		char *p = string_format_uint64(end, values[i % NUM_VALUES]);
+		checksum_string += (end - p) + p[0];
+	}
+	double string_ns = (double)(now_ns() - start) / NUM_ITERATIONS;
+	printf("%-10s %12.1f %12.1f %7.1fx\n", "format", printf_ns, string_ns, printf_ns / string_ns);
+	if (checksum_printf != checksum_string) {
+		fprintf(stderr, "formatting checksums differ\n");
+		return 1;
+	}
+
+	checksum_printf = 0;
+	start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		size_t parsed = 0;
+		sscanf(texts[i % NUM_VALUES], "%zu", &parsed);
+		checksum_printf += parsed;
+	}
+	printf_ns = (double)(now_ns() - start) / NUM_ITERATIONS;
+	checksum_string = 0;
+	start = now_ns();
+	for (int i = 0; i < NUM_ITERATIONS; i++) {
+		uint64_t parsed = 0;
+		string_parse_uint64_cstr_len(texts[i % NUM_VALUES], text_lens[i % NUM_VALUES], &parsed);
+		checksum_string += parsed;
+	}
+	string_ns = (double)(now_ns() - start) / NUM_ITERATIONS;
+	printf("%-10s %12.1f %12.1f %7.1fx\n", "parse", printf_ns, string_ns, printf_ns / string_ns);
+	if (checksum_printf != checksum_string) {
+		fprintf(stderr, "parsing checksums differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -1,39 +1,54 @@
 #include <getopt.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "../shared/http.h"
 #include "../shared/log.h"
+#include "../shared/metrics.h"
+#include "../shared/perf_counters.h"
+#include "../shared/router.h"
 
-#define DEFAULT_PORT 8000
-#define DEFAULT_WORKER_POOL_SIZE 2
-#define DEFAULT_WORKER_POOL_QUEUE_SIZE 10
-// 5 seconds in nanoseconds
-#define DEFAULT_HTTP_TIMEOUT 5000000000llu
+// options that aren't server config, the server config options come after these
+#define NUM_MAIN_OPTIONS 2
 
-int shutdown_requested;
+// set by the signal handler and picked up by the main loop, which is the only place that logs or touches the server
+volatile sig_atomic_t shutdown_requested;
+volatile sig_atomic_t reopen_requested;
+volatile sig_atomic_t dump_requested;
 
 void usage(char *name) {
 	printf("usage:\n");
 	printf("    %s [options]\n", name);
 	printf("    -h, --help\n");
 	printf("        display help text\n");
-	printf("    -p, --port PORT\n");
-	printf("        Listen on this port\n");
+	printf("    -p PORT\n");
+	printf("        Same as --port\n");
+	printf("    -c, --config FILE\n");
+	printf("        Load server options from a JSON file, options given on the command line take precedence\n");
+	for (size_t i = 0; i < http_server_config_get_num_options(); i++) {
+		http_server_config_option *option = http_server_config_get_option(i);
+		printf("    --%s VALUE\n", option->name);
+		printf("        %s\n", option->description);
+	}
 }
 
 void signal_handler(int signum) {
+	// logging takes locks and allocates, neither of which is safe here, so this only sets flags
 	switch (signum) {
 	case SIGINT:
-		log_debug("stop requested\n");
 		shutdown_requested = 1;
 		break;
-	default:
-		log_error("unrecognized signal %i\n", signum);
+	case SIGHUP:
+		reopen_requested = 1;
+		break;
+	case SIGUSR1:
+		dump_requested = 1;
+		break;
 	}
 }
 
-int handle_request(void *data, http_request *request, http_response *response) {
+int handle_request(void *data, http_request *request, http_response *response, router_match *match) {
 	// TODO some real HTTP request-response stuff
 	stream_write_cstrf(http_response_get_body(response), NULL, "Received request at URI: %s\n",
 					   string_get_cstr(http_request_get_uri(request)));
@@ -43,62 +58,150 @@ int handle_request(void *data, http_request *request, http_response *response) {
 int main(int argc, char **argv) {
 	// parsing options
 
-	int port = DEFAULT_PORT;
+	http_server_config config;
+	http_server_config_init(&config);
+	string error;
+	string_init(&error);
+	char *config_path = NULL;
+	// config options are applied after the config file regardless of order, so remember them until then
+	size_t num_overrides = 0;
+	char **override_names = malloc(sizeof(char *) * argc);
+	char **override_values = malloc(sizeof(char *) * argc);
 
+	size_t num_config_options = http_server_config_get_num_options();
+	struct option *arg_options = calloc(NUM_MAIN_OPTIONS + num_config_options + 1, sizeof(struct option));
+	arg_options[0] = (struct option){"help", 0, 0, 0};
+	arg_options[1] = (struct option){"config", required_argument, 0, 0};
+	for (size_t i = 0; i < num_config_options; i++) {
+		arg_options[NUM_MAIN_OPTIONS + i] = (struct option){http_server_config_get_option(i)->name, required_argument, 0, 0};
+	}
+
+	int result = 0;
 	// suppress getopt logging
 	opterr = 0;
 	while (1) {
-		static struct option arg_options[] = {{"help", 0, 0, 0}, {"port", required_argument, 0, 0}};
 		int option_index = 0;
 
-		int c = getopt_long(argc, argv, "hp:", arg_options, &option_index);
+		int c = getopt_long(argc, argv, "hp:c:", arg_options, &option_index);
 		if (c == -1) {
 			break;
 		}
 		if ((c == 0 && option_index == 0) || c == 'h') {
 			usage(argv[0]);
-			return 0;
+			goto DONE;
 		}
-		if ((c == 0 && option_index == 1) || c == 'p') {
-			if (!optarg) {
-				return 1;
-			}
-			if (sscanf(optarg, "%i", &port) != 1) {
-				log_error("failed to parse port: %s\n", optarg);
-				return 1;
-			}
+		if (c == 'p') {
+			override_names[num_overrides] = "port";
+			override_values[num_overrides] = optarg;
+			num_overrides++;
+			continue;
+		}
+		if ((c == 0 && option_index == 1) || c == 'c') {
+			config_path = optarg;
+			continue;
+		}
+		if (c == 0) {
+			override_names[num_overrides] = (char *)arg_options[option_index].name;
+			override_values[num_overrides] = optarg;
+			num_overrides++;
 			continue;
 		}
 		log_error("unrecognized arg: %s\n", argv[optind - 1]);
 		usage(argv[0]);
-		return 1;
+		result = 1;
+		goto DONE;
 	}
 	if (optind < argc) {
 		log_error("unrecognized arg: %s\n", argv[optind]);
 		usage(argv[0]);
-		return 1;
+		result = 1;
+		goto DONE;
+	}
+	if (config_path && http_server_config_load_file_cstr(&config, config_path, &error)) {
+		log_error("failed to load config: %s\n", string_get_cstr(&error));
+		result = 1;
+		goto DONE;
+	}
+	for (size_t i = 0; i < num_overrides; i++) {
+		if (http_server_config_set_cstr(&config, override_names[i], override_values[i], &error)) {
+			log_error("%s\n", string_get_cstr(&error));
+			result = 1;
+			goto DONE;
+		}
+	}
+
+	log_level level;
+	// already checked when the option was set
+	http_server_config_get_log_level(&config, &level);
+	log_set_level(level);
+	if (config.log_buffer_size > 0 && log_start_async(config.log_buffer_size)) {
+		log_error("failed to start logging thread\n");
+		result = 1;
+		goto DONE;
+	}
+
+	router router;
+	router_init(&router);
+	if (router_add_cstr(&router, NULL, "/*path", handle_request, NULL)) {
+		log_error("failed to register routes\n");
+		router_dealloc(&router);
+		result = 1;
+		goto DONE;
 	}
 
 	http_server server;
-	if (http_server_init(&server, handle_request, NULL, NULL, port, DEFAULT_WORKER_POOL_SIZE, DEFAULT_WORKER_POOL_QUEUE_SIZE,
-						 DEFAULT_HTTP_TIMEOUT)) {
+	if (http_server_init(&server, router_handle_request, &router, &config)) {
 		log_error("failed to make HTTP server\n");
-		return 1;
+		router_dealloc(&router);
+		result = 1;
+		goto DONE;
 	}
 
 	shutdown_requested = 0;
+	reopen_requested = 0;
+	dump_requested = 0;
 	signal(SIGINT, signal_handler);
-	log_debug("waiting for requests on port %i\n", port);
+	signal(SIGHUP, signal_handler);
+	signal(SIGUSR1, signal_handler);
+	log_debug("waiting for requests on port %i with %i threads\n", (int)config.port, config.num_threads);
 	// TODO should be a semaphore that is signalled when we're shutting down
 	while (!shutdown_requested) {
-		// 1 second in microseconds
+		// 1 second in microseconds, a signal cuts it short
 		usleep(1000000llu);
+		if (reopen_requested) {
+			reopen_requested = 0;
+			log_debug("reopening access log\n");
+			http_server_reopen_access_log(&server);
+		}
+		if (dump_requested) {
+			dump_requested = 0;
+			string latencies;
+			string_init(&latencies);
+			metrics_write_histograms(&latencies);
+			log_info("request latencies:\n%s", string_get_cstr(&latencies));
+			string_clear(&latencies);
+			perf_counters_write(&latencies);
+			if (string_get_length(&latencies)) {
+				log_info("request hardware counters, per phase:\n%s", string_get_cstr(&latencies));
+			}
+			string_dealloc(&latencies);
+		}
 	}
+	log_debug("stop requested\n");
 
 	if (http_server_dealloc(&server)) {
 		log_error("failed to clean up HTTP server\n");
-		return 1;
+		result = 1;
 	}
+	router_dealloc(&router);
 
-	return 0;
-}
\ No newline at end of file
+DONE:
+	// anything still buffered is written out
+	log_stop_async();
+	free(arg_options);
+	free(override_names);
+	free(override_values);
+	string_dealloc(&error);
+	http_server_config_dealloc(&config);
+	return result;
+}
@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "access_log.h"
+#include "log.h"
+
+// how often the background thread writes when no slot has filled a block
+#define ACCESS_LOG_FLUSH_INTERVAL_MS 1000
+// once a slot has this much waiting the background thread is woken to write it
+#define ACCESS_LOG_BLOCK_SIZE (64 * 1024)
+// entries are dropped while a slot has this much waiting
+#define ACCESS_LOG_MAX_PENDING (1024 * 1024)
+// room for everything in an entry but the address, method and uri
+#define ACCESS_LOG_MAX_FIXED_LENGTH 256
+
+// private
+int access_log_open(char *path) {
+	return open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+}
+
+// private
+void access_log_write_all(access_log *log, buffer *data) {
+	size_t length = buffer_get_length(data);
+	size_t written = 0;
+	while (written < length) {
+		ssize_t result = write(log->fd, data->data + written, length - written);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_error("failed to write access log %s, %s\n", string_get_cstr(&log->path), strerror(errno));
+			break;
+		}
+		written += result;
+	}
+	buffer_clear(data);
+}
+
+/*
+private
+
+Writes out every slot's entries, a slot at a time so a slot is only locked for long enough to swap its buffer out. Only called with
+log->mutex held.
+*/
+void access_log_write_pending(access_log *log) {
+	for (size_t i = 0; i < log->num_slots; i++) {
+		access_log_slot *slot = &log->slots[i];
+		pthread_mutex_lock(&slot->mutex);
+		buffer swap = slot->pending;
+		slot->pending = log->writing;
+		log->writing = swap;
+		pthread_mutex_unlock(&slot->mutex);
+		if (buffer_get_length(&log->writing) > 0) {
+			access_log_write_all(log, &log->writing);
+		}
+	}
+}
+
+// private
+void access_log_reopen_file(access_log *log) {
+	int fd = access_log_open(string_get_cstr(&log->path));
+	if (fd < 0) {
+		// carry on with the old file rather than lose entries
+		log_error("failed to reopen access log %s, %s\n", string_get_cstr(&log->path), strerror(errno));
+		return;
+	}
+	close(log->fd);
+	log->fd = fd;
+}
+
+// private
+void *access_log_thread_main(void *data) {
+	access_log *log = data;
+	pthread_mutex_lock(&log->mutex);
+	while (1) {
+		access_log_write_pending(log);
+		if (log->reopen_requested) {
+			log->reopen_requested = 0;
+			access_log_reopen_file(log);
+		}
+		if (log->stopping) {
+			break;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += ACCESS_LOG_FLUSH_INTERVAL_MS / 1000;
+		deadline.tv_nsec += (ACCESS_LOG_FLUSH_INTERVAL_MS % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&log->cond, &log->mutex, &deadline);
+	}
+	pthread_mutex_unlock(&log->mutex);
+	return NULL;
+}
+
+int access_log_init(access_log *log, char *path, size_t num_slots, uint64_t sample, string *error) {
+	if (num_slots < 1 || sample < 1) {
+		if (error) {
+			string_set_cstr(error, "access log needs at least one slot and a sample rate of at least 1");
+		}
+		return 1;
+	}
+	log->fd = access_log_open(path);
+	if (log->fd < 0) {
+		if (error) {
+			string_set_cstrf(error, "failed to open access log %s, %s", path, strerror(errno));
+		}
+		return 1;
+	}
+	string_init_cstr(&log->path, path);
+	log->sample = sample;
+	log->num_slots = num_slots;
+	log->slots = malloc(sizeof(access_log_slot) * num_slots);
+	for (size_t i = 0; i < num_slots; i++) {
+		access_log_slot *slot = &log->slots[i];
+		pthread_mutex_init(&slot->mutex, NULL);
+		buffer_init(&slot->pending);
+		slot->num_seen = 0;
+		slot->second = -1;
+		slot->timestamp_length = 0;
+	}
+	log->num_dropped = 0;
+	pthread_mutex_init(&log->mutex, NULL);
+	pthread_cond_init(&log->cond, NULL);
+	log->stopping = 0;
+	log->reopen_requested = 0;
+	buffer_init(&log->writing);
+	if (pthread_create(&log->thread, NULL, access_log_thread_main, log)) {
+		if (error) {
+			string_set_cstr(error, "failed to start the access log thread");
+		}
+		log->stopping = 1;
+		access_log_dealloc(log);
+		return 1;
+	}
+	return 0;
+}
+
+void access_log_dealloc(access_log *log) {
+	pthread_mutex_lock(&log->mutex);
+	int running = !log->stopping;
+	log->stopping = 1;
+	pthread_cond_signal(&log->cond);
+	pthread_mutex_unlock(&log->mutex);
+	if (running) {
+		// it writes everything out once more before it exits
+		pthread_join(log->thread, NULL);
+	}
+	for (size_t i = 0; i < log->num_slots; i++) {
+		pthread_mutex_destroy(&log->slots[i].mutex);
+		buffer_dealloc(&log->slots[i].pending);
+	}
+	free(log->slots);
+	buffer_dealloc(&log->writing);
+	pthread_mutex_destroy(&log->mutex);
+	pthread_cond_destroy(&log->cond);
+	close(log->fd);
+	string_dealloc(&log->path);
+}
+
+// private
+char *access_log_append(char *p, char *src, size_t length) {
+	memcpy(p, src, length);
+	return p + length;
+}
+
+// private
+char *access_log_append_uint64(char *p, uint64_t value) {
+	char tmp[STRING_MAX_INT64_LENGTH];
+	char *start = string_format_uint64(tmp + sizeof(tmp), value);
+	return access_log_append(p, start, tmp + sizeof(tmp) - start);
+}
+
+// private
+char *access_log_append_str(char *p, string *s) {
+	if (!s || string_get_length(s) == 0) {
+		*p++ = '-';
+		return p;
+	}
+	return access_log_append(p, string_get_cstr(s), string_get_length(s));
+}
+
+/*
+private
+
+Appends a duration in microseconds to 3 decimal places.
+*/
+char *access_log_append_us(char *p, uint64_t ns) {
+	p = access_log_append_uint64(p, ns / 1000);
+	unsigned fraction = ns % 1000;
+	p[0] = '.';
+	p[1] = '0' + fraction / 100;
+	p[2] = '0' + fraction / 10 % 10;
+	p[3] = '0' + fraction % 10;
+	return p + 4;
+}
+
+/*
+private
+
+Appends s with anything that would make the line ambiguous escaped as \xHH, control characters, quotes and backslashes, and unless it's
+going in quotes spaces and = too. Takes up to 4 bytes per byte of s.
+*/
+char *access_log_append_escaped(char *p, string *s, int quoted) {
+	static const char hex[] = "0123456789abcdef";
+	char *src = s ? string_get_cstr(s) : "";
+	size_t length = s ? string_get_length(s) : 0;
+	for (size_t i = 0; i < length; i++) {
+		unsigned char c = src[i];
+		if (c < 0x20 || c >= 0x7f || c == '"' || c == '\\' || (!quoted && (c == ' ' || c == '='))) {
+			p[0] = '\\';
+			p[1] = 'x';
+			p[2] = hex[c >> 4];
+			p[3] = hex[c & 0xf];
+			p += 4;
+		} else {
+			*p++ = c;
+		}
+	}
+	return p;
+}
+
+/*
+private
+
+Appends s in quotes and escaped. Takes up to 4 bytes per byte of s plus the quotes.
+*/
+char *access_log_append_quoted(char *p, string *s) {
+	*p++ = '"';
+	p = access_log_append_escaped(p, s, 1);
+	*p++ = '"';
+	return p;
+}
+
+// private
+size_t access_log_str_length(string *s) {
+	return s ? string_get_length(s) : 0;
+}
+
+void access_log_write(access_log *log, size_t slot_index, access_log_entry *entry) {
+	access_log_slot *slot = &log->slots[slot_index % log->num_slots];
+	pthread_mutex_lock(&slot->mutex);
+	if (slot->num_seen++ % log->sample) {
+		pthread_mutex_unlock(&slot->mutex);
+		return;
+	}
+	size_t length = buffer_get_length(&slot->pending);
+	if (length >= ACCESS_LOG_MAX_PENDING) {
+		pthread_mutex_unlock(&slot->mutex);
+		__atomic_fetch_add(&log->num_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (now.tv_sec != slot->second) {
+		struct tm tm;
+		gmtime_r(&now.tv_sec, &tm);
+		slot->timestamp_length = strftime(slot->timestamp, sizeof(slot->timestamp), "%Y-%m-%dT%H:%M:%S", &tm);
+		slot->second = now.tv_sec;
+	}
+	size_t max_length = ACCESS_LOG_MAX_FIXED_LENGTH + access_log_str_length(entry->address) + access_log_str_length(entry->method) * 4 +
+						access_log_str_length(entry->uri) * 4;
+	buffer_ensure_capacity(&slot->pending, length + max_length);
+	char *p = (char *)slot->pending.data + length;
+
+	p = access_log_append(p, "time=", 5);
+	p = access_log_append(p, slot->timestamp, slot->timestamp_length);
+	unsigned ms = now.tv_nsec / 1000000;
+	p[0] = '.';
+	p[1] = '0' + ms / 100;
+	p[2] = '0' + ms / 10 % 10;
+	p[3] = '0' + ms % 10;
+	p[4] = 'Z';
+	p += 5;
+	p = access_log_append(p, " remote=", 8);
+	p = access_log_append_str(p, entry->address);
+	if (entry->address && string_get_length(entry->address) > 0) {
+		*p++ = ':';
+		p = access_log_append_uint64(p, entry->port);
+	}
+	p = access_log_append(p, " method=", 8);
+	// the method's whatever the client sent up to the first space, so it can't be trusted not to forge a line
+	if (entry->method && string_get_length(entry->method) > 0) {
+		p = access_log_append_escaped(p, entry->method, 0);
+	} else {
+		*p++ = '-';
+	}
+	p = access_log_append(p, " uri=", 5);
+	if (entry->uri) {
+		p = access_log_append_quoted(p, entry->uri);
+	} else {
+		*p++ = '-';
+	}
+	p = access_log_append(p, " status=", 8);
+	p = access_log_append_uint64(p, entry->status_code);
+	p = access_log_append(p, " bytes=", 7);
+	p = access_log_append_uint64(p, entry->bytes);
+	p = access_log_append(p, " parse_us=", 10);
+	p = access_log_append_us(p, entry->parse_ns);
+	p = access_log_append(p, " queue_us=", 10);
+	p = access_log_append_us(p, entry->queue_ns);
+	p = access_log_append(p, " handler_us=", 12);
+	p = access_log_append_us(p, entry->handler_ns);
+	p = access_log_append(p, " write_us=", 10);
+	p = access_log_append_us(p, entry->write_ns);
+	*p++ = '\n';
+
+	size_t new_length = p - (char *)slot->pending.data;
+	buffer_set_length(&slot->pending, new_length);
+	pthread_mutex_unlock(&slot->mutex);
+	// the background thread gets to it within a second anyway, but a busy slot shouldn't have to wait that long
+	if (length < ACCESS_LOG_BLOCK_SIZE && new_length >= ACCESS_LOG_BLOCK_SIZE) {
+		pthread_cond_signal(&log->cond);
+	}
+}
+
+void access_log_flush(access_log *log) {
+	pthread_mutex_lock(&log->mutex);
+	access_log_write_pending(log);
+	pthread_mutex_unlock(&log->mutex);
+}
+
+void access_log_reopen(access_log *log) {
+	pthread_mutex_lock(&log->mutex);
+	log->reopen_requested = 1;
+	pthread_cond_signal(&log->cond);
+	pthread_mutex_unlock(&log->mutex);
+}
+
+uint64_t access_log_get_num_dropped(access_log *log) {
+	return __atomic_load_n(&log->num_dropped, __ATOMIC_RELAXED);
+}
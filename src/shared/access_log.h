@@ -0,0 +1,111 @@
+/*
+A structured access log, one line per request.
+
+Each line is key=value pairs, e.g.
+time=2026-10-19T12:34:56.789Z remote=127.0.0.1:51234 method=GET uri="/index.html" status=200 bytes=512 parse_us=1.204 queue_us=3.871
+handler_us=20.110 write_us=9.562
+with "-" for anything that isn't known, like the method of a request that couldn't be parsed. The uri is quoted with quotes, backslashes
+and control characters escaped as \xHH, and the method has those and spaces and = escaped the same way.
+
+Writing an entry formats it straight into a buffer for the calling thread's slot, so the cost per request is a format and an uncontended
+lock. A background thread swaps each slot's buffer out and writes it to the file in one go, every second or sooner once a slot has a
+block's worth waiting. A slot that's fallen too far behind drops entries and counts them rather than holding up the request.
+*/
+
+#ifndef access_log_h
+#define access_log_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	// NULL for unknown
+	string *address;
+	uint16_t port;
+	// NULL when there's no parsed request
+	string *method;
+	string *uri;
+	int status_code;
+	uint64_t bytes;
+	// how long the request took to parse, waited for a worker, spent in the handler, and took to write
+	uint64_t parse_ns;
+	uint64_t queue_ns;
+	uint64_t handler_ns;
+	uint64_t write_ns;
+} access_log_entry;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	buffer pending;
+	// entries seen, logged or not, for sampling
+	uint64_t num_seen;
+	// the formatted time is only worked out again when the second changes
+	time_t second;
+	char timestamp[32];
+	size_t timestamp_length;
+} access_log_slot;
+
+typedef struct {
+	string path;
+	int fd;
+	uint64_t sample;
+	size_t num_slots;
+	access_log_slot *slots;
+	uint64_t num_dropped;
+
+	// held by the background thread while it writes, and by anything that flushes or reopens
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	int stopping;
+	int reopen_requested;
+	// swapped with each slot's pending buffer in turn
+	buffer writing;
+} access_log;
+
+/**
+ * Opens the file for appending and starts the background thread.
+ * @param num_slots how many threads can write without contending, a slot number passed to access_log_write is taken modulo this
+ * @param sample only every sample'th entry in each slot is written, 1 for all of them
+ * @param error optional, if provided and an error occurs the contents are replaced with an error message
+ * @returns 0 on success, non-0 if the file can't be opened or the thread can't be started
+ */
+int access_log_init(access_log *log, char *path, size_t num_slots, uint64_t sample, string *error);
+/**
+ * Writes out everything waiting and closes the file. Nothing can be writing entries while this runs.
+ */
+void access_log_dealloc(access_log *log);
+
+/**
+ * Adds an entry, safe from any thread. Threads that write often should each have their own slot.
+ */
+void access_log_write(access_log *log, size_t slot, access_log_entry *entry);
+/**
+ * Writes out everything waiting now rather than waiting for the background thread.
+ */
+void access_log_flush(access_log *log);
+/**
+ * Closes and opens the file again by its path, after everything waiting has been written to the old one, so a log that's been moved
+ * aside by log rotation starts over in a new file. The background thread does the reopening, this only asks it to.
+ */
+void access_log_reopen(access_log *log);
+
+/**
+ * @returns how many entries have been dropped because a slot had too much waiting to be written
+ */
+uint64_t access_log_get_num_dropped(access_log *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+#include "concurrency_limiter.h"
+
+// completed requests per window
+#define CONCURRENCY_LIMITER_WINDOW_SAMPLES 16
+// time between probes of the latency with less queueing, plus up to half again as jitter so servers started together don't probe together
+#define CONCURRENCY_LIMITER_PROBE_INTERVAL_NS 10000000000ull
+// what the limit is multiplied by while probing
+#define CONCURRENCY_LIMITER_PROBE_FRACTION 0.5
+// how much slower than the lowest latency a window can be before it counts as queueing
+#define CONCURRENCY_LIMITER_TOLERANCE 1.5
+// how much of each window's new limit is taken, the rest is the old limit
+#define CONCURRENCY_LIMITER_SMOOTHING 0.2
+// what the limit is multiplied by when a request is dropped
+#define CONCURRENCY_LIMITER_BACKOFF 0.9
+
+int concurrency_limiter_init(concurrency_limiter *limiter, size_t min_limit, size_t initial_limit, size_t max_limit) {
+	if (min_limit < 1 || max_limit < min_limit) {
+		return 1;
+	}
+	if (initial_limit < min_limit) {
+		initial_limit = min_limit;
+	} else if (initial_limit > max_limit) {
+		initial_limit = max_limit;
+	}
+	if (pthread_mutex_init(&limiter->mutex, NULL)) {
+		return 1;
+	}
+	limiter->min_limit = min_limit;
+	limiter->max_limit = max_limit;
+	limiter->limit = initial_limit;
+	limiter->in_flight = 0;
+	limiter->num_rejected = 0;
+	limiter->exact_limit = initial_limit;
+	limiter->min_latency_ns = 0;
+	limiter->next_probe_ns = 0;
+	limiter->probing = 0;
+	limiter->probe_limit = initial_limit;
+	limiter->window_samples = 0;
+	limiter->window_latency_ns = 0;
+	limiter->window_max_in_flight = 0;
+	return 0;
+}
+
+void concurrency_limiter_dealloc(concurrency_limiter *limiter) {
+	pthread_mutex_destroy(&limiter->mutex);
+}
+
+int concurrency_limiter_try_acquire(concurrency_limiter *limiter) {
+	size_t in_flight = __atomic_load_n(&limiter->in_flight, __ATOMIC_RELAXED);
+	do {
+		if (in_flight >= __atomic_load_n(&limiter->limit, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&limiter->num_rejected, 1, __ATOMIC_RELAXED);
+			return 1;
+		}
+	} while (!__atomic_compare_exchange_n(&limiter->in_flight, &in_flight, in_flight + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return 0;
+}
+
+int concurrency_limiter_is_full(concurrency_limiter *limiter) {
+	if (__atomic_load_n(&limiter->in_flight, __ATOMIC_RELAXED) < __atomic_load_n(&limiter->limit, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	__atomic_fetch_add(&limiter->num_rejected, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+// private
+size_t concurrency_limiter_sqrt(size_t n) {
+	size_t root = 0;
+	while ((root + 1) * (root + 1) <= n) {
+		root++;
+	}
+	return root;
+}
+
+// private
+void concurrency_limiter_set_limit(concurrency_limiter *limiter, double limit) {
+	if (limit < limiter->min_limit) {
+		limit = limiter->min_limit;
+	} else if (limit > limiter->max_limit) {
+		limit = limiter->max_limit;
+	}
+	limiter->exact_limit = limit;
+	__atomic_store_n(&limiter->limit, (size_t)limit, __ATOMIC_RELAXED);
+}
+
+// private
+void concurrency_limiter_schedule_probe(concurrency_limiter *limiter, uint64_t now_ns) {
+	// the low bits of the clock are as good as random for spreading probes out
+	limiter->next_probe_ns = now_ns + CONCURRENCY_LIMITER_PROBE_INTERVAL_NS + now_ns % (CONCURRENCY_LIMITER_PROBE_INTERVAL_NS / 2);
+}
+
+// private
+void concurrency_limiter_end_window(concurrency_limiter *limiter, uint64_t now_ns) {
+	uint64_t latency_ns = limiter->window_latency_ns / limiter->window_samples;
+	if (limiter->probing) {
+		// requests admitted before the probe started can have queued behind more than the probe allows, so wait for a window without them
+		if (limiter->window_max_in_flight <= limiter->limit) {
+			limiter->min_latency_ns = latency_ns;
+			limiter->probing = 0;
+			concurrency_limiter_set_limit(limiter, limiter->probe_limit);
+			concurrency_limiter_schedule_probe(limiter, now_ns);
+		}
+		goto DONE;
+	}
+	if (!limiter->min_latency_ns || latency_ns < limiter->min_latency_ns) {
+		limiter->min_latency_ns = latency_ns;
+	}
+	if (!limiter->next_probe_ns) {
+		concurrency_limiter_schedule_probe(limiter, now_ns);
+	} else if (now_ns >= limiter->next_probe_ns) {
+		// a fraction of the limit queues less than the limit, so its latency is a fresher lowest one, without shedding everything over
+		// the minimum on a loaded server the way dropping to it would
+		limiter->probing = 1;
+		limiter->probe_limit = limiter->exact_limit;
+		concurrency_limiter_set_limit(limiter, limiter->exact_limit * CONCURRENCY_LIMITER_PROBE_FRACTION);
+		goto DONE;
+	}
+
+	double gradient = latency_ns > 0 ? CONCURRENCY_LIMITER_TOLERANCE * limiter->min_latency_ns / latency_ns : 1;
+	if (gradient > 1) {
+		gradient = 1;
+	} else if (gradient < 0.5) {
+		gradient = 0.5;
+	}
+	double limit = limiter->exact_limit;
+	double new_limit = limit;
+	// growing needs evidence the current limit is actually in use
+	if (gradient < 1 || limiter->window_max_in_flight * 2 >= (size_t)limit) {
+		new_limit = limit * gradient + concurrency_limiter_sqrt((size_t)limit);
+	}
+	concurrency_limiter_set_limit(limiter, limit * (1 - CONCURRENCY_LIMITER_SMOOTHING) + new_limit * CONCURRENCY_LIMITER_SMOOTHING);
+
+DONE:
+	limiter->window_samples = 0;
+	limiter->window_latency_ns = 0;
+	limiter->window_max_in_flight = 0;
+}
+
+void concurrency_limiter_release(concurrency_limiter *limiter, uint64_t admitted_ns, uint64_t now_ns, int dropped) {
+	size_t in_flight = __atomic_fetch_sub(&limiter->in_flight, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&limiter->mutex);
+	if (dropped) {
+		concurrency_limiter_set_limit(limiter, limiter->exact_limit * CONCURRENCY_LIMITER_BACKOFF);
+	} else {
+		limiter->window_samples++;
+		limiter->window_latency_ns += now_ns - admitted_ns;
+		if (in_flight > limiter->window_max_in_flight) {
+			limiter->window_max_in_flight = in_flight;
+		}
+		if (limiter->window_samples >= CONCURRENCY_LIMITER_WINDOW_SAMPLES) {
+			concurrency_limiter_end_window(limiter, now_ns);
+		}
+	}
+	pthread_mutex_unlock(&limiter->mutex);
+}
+
+size_t concurrency_limiter_get_limit(concurrency_limiter *limiter) {
+	return __atomic_load_n(&limiter->limit, __ATOMIC_RELAXED);
+}
+
+size_t concurrency_limiter_get_in_flight(concurrency_limiter *limiter) {
+	return __atomic_load_n(&limiter->in_flight, __ATOMIC_RELAXED);
+}
+
+uint64_t concurrency_limiter_get_num_rejected(concurrency_limiter *limiter) {
+	return __atomic_load_n(&limiter->num_rejected, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,95 @@
+/*
+Decides how many requests can be in flight at once from how long they're taking, so the server sheds load before requests sit queued for
+longer than they take to handle.
+
+The limit follows a latency gradient. For each window of completed requests the average latency is compared against the lowest seen,
+which stands in for the latency without queueing. While they're close the limit grows by about its square root, and once requests start
+queueing and latency climbs the limit shrinks in proportion, down to half per window. Requests that time out or fail shrink the limit
+straight away, the multiplicative decrease of AIMD, rather than waiting for the window to end. The limit only grows while at least half of
+it is in use, so a quiet server doesn't build up headroom it never measured.
+
+Latency is measured from admission, so it includes the time spent queued for a worker as well as in the handler, which is what rises once
+more is admitted than can run at once.
+
+Every 10 to 15 seconds the limit is halved for a window to relearn the lowest latency from less queueing, so a server whose requests have
+become slower for good stops treating that as queueing. The limit doesn't grow past twice what's in use, so a steady load the server keeps
+up with still fits under the halved limit and only load over that is shed while probing. The minimum should be no more than the number of
+requests that can run at once.
+
+Admission is lock-free, the limit is only locked to be updated when requests complete.
+
+References:
+https://netflixtechblog.medium.com/performance-under-load-3e6fa9a60581
+https://github.com/Netflix/concurrency-limits
+*/
+
+#ifndef concurrency_limiter_h
+#define concurrency_limiter_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	size_t min_limit;
+	size_t max_limit;
+
+	// read without the lock when admitting
+	size_t limit;
+	size_t in_flight;
+	uint64_t num_rejected;
+
+	// the rest is only touched with the lock held
+	pthread_mutex_t mutex;
+	// the limit with its fractional part, it moves by less than 1 at a time
+	double exact_limit;
+	uint64_t min_latency_ns;
+	// CLOCK_MONOTONIC time of the next probe, 0 until the first window ends
+	uint64_t next_probe_ns;
+	// held at a fraction of probe_limit until a window has nothing admitted before the probe in it, then back to probe_limit
+	int probing;
+	double probe_limit;
+	size_t window_samples;
+	uint64_t window_latency_ns;
+	size_t window_max_in_flight;
+} concurrency_limiter;
+
+/**
+ * @param min_limit never limit below this, at least 1
+ * @param initial_limit where the limit starts before anything's been measured, clamped between min_limit and max_limit
+ * @param max_limit never allow more than this
+ * @returns 0 on success, non-0 on bad arguments
+ */
+int concurrency_limiter_init(concurrency_limiter *limiter, size_t min_limit, size_t initial_limit, size_t max_limit);
+void concurrency_limiter_dealloc(concurrency_limiter *limiter);
+
+/**
+ * Takes a slot for a request. Safe from any thread.
+ * @returns 0 if the request is admitted and has to be released, non-0 if it should be rejected
+ */
+int concurrency_limiter_try_acquire(concurrency_limiter *limiter);
+/**
+ * Checks whether try_acquire would reject right now without taking a slot, for rejecting before doing any work for a request.
+ */
+int concurrency_limiter_is_full(concurrency_limiter *limiter);
+/**
+ * Gives back the slot taken for an admitted request. Safe from any thread.
+ * @param admitted_ns CLOCK_MONOTONIC time the request was admitted
+ * @param now_ns CLOCK_MONOTONIC time now, the latency is from admitted_ns to this and probes are timed by it
+ * @param dropped the request timed out or failed, which shrinks the limit straight away
+ */
+void concurrency_limiter_release(concurrency_limiter *limiter, uint64_t admitted_ns, uint64_t now_ns, int dropped);
+
+size_t concurrency_limiter_get_limit(concurrency_limiter *limiter);
+size_t concurrency_limiter_get_in_flight(concurrency_limiter *limiter);
+uint64_t concurrency_limiter_get_num_rejected(concurrency_limiter *limiter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
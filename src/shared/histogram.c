@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "histogram.h"
+
+#define HISTOGRAM_HALF_SUB_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+
+void histogram_init(histogram *h) {
+	memset(h, 0, sizeof(histogram));
+}
+
+size_t histogram_get_bucket(uint64_t value) {
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return value;
+	}
+	if (value > HISTOGRAM_MAX_VALUE) {
+		value = HISTOGRAM_MAX_VALUE;
+	}
+	// keep the top HISTOGRAM_SUB_BUCKET_BITS bits, the highest of which is always set, and the shift says which power of 2 they're from
+	int shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+	return (size_t)shift * HISTOGRAM_HALF_SUB_BUCKETS + (value >> shift);
+}
+
+uint64_t histogram_get_bucket_max(size_t bucket) {
+	if (bucket < HISTOGRAM_SUB_BUCKETS) {
+		return bucket;
+	}
+	int shift = bucket / HISTOGRAM_HALF_SUB_BUCKETS - 1;
+	uint64_t sub_bucket = bucket - (size_t)shift * HISTOGRAM_HALF_SUB_BUCKETS;
+	return ((sub_bucket + 1) << shift) - 1;
+}
+
+void histogram_record(histogram *h, uint64_t value) {
+	size_t bucket = histogram_get_bucket(value);
+	// only this thread writes, mergers only need each count not to tear
+	__atomic_store_n(&h->buckets[bucket], h->buckets[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+	if (value > h->max) {
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	}
+}
+
+void histogram_merge(histogram *dst, histogram *src) {
+	for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+		dst->buckets[i] += __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+	}
+	dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	if (max > dst->max) {
+		dst->max = max;
+	}
+}
+
+void histogram_clear(histogram *h) {
+	memset(h, 0, sizeof(histogram));
+}
+
+uint64_t histogram_get_count(histogram *h) {
+	// counted from the buckets rather than kept alongside them, so it can't disagree with them after a merge that raced a record
+	uint64_t count = 0;
+	for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+		count += h->buckets[i];
+	}
+	return count;
+}
+
+uint64_t histogram_get_sum(histogram *h) {
+	return h->sum;
+}
+
+uint64_t histogram_get_max(histogram *h) {
+	return h->max;
+}
+
+uint64_t histogram_get_percentile(histogram *h, double percentile) {
+	uint64_t count = histogram_get_count(h);
+	if (count == 0) {
+		return 0;
+	}
+	// the rank of the value at the percentile, rounded up, and at least the first value
+	uint64_t rank = (uint64_t)(percentile / 100 * count);
+	if (rank < percentile / 100 * count) {
+		rank++;
+	}
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			uint64_t bucket_max = histogram_get_bucket_max(i);
+			// nothing recorded is higher than the max, which narrows the top bucket down
+			return bucket_max < h->max ? bucket_max : h->max;
+		}
+	}
+	return h->max;
+}
@@ -0,0 +1,84 @@
+/*
+A log-linear histogram of durations, in the style of HdrHistogram. Values below HISTOGRAM_SUB_BUCKETS each get their own bucket, and from
+there every power of 2 is split into HISTOGRAM_SUB_BUCKETS / 2 equal buckets, so a bucket is never wider than 1/32 of the values in it and
+any percentile read back is within about 3% of the real one. Recording is finding the highest set bit and a shift, with no floating point
+or search.
+
+Values are nanoseconds, anything over HISTOGRAM_MAX_VALUE (about 18 minutes) goes in the last bucket, the exact max is kept separately.
+
+A histogram has a single writer, but others can merge it into their own at the same time without locking. Each count is written and read
+atomically, so a merge sees each bucket either before or after a record, never a torn count, and the merged total is always the sum of the
+buckets merged.
+
+References:
+http://hdrhistogram.org/
+*/
+
+#ifndef histogram_h
+#define histogram_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTOGRAM_SUB_BUCKET_BITS 6
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+// the highest set bit of the largest value with its own bucket
+#define HISTOGRAM_MAX_BIT 39
+#define HISTOGRAM_MAX_VALUE ((1ull << (HISTOGRAM_MAX_BIT + 1)) - 1)
+// a bucket for each value below HISTOGRAM_SUB_BUCKETS, then half that many for each bit from there up
+#define HISTOGRAM_NUM_BUCKETS ((HISTOGRAM_MAX_BIT - HISTOGRAM_SUB_BUCKET_BITS + 3) * (HISTOGRAM_SUB_BUCKETS / 2))
+
+typedef struct {
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_NUM_BUCKETS];
+} histogram;
+
+void histogram_init(histogram *h);
+
+/**
+ * Adds one value. Only one thread can record into a histogram.
+ */
+void histogram_record(histogram *h, uint64_t value);
+
+/**
+ * Adds everything in src to dst. src can be recorded into while this runs, dst can't be touched by anything else.
+ */
+void histogram_merge(histogram *dst, histogram *src);
+
+/**
+ * Clears all the values.
+ */
+void histogram_clear(histogram *h);
+
+uint64_t histogram_get_count(histogram *h);
+
+uint64_t histogram_get_sum(histogram *h);
+
+uint64_t histogram_get_max(histogram *h);
+
+/**
+ * @param percentile from 0 to 100, e.g. 99.9
+ * @returns the highest value that could be in the bucket the percentile falls in, so it's never under, or 0 if there are no values
+ */
+uint64_t histogram_get_percentile(histogram *h, double percentile);
+
+/**
+ * @returns the bucket a value is counted in
+ */
+size_t histogram_get_bucket(uint64_t value);
+
+/**
+ * @returns the highest value counted in a bucket
+ */
+uint64_t histogram_get_bucket_max(size_t bucket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,16 +1,22 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "http.h"
 #include "log.h"
-
-#define CHUNK_READ_SIZE 1024
-#define MAX_SOCKET_READ_SIZE_IN_CHUNKS 64
+#include "metrics.h"
+#include "perf_counters.h"
+#include "trace.h"
 
 void http_header_init(http_header *header) {
 	string_init(&header->name);
@@ -133,7 +139,7 @@ void http_headers_to_string(http_headers *headers, string *dst, char *indent) {
 				if (j > 0) {
 					string_append_cstr(dst, ",");
 				}
-				string_append_cstrf(dst, string_get_cstr(http_header_get_value(header, j)));
+				string_append_str(dst, http_header_get_value(header, j));
 			}
 			string_append_cstr(dst, "\n");
 		}
@@ -147,8 +153,12 @@ void http_request_init(http_request *request) {
 	string_init(&request->scratch);
 	string_init(&request->method);
 	string_init(&request->uri);
+	string_init(&request->protocol_version);
 	http_headers_init(&request->headers);
 	buffer_init(&request->body);
+	json_document_init(&request->json);
+	http_request_set_limits(request, HTTP_REQUEST_DEFAULT_READ_CHUNK_SIZE, HTTP_REQUEST_DEFAULT_MAX_HEADER_SIZE,
+							HTTP_REQUEST_DEFAULT_MAX_BODY_SIZE);
 }
 
 void http_request_dealloc(http_request *request) {
@@ -156,8 +166,10 @@ void http_request_dealloc(http_request *request) {
 	string_dealloc(&request->scratch);
 	string_dealloc(&request->method);
 	string_dealloc(&request->uri);
+	string_dealloc(&request->protocol_version);
 	http_headers_dealloc(&request->headers);
 	buffer_dealloc(&request->body);
+	json_document_dealloc(&request->json);
 }
 
 string *http_request_get_method(http_request *request) {
@@ -168,14 +180,34 @@ string *http_request_get_uri(http_request *request) {
 	return &request->uri;
 }
 
+string *http_request_get_protocol_version(http_request *request) {
+	return &request->protocol_version;
+}
+
 http_headers *http_request_get_headers(http_request *request) {
 	return &request->headers;
 }
 
+void http_request_set_limits(http_request *request, size_t read_chunk_size, size_t max_header_size, size_t max_body_size) {
+	request->read_chunk_size = read_chunk_size;
+	request->max_header_size = max_header_size;
+	request->max_body_size = max_body_size;
+}
+
+/*
+private
+
+Whether c can be part of a token, like a method or a header name, per RFC 7230 3.2.6.
+*/
+int http_is_token_char(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || (c && strchr("!#$%&'*+-.^_`|~", c));
+}
+
 int http_request_parse(http_request *request, stream *stream) {
 	buffer_clear(&request->read_buf);
 	string_clear(&request->method);
 	string_clear(&request->uri);
+	string_clear(&request->protocol_version);
 	http_headers_clear(&request->headers);
 	buffer_clear(&request->body);
 
@@ -185,11 +217,15 @@ int http_request_parse(http_request *request, stream *stream) {
 	int found_end_of_header = 0;
 	size_t start_of_body;
 
-	// use max size -1 because we're going to want to put a terminating 0
-	size_t max_read_length = MAX_SOCKET_READ_SIZE_IN_CHUNKS * CHUNK_READ_SIZE;
+	// until the end of the headers is found this is the most that can be read, after that it's exactly the end of the body
+	size_t max_read_length = request->max_header_size;
 	size_t expected_content_length = 0;
 	while (buffer_get_length(&request->read_buf) < max_read_length) {
-		int read_result = stream_read_buffer(stream, &request->read_buf, CHUNK_READ_SIZE, &request->scratch);
+		size_t read_size = max_read_length - buffer_get_length(&request->read_buf);
+		if (read_size > request->read_chunk_size) {
+			read_size = request->read_chunk_size;
+		}
+		int read_result = stream_read_buffer(stream, &request->read_buf, read_size, &request->scratch);
 		if (read_result < 0) {
 			log_error("parsing http request failed, error reading: %s\n", string_get_cstr(&request->scratch));
 			return 1;
@@ -253,9 +289,17 @@ int http_request_parse(http_request *request, stream *stream) {
 								}
 							}
 						}
+						// the method ends at the first space, so without this it could carry control characters into the logs
+						for (size_t j = method_start; found_end_of_protocol_version && j < method_end; j++) {
+							if (!http_is_token_char(request->read_buf.data[j])) {
+								found_end_of_protocol_version = 0;
+							}
+						}
 						if (found_end_of_protocol_version) {
 							string_set_cstr_len(&request->method, request->read_buf.data + method_start, method_end - method_start);
 							string_set_cstr_len(&request->uri, request->read_buf.data + uri_start, uri_end - uri_start);
+							string_set_cstr_len(&request->protocol_version, request->read_buf.data + protocol_version_start,
+												protocol_version_end - protocol_version_start);
 						} else {
 							string_set_cstr_len(&request->scratch, request->read_buf.data, end_of_request_line);
 							log_error("failed to parse request line: %s\n", string_get_cstr(&request->scratch));
@@ -267,6 +311,11 @@ int http_request_parse(http_request *request, stream *stream) {
 							start_of_body = i + 2;
 							// at this point we either have a content length header or we don't
 							// either way we know exactly how many more bytes to read, which may be 0
+							// only Content-Length bodies are supported, so a chunked body can't be mistaken for the next request
+							if (http_headers_get_cstr(&request->headers, "Transfer-Encoding", 0)) {
+								log_error("Transfer-Encoding isn't supported\n");
+								return 1;
+							}
 							http_header *header = http_headers_get_cstr(&request->headers, "Content-Length",
 																		// don't create this header if missing
 																		0);
@@ -279,8 +328,17 @@ int http_request_parse(http_request *request, stream *stream) {
 								return 1;
 							} else {
 								string *value = http_header_get_value(header, 0);
-								if (sscanf(string_get_cstr(value), "%zu", &expected_content_length) == 1) {
-									max_read_length = i + expected_content_length;
+								// the leading whitespace is already gone but trailing whitespace is allowed too
+								size_t value_length = string_reverse_index_not_of_any_cstr(value, " \t", -1) + 1;
+								uint64_t parsed_content_length;
+								if (!string_parse_uint64_cstr_len(string_get_cstr(value), value_length, &parsed_content_length)) {
+									expected_content_length = parsed_content_length > SIZE_MAX ? SIZE_MAX : parsed_content_length;
+									if (expected_content_length > request->max_body_size) {
+										log_error("Content-Length %zu is more than the limit of %zu\n", expected_content_length,
+												  request->max_body_size);
+										return 1;
+									}
+									max_read_length = start_of_body + expected_content_length;
 								} else {
 									log_error("Content-Length header present but isn't a valid integer: %s\n", string_get_cstr(value));
 									return 1;
@@ -296,6 +354,13 @@ int http_request_parse(http_request *request, stream *stream) {
 								log_error("failed to parse header line: %s\n", string_get_cstr(&request->scratch));
 								return 1;
 							}
+							// whitespace before the colon isn't allowed, as a proxy could read the name differently
+							char *name = string_get_cstr(&request->scratch);
+							if (split_results[1] == split_results[0] || name[split_results[1] - 1] == ' ' ||
+								name[split_results[1] - 1] == '\t') {
+								log_error("failed to parse header line: %s\n", string_get_cstr(&request->scratch));
+								return 1;
+							}
 							http_header *header =
 								http_headers_get_cstr_len(&request->headers, string_get_cstr(&request->scratch) + split_results[0],
 														  split_results[1] - split_results[0],
@@ -338,11 +403,15 @@ int http_request_parse(http_request *request, stream *stream) {
 
 	buffer_append_bytes(&request->body, request->read_buf.data + start_of_body, buffer_get_length(&request->read_buf) - start_of_body);
 
-	string_clear(&request->scratch);
-	string_append_cstrf(&request->scratch, "parsed request %s %s\n", string_get_cstr(&request->method), string_get_cstr(&request->uri));
-	http_headers_to_string(&request->headers, &request->scratch, "    ");
-	string_append_cstrf(&request->scratch, "    body: %zu bytes\n", buffer_get_length(&request->body));
-	log_trace("%s\n", string_get_cstr(&request->scratch));
+	// the dump is only worth building if it's going to be written
+	if (log_is_enabled(LOG_LEVEL_TRACE)) {
+		string_clear(&request->scratch);
+		string_append_cstrf(&request->scratch, "parsed request %s %s\n", string_get_cstr(&request->method),
+							string_get_cstr(&request->uri));
+		http_headers_to_string(&request->headers, &request->scratch, "    ");
+		string_append_cstrf(&request->scratch, "    body: %zu bytes\n", buffer_get_length(&request->body));
+		log_trace("%s\n", string_get_cstr(&request->scratch));
+	}
 
 	if (buffer_get_length(&request->body) != expected_content_length) {
 		log_error("expected content length %zu but read %zu bytes\n", expected_content_length, buffer_get_length(&request->body));
@@ -352,6 +421,234 @@ int http_request_parse(http_request *request, stream *stream) {
 	return 0;
 }
 
+int http_request_find_end(uint8_t *data, size_t length, size_t max_header_size, size_t max_body_size, size_t *request_length) {
+	uint8_t *end_of_header = memmem(data, length < max_header_size ? length : max_header_size, "\r\n\r\n", 4);
+	if (!end_of_header) {
+		return length >= max_header_size ? -1 : HTTP_REQUEST_FIND_END_NEED_HEADERS;
+	}
+	size_t header_length = end_of_header + 4 - data;
+
+	// only Content-Length bodies are supported, the same as http_request_parse. Anything a proxy in front could frame differently is
+	// malformed here, a Transfer-Encoding or a second Content-Length, or the body would be read as the next request on the connection
+	static char content_length_name[] = "content-length";
+	size_t content_length_name_length = sizeof(content_length_name) - 1;
+	static char transfer_encoding_name[] = "transfer-encoding";
+	size_t transfer_encoding_name_length = sizeof(transfer_encoding_name) - 1;
+	size_t content_length = 0;
+	int found_content_length = 0;
+	uint8_t *line = (uint8_t *)memchr(data, '\n', header_length) + 1;
+	while (line < end_of_header + 2) {
+		size_t line_length = end_of_header + 2 - line;
+		if (line_length > transfer_encoding_name_length &&
+			!strncasecmp((char *)line, transfer_encoding_name, transfer_encoding_name_length) &&
+			(line[transfer_encoding_name_length] == ':' || line[transfer_encoding_name_length] == ' ' ||
+			 line[transfer_encoding_name_length] == '\t')) {
+			return -1;
+		}
+		if (line_length > content_length_name_length && !strncasecmp((char *)line, content_length_name, content_length_name_length)) {
+			uint8_t *c = line + content_length_name_length;
+			// whitespace before the colon isn't allowed, and a header that isn't quite Content-Length is left alone
+			if (*c == ' ' || *c == '\t') {
+				return -1;
+			}
+			if (*c == ':') {
+				if (found_content_length) {
+					return -1;
+				}
+				found_content_length = 1;
+				c++;
+				while (*c == ' ' || *c == '\t') {
+					c++;
+				}
+				if (*c < '0' || *c > '9') {
+					return -1;
+				}
+				for (; *c >= '0' && *c <= '9'; c++) {
+					content_length = content_length * 10 + (*c - '0');
+					if (content_length > max_body_size) {
+						return -1;
+					}
+				}
+				// only trailing whitespace, so a list of lengths isn't taken as its first one
+				while (*c == ' ' || *c == '\t') {
+					c++;
+				}
+				if (*c != '\r') {
+					return -1;
+				}
+			}
+		}
+		line = (uint8_t *)memchr(line, '\n', end_of_header + 2 - line) + 1;
+	}
+
+	if (length < header_length + content_length) {
+		return HTTP_REQUEST_FIND_END_NEED_BODY;
+	}
+	*request_length = header_length + content_length;
+	return 0;
+}
+
+int http_request_get_body_json(http_request *request, json_value *root) {
+	if (json_document_parse(&request->json, (char *)request->body.data, buffer_get_length(&request->body))) {
+		return 1;
+	}
+	return json_document_get_root(&request->json, root);
+}
+
+// every status code with a standard reason phrase
+#define HTTP_STATUS_CODES(X)                                                                                                               \
+	X(100, "Continue")                                                                                                                     \
+	X(101, "Switching Protocols")                                                                                                          \
+	X(200, "OK")                                                                                                                           \
+	X(201, "Created")                                                                                                                      \
+	X(202, "Accepted")                                                                                                                     \
+	X(203, "Non-Authoritative Information")                                                                                                \
+	X(204, "No Content")                                                                                                                   \
+	X(205, "Reset Content")                                                                                                                \
+	X(206, "Partial Content")                                                                                                              \
+	X(300, "Multiple Choices")                                                                                                             \
+	X(301, "Moved Permanently")                                                                                                            \
+	X(302, "Found")                                                                                                                        \
+	X(303, "See Other")                                                                                                                    \
+	X(304, "Not Modified")                                                                                                                 \
+	X(305, "Use Proxy")                                                                                                                    \
+	X(307, "Temporary Redirect")                                                                                                           \
+	X(400, "Bad Request")                                                                                                                  \
+	X(401, "Unauthorized")                                                                                                                 \
+	X(402, "Payment Required")                                                                                                             \
+	X(403, "Forbidden")                                                                                                                    \
+	X(404, "Not Found")                                                                                                                    \
+	X(405, "Method Not Allowed")                                                                                                           \
+	X(406, "Not Acceptable")                                                                                                               \
+	X(407, "Proxy Authentication Required")                                                                                                \
+	X(408, "Request Time-out")                                                                                                             \
+	X(409, "Conflict")                                                                                                                     \
+	X(410, "Gone")                                                                                                                         \
+	X(411, "Length Required")                                                                                                              \
+	X(412, "Precondition Failed")                                                                                                          \
+	X(413, "Request Entity Too Large")                                                                                                     \
+	X(414, "Request-URI Too Large")                                                                                                        \
+	X(415, "Unsupported Media Type")                                                                                                       \
+	X(416, "Requested range not satisfiable")                                                                                              \
+	X(417, "Expectation Failed")                                                                                                           \
+	X(500, "Internal Server Error")                                                                                                        \
+	X(501, "Not Implemented")                                                                                                              \
+	X(502, "Bad Gateway")                                                                                                                  \
+	X(503, "Service Unavailable")                                                                                                          \
+	X(504, "Gateway Time-out")                                                                                                             \
+	X(505, "HTTP Version not supported")
+
+#define HTTP_STATUS_LINE_TEXT(status_code, reason_phrase) "HTTP/1.1 " #status_code " " reason_phrase "\r\n"
+#define HTTP_STATUS_LINE(status_code, reason_phrase)                                                                                       \
+	[status_code] = {HTTP_STATUS_LINE_TEXT(status_code, reason_phrase), sizeof(HTTP_STATUS_LINE_TEXT(status_code, reason_phrase)) - 1,     \
+					 reason_phrase},
+#define HTTP_STATUS_LINES_SIZE 600
+
+typedef struct {
+	const char *line;
+	size_t length;
+	const char *reason_phrase;
+} http_status_line;
+
+/*
+Whole status lines for every standard status, indexed by status code, so writing one is a single copy.
+*/
+static const http_status_line http_status_lines[HTTP_STATUS_LINES_SIZE] = {HTTP_STATUS_CODES(HTTP_STATUS_LINE)};
+
+// private
+const http_status_line *http_get_status_line(int status_code) {
+	if (status_code < 0 || status_code >= HTTP_STATUS_LINES_SIZE || !http_status_lines[status_code].line) {
+		return NULL;
+	}
+	return &http_status_lines[status_code];
+}
+
+// "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+#define HTTP_DATE_LINE_LENGTH 37
+// readers can be part way through copying an old line while a new one is written, so lines are only reused after this many seconds
+#define HTTP_DATE_SLOTS 16
+
+/*
+The Date header only changes once a second, so it's formatted once a second and everything else copies it. Readers load the current slot
+and copy from it without locking, and a refresh writes the next slot before publishing it.
+*/
+static char http_date_lines[HTTP_DATE_SLOTS][HTTP_DATE_LINE_LENGTH + 1];
+static unsigned http_date_slot;
+static time_t http_date_second = -1;
+static int http_date_refreshing;
+
+/*
+Formats the line for the current second if it isn't already. Only one thread formats at a time, any others carry on with the old line.
+*/
+// private
+void http_date_refresh(time_t now) {
+	static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+	static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	if (__atomic_exchange_n(&http_date_refreshing, 1, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	if (__atomic_load_n(&http_date_second, __ATOMIC_RELAXED) != now) {
+		unsigned slot = (__atomic_load_n(&http_date_slot, __ATOMIC_RELAXED) + 1) % HTTP_DATE_SLOTS;
+		struct tm tm;
+		gmtime_r(&now, &tm);
+		// not strftime, the names have to be English whatever the locale is
+		snprintf(http_date_lines[slot], sizeof(http_date_lines[slot]), "Date: %s, %02d %s %04d %02d:%02d:%02d GMT\r\n", days[tm.tm_wday],
+				 tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+		__atomic_store_n(&http_date_slot, slot, __ATOMIC_RELEASE);
+		__atomic_store_n(&http_date_second, now, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&http_date_refreshing, 0, __ATOMIC_RELEASE);
+}
+
+// private
+time_t http_date_now() {
+	// the coarse clock is only as precise as the scheduler tick, but a vDSO read that never goes into the kernel
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+/*
+Returns the Date header line for now, HTTP_DATE_LINE_LENGTH long. With an io loop a timer refreshes it as each second starts, so this only
+formats it when there's no loop.
+*/
+// private
+char *http_date_get_line() {
+	if (__atomic_load_n(&http_date_second, __ATOMIC_ACQUIRE) != http_date_now()) {
+		http_date_refresh(http_date_now());
+	}
+	return http_date_lines[__atomic_load_n(&http_date_slot, __ATOMIC_ACQUIRE)];
+}
+
+int http_common_headers_init(http_common_headers *common_headers, int date, char *lines) {
+	common_headers->date = date;
+	buffer_init(&common_headers->block);
+	// checked and normalized to CRLF line endings
+	char *line = lines;
+	while (*line) {
+		size_t length = strcspn(line, "\r\n");
+		char *colon = memchr(line, ':', length);
+		if (length > 0) {
+			if (!colon || colon == line || memchr(line, ' ', colon - line)) {
+				buffer_dealloc(&common_headers->block);
+				return 1;
+			}
+			buffer_append_bytes(&common_headers->block, line, length);
+			buffer_append_bytes(&common_headers->block, "\r\n", 2);
+		}
+		line += length;
+		line += strspn(line, "\r\n");
+	}
+	if (date) {
+		http_date_refresh(http_date_now());
+	}
+	return 0;
+}
+
+void http_common_headers_dealloc(http_common_headers *common_headers) {
+	buffer_dealloc(&common_headers->block);
+}
+
 void http_response_init(http_response *response) {
 	string_init(&response->scratch);
 	string_init(&response->reason_phrase);
@@ -359,9 +656,15 @@ void http_response_init(http_response *response) {
 	http_headers_init(&response->headers);
 	buffer_init(&response->body_buffer);
 	stream_init_buffer(&response->body_stream, &response->body_buffer, 0);
+	response->streaming = 0;
+	response->close_delimited = 0;
+	response->flush = NULL;
+	response->flush_data = NULL;
+	response->common_headers = NULL;
 }
 
 void http_response_dealloc(http_response *response) {
+	string_dealloc(&response->reason_phrase);
 	http_headers_dealloc(&response->headers);
 	buffer_dealloc(&response->body_buffer);
 	if (stream_dealloc(&response->body_stream, &response->scratch)) {
@@ -376,6 +679,10 @@ void http_response_clear(http_response *response) {
 	http_headers_clear(&response->headers);
 	buffer_clear(&response->body_buffer);
 	stream_set_position(&response->body_stream, 0);
+	response->streaming = 0;
+	response->close_delimited = 0;
+	response->flush = NULL;
+	response->flush_data = NULL;
 }
 
 int http_response_get_status_code(http_response *response) {
@@ -384,133 +691,24 @@ int http_response_get_status_code(http_response *response) {
 
 void http_response_set_status_code(http_response *response, int status_code) {
 	response->status_code = status_code;
-	switch (status_code) {
-	case 100:
-		string_set_cstr(&response->reason_phrase, "Continue");
-		break;
-	case 101:
-		string_set_cstr(&response->reason_phrase, "Switching Protocols");
-		break;
-	case 200:
-		string_set_cstr(&response->reason_phrase, "OK");
-		break;
-	case 201:
-		string_set_cstr(&response->reason_phrase, "Created");
-		break;
-	case 202:
-		string_set_cstr(&response->reason_phrase, "Accepted");
-		break;
-	case 203:
-		string_set_cstr(&response->reason_phrase, "Non-Authoritative Information");
-		break;
-	case 204:
-		string_set_cstr(&response->reason_phrase, "No Content");
-		break;
-	case 205:
-		string_set_cstr(&response->reason_phrase, "Reset Content");
-		break;
-	case 206:
-		string_set_cstr(&response->reason_phrase, "Partial Content");
-		break;
-	case 300:
-		string_set_cstr(&response->reason_phrase, "Multiple Choices");
-		break;
-	case 301:
-		string_set_cstr(&response->reason_phrase, "Moved Permanently");
-		break;
-	case 302:
-		string_set_cstr(&response->reason_phrase, "Found");
-		break;
-	case 303:
-		string_set_cstr(&response->reason_phrase, "See Other");
-		break;
-	case 304:
-		string_set_cstr(&response->reason_phrase, "Not Modified");
-		break;
-	case 305:
-		string_set_cstr(&response->reason_phrase, "Use Proxy");
-		break;
-	case 307:
-		string_set_cstr(&response->reason_phrase, "Temporary Redirect");
-		break;
-	case 400:
-		string_set_cstr(&response->reason_phrase, "Bad Request");
-		break;
-	case 401:
-		string_set_cstr(&response->reason_phrase, "Unauthorized");
-		break;
-	case 402:
-		string_set_cstr(&response->reason_phrase, "Payment Required");
-		break;
-	case 403:
-		string_set_cstr(&response->reason_phrase, "Forbidden");
-		break;
-	case 404:
-		string_set_cstr(&response->reason_phrase, "Not Found");
-		break;
-	case 405:
-		string_set_cstr(&response->reason_phrase, "Method Not Allowed");
-		break;
-	case 406:
-		string_set_cstr(&response->reason_phrase, "Not Acceptable");
-		break;
-	case 407:
-		string_set_cstr(&response->reason_phrase, "Proxy Authentication Required");
-		break;
-	case 408:
-		string_set_cstr(&response->reason_phrase, "Request Time-out");
-		break;
-	case 409:
-		string_set_cstr(&response->reason_phrase, "Conflict");
-		break;
-	case 410:
-		string_set_cstr(&response->reason_phrase, "Gone");
-		break;
-	case 411:
-		string_set_cstr(&response->reason_phrase, "Length Required");
-		break;
-	case 412:
-		string_set_cstr(&response->reason_phrase, "Precondition Failed");
-		break;
-	case 413:
-		string_set_cstr(&response->reason_phrase, "Request Entity Too Large");
-		break;
-	case 414:
-		string_set_cstr(&response->reason_phrase, "Request-URI Too Large");
-		break;
-	case 415:
-		string_set_cstr(&response->reason_phrase, "Unsupported Media Type");
-		break;
-	case 416:
-		string_set_cstr(&response->reason_phrase, "Requested range not satisfiable");
-		break;
-	case 417:
-		string_set_cstr(&response->reason_phrase, "Expectation Failed");
-		break;
-	case 500:
-		string_set_cstr(&response->reason_phrase, "Internal Server Error");
-		break;
-	case 501:
-		string_set_cstr(&response->reason_phrase, "Not Implemented");
-		break;
-	case 502:
-		string_set_cstr(&response->reason_phrase, "Bad Gateway");
-		break;
-	case 503:
-		string_set_cstr(&response->reason_phrase, "Service Unavailable");
-		break;
-	case 504:
-		string_set_cstr(&response->reason_phrase, "Gateway Time-out");
-		break;
-	case 505:
-		string_set_cstr(&response->reason_phrase, "HTTP Version not supported");
-		break;
-	default:
-		string_set_cstr(&response->reason_phrase, "Other");
+	response->custom_reason_phrase = 0;
+}
+
+// private
+const char *http_response_get_reason_phrase_cstr(http_response *response) {
+	if (response->custom_reason_phrase) {
+		return string_get_cstr(&response->reason_phrase);
 	}
+	const http_status_line *status_line = http_get_status_line(response->status_code);
+	return status_line ? status_line->reason_phrase : "Other";
 }
 
 string *http_response_get_reason_phrase(http_response *response) {
+	if (!response->custom_reason_phrase) {
+		// the caller can change it from here on, so it's written out as is
+		string_set_cstr(&response->reason_phrase, (char *)http_response_get_reason_phrase_cstr(response));
+		response->custom_reason_phrase = 1;
+	}
 	return &response->reason_phrase;
 }
 
@@ -522,80 +720,174 @@ stream *http_response_get_body(http_response *response) {
 	return &response->body_stream;
 }
 
-int http_response_write(http_response *response, stream *stream) {
-	// fix the content length header first
-	// this is true for even empty bodies, as without a Content-Length of 0 the client may not properly handle the response
-	// it's possible that a more careful reading of the RFC would make this obvious, but I see Content-Length as optional
-	// add it anyway to make clients happy
-	http_header *content_length_header = http_headers_get_cstr(&response->headers, "Content-Length", 1);
-	// check to see if the content length header is already set to the correct value
-	// check number of values, anything but exactly one value is obviously not correct
-	if (http_header_get_num_values(content_length_header) != 1) {
-		http_header_clear(content_length_header);
+void http_response_set_common_headers(http_response *response, http_common_headers *common_headers) {
+	response->common_headers = common_headers;
+}
+
+// private
+int http_response_write_head(http_response *response, stream *stream) {
+	// status line
+	const http_status_line *status_line = response->custom_reason_phrase ? NULL : http_get_status_line(response->status_code);
+	if (status_line) {
+		if (stream_write(stream, (void *)status_line->line, status_line->length, &response->scratch) < 0) {
+			log_error("error writing status line: %s\n", string_get_cstr(&response->scratch));
+			return 1;
+		}
 	} else {
-		// get the actual value
-		size_t content_length_header_value;
-		if (sscanf(string_get_cstr(http_header_get_value(content_length_header, 0)), "%zu", &content_length_header_value) == 1) {
-			// it's an intenger, is it the right value already?
-			if (content_length_header_value != buffer_get_length(&response->body_buffer)) {
-				http_header_clear(content_length_header);
-			}
-		} else {
-			// not the right value
-			http_header_clear(content_length_header);
+		char code[STRING_MAX_INT64_LENGTH];
+		char *code_end = code + sizeof(code);
+		char *code_start = string_format_int64(code_end, response->status_code);
+		if (stream_write_cstr(stream, "HTTP/1.1 ", &response->scratch) < 0 ||
+			stream_write(stream, code_start, code_end - code_start, &response->scratch) < 0 ||
+			stream_write_cstr(stream, " ", &response->scratch) < 0 ||
+			stream_write_cstr(stream, (char *)http_response_get_reason_phrase_cstr(response), &response->scratch) < 0 ||
+			stream_write_cstr(stream, "\r\n", &response->scratch) < 0) {
+			log_error("error writing status line: %s\n", string_get_cstr(&response->scratch));
+			return 1;
 		}
 	}
-	// if we ended up clearing the header add the correct value back
-	if (http_header_get_num_values(content_length_header) == 0) {
-		string_set_cstrf(http_header_append_value(content_length_header), "%zu", buffer_get_length(&response->body_buffer));
-	}
-
-	string_clear(&response->scratch);
-	string_append_cstrf(&response->scratch, "serializing response %i %s\n", response->status_code,
-						string_get_cstr(&response->reason_phrase));
-	http_headers_to_string(&response->headers, &response->scratch, "    ");
-	string_append_cstrf(&response->scratch, "    body: %zu bytes\n", buffer_get_length(&response->body_buffer));
-	log_trace("%s\n", string_get_cstr(&response->scratch));
 
-	// status line
-	if (stream_write_cstrf(stream, &response->scratch, "HTTP/1.1 %i %s\r\n", response->status_code,
-						   string_get_cstr(&response->reason_phrase)) < 0) {
-		log_error("error writing status line: %s\n", string_get_cstr(&response->scratch));
-		return 1;
+	// the server's headers, already serialized
+	http_common_headers *common_headers = response->common_headers;
+	if (common_headers) {
+		if (common_headers->date && !http_headers_get_cstr(&response->headers, "Date", 0) &&
+			stream_write(stream, http_date_get_line(), HTTP_DATE_LINE_LENGTH, &response->scratch) < 0) {
+			log_error("error writing date header: %s\n", string_get_cstr(&response->scratch));
+			return 1;
+		}
+		if (buffer_get_length(&common_headers->block) > 0 && stream_write_buffer(stream, &common_headers->block, &response->scratch) < 0) {
+			log_error("error writing common headers: %s\n", string_get_cstr(&response->scratch));
+			return 1;
+		}
 	}
 
 	// headers
 	for (size_t i = 0; i < http_headers_get_num(&response->headers); i++) {
 		http_header *header = http_headers_get(&response->headers, i);
-		if (stream_write_cstrf(stream, &response->scratch, "%s: ", string_get_cstr(http_header_get_name(header))) < 0) {
+		if (response->streaming && !string_compare_cstr(http_header_get_name(header), "Content-Length", STRING_COMPARE_CASE_INSENSITIVE)) {
+			// the length isn't known up front when the body's sent in chunks
+			continue;
+		}
+		string *name = http_header_get_name(header);
+		if (stream_write(stream, string_get_cstr(name), string_get_length(name), &response->scratch) < 0 ||
+			stream_write(stream, ": ", 2, &response->scratch) < 0) {
 			log_error("error writing header name (%zu): %s\n", i, string_get_cstr(&response->scratch));
 			return 1;
 		}
 		for (size_t j = 0; j < http_header_get_num_values(header); j++) {
 			string *value = http_header_get_value(header, j);
 			if (j > 0) {
-				if (stream_write_cstrf(stream, &response->scratch, ",") < 0) {
+				if (stream_write(stream, ",", 1, &response->scratch) < 0) {
 					log_error("error writing header value separator (%zu, %zu): %s\n", i, j, string_get_cstr(&response->scratch));
 					return 1;
 				}
 			}
-			if (stream_write_cstrf(stream, &response->scratch, "%s", string_get_cstr(value)) < 0) {
+			if (stream_write(stream, string_get_cstr(value), string_get_length(value), &response->scratch) < 0) {
 				log_error("error writing header value (%zu, %zu): %s\n", i, j, string_get_cstr(&response->scratch));
 				return 1;
 			}
 		}
-		if (stream_write_cstrf(stream, &response->scratch, "\r\n") < 0) {
+		if (stream_write(stream, "\r\n", 2, &response->scratch) < 0) {
 			log_error("error writing header line break (%zu): %s\n", i, string_get_cstr(&response->scratch));
 			return 1;
 		}
 	}
 
 	// separator between headers and body
-	if (stream_write_cstrf(stream, &response->scratch, "\r\n") < 0) {
+	if (stream_write(stream, "\r\n", 2, &response->scratch) < 0) {
 		log_error("error writing extra line break between headers and body: %s\n", string_get_cstr(&response->scratch));
 		return 1;
 	}
 
+	return 0;
+}
+
+// private
+int http_response_write_chunk(http_response *response, stream *stream) {
+	size_t length = buffer_get_length(&response->body_buffer);
+	// an empty chunk would end the body
+	if (length == 0) {
+		return 0;
+	}
+	if (response->close_delimited) {
+		// closing the connection is what ends the body
+		if (stream_write_buffer(stream, &response->body_buffer, &response->scratch) < 0) {
+			log_error("error writing body: %s\n", string_get_cstr(&response->scratch));
+			return 1;
+		}
+		buffer_clear(&response->body_buffer);
+		stream_set_position(&response->body_stream, 0);
+		return 0;
+	}
+	// the size line, the hex length followed by a line break
+	char size_line[16 + 2];
+	char *size_end = size_line + sizeof(size_line);
+	char *size_start = string_format_hex_uint64(size_end - 2, length);
+	memcpy(size_end - 2, "\r\n", 2);
+	if (stream_write(stream, size_start, size_end - size_start, &response->scratch) < 0 ||
+		stream_write_buffer(stream, &response->body_buffer, &response->scratch) < 0 ||
+		stream_write_cstr(stream, "\r\n", &response->scratch) < 0) {
+		log_error("error writing body chunk: %s\n", string_get_cstr(&response->scratch));
+		return 1;
+	}
+	buffer_clear(&response->body_buffer);
+	stream_set_position(&response->body_stream, 0);
+	return 0;
+}
+
+int http_response_write(http_response *response, stream *stream) {
+	if (response->streaming) {
+		// the head and some of the body are already out, finish off the chunks
+		if (http_response_write_chunk(response, stream)) {
+			return 1;
+		}
+		if (!response->close_delimited && stream_write_cstr(stream, "0\r\n\r\n", &response->scratch) < 0) {
+			log_error("error writing last body chunk: %s\n", string_get_cstr(&response->scratch));
+			return 1;
+		}
+		return 0;
+	}
+
+	// fix the content length header first
+	// this is true for even empty bodies, as without a Content-Length of 0 the client may not properly handle the response
+	// it's possible that a more careful reading of the RFC would make this obvious, but I see Content-Length as optional
+	// add it anyway to make clients happy
+	http_header *content_length_header = http_headers_get_cstr(&response->headers, "Content-Length", 1);
+	// check to see if the content length header is already set to the correct value
+	// check number of values, anything but exactly one value is obviously not correct
+	if (http_header_get_num_values(content_length_header) != 1) {
+		http_header_clear(content_length_header);
+	} else {
+		// get the actual value
+		uint64_t content_length_header_value;
+		if (!string_parse_uint64(http_header_get_value(content_length_header, 0), &content_length_header_value)) {
+			// it's an intenger, is it the right value already?
+			if (content_length_header_value != buffer_get_length(&response->body_buffer)) {
+				http_header_clear(content_length_header);
+			}
+		} else {
+			// not the right value
+			http_header_clear(content_length_header);
+		}
+	}
+	// if we ended up clearing the header add the correct value back
+	if (http_header_get_num_values(content_length_header) == 0) {
+		string_set_uint64(http_header_append_value(content_length_header), buffer_get_length(&response->body_buffer));
+	}
+
+	if (log_is_enabled(LOG_LEVEL_TRACE)) {
+		string_clear(&response->scratch);
+		string_append_cstrf(&response->scratch, "serializing response %i %s\n", response->status_code,
+							http_response_get_reason_phrase_cstr(response));
+		http_headers_to_string(&response->headers, &response->scratch, "    ");
+		string_append_cstrf(&response->scratch, "    body: %zu bytes\n", buffer_get_length(&response->body_buffer));
+		log_trace("%s\n", string_get_cstr(&response->scratch));
+	}
+
+	if (http_response_write_head(response, stream)) {
+		return 1;
+	}
+
 	// body
 	if (stream_write_buffer(stream, &response->body_buffer, &response->scratch) < 0) {
 		log_error("error writing body: %s\n", string_get_cstr(&response->scratch));
@@ -606,75 +898,103 @@ int http_response_write(http_response *response, stream *stream) {
 	return 0;
 }
 
-// private
-void http_server_finalize_task(http_server_task_data *data) {
-	log_trace("responding to request %s:%i %s %s\n", string_get_cstr(&data->request_address), data->request_port,
-			  string_get_cstr(http_request_get_method(&data->request)), string_get_cstr(http_request_get_uri(&data->request)));
-	if (http_response_write(&data->response, &data->socket_stream)) {
-		log_error("failed to write HTTP response to the socket stream\n");
-	}
-	// close out future reads and writes
-	// if we're writing a timeout response this will cause future writes to the socket to fail in the handler function ever finishes
-	shutdown(data->socket, SHUT_RDWR);
-	if (stream_dealloc(&data->socket_stream, &data->scratch)) {
-		log_error("failed to close HTTP request socket stream: %s\n", string_get_cstr(&data->scratch));
+int http_response_write_partial(http_response *response, stream *stream) {
+	if (!response->streaming) {
+		response->streaming = 1;
+		if (response->close_delimited) {
+			// chunks can't be sent to HTTP/1.0, so the body is only over once the connection is
+			http_header *connection = http_headers_get_cstr(&response->headers, "Connection", 1);
+			http_header_clear(connection);
+			string_set_cstr(http_header_append_value(connection), "close");
+		} else {
+			http_header *transfer_encoding = http_headers_get_cstr(&response->headers, "Transfer-Encoding", 1);
+			http_header_clear(transfer_encoding);
+			string_set_cstr(http_header_append_value(transfer_encoding), "chunked");
+		}
+		log_trace("streaming response %i %s\n", response->status_code, http_response_get_reason_phrase_cstr(response));
+		if (http_response_write_head(response, stream)) {
+			return 1;
+		}
 	}
+	return http_response_write_chunk(response, stream);
+}
 
-	// put task back on pool
-	if (pthread_mutex_lock(&data->server->task_pool_mutex)) {
-		log_error("error locking http server task pool\n");
-		close(data->socket);
-		return;
-	}
-	data->next = data->server->task_pool;
-	data->server->task_pool = data;
-	data->server->task_pool_len++;
-	log_trace("put http server task data back on the pool, there are now %zu tasks in the pool\n", data->server->task_pool_len);
-	if (pthread_mutex_unlock(&data->server->task_pool_mutex)) {
-		log_error("error unlock http server task pool\n");
+void http_response_set_flush(http_response *response, http_response_flush_func flush, void *data) {
+	response->flush = flush;
+	response->flush_data = data;
+}
+
+int http_response_flush(http_response *response) {
+	if (!response->flush) {
+		return 0;
 	}
+	return response->flush(response->flush_data, response);
 }
 
-// private
-int http_server_task(int thread_id, void *data) {
-	http_server_task_data *task_data = data;
+// shared by every server in the process
+static pthread_once_t http_server_metrics_once = PTHREAD_ONCE_INIT;
+// by status class, 1xx to 5xx
+static metrics_id http_server_responses_metrics[5];
+static metrics_id http_server_response_bytes_metric;
+static metrics_id http_server_shed_metric;
+static metrics_id http_server_handler_timeouts_metric;
+static metrics_id http_server_read_timeouts_metric;
+static metrics_id http_server_handler_errors_metric;
+static metrics_id http_server_connections_metric;
+static metrics_id http_server_tasks_in_use_metric;
+static metrics_id http_server_tasks_pooled_metric;
+// accept to dispatch, queue, parse, handler and write
+static metrics_id http_server_phase_metrics[5];
+static pthread_once_t http_server_perf_counters_once = PTHREAD_ONCE_INIT;
+// parse, handler and serialize, only registered once a server turns the hardware counters on
+static perf_counters_phase_id http_server_perf_phases[3];
 
-	// parse the input
-	log_trace("parsing incoming HTTP request from %s:%i\n", string_get_cstr(&task_data->request_address), task_data->request_port);
-	if (http_request_parse(&task_data->request, &task_data->socket_stream)) {
-		// failed to even read the input document, just return an error telling the client they did this wrong
-		log_error("error parsing HTTP data\n");
-		http_response_clear(&task_data->response);
-		http_response_set_status_code(&task_data->response, 400);
-		goto DONE;
+// private
+void http_server_register_metrics() {
+	static char *response_names[] = {"http_responses_total{class=\"1xx\"}", "http_responses_total{class=\"2xx\"}",
+									 "http_responses_total{class=\"3xx\"}", "http_responses_total{class=\"4xx\"}",
+									 "http_responses_total{class=\"5xx\"}"};
+	for (int i = 0; i < 5; i++) {
+		metrics_register_cstr(response_names[i], "Responses sent, by status class.", METRICS_TYPE_COUNTER,
+							  &http_server_responses_metrics[i]);
 	}
-
-	// try to handle this with the user-provided callback
-	http_response_clear(&task_data->response);
-	log_trace("handling HTTP request from %s:%i %s %s\n", string_get_cstr(&task_data->request_address), task_data->request_port,
-			  string_get_cstr(http_request_get_method(&task_data->request)), string_get_cstr(http_request_get_uri(&task_data->request)));
-	if (task_data->server->callback(task_data->server->callback_data, &task_data->request, &task_data->response)) {
-		// something bad happened in the handler, just return a generic error
-		log_debug("HTTP handler failed\n");
-		http_response_clear(&task_data->response);
-		http_response_set_status_code(&task_data->response, 500);
-		goto DONE;
+	metrics_register_cstr("http_response_bytes_total", "Bytes of responses sent.", METRICS_TYPE_COUNTER,
+						  &http_server_response_bytes_metric);
+	metrics_register_cstr("http_requests_shed_total", "Requests turned away by the concurrency limiter.", METRICS_TYPE_COUNTER,
+						  &http_server_shed_metric);
+	metrics_register_cstr("http_handler_timeouts_total", "Requests whose handler ran past the handler timeout.", METRICS_TYPE_COUNTER,
+						  &http_server_handler_timeouts_metric);
+	metrics_register_cstr("http_read_timeouts_total", "Connections that took too long to send a request.", METRICS_TYPE_COUNTER,
+						  &http_server_read_timeouts_metric);
+	metrics_register_cstr("http_handler_errors_total", "Requests whose handler failed.", METRICS_TYPE_COUNTER,
+						  &http_server_handler_errors_metric);
+	metrics_register_cstr("http_connections_open", "Connections open.", METRICS_TYPE_GAUGE, &http_server_connections_metric);
+	metrics_register_cstr("http_server_tasks_in_use", "Requests with a task, from being read to their response being sent.",
+						  METRICS_TYPE_GAUGE, &http_server_tasks_in_use_metric);
+	metrics_register_cstr("http_server_tasks_pooled", "Allocated tasks waiting to be reused.", METRICS_TYPE_GAUGE,
+						  &http_server_tasks_pooled_metric);
+	static char *phase_names[] = {"http_request_phase_seconds{phase=\"accept\"}", "http_request_phase_seconds{phase=\"queue\"}",
+								  "http_request_phase_seconds{phase=\"parse\"}", "http_request_phase_seconds{phase=\"handler\"}",
+								  "http_request_phase_seconds{phase=\"write\"}"};
+	for (int i = 0; i < 5; i++) {
+		metrics_register_cstr(phase_names[i],
+							  "Time requests spent in each phase, from accept to being dispatched to a worker, waiting for one, being "
+							  "parsed, in the handler, and having the response written.",
+							  METRICS_TYPE_HISTOGRAM, &http_server_phase_metrics[i]);
 	}
-
-DONE:
-	http_server_finalize_task(task_data);
-	return 0;
 }
 
 // private
-void http_server_socket_accept(void *data, string *address, uint16_t port, int socket) {
-	http_server *server = data;
+void http_server_register_perf_counters() {
+	static char *labels[] = {"phase=\"parse\"", "phase=\"handler\"", "phase=\"serialize\""};
+	perf_counters_register_phases_cstr("http_request_phase", labels, 3, http_server_perf_phases);
+}
 
-	// grab a task off the pool
+// private
+http_server_task_data *http_server_take_task(http_server *server) {
 	if (pthread_mutex_lock(&server->task_pool_mutex)) {
 		log_error("error locking http server task pool\n");
-		close(socket);
-		return;
+		return NULL;
 	}
 	http_server_task_data *task_data;
 	if (server->task_pool) {
@@ -682,6 +1002,7 @@ void http_server_socket_accept(void *data, string *address, uint16_t port, int s
 		task_data = server->task_pool;
 		server->task_pool = server->task_pool->next;
 		server->task_pool_len--;
+		metrics_add(http_server_tasks_pooled_metric, -1);
 		log_trace("http server task pool had an available task, there are %zu tasks remaining in the pool\n", server->task_pool_len);
 	} else {
 		// allocate a new task
@@ -691,23 +1012,555 @@ void http_server_socket_accept(void *data, string *address, uint16_t port, int s
 		string_init(&task_data->scratch);
 		string_init(&task_data->request_address);
 		http_request_init(&task_data->request);
+		http_request_set_limits(&task_data->request, server->config.read_chunk_size, server->config.max_header_size,
+								server->config.max_body_size);
 		http_response_init(&task_data->response);
+		http_response_set_common_headers(&task_data->response, &server->common_headers);
+		buffer_init(&task_data->output);
 	}
+	task_data->connection = NULL;
+	task_data->aborted = 0;
+	task_data->canned_status_code = 0;
+	task_data->admitted = 0;
+	task_data->parsed = 0;
+	task_data->accept_ns = 0;
+	task_data->parse_ns = 0;
+	task_data->queue_ns = 0;
+	task_data->handler_ns = 0;
+	task_data->trace_id = 0;
+	task_data->response_bytes = 0;
 	if (pthread_mutex_unlock(&server->task_pool_mutex)) {
 		log_error("error unlock http server task pool\n");
 	}
+	metrics_add(http_server_tasks_in_use_metric, 1);
+	return task_data;
+}
 
-	// remember where this request came from
+// private
+void http_server_release_task(http_server_task_data *data) {
+	if (pthread_mutex_lock(&data->server->task_pool_mutex)) {
+		log_error("error locking http server task pool\n");
+		return;
+	}
+	data->next = data->server->task_pool;
+	data->server->task_pool = data;
+	data->server->task_pool_len++;
+	metrics_add(http_server_tasks_in_use_metric, -1);
+	metrics_add(http_server_tasks_pooled_metric, 1);
+	log_trace("put http server task data back on the pool, there are now %zu tasks in the pool\n", data->server->task_pool_len);
+	if (pthread_mutex_unlock(&data->server->task_pool_mutex)) {
+		log_error("error unlock http server task pool\n");
+	}
+}
+
+typedef struct {
+	int status_code;
+	const char *data;
+	size_t length;
+} http_server_canned_response;
+
+#define HTTP_SERVER_CANNED_TEXT(status_code, reason_phrase)                                                                                \
+	"HTTP/1.1 " #status_code " " reason_phrase "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define HTTP_SERVER_CANNED_RESPONSE(status_code, reason_phrase)                                                                            \
+	{ status_code, HTTP_SERVER_CANNED_TEXT(status_code, reason_phrase), sizeof(HTTP_SERVER_CANNED_TEXT(status_code, reason_phrase)) - 1 }
+
+/*
+The error responses the server makes itself, written out in full up front. They're what gets sent when the server is struggling, so they
+shouldn't cost more than a send. They all close the connection, as whatever else the client sent can't be trusted to line up with a
+request.
+*/
+static const http_server_canned_response http_server_canned_responses[] = {
+	HTTP_SERVER_CANNED_RESPONSE(400, "Bad Request"),
+	HTTP_SERVER_CANNED_RESPONSE(408, "Request Time-out"),
+	HTTP_SERVER_CANNED_RESPONSE(500, "Internal Server Error"),
+	HTTP_SERVER_CANNED_RESPONSE(503, "Service Unavailable"),
+};
+
+/*
+Returns the canned response for the status, a 500 for any status there isn't one for.
+*/
+// private
+const http_server_canned_response *http_server_get_canned_response(int status_code) {
+	size_t num_canned = sizeof(http_server_canned_responses) / sizeof(http_server_canned_responses[0]);
+	for (size_t i = 0; i < num_canned; i++) {
+		if (http_server_canned_responses[i].status_code == status_code) {
+			return &http_server_canned_responses[i];
+		}
+	}
+	return http_server_get_canned_response(500);
+}
+
+/*
+Writes a canned response to a blocking model socket with one non-blocking send, they're small enough to always fit in a new socket's send
+buffer.
+*/
+// private
+size_t http_server_send_canned_response(int socket, int status_code) {
+	const http_server_canned_response *canned = http_server_get_canned_response(status_code);
+	ssize_t sent = send(socket, canned->data, canned->length, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent < 0) {
+		log_trace("failed to send HTTP %i response, %s\n", status_code, strerror(errno));
+		return 0;
+	}
+	return sent;
+}
+
+/*
+Writes all of data to a blocking model socket, SO_SNDTIMEO bounds how long that can take. Returns how much was sent, less than length if
+sending failed.
+*/
+// private
+size_t http_server_send_all(int socket, uint8_t *data, size_t length) {
+	size_t sent = 0;
+	while (sent < length) {
+		ssize_t result = send(socket, data + sent, length - sent, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			log_trace("failed to send HTTP response, %s\n", strerror(errno));
+			break;
+		}
+		sent += result;
+	}
+	return sent;
+}
+
+// private
+void http_server_count_response(int status_code, uint64_t bytes) {
+	int status_class = status_code / 100;
+	if (status_class >= 1 && status_class <= 5) {
+		metrics_add(http_server_responses_metrics[status_class - 1], 1);
+	}
+	metrics_add(http_server_response_bytes_metric, bytes);
+}
+
+/*
+Counts, times and logs a request that got as far as having a task, once its response has been written or sent.
+*/
+// private
+void http_server_record_task(http_server_task_data *task_data, size_t slot) {
+	http_server *server = task_data->server;
+	int status_code =
+		task_data->canned_status_code ? task_data->canned_status_code : http_response_get_status_code(&task_data->response);
+	http_server_count_response(status_code, task_data->response_bytes);
+	uint64_t write_ns = io_loop_now_ns() - task_data->phase_ns;
+	metrics_record(http_server_phase_metrics[0], task_data->accept_ns);
+	metrics_record(http_server_phase_metrics[1], task_data->queue_ns);
+	metrics_record(http_server_phase_metrics[2], task_data->parse_ns);
+	// a request that couldn't be parsed never got to a handler
+	if (task_data->parsed) {
+		metrics_record(http_server_phase_metrics[3], task_data->handler_ns);
+		metrics_record(http_server_phase_metrics[4], write_ns);
+	}
+	if (!server->access_log_is_init) {
+		return;
+	}
+	access_log_entry entry;
+	entry.address = &task_data->request_address;
+	entry.port = task_data->request_port;
+	entry.method = task_data->parsed ? http_request_get_method(&task_data->request) : NULL;
+	entry.uri = task_data->parsed ? http_request_get_uri(&task_data->request) : NULL;
+	entry.status_code = status_code;
+	entry.bytes = task_data->response_bytes;
+	entry.parse_ns = task_data->parse_ns;
+	entry.queue_ns = task_data->queue_ns;
+	entry.handler_ns = task_data->handler_ns;
+	entry.write_ns = write_ns;
+	access_log_write(&server->access_log, slot, &entry);
+}
+
+/*
+Counts and logs a canned response sent by the loop or the accept thread in place of a handler's. There's no request to log, either it
+couldn't be read or a handler still has it.
+*/
+// private
+void http_server_record_canned(http_server *server, string *address, uint16_t port, int status_code) {
+	size_t length = http_server_get_canned_response(status_code)->length;
+	http_server_count_response(status_code, length);
+	if (!server->access_log_is_init) {
+		return;
+	}
+	access_log_entry entry = {0};
+	entry.address = address;
+	entry.port = port;
+	entry.status_code = status_code;
+	entry.bytes = length;
+	access_log_write(&server->access_log, 0, &entry);
+}
+
+// private
+void http_server_shed(int socket) {
+	http_server_send_canned_response(socket, 503);
+	// read whatever of the request has already arrived, closing with it unread would reset the connection before the client reads this
+	char discard[1024];
+	while (recv(socket, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+	}
+	close(socket);
+}
+
+// private
+void http_server_admit(http_server_task_data *task_data) {
+	task_data->admitted = 1;
+	task_data->admitted_ns = io_loop_now_ns();
+}
+
+/*
+Gives the task's slot in the concurrency limiter back, with how long it took from being admitted.
+*/
+// private
+void http_server_release_admission(http_server *server, http_server_task_data *task_data, int dropped) {
+	if (!task_data->admitted) {
+		return;
+	}
+	task_data->admitted = 0;
+	concurrency_limiter_release(&server->limiter, task_data->admitted_ns, io_loop_now_ns(), dropped);
+}
+
+// private
+void http_server_connection_woken(void *data);
+
+/*
+Hands part of a response to the loop to send. Once the last chunk is queued the connection belongs to the loop again and can't be touched.
+Chunks queued after the loop has given up on the response are dropped.
+
+Returns non-0 if the response can't be sent any more.
+*/
+// private
+int http_server_connection_queue_output(http_server_connection *connection, http_server_outbound_chunk *chunk, int is_last,
+										int must_close) {
+	http_server *server = connection->server;
+	pthread_mutex_lock(&connection->outbound_mutex);
+	int failed = connection->outbound_failed;
+	if (failed) {
+		if (chunk && chunk->allocated) {
+			free(chunk);
+		}
+	} else if (chunk) {
+		chunk->next = NULL;
+		if (connection->outbound_last) {
+			connection->outbound_last->next = chunk;
+		} else {
+			connection->outbound_first = chunk;
+		}
+		connection->outbound_last = chunk;
+		connection->outbound_size += chunk->length;
+		connection->outbound_started = 1;
+	}
+	if (is_last) {
+		connection->outbound_complete = 1;
+		connection->outbound_close = must_close;
+	}
+	// while the loop is sending it picks up whatever's queued behind once the send completes, so it only needs waking when idle
+	int should_post = !connection->wake_posted && !connection->outbound_sending;
+	if (should_post) {
+		connection->wake_posted = 1;
+	}
+	pthread_mutex_unlock(&connection->outbound_mutex);
+	if (should_post) {
+		io_loop_post(&server->loop, &connection->wake, http_server_connection_woken, connection);
+	}
+	if (is_last || failed) {
+		return failed;
+	}
+
+	// back-pressure, a handler producing faster than the client reads waits for the queue to drain
+	pthread_mutex_lock(&connection->outbound_mutex);
+	while (connection->outbound_size > server->config.max_outbound_size && !connection->outbound_failed) {
+		pthread_cond_wait(&connection->outbound_drained, &connection->outbound_mutex);
+	}
+	failed = connection->outbound_failed;
+	pthread_mutex_unlock(&connection->outbound_mutex);
+	return failed;
+}
+
+// private
+int http_server_task_flush_loop(void *data, http_response *response) {
+	http_server_task_data *task_data = data;
+	buffer_clear(&task_data->output);
+	stream output;
+	stream_init_buffer(&output, &task_data->output, 0);
+	if (http_response_write_partial(response, &output)) {
+		log_error("failed to write partial HTTP response to the output buffer\n");
+		return 1;
+	}
+	size_t length = buffer_get_length(&task_data->output);
+	// the output buffer is reused for the next flush, so the chunk gets its own copy
+	http_server_outbound_chunk *chunk = malloc(sizeof(http_server_outbound_chunk) + length);
+	chunk->data = (uint8_t *)(chunk + 1);
+	memcpy(chunk->data, task_data->output.data, length);
+	chunk->length = length;
+	chunk->allocated = 1;
+	task_data->response_bytes += length;
+	return http_server_connection_queue_output(task_data->connection, chunk, 0, 0);
+}
+
+/*
+Writes the response, or as much of it as the handler has flushed, to a blocking model socket. It's put together in the output buffer first
+so it goes out in one send rather than a write per line.
+*/
+// private
+int http_server_task_write_socket(http_server_task_data *task_data, int partial) {
+	buffer_clear(&task_data->output);
+	stream output;
+	stream_init_buffer(&output, &task_data->output, 0);
+	if (partial ? http_response_write_partial(&task_data->response, &output) : http_response_write(&task_data->response, &output)) {
+		return 1;
+	}
+	size_t length = buffer_get_length(&task_data->output);
+	size_t sent = http_server_send_all(task_data->socket, task_data->output.data, length);
+	task_data->response_bytes += sent;
+	return sent < length;
+}
+
+// private
+int http_server_task_flush_socket(void *data, http_response *response) {
+	http_server_task_data *task_data = data;
+	// the socket's send buffer and SO_SNDTIMEO are all the back-pressure the blocking model needs
+	if (http_server_task_write_socket(task_data, 1)) {
+		log_error("failed to write partial HTTP response to the socket\n");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+Sends the response, or hands it to the loop to send. log_slot is the calling thread's access log slot.
+*/
+// private
+void http_server_finalize_task(http_server_task_data *data, size_t log_slot) {
+	// the task is someone else's once it's handed back
+	uint64_t trace_id = data->trace_id;
+	uint64_t start_ns = trace_id ? io_loop_now_ns() : 0;
+	log_trace("responding to request %s:%i %s %s\n", string_get_cstr(&data->request_address), data->request_port,
+			  string_get_cstr(http_request_get_method(&data->request)), string_get_cstr(http_request_get_uri(&data->request)));
+	if (data->connection) {
+		// the loop thread sends it, and owns the task again from here
+		data->final_chunk.allocated = 0;
+		if (data->canned_status_code) {
+			const http_server_canned_response *canned = http_server_get_canned_response(data->canned_status_code);
+			data->final_chunk.data = (uint8_t *)canned->data;
+			data->final_chunk.length = canned->length;
+		} else {
+			buffer_clear(&data->output);
+			if (!data->aborted) {
+				perf_counters_sample counters_start, counters_end;
+				perf_counters_read(&counters_start);
+				stream output;
+				stream_init_buffer(&output, &data->output, 0);
+				if (http_response_write(&data->response, &output)) {
+					log_error("failed to write HTTP response to the output buffer\n");
+				}
+				perf_counters_read(&counters_end);
+				perf_counters_add(http_server_perf_phases[2], &counters_start, &counters_end);
+			}
+			data->final_chunk.data = data->output.data;
+			data->final_chunk.length = buffer_get_length(&data->output);
+		}
+		data->response_bytes += data->final_chunk.length;
+		http_server_connection_queue_output(data->connection, data->final_chunk.length ? &data->final_chunk : NULL, 1,
+											data->aborted || data->canned_status_code);
+		trace_record(trace_id, "finalize", start_ns, trace_id ? io_loop_now_ns() : 0);
+		return;
+	}
+	if (data->canned_status_code) {
+		data->response_bytes += http_server_send_canned_response(data->socket, data->canned_status_code);
+	} else if (!data->aborted) {
+		// the write system calls are in here too, but only user space is counted
+		perf_counters_sample counters_start, counters_end;
+		perf_counters_read(&counters_start);
+		if (http_server_task_write_socket(data, 0)) {
+			log_error("failed to write HTTP response to the socket\n");
+		}
+		perf_counters_read(&counters_end);
+		perf_counters_add(http_server_perf_phases[2], &counters_start, &counters_end);
+	}
+	http_server_record_task(data, log_slot);
+	// close out future reads and writes
+	// if we're writing a timeout response this will cause future writes to the socket to fail in the handler function ever finishes
+	shutdown(data->socket, SHUT_RDWR);
+	if (stream_dealloc(&data->socket_stream, &data->scratch)) {
+		log_error("failed to close HTTP request socket stream: %s\n", string_get_cstr(&data->scratch));
+	}
+	metrics_add(http_server_connections_metric, -1);
+
+	// put task back on pool
+	http_server_release_task(data);
+	trace_record(trace_id, "finalize", start_ns, trace_id ? io_loop_now_ns() : 0);
+}
+
+// private
+int http_server_is_request_for(http_server_task_data *task_data, string *path) {
+	if (string_get_length(path) == 0 ||
+		string_compare_cstr(http_request_get_method(&task_data->request), "GET", STRING_COMPARE_CASE_SENSITIVE)) {
+		return 0;
+	}
+	// a query string doesn't make it a different path
+	string *uri = http_request_get_uri(&task_data->request);
+	char *query = memchr(string_get_cstr(uri), '?', string_get_length(uri));
+	size_t length = query ? (size_t)(query - string_get_cstr(uri)) : string_get_length(uri);
+	return length == string_get_length(path) && !memcmp(string_get_cstr(uri), string_get_cstr(path), length);
+}
+
+// private
+void http_server_write_metrics(http_server_task_data *task_data) {
+	http_response *response = &task_data->response;
+	http_response_set_status_code(response, 200);
+	string_set_cstr(http_header_append_value(http_headers_get_cstr(http_response_get_headers(response), "Content-Type", 1)),
+					"text/plain; version=0.0.4");
+	string_clear(&task_data->scratch);
+	metrics_write_prometheus(&task_data->scratch);
+	stream_write_str(http_response_get_body(response), &task_data->scratch, NULL);
+}
+
+// private
+void http_server_write_trace(http_server_task_data *task_data) {
+	http_response *response = &task_data->response;
+	http_response_set_status_code(response, 200);
+	string_set_cstr(http_header_append_value(http_headers_get_cstr(http_response_get_headers(response), "Content-Type", 1)),
+					"application/json");
+	if (trace_write_chrome(http_response_get_body(response), &task_data->scratch)) {
+		log_error("failed to write the trace: %s\n", string_get_cstr(&task_data->scratch));
+	}
+}
+
+// private
+int http_server_task(int thread_id, void *data) {
+	http_server_task_data *task_data = data;
+	uint64_t now_ns = io_loop_now_ns();
+	uint64_t task_start_ns = now_ns;
+	task_data->queue_ns = now_ns - task_data->phase_ns;
+	trace_record_wait(task_data->trace_id, "queue", task_data->phase_ns, now_ns);
+	task_data->phase_ns = now_ns;
+	perf_counters_sample counters_start, counters_end;
+	perf_counters_read(&counters_start);
+
+	// parse the input, requests that came in on the loop were parsed there before they were queued
+	if (!task_data->connection) {
+		log_trace("parsing incoming HTTP request from %s:%i\n", string_get_cstr(&task_data->request_address), task_data->request_port);
+		int parse_error = http_request_parse(&task_data->request, &task_data->socket_stream);
+		perf_counters_read(&counters_end);
+		perf_counters_add(http_server_perf_phases[0], &counters_start, &counters_end);
+		counters_start = counters_end;
+		now_ns = io_loop_now_ns();
+		task_data->parse_ns = now_ns - task_data->phase_ns;
+		task_data->phase_ns = now_ns;
+		if (parse_error) {
+			// failed to even read the input document, just return an error telling the client they did this wrong
+			log_error("error parsing HTTP data\n");
+			task_data->canned_status_code = 400;
+			goto DONE;
+		}
+		task_data->parsed = 1;
+	}
+
+	// try to handle this with the user-provided callback
+	http_response_clear(&task_data->response);
+	// only HTTP/1.1 clients have to understand chunks
+	task_data->response.close_delimited = task_data->parsed && string_compare_cstr(http_request_get_protocol_version(&task_data->request),
+																				   "HTTP/1.1", STRING_COMPARE_CASE_SENSITIVE);
+	http_response_set_flush(&task_data->response, task_data->connection ? http_server_task_flush_loop : http_server_task_flush_socket,
+							task_data);
+	log_trace("handling HTTP request from %s:%i %s %s\n", string_get_cstr(&task_data->request_address), task_data->request_port,
+			  string_get_cstr(http_request_get_method(&task_data->request)), string_get_cstr(http_request_get_uri(&task_data->request)));
+	if (http_server_is_request_for(task_data, &task_data->server->config.metrics_path)) {
+		http_server_write_metrics(task_data);
+	} else if (http_server_is_request_for(task_data, &task_data->server->config.trace_path)) {
+		http_server_write_trace(task_data);
+	} else if (task_data->server->callback(task_data->server->callback_data, &task_data->request, &task_data->response)) {
+		log_debug("HTTP handler failed\n");
+		metrics_add(http_server_handler_errors_metric, 1);
+		if (task_data->response.streaming) {
+			// the status has already gone out, all that can be done is cutting the body off
+			task_data->aborted = 1;
+			goto DONE;
+		}
+		// something bad happened in the handler, just return a generic error
+		task_data->canned_status_code = 500;
+		goto DONE;
+	}
+
+DONE:
+	now_ns = io_loop_now_ns();
+	task_data->handler_ns = now_ns - task_data->phase_ns;
+	task_data->phase_ns = now_ns;
+	// a request that couldn't be parsed never got to a handler
+	if (task_data->parsed) {
+		perf_counters_read(&counters_end);
+		perf_counters_add(http_server_perf_phases[1], &counters_start, &counters_end);
+	}
+	trace_record(task_data->trace_id, "task", task_start_ns, now_ns);
+	// the response still has to be written, but the worker's done with it
+	http_server_release_admission(task_data->server, task_data, 0);
+	// slot 0 is the accept thread's
+	http_server_finalize_task(task_data, thread_id + 1);
+	return 0;
+}
+
+// private
+void http_server_set_socket_timeout(int socket, int option, uint64_t timeout_ms) {
+	if (timeout_ms == 0) {
+		return;
+	}
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	if (setsockopt(socket, SOL_SOCKET, option, &tv, sizeof(tv))) {
+		log_error("failed to set timeout on accepted socket, %s\n", strerror(errno));
+	}
+}
+
+// private
+void http_server_socket_accept(void *data, string *address, uint16_t port, int socket) {
+	http_server *server = data;
+	uint64_t accept_ns = io_loop_now_ns();
+
+	// turned away before anything is allocated for it
+	if (server->limiter_is_init && concurrency_limiter_try_acquire(&server->limiter)) {
+		log_trace("shedding HTTP request from %s:%i, %zu requests in flight\n", string_get_cstr(address), port,
+				  concurrency_limiter_get_in_flight(&server->limiter));
+		http_server_shed(socket);
+		metrics_add(http_server_shed_metric, 1);
+		http_server_record_canned(server, address, port, 503);
+		return;
+	}
+
+	// grab a task off the pool
+	http_server_task_data *task_data = http_server_take_task(server);
+	if (!task_data) {
+		if (server->limiter_is_init) {
+			concurrency_limiter_release(&server->limiter, 0, 0, 1);
+		}
+		close(socket);
+		return;
+	}
+	if (server->limiter_is_init) {
+		http_server_admit(task_data);
+	}
+	metrics_add(http_server_connections_metric, 1);
+
+	// remember where this request came from
 	string_set_str(&task_data->request_address, address);
 	task_data->request_port = port;
+	task_data->trace_id = trace_sample();
 	log_trace("queuing incoming HTTP request from %s:%i\n", string_get_cstr(&task_data->request_address), task_data->request_port);
 
 	// fill in the socket on the task
 	task_data->socket = socket;
 	stream_init_file_descriptor(&task_data->socket_stream, socket, 1);
-
-	// try to handle this on the thread pool
-	int enqueue_error = worker_thread_pool_enqueue(&server->thread_pool, http_server_task, task_data, NULL, server->timeout);
+	http_server_set_socket_timeout(socket, SO_RCVTIMEO, server->config.read_timeout_ms);
+	http_server_set_socket_timeout(socket, SO_SNDTIMEO, server->config.write_timeout_ms);
+	// waiting for a worker from here
+	task_data->phase_ns = io_loop_now_ns();
+	task_data->accept_ns = task_data->phase_ns - accept_ns;
+	uint64_t trace_id = task_data->trace_id;
+	trace_record(trace_id, "socket_accept", accept_ns, task_data->phase_ns);
+
+	// try to handle this on the thread pool, this waits for the handler, so the task may be back on the pool by the time it returns
+	uint64_t enqueue_ns = task_data->phase_ns;
+	int enqueue_error = worker_thread_pool_enqueue(&server->thread_pool, http_server_task, task_data, NULL,
+												   server->config.handler_timeout_ms * 1000000ull);
+	trace_record(trace_id, "enqueue", enqueue_ns, trace_id ? io_loop_now_ns() : 0);
 	int should_finalize_task = 0;
 	switch (enqueue_error) {
 	case 0:
@@ -717,56 +1570,621 @@ void http_server_socket_accept(void *data, string *address, uint16_t port, int s
 	case WORKER_THREAD_POOL_ERROR_QUEUE_FULL:
 		// we didn't enqueue, so we can't rely on them to free memory
 		log_error("failed to execute incoming HTTP request, queue is full\n");
-		http_response_clear(&task_data->response);
-		http_response_set_status_code(&task_data->response, 503);
+		http_server_release_admission(server, task_data, 1);
+		task_data->canned_status_code = 503;
 		should_finalize_task = 1;
 		break;
 	case WORKER_THREAD_POOL_ERROR_TIMEOUT:
 		// we did enqueue, it's just taking a long time
 		log_error("timed out waiting on HTTP response handler for request\n");
-		http_response_clear(&task_data->response);
-		http_response_set_status_code(&task_data->response, 503);
+		metrics_add(http_server_handler_timeouts_metric, 1);
+		task_data->canned_status_code = 503;
 		should_finalize_task = 1;
 		break;
 	default:
 		// any other error we assume we didn't end up in the queue so clean up
 		log_error("failed to execute incoming request, %i\n", enqueue_error);
-		http_response_clear(&task_data->response);
-		http_response_set_status_code(&task_data->response, 500);
+		http_server_release_admission(server, task_data, 1);
+		task_data->canned_status_code = 500;
 		should_finalize_task = 1;
 		break;
 	}
 	// if we had some kind of error that means we're going to need to respond ourselves, instead of letter the user callback handle it, we
 	// can do so here
 	if (should_finalize_task) {
-		http_server_finalize_task(task_data);
+		http_server_finalize_task(task_data, 0);
 	}
 }
 
-int http_server_init(http_server *server, http_server_func callback, void *callback_data, char *address, uint16_t port, int num_threads,
-					 int queue_size, uint64_t timeout) {
+// private
+void http_server_connection_timed_out(void *data);
+
+// private
+void http_server_connection_set_state(http_server_connection *connection, http_server_connection_state state) {
+	http_server *server = connection->server;
+	uint64_t timeout_ms = 0;
+	switch (state) {
+	case HTTP_SERVER_CONNECTION_IDLE:
+		timeout_ms = server->config.keep_alive_timeout_ms;
+		break;
+	case HTTP_SERVER_CONNECTION_READING_HEADERS:
+		timeout_ms = server->config.header_timeout_ms;
+		break;
+	case HTTP_SERVER_CONNECTION_READING_BODY:
+		timeout_ms = server->config.read_timeout_ms;
+		break;
+	case HTTP_SERVER_CONNECTION_HANDLING:
+		timeout_ms = server->config.handler_timeout_ms;
+		break;
+	case HTTP_SERVER_CONNECTION_WRITING:
+		timeout_ms = server->config.write_timeout_ms;
+		break;
+	default:
+		break;
+	}
+	connection->state = state;
+	if (timeout_ms) {
+		timer_wheel_schedule(&server->timers, &connection->timer, io_loop_now_ns() + timeout_ms * 1000000);
+	} else {
+		timer_wheel_cancel(&server->timers, &connection->timer);
+	}
+}
+
+// private
+void http_server_connection_free_outbound(http_server_connection *connection) {
+	while (connection->outbound_first) {
+		http_server_outbound_chunk *chunk = connection->outbound_first;
+		connection->outbound_first = chunk->next;
+		if (chunk->allocated) {
+			free(chunk);
+		}
+	}
+	connection->outbound_last = NULL;
+	connection->outbound_size = 0;
+}
+
+/*
+Stops the handler's response from being sent, anything it queues from here on is dropped and a handler waiting on the queue to drain gives
+up.
+*/
+// private
+void http_server_connection_fail_outbound(http_server_connection *connection) {
+	pthread_mutex_lock(&connection->outbound_mutex);
+	connection->outbound_failed = 1;
+	pthread_cond_broadcast(&connection->outbound_drained);
+	pthread_mutex_unlock(&connection->outbound_mutex);
+}
+
+// private
+void http_server_connection_reset_outbound(http_server_connection *connection) {
+	// a wake can still be posted from the previous handler, so that's left alone
+	connection->outbound_first = NULL;
+	connection->outbound_last = NULL;
+	connection->outbound_size = 0;
+	connection->outbound_sending = 0;
+	connection->outbound_started = 0;
+	connection->outbound_complete = 0;
+	connection->outbound_close = 0;
+	connection->outbound_failed = 0;
+}
+
+// private
+void http_server_connection_close(http_server_connection *connection) {
+	if (connection->state == HTTP_SERVER_CONNECTION_CLOSING) {
+		return;
+	}
+	http_server_connection_fail_outbound(connection);
+	http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_CLOSING);
+	io_loop_close(&connection->server->loop, &connection->socket);
+}
+
+// private
+void http_server_connection_respond(http_server_connection *connection, int status_code) {
+	http_server *server = connection->server;
+	// nothing from the handler has been sent, this goes out in its place
+	http_server_connection_fail_outbound(connection);
+	const http_server_canned_response *canned = http_server_get_canned_response(status_code);
+	connection->keep_alive = 0;
+	http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_WRITING);
+	io_loop_send(&server->loop, &connection->socket, (uint8_t *)canned->data, canned->length);
+	http_server_record_canned(server, &connection->address, connection->port, status_code);
+}
+
+// private
+void http_server_connection_free(http_server_connection *connection) {
+	http_server *server = connection->server;
+	timer_wheel_cancel(&server->timers, &connection->timer);
+	if (connection->prev) {
+		connection->prev->next = connection->next;
+	} else {
+		server->connections = connection->next;
+	}
+	if (connection->next) {
+		connection->next->prev = connection->prev;
+	}
+	metrics_add(http_server_connections_metric, -1);
+	// the buffers stay allocated for the next connection
+	connection->next = server->connection_pool;
+	server->connection_pool = connection;
+}
+
+// private
+int http_server_header_has_value_cstr(http_header *header, char *value) {
+	if (!header) {
+		return 0;
+	}
+	for (size_t i = 0; i < http_header_get_num_values(header); i++) {
+		if (!string_compare_cstr(http_header_get_value(header, i), value, STRING_COMPARE_CASE_INSENSITIVE)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// private
+void http_server_connection_dispatch(http_server_connection *connection, size_t request_length) {
+	http_server *server = connection->server;
+
+	// anything after the request is the start of the next one, the worker only gets to see this one
+	buffer_clear(&connection->pipelined);
+	if (buffer_get_length(&connection->received) > request_length) {
+		buffer_append_bytes(&connection->pipelined, connection->received.data + request_length,
+							buffer_get_length(&connection->received) - request_length);
+		buffer_set_length(&connection->received, request_length);
+	}
+	// only HTTP/1.1 is persistent without being asked, the request line has already been found so this can't run off the end
+	uint8_t *end_of_request_line = memmem(connection->received.data, request_length, "\r\n", 2);
+	connection->keep_alive = server->config.keep_alive_timeout_ms > 0 && end_of_request_line - connection->received.data >= 8 &&
+							 !memcmp(end_of_request_line - 8, "HTTP/1.1", 8);
+
+	if (server->limiter_is_init && concurrency_limiter_try_acquire(&server->limiter)) {
+		log_trace("shedding HTTP request from %s:%i, %zu requests in flight\n", string_get_cstr(&connection->address), connection->port,
+				  concurrency_limiter_get_in_flight(&server->limiter));
+		metrics_add(http_server_shed_metric, 1);
+		http_server_connection_respond(connection, 503);
+		return;
+	}
+	http_server_task_data *task_data = http_server_take_task(server);
+	if (!task_data) {
+		if (server->limiter_is_init) {
+			concurrency_limiter_release(&server->limiter, 0, 0, 1);
+		}
+		http_server_connection_respond(connection, 500);
+		return;
+	}
+	if (server->limiter_is_init) {
+		http_server_admit(task_data);
+	}
+	string_set_str(&task_data->request_address, &connection->address);
+	task_data->request_port = connection->port;
+	task_data->socket = connection->socket.socket;
+	task_data->trace_id = trace_sample();
+	// the whole request is in memory, parsing it here means a worker only ever runs the handler, and bad requests never get to one
+	stream_init_buffer(&task_data->socket_stream, &connection->received, 0);
+	uint64_t parse_start_ns = io_loop_now_ns();
+	task_data->accept_ns = parse_start_ns - connection->request_start_ns;
+	perf_counters_sample counters_start, counters_end;
+	perf_counters_read(&counters_start);
+	int parse_error = http_request_parse(&task_data->request, &task_data->socket_stream);
+	perf_counters_read(&counters_end);
+	perf_counters_add(http_server_perf_phases[0], &counters_start, &counters_end);
+	// waiting for a worker from here
+	task_data->phase_ns = io_loop_now_ns();
+	task_data->parse_ns = task_data->phase_ns - parse_start_ns;
+	if (parse_error) {
+		log_error("error parsing HTTP data\n");
+		http_server_release_admission(server, task_data, 0);
+		http_server_release_task(task_data);
+		http_server_connection_respond(connection, 400);
+		return;
+	}
+	task_data->parsed = 1;
+	task_data->connection = connection;
+	connection->task = task_data;
+	connection->handler_running = 1;
+	http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_HANDLING);
+	// from the first bytes of the request to having all of it is waiting on the client, not time on the loop
+	uint64_t trace_id = task_data->trace_id;
+	trace_record_wait(trace_id, "receive", connection->request_start_ns, parse_start_ns);
+	trace_record(trace_id, "dispatch", parse_start_ns, task_data->phase_ns);
+
+	// the loop never waits on a handler, finalize posts the response back to it, so the task may have moved on by the time this returns
+	uint64_t enqueue_ns = task_data->phase_ns;
+	int enqueue_error = worker_thread_pool_enqueue(&server->thread_pool, http_server_task, task_data, NULL, 0);
+	trace_record(trace_id, "enqueue", enqueue_ns, trace_id ? io_loop_now_ns() : 0);
+	if (enqueue_error) {
+		log_error("failed to execute incoming HTTP request, %i\n", enqueue_error);
+		connection->task = NULL;
+		connection->handler_running = 0;
+		http_server_release_admission(server, task_data, 1);
+		http_server_release_task(task_data);
+		http_server_connection_respond(connection, enqueue_error == WORKER_THREAD_POOL_ERROR_QUEUE_FULL ? 503 : 500);
+	}
+}
+
+/*
+Works out what to do with what's been received so far, either dispatching a whole request or waiting on more of it.
+*/
+// private
+void http_server_connection_process(http_server_connection *connection) {
+	http_server *server = connection->server;
+	size_t request_length;
+	int end = http_request_find_end(connection->received.data, buffer_get_length(&connection->received), server->config.max_header_size,
+									server->config.max_body_size, &request_length);
+	if (end < 0) {
+		log_error("error reading HTTP request, malformed or over the size limits\n");
+		http_server_connection_respond(connection, 400);
+	} else if (end == 0) {
+		http_server_connection_dispatch(connection, request_length);
+	} else {
+		if (end == HTTP_REQUEST_FIND_END_NEED_BODY) {
+			// the body timeout restarts with every read, the same as SO_RCVTIMEO does for the blocking model
+			http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_READING_BODY);
+		} else if (connection->state == HTTP_SERVER_CONNECTION_IDLE) {
+			// the header timeout covers all of the headers, so a client trickling them in can't hold on forever
+			http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_READING_HEADERS);
+		}
+		io_loop_recv(&server->loop, &connection->socket);
+	}
+}
+
+/*
+Called once the handler is done and everything it queued is sent. Either waits for the next request on the connection or closes it.
+*/
+// private
+void http_server_connection_finish_response(http_server_connection *connection) {
+	http_server_task_data *task_data = connection->task;
+	// the loop sends the response between other connections' work, so the time it took isn't on any one thread
+	trace_record_wait(task_data->trace_id, "write", task_data->phase_ns, task_data->trace_id ? io_loop_now_ns() : 0);
+	http_server_record_task(task_data, 0);
+	if (http_server_header_has_value_cstr(http_headers_get_cstr(&task_data->request.headers, "Connection", 0), "close") ||
+		http_server_header_has_value_cstr(http_headers_get_cstr(&task_data->response.headers, "Connection", 0), "close")) {
+		connection->keep_alive = 0;
+	}
+	if (!connection->keep_alive) {
+		// the task is released once the socket is closed
+		http_server_connection_close(connection);
+		return;
+	}
+
+	// ready for the next request on the same connection
+	connection->task = NULL;
+	http_server_release_task(task_data);
+	http_server_connection_reset_outbound(connection);
+	buffer swap = connection->received;
+	connection->received = connection->pipelined;
+	connection->pipelined = swap;
+	buffer_clear(&connection->pipelined);
+	http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_IDLE);
+	// a pipelined request starts now, it's been waiting on the one before it rather than on the client, otherwise this is reset when the
+	// next request's first bytes come in
+	connection->request_start_ns = io_loop_now_ns();
+	if (buffer_get_length(&connection->received) > 0) {
+		http_server_connection_process(connection);
+	} else {
+		io_loop_recv(&connection->server->loop, &connection->socket);
+	}
+}
+
+/*
+Sends the next chunk the handler has queued, if one isn't already being sent, and finishes the response once the handler is done and the
+queue is empty.
+*/
+// private
+void http_server_connection_pump(http_server_connection *connection) {
+	pthread_mutex_lock(&connection->outbound_mutex);
+	if (connection->outbound_sending) {
+		pthread_mutex_unlock(&connection->outbound_mutex);
+		return;
+	}
+	http_server_outbound_chunk *chunk = connection->outbound_failed ? NULL : connection->outbound_first;
+	connection->outbound_sending = chunk != NULL;
+	int complete = connection->outbound_complete;
+	int must_close = connection->outbound_close;
+	int failed = connection->outbound_failed;
+	pthread_mutex_unlock(&connection->outbound_mutex);
+
+	if (chunk) {
+		// the chunk stays queued, and counted against the limit, until it's sent
+		http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_WRITING);
+		io_loop_send(&connection->server->loop, &connection->socket, chunk->data, chunk->length);
+		return;
+	}
+	if (!complete) {
+		// a streaming handler is working on the next chunk
+		if (!failed) {
+			http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_HANDLING);
+		}
+		return;
+	}
+	connection->handler_running = 0;
+	if (failed) {
+		// the loop already gave up on this response
+		http_server_release_task(connection->task);
+		connection->task = NULL;
+		if (connection->closed) {
+			http_server_connection_free(connection);
+		}
+		return;
+	}
+	if (must_close) {
+		connection->keep_alive = 0;
+	}
+	http_server_connection_finish_response(connection);
+}
+
+// private
+void http_server_connection_woken(void *data) {
+	http_server_connection *connection = data;
+	pthread_mutex_lock(&connection->outbound_mutex);
+	connection->wake_posted = 0;
+	pthread_mutex_unlock(&connection->outbound_mutex);
+	// a wake can be left over from a handler whose response has already been finished off by a send completing
+	if (connection->handler_running) {
+		http_server_connection_pump(connection);
+	}
+}
+
+// private
+void http_server_connection_received(void *data, uint8_t *bytes, int result) {
+	http_server_connection *connection = data;
+	if (connection->state != HTTP_SERVER_CONNECTION_IDLE && connection->state != HTTP_SERVER_CONNECTION_READING_HEADERS &&
+		connection->state != HTTP_SERVER_CONNECTION_READING_BODY) {
+		// a response is already on its way
+		return;
+	}
+	if (result <= 0) {
+		if (result < 0) {
+			log_error("error receiving HTTP request, %s\n", strerror(-result));
+		}
+		http_server_connection_close(connection);
+		return;
+	}
+	if (connection->state == HTTP_SERVER_CONNECTION_IDLE && buffer_get_length(&connection->received) == 0) {
+		// the next request on a kept alive connection, the time it sat idle before this doesn't count
+		connection->request_start_ns = io_loop_now_ns();
+	}
+	buffer_append_bytes(&connection->received, bytes, result);
+	http_server_connection_process(connection);
+}
+
+// private
+void http_server_connection_sent(void *data, int result) {
+	http_server_connection *connection = data;
+	if (result) {
+		log_error("error sending HTTP response, %s\n", strerror(-result));
+		connection->keep_alive = 0;
+	}
+	pthread_mutex_lock(&connection->outbound_mutex);
+	// once failed, what was sent was the loop's own response, or the handler's was cut off
+	int failed = connection->outbound_failed;
+	http_server_outbound_chunk *chunk = NULL;
+	if (!failed) {
+		chunk = connection->outbound_first;
+		connection->outbound_first = chunk->next;
+		if (!connection->outbound_first) {
+			connection->outbound_last = NULL;
+		}
+		connection->outbound_size -= chunk->length;
+		connection->outbound_sending = 0;
+		pthread_cond_broadcast(&connection->outbound_drained);
+	}
+	pthread_mutex_unlock(&connection->outbound_mutex);
+	if (chunk && chunk->allocated) {
+		free(chunk);
+	}
+	if (failed || result) {
+		http_server_connection_close(connection);
+		return;
+	}
+	http_server_connection_pump(connection);
+}
+
+// private
+void http_server_connection_closed(void *data) {
+	http_server_connection *connection = data;
+	connection->closed = 1;
+	pthread_mutex_lock(&connection->outbound_mutex);
+	connection->outbound_failed = 1;
+	connection->outbound_sending = 0;
+	http_server_connection_free_outbound(connection);
+	pthread_cond_broadcast(&connection->outbound_drained);
+	pthread_mutex_unlock(&connection->outbound_mutex);
+	if (connection->handler_running) {
+		// freed once the handler's finished
+		return;
+	}
+	if (connection->task) {
+		http_server_release_task(connection->task);
+		connection->task = NULL;
+	}
+	http_server_connection_free(connection);
+}
+
+// private
+void http_server_connection_timed_out(void *data) {
+	http_server_connection *connection = data;
+	switch (connection->state) {
+	case HTTP_SERVER_CONNECTION_IDLE:
+		log_trace("closing idle HTTP connection\n");
+		http_server_connection_close(connection);
+		break;
+	case HTTP_SERVER_CONNECTION_READING_HEADERS:
+	case HTTP_SERVER_CONNECTION_READING_BODY:
+		log_error("timed out reading HTTP request\n");
+		metrics_add(http_server_read_timeouts_metric, 1);
+		http_server_connection_respond(connection, 408);
+		break;
+	case HTTP_SERVER_CONNECTION_HANDLING: {
+		metrics_add(http_server_handler_timeouts_metric, 1);
+		pthread_mutex_lock(&connection->outbound_mutex);
+		int started = connection->outbound_started;
+		pthread_mutex_unlock(&connection->outbound_mutex);
+		if (started) {
+			// part of the response is already out, so the client can only tell from it being cut off
+			log_error("timed out waiting on streaming HTTP response handler for request\n");
+			http_server_connection_close(connection);
+		} else {
+			log_error("timed out waiting on HTTP response handler for request\n");
+			http_server_connection_respond(connection, 503);
+		}
+		break;
+	}
+	case HTTP_SERVER_CONNECTION_WRITING:
+		log_error("timed out writing HTTP response\n");
+		connection->keep_alive = 0;
+		http_server_connection_close(connection);
+		break;
+	default:
+		break;
+	}
+}
+
+// private
+void http_server_loop_accept(void *data, int socket, struct sockaddr *address) {
+	http_server *server = data;
+	// a new connection will only add to the requests in flight, so while at the limit it's turned away before anything is allocated
+	if (server->limiter_is_init && concurrency_limiter_is_full(&server->limiter)) {
+		log_trace("shedding HTTP connection, %zu requests in flight\n", concurrency_limiter_get_in_flight(&server->limiter));
+		http_server_shed(socket);
+		metrics_add(http_server_shed_metric, 1);
+		// the address isn't worth working out just for this
+		http_server_record_canned(server, NULL, 0, 503);
+		return;
+	}
+	tcp_socket_wrapper_configure_accepted(&server->socket, socket);
+
+	http_server_connection *connection = server->connection_pool;
+	if (connection) {
+		server->connection_pool = connection->next;
+	} else {
+		connection = malloc(sizeof(http_server_connection));
+		connection->server = server;
+		buffer_init(&connection->received);
+		buffer_init(&connection->pipelined);
+		string_init(&connection->address);
+		timer_wheel_timer_init(&connection->timer, http_server_connection_timed_out, connection);
+		pthread_mutex_init(&connection->outbound_mutex, NULL);
+		pthread_cond_init(&connection->outbound_drained, NULL);
+		connection->wake_posted = 0;
+	}
+	connection->prev = NULL;
+	connection->next = server->connections;
+	if (connection->next) {
+		connection->next->prev = connection;
+	}
+	server->connections = connection;
+	metrics_add(http_server_connections_metric, 1);
+	connection->closed = 0;
+	connection->keep_alive = 0;
+	connection->task = NULL;
+	connection->handler_running = 0;
+	connection->request_start_ns = io_loop_now_ns();
+	http_server_connection_reset_outbound(connection);
+	buffer_clear(&connection->received);
+	// io_uring accepts without the address, it's only worth the extra call when it's going to be logged
+	struct sockaddr_storage peer;
+	socklen_t peer_len = sizeof(peer);
+	if (!address && server->access_log_is_init && !getpeername(socket, (struct sockaddr *)&peer, &peer_len)) {
+		address = (struct sockaddr *)&peer;
+	}
+	if (!address || get_sockaddr_info_str(address, &connection->address, &connection->port)) {
+		string_clear(&connection->address);
+		connection->port = 0;
+	}
+	log_trace("accepted HTTP connection from %s:%i\n", string_get_cstr(&connection->address), connection->port);
+
+	io_loop_socket_init(&connection->socket, socket, http_server_connection_received, http_server_connection_sent,
+						http_server_connection_closed, connection);
+	// the header timeout starts at accept, a client that connects and sends nothing gets the same time as one that's slow to send
+	http_server_connection_set_state(connection, HTTP_SERVER_CONNECTION_READING_HEADERS);
+	io_loop_recv(&server->loop, &connection->socket);
+}
+
+// private
+void http_server_date_timer_fired(void *data) {
+	http_server *server = data;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	http_date_refresh(now.tv_sec);
+	// as close after the next second starts as the wheel's resolution allows
+	timer_wheel_schedule(&server->timers, &server->date_timer, io_loop_now_ns() + 1000000000 - now.tv_nsec);
+}
+
+// private
+uint64_t http_server_loop_timer(void *data, uint64_t now_ns) {
+	http_server *server = data;
+	timer_wheel_advance(&server->timers, now_ns);
+	return timer_wheel_get_next_deadline_ns(&server->timers);
+}
+
+int http_server_init(http_server *server, http_server_func callback, void *callback_data, http_server_config *config) {
 	server->callback = callback;
-	server->timeout = timeout;
+	server->callback_data = callback_data;
+	http_server_config_init(&server->config);
+	if (config) {
+		http_server_config_copy(&server->config, config);
+	}
+	config = &server->config;
+	pthread_once(&http_server_metrics_once, http_server_register_metrics);
+	if (config->trace_sample) {
+		trace_set_sample(config->trace_sample);
+	}
+	if (config->perf_counters) {
+		if (perf_counters_enable()) {
+			// only instrumentation, so the server runs without it
+			log_error("hardware performance counters aren't available, requests won't be counted\n");
+		} else {
+			pthread_once(&http_server_perf_counters_once, http_server_register_perf_counters);
+		}
+	}
 
 	int result = 0;
 	int socket_init = 0;
 	int thread_pool_init = 0;
 	int mutex_init = 0;
+	int common_headers_init = 0;
+	server->loop_is_init = 0;
+	server->limiter_is_init = 0;
+	server->access_log_is_init = 0;
+	string error;
+	string_init(&error);
+
+	int cpus[CPU_SETSIZE];
+	size_t num_cpus;
+	if (http_server_config_get_cpu_affinity(config, cpus, CPU_SETSIZE, &num_cpus)) {
+		log_error("failed to parse the http server cpu affinity: %s\n", string_get_cstr(&config->cpu_affinity));
+		result = 1;
+		goto DONE;
+	}
 
-	if (tcp_socket_wrapper_init(&server->socket, address, port, http_server_socket_accept, server)) {
-		log_error("failed to open the http server socket\n");
+	int use_loop;
+	io_loop_backend backend;
+	if (http_server_config_get_io_backend(config, &use_loop, &backend)) {
+		log_error("unknown http server io backend: %s\n", string_get_cstr(&config->io_backend));
 		result = 1;
 		goto DONE;
 	}
-	socket_init = 1;
 
-	if (worker_thread_pool_init(&server->thread_pool, num_threads, queue_size)) {
-		log_error("failed to initialize the http server thread pool\n");
+	if (http_common_headers_init(&server->common_headers, config->date_header, string_get_cstr(&config->common_headers))) {
+		log_error("http server common headers aren't all \"Name: value\" lines: %s\n", string_get_cstr(&config->common_headers));
 		result = 1;
 		goto DONE;
 	}
-	thread_pool_init = 1;
+	common_headers_init = 1;
+
+	if (string_get_length(&config->access_log) > 0) {
+		// a slot for the loop or accept thread, and one for each worker
+		if (access_log_init(&server->access_log, string_get_cstr(&config->access_log), config->num_threads + 1, config->access_log_sample,
+							&error)) {
+			log_error("failed to start the http server access log: %s\n", string_get_cstr(&error));
+			result = 1;
+			goto DONE;
+		}
+		server->access_log_is_init = 1;
+	}
 
+	// the task pool has to be ready before the first connection is accepted
 	if (pthread_mutex_init(&server->task_pool_mutex, NULL)) {
 		log_error("failed to allocate mutex for task pool\n");
 		result = 1;
@@ -776,10 +2194,76 @@ int http_server_init(http_server *server, http_server_func callback, void *callb
 	server->task_pool_len = 0;
 	server->task_pool = NULL;
 
+	if (config->max_concurrency > 0) {
+		int min_concurrency = config->min_concurrency > 0 ? config->min_concurrency : config->num_threads;
+		if (min_concurrency > config->max_concurrency) {
+			min_concurrency = config->max_concurrency;
+		}
+		// start at what the worker pool can hold anyway, so nothing's shed that wouldn't have been before anything's measured
+		size_t initial_concurrency = (size_t)config->num_threads + config->queue_size;
+		if (concurrency_limiter_init(&server->limiter, min_concurrency, initial_concurrency, config->max_concurrency)) {
+			log_error("failed to initialize the http server concurrency limiter\n");
+			result = 1;
+			goto DONE;
+		}
+		server->limiter_is_init = 1;
+	}
+
+	char *address = string_get_length(&config->address) > 0 ? string_get_cstr(&config->address) : NULL;
+	// with a loop there's no accept thread, the loop accepts on the socket itself
+	if (tcp_socket_wrapper_init(&server->socket, address, config->port, &config->socket_options,
+								use_loop ? NULL : http_server_socket_accept, server)) {
+		log_error("failed to open the http server socket\n");
+		result = 1;
+		goto DONE;
+	}
+	socket_init = 1;
+
+	if (worker_thread_pool_init(&server->thread_pool, config->num_threads, config->queue_size)) {
+		log_error("failed to initialize the http server thread pool\n");
+		result = 1;
+		goto DONE;
+	}
+	thread_pool_init = 1;
+
+	if (num_cpus > 0 && worker_thread_pool_set_cpu_affinity(&server->thread_pool, cpus, num_cpus)) {
+		log_error("failed to set the http server cpu affinity\n");
+		result = 1;
+		goto DONE;
+	}
+
+	if (use_loop) {
+		if (io_loop_init(&server->loop, backend, config->read_chunk_size, config->receive_buffers)) {
+			log_error("failed to initialize the http server %s io loop\n", io_loop_backend_get_name(backend));
+			result = 1;
+			goto DONE;
+		}
+		server->loop_is_init = 1;
+		timer_wheel_init(&server->timers, HTTP_SERVER_TIMER_RESOLUTION_NS, io_loop_now_ns());
+		server->connections = NULL;
+		server->connection_pool = NULL;
+		timer_wheel_timer_init(&server->date_timer, http_server_date_timer_fired, server);
+		if (server->common_headers.date) {
+			http_server_date_timer_fired(server);
+		}
+		io_loop_set_timer_callback(&server->loop, http_server_loop_timer, server);
+		if (io_loop_accept(&server->loop, &server->listener, tcp_socket_wrapper_get_socket(&server->socket), http_server_loop_accept,
+						   server) ||
+			io_loop_start(&server->loop)) {
+			log_error("failed to start the http server io loop\n");
+			result = 1;
+			goto DONE;
+		}
+		log_debug("http server using the %s io loop\n", io_loop_backend_get_name(io_loop_get_backend(&server->loop)));
+	}
+
 	log_debug("http server started at %s:%i\n", string_get_cstr(tcp_socket_wrapper_get_address(&server->socket)),
 			  tcp_socket_wrapper_get_port(&server->socket));
 DONE:
 	if (result) {
+		if (server->loop_is_init) {
+			io_loop_dealloc(&server->loop);
+		}
 		if (socket_init && tcp_socket_wrapper_dealloc(&server->socket)) {
 			log_error("failed to close the http server socket after a previous failure to initialize the http server\n");
 		}
@@ -789,12 +2273,30 @@ DONE:
 		if (mutex_init && pthread_mutex_destroy(&server->task_pool_mutex)) {
 			log_error("failed to clean up task pool mutex after a previous failure to initialize the http server\n");
 		}
+		if (server->limiter_is_init) {
+			concurrency_limiter_dealloc(&server->limiter);
+		}
+		if (common_headers_init) {
+			http_common_headers_dealloc(&server->common_headers);
+		}
+		if (server->access_log_is_init) {
+			access_log_dealloc(&server->access_log);
+		}
+		http_server_config_dealloc(&server->config);
 	}
+	string_dealloc(&error);
 	return result;
 }
 
 int http_server_dealloc(http_server *server) {
 	int result = 0;
+	if (server->loop_is_init) {
+		io_loop_stop(&server->loop);
+		// handlers waiting for their output to drain would wait forever with the loop stopped
+		for (http_server_connection *connection = server->connections; connection; connection = connection->next) {
+			http_server_connection_fail_outbound(connection);
+		}
+	}
 	if (tcp_socket_wrapper_dealloc(&server->socket)) {
 		log_error("failed to close the http server socket\n");
 		result = 1;
@@ -803,19 +2305,63 @@ int http_server_dealloc(http_server *server) {
 		log_error("failed to close the http server thread pool\n");
 		result = 1;
 	}
+	if (server->loop_is_init) {
+		// the loop and the workers are stopped, so whatever connections are left can be torn down from here
+		while (server->connections) {
+			http_server_connection *connection = server->connections;
+			if (connection->state != HTTP_SERVER_CONNECTION_CLOSING) {
+				close(connection->socket.socket);
+			}
+			if (connection->task) {
+				http_server_release_task(connection->task);
+				connection->task = NULL;
+			}
+			http_server_connection_free_outbound(connection);
+			http_server_connection_free(connection);
+		}
+		while (server->connection_pool) {
+			http_server_connection *connection = server->connection_pool;
+			server->connection_pool = connection->next;
+			buffer_dealloc(&connection->received);
+			buffer_dealloc(&connection->pipelined);
+			string_dealloc(&connection->address);
+			pthread_mutex_destroy(&connection->outbound_mutex);
+			pthread_cond_destroy(&connection->outbound_drained);
+			free(connection);
+		}
+		timer_wheel_dealloc(&server->timers);
+		io_loop_dealloc(&server->loop);
+	}
 	if (pthread_mutex_destroy(&server->task_pool_mutex)) {
 		log_error("failed to clean up the task pool mutex\n");
 		result = 1;
 	}
+	if (server->limiter_is_init) {
+		concurrency_limiter_dealloc(&server->limiter);
+	}
 	while (server->task_pool) {
 		http_server_task_data *data = server->task_pool;
 		server->task_pool = server->task_pool->next;
+		metrics_add(http_server_tasks_pooled_metric, -1);
 		string_dealloc(&data->scratch);
 		string_dealloc(&data->request_address);
 		http_request_dealloc(&data->request);
 		http_response_dealloc(&data->response);
+		buffer_dealloc(&data->output);
 		free(data);
 	}
 	free(server->task_pool);
+	if (server->access_log_is_init) {
+		// everything that logs has stopped, so this writes out the last of it
+		access_log_dealloc(&server->access_log);
+	}
+	http_common_headers_dealloc(&server->common_headers);
+	http_server_config_dealloc(&server->config);
 	return result;
-}
\ No newline at end of file
+}
+
+void http_server_reopen_access_log(http_server *server) {
+	if (server->access_log_is_init) {
+		access_log_reopen(&server->access_log);
+	}
+}
@@ -9,9 +9,15 @@ https://www.ietf.org/rfc/rfc7230.txt
 #ifndef http_h
 #define http_h
 
+#include "access_log.h"
+#include "concurrency_limiter.h"
+#include "http_server_config.h"
+#include "io_loop.h"
+#include "json.h"
 #include "stream.h"
 #include "string.h"
 #include "tcp_socket_wrapper.h"
+#include "timer_wheel.h"
 #include "worker_thread_pool.h"
 
 #ifdef __cplusplus
@@ -31,31 +37,84 @@ typedef struct {
 	http_header *headers;
 } http_headers;
 
+// the limits a request parses with until http_request_set_limits, and the defaults of the matching http_server_config options
+#define HTTP_REQUEST_DEFAULT_READ_CHUNK_SIZE 4096
+#define HTTP_REQUEST_DEFAULT_MAX_HEADER_SIZE (64 * 1024)
+#define HTTP_REQUEST_DEFAULT_MAX_BODY_SIZE (1024 * 1024)
+
 typedef struct {
 	buffer read_buf;
 	string scratch;
 	string method;
 	// TODO uri should be the uri type
 	string uri;
+	// e.g. "HTTP/1.1"
+	string protocol_version;
 	http_headers headers;
 	// TODO body of request should be a stream, not fetch all data up front
 	buffer body;
+	// kept with the request so that its allocations are reused from one request to the next
+	json_document json;
+	// limits applied while parsing
+	size_t read_chunk_size;
+	size_t max_header_size;
+	size_t max_body_size;
 } http_request;
 
+// headers a server adds to every response, serialized once when it starts
 typedef struct {
+	// add a Date header, from a cache that's formatted once a second
+	int date;
+	// "Name: value\r\n" lines
+	buffer block;
+} http_common_headers;
+
+struct http_response;
+/**
+ * Sends what's been written to the response so far, see http_response_flush.
+ * @returns 0 on success, non-0 if the client has gone away
+ */
+typedef int (*http_response_flush_func)(void *data, struct http_response *response);
+
+typedef struct http_response {
 	string scratch;
 	int status_code;
+	// only filled in once it's been asked for, until then the standard one for the status code is used
 	string reason_phrase;
+	int custom_reason_phrase;
 	http_headers headers;
 	buffer body_buffer;
 	stream body_stream;
+	// set once the head has been sent and the body is going out in chunks
+	int streaming;
+	// set by the server for a client that can't take chunks, HTTP/1.0, a streamed body goes out as it is and the connection's closed
+	// to end it
+	int close_delimited;
+	// set by the server while a handler runs
+	http_response_flush_func flush;
+	void *flush_data;
+	// set by the server, kept when the response is cleared
+	http_common_headers *common_headers;
 } http_response;
 
+#define HTTP_REQUEST_FIND_END_NEED_HEADERS 1
+#define HTTP_REQUEST_FIND_END_NEED_BODY 2
+
 typedef int (*http_server_func)(void *data, http_request *request, http_response *response);
 
 struct http_server_task_data;
+struct http_server_connection;
 struct http_server;
 
+// part of a response waiting to be sent
+typedef struct http_server_outbound_chunk {
+	struct http_server_outbound_chunk *next;
+	uint8_t *data;
+	size_t length;
+	// flushed chunks are allocated along with a copy of their data, the last one of a response is sent from the task's output
+	int allocated;
+} http_server_outbound_chunk;
+
 typedef struct http_server_task_data {
 	struct http_server_task_data *next;
 	struct http_server *server;
@@ -66,17 +125,115 @@ typedef struct http_server_task_data {
 	http_response response;
 	int socket;
 	stream socket_stream;
+	// set when the request came in on the io_loop, the response is written to output and handed to the loop to send
+	struct http_server_connection *connection;
+	buffer output;
+	http_server_outbound_chunk final_chunk;
+	// the handler failed after it had started streaming, so the response can only be cut off
+	int aborted;
+	// non-0 to send the canned response for this status instead of the response
+	int canned_status_code;
+	// holding a slot in the server's concurrency limiter since admitted_ns
+	int admitted;
+	uint64_t admitted_ns;
+	// the request was parsed, so its method and uri can be logged
+	int parsed;
+	// when the current phase started, each phase's duration is worked out as it ends
+	uint64_t phase_ns;
+	uint64_t accept_ns;
+	uint64_t parse_ns;
+	uint64_t queue_ns;
+	uint64_t handler_ns;
+	// from trace_sample, 0 if this request isn't traced
+	uint64_t trace_id;
+	// how much of the response has been written or queued
+	uint64_t response_bytes;
 } http_server_task_data;
 
+typedef enum {
+	// between requests on a kept alive connection
+	HTTP_SERVER_CONNECTION_IDLE = 0,
+	HTTP_SERVER_CONNECTION_READING_HEADERS = 1,
+	HTTP_SERVER_CONNECTION_READING_BODY = 2,
+	HTTP_SERVER_CONNECTION_HANDLING = 3,
+	HTTP_SERVER_CONNECTION_WRITING = 4,
+	// closed, or closing, and waiting on the loop or a handler that's still running
+	HTTP_SERVER_CONNECTION_CLOSING = 5
+} http_server_connection_state;
+
+// connection timeouts are configured in ms, so there's no point tracking them any finer
+#define HTTP_SERVER_TIMER_RESOLUTION_NS 1000000
+
+typedef struct http_server_connection {
+	// every live connection, so they can be cleaned up
+	struct http_server_connection *prev;
+	struct http_server_connection *next;
+	struct http_server *server;
+	io_loop_socket socket;
+	http_server_connection_state state;
+	// the current state's timeout
+	timer_wheel_timer timer;
+	int closed;
+	int keep_alive;
+	buffer received;
+	// received past the end of the request being handled
+	buffer pipelined;
+	// owned by the connection while a handler runs, until the handler's response is sent
+	http_server_task_data *task;
+	int handler_running;
+	string address;
+	uint16_t port;
+	// when the connection was accepted, or for a later request on it when that request's first bytes came in
+	uint64_t request_start_ns;
+
+	// the response queue, written to by the worker running the handler and sent by the loop
+	pthread_mutex_t outbound_mutex;
+	// signalled as the queue drains, for handlers waiting to flush
+	pthread_cond_t outbound_drained;
+	http_server_outbound_chunk *outbound_first;
+	http_server_outbound_chunk *outbound_last;
+	size_t outbound_size;
+	// the loop is sending the first chunk
+	int outbound_sending;
+	// something has been queued, so the loop can't send an error response instead
+	int outbound_started;
+	// the handler is done and its last chunk is queued
+	int outbound_complete;
+	// the connection can't be kept alive after the response, it was cut off or was an error
+	int outbound_close;
+	// the loop has given up on the handler's response, anything else it queues is dropped
+	int outbound_failed;
+	// wakes the loop when there's something to send
+	int wake_posted;
+	io_loop_post_task wake;
+} http_server_connection;
+
 typedef struct http_server {
 	http_server_func callback;
 	void *callback_data;
-	uint64_t timeout;
+	http_server_config config;
 	tcp_socket_wrapper socket;
 	worker_thread_pool thread_pool;
 	pthread_mutex_t task_pool_mutex;
 	size_t task_pool_len;
 	http_server_task_data *task_pool;
+	http_common_headers common_headers;
+	// only used when config.max_concurrency is set
+	concurrency_limiter limiter;
+	int limiter_is_init;
+	// only used when config.io_backend isn't "blocking", everything here is owned by the loop thread
+	io_loop loop;
+	int loop_is_init;
+	io_loop_listener listener;
+	// every connection timeout, header, body, keep alive, handler and write
+	timer_wheel timers;
+	// refreshes the cached Date header as each second starts
+	timer_wheel_timer date_timer;
+	http_server_connection *connections;
+	http_server_connection *connection_pool;
+	// only used when config.access_log is set, slot 0 is for the loop or accept thread and the rest are for the workers
+	access_log access_log;
+	int access_log_is_init;
 } http_server;
 
 void http_header_init(http_header *header);
@@ -99,7 +256,15 @@ void http_request_init(http_request *request);
 void http_request_dealloc(http_request *request);
 string *http_request_get_method(http_request *request);
 string *http_request_get_uri(http_request *request);
+string *http_request_get_protocol_version(http_request *request);
 http_headers *http_request_get_headers(http_request *request);
+/**
+ * Sets the limits used by http_request_parse, which start out as the HTTP_REQUEST_DEFAULT_ ones.
+ * @param read_chunk_size how much to read from the stream at once
+ * @param max_header_size requests with a longer request line and headers fail to parse
+ * @param max_body_size requests with a longer body fail to parse
+ */
+void http_request_set_limits(http_request *request, size_t read_chunk_size, size_t max_header_size, size_t max_body_size);
 /**
  * Clears all data from this request ahead of time and replaces it with new data parsed from the input stream. Aborts when it's obvious that
  * the document is malformed.
@@ -107,35 +272,85 @@ http_headers *http_request_get_headers(http_request *request);
  * @returns 0 when successful, non-0 when any error occurs reading from the stream or if the content is malformed
  */
 int http_request_parse(http_request *request, stream *stream);
+/**
+ * Finds where a request ends without parsing it, so a request can be read in full before anything waits on it.
+ * @param data the start of the request
+ * @param length how much of the request has been read
+ * @param request_length set to the length of the request line, headers and body when it's all there
+ * @returns 0 when the whole request has been read, HTTP_REQUEST_FIND_END_NEED_HEADERS or HTTP_REQUEST_FIND_END_NEED_BODY when more needs to
+ * be read, negative when it's malformed, over the limits, or has a body framed any way but a single Content-Length
+ */
+int http_request_find_end(uint8_t *data, size_t length, size_t max_header_size, size_t max_body_size, size_t *request_length);
+/**
+ * Parses the body as JSON. The result is only valid until the request is parsed again or deallocated.
+ * @param root set to the top level value of the body
+ * @returns 0 on success, non-0 if the body isn't valid JSON
+ */
+int http_request_get_body_json(http_request *request, json_value *root);
+
+/**
+ * @param lines one "Name: value" header per line
+ * @returns 0 on success, non-0 if a line isn't a header
+ */
+int http_common_headers_init(http_common_headers *common_headers, int date, char *lines);
+void http_common_headers_dealloc(http_common_headers *common_headers);
 
 void http_response_init(http_response *response);
 void http_response_dealloc(http_response *response);
 void http_response_clear(http_response *response);
 int http_response_get_status_code(http_response *response);
 void http_response_set_status_code(http_response *response, int status_code);
+/**
+ * Standard reason phrases come from a static table. Getting the reason phrase copies it into the response so it can be changed, and it's
+ * written as is from then on, until the status code is set again.
+ */
 string *http_response_get_reason_phrase(http_response *response);
 http_headers *http_response_get_headers(http_response *response);
 stream *http_response_get_body(http_response *response);
+/**
+ * Has the response written with the common headers, between the status line and its own headers. Headers in the common block shouldn't
+ * be set on the response as well, the Date header is the exception and the response's own is used instead.
+ */
+void http_response_set_common_headers(http_response *response, http_common_headers *common_headers);
 /**
  * Serializes this response to the destination stream.
  * @param stream the stream to write to
  * @returns 0 when successful, non-0 when any error occurs writing to the stream
  */
 int http_response_write(http_response *response, stream *stream);
+/**
+ * Serializes the status line and headers if they haven't been already, switching the body to chunked transfer encoding, and then
+ * whatever has been written to the body since the last call as a chunk. Once this has been called http_response_write finishes off the
+ * body instead of writing a whole response. With close_delimited set the body goes out without chunks and with Connection: close instead,
+ * and it's up to the caller to close the connection once it's all been written.
+ * @returns 0 when successful, non-0 when any error occurs writing to the stream
+ */
+int http_response_write_partial(http_response *response, stream *stream);
+void http_response_set_flush(http_response *response, http_response_flush_func flush, void *data);
+/**
+ * Lets a handler stream a large or slow body. The status and headers can't be changed after the first flush. Each flush hands what's
+ * been written to the body so far to the connection, and waits while more than max_outbound_size is still waiting to be sent, so a
+ * client that reads slowly slows the handler down rather than using up memory. Does nothing outside of a server handler.
+ * @returns 0 on success, non-0 if the client has gone away and the handler should give up
+ */
+int http_response_flush(http_response *response);
 
 /**
  * Maintains a socket that it accepts incoming HTTP requests on. It invokes the given callback in a thread pool, and then responds with the
  * filled in response. Task failures or timeouts generate default responses.
- * @param address passed to tcp_socket_wrapper_init
- * @param port passed to tcp_socket_wrapper_init
- * @param num_threads passed to worker_thread_pool_init
- * @param queue_size passed to worker_thread_pool_init
- * @param timeout the time wait on the server callback to return before sending back an error response, in nanoseconds
+ *
+ * With the blocking io_backend an accept thread hands each connection to a worker, which reads, handles and writes it with blocking calls.
+ * Otherwise an io_loop thread accepts, reads and parses whole requests, and sends the responses, so workers are only busy while handlers
+ * run and a slow client costs a buffer rather than a thread.
+ * @param config optional, copied so it doesn't need to outlive this call, NULL uses the defaults from http_server_config_init
  * @return 0 when successful, non-0 when an error occurs or on bad arguments
  */
-int http_server_init(http_server *server, http_server_func callback, void *callback_data, char *address, uint16_t port, int num_threads,
-					 int queue_size, uint64_t timeout);
+int http_server_init(http_server *server, http_server_func callback, void *callback_data, http_server_config *config);
 int http_server_dealloc(http_server *server);
+/**
+ * Reopens the access log by its path, for log rotation. Does nothing without an access log.
+ */
+void http_server_reopen_access_log(http_server *server);
 
 #ifdef __cplusplus
 }
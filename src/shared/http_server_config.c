@@ -0,0 +1,461 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "http.h"
+#include "http_server_config.h"
+#include "json.h"
+#include "log.h"
+#include "stream.h"
+
+// nobody should need a config file bigger than this
+#define MAX_CONFIG_FILE_SIZE (1024 * 1024)
+#define MAX_CPUS 1024
+
+static http_server_config_option http_server_config_options[] = {
+	{"address", HTTP_SERVER_CONFIG_OPTION_STRING, offsetof(http_server_config, address), 0, 0, "address to listen on, empty for any"},
+	{"port", HTTP_SERVER_CONFIG_OPTION_PORT, offsetof(http_server_config, port), 0, UINT16_MAX, "port to listen on"},
+	{"num_threads", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, num_threads), 1, 4096, "worker threads that run handlers"},
+	{"queue_size", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, queue_size), 1, INT32_MAX,
+	 "requests that can be waiting for a worker"},
+	{"listen_backlog", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, socket_options.backlog), 1, INT32_MAX,
+	 "connections that can be waiting to be accepted"},
+	{"reuse_address", HTTP_SERVER_CONFIG_OPTION_BOOL, offsetof(http_server_config, socket_options.reuse_address), 0, 1,
+	 "set SO_REUSEADDR on the listening socket"},
+	{"tcp_no_delay", HTTP_SERVER_CONFIG_OPTION_BOOL, offsetof(http_server_config, socket_options.no_delay), 0, 1,
+	 "set TCP_NODELAY on accepted sockets"},
+	{"tcp_defer_accept_s", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, socket_options.defer_accept_seconds), 0, 3600,
+	 "TCP_DEFER_ACCEPT seconds on the listening socket, 0 to disable"},
+	{"tcp_fast_open", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, socket_options.fast_open_queue_length), 0, INT32_MAX,
+	 "TCP_FASTOPEN pending request queue length on the listening socket, 0 to disable"},
+	{"receive_buffer_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, socket_options.receive_buffer_size), 0, INT32_MAX,
+	 "SO_RCVBUF for connections, 0 for the system default"},
+	{"send_buffer_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, socket_options.send_buffer_size), 0, INT32_MAX,
+	 "SO_SNDBUF for connections, 0 for the system default"},
+	{"tcp_quick_ack", HTTP_SERVER_CONFIG_OPTION_BOOL, offsetof(http_server_config, socket_options.quick_ack), 0, 1,
+	 "set TCP_QUICKACK once on accepted sockets, not sticky, the kernel can leave quick ack mode again"},
+	{"busy_poll_us", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, socket_options.busy_poll_microseconds), 0, INT32_MAX,
+	 "SO_BUSY_POLL microseconds on accepted sockets, 0 to disable"},
+	{"read_chunk_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, read_chunk_size), 64, 16 * 1024 * 1024,
+	 "bytes to read from a socket at once"},
+	{"max_header_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, max_header_size), 256, INT32_MAX,
+	 "largest request line and headers accepted"},
+	{"max_body_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, max_body_size), 0, INT32_MAX,
+	 "largest request body accepted"},
+	{"handler_timeout_ms", HTTP_SERVER_CONFIG_OPTION_UINT64, offsetof(http_server_config, handler_timeout_ms), 1, INT32_MAX,
+	 "time a handler has to respond before the client gets an error"},
+	{"read_timeout_ms", HTTP_SERVER_CONFIG_OPTION_UINT64, offsetof(http_server_config, read_timeout_ms), 0, INT32_MAX,
+	 "time a single read from a client can block, 0 for no limit"},
+	{"write_timeout_ms", HTTP_SERVER_CONFIG_OPTION_UINT64, offsetof(http_server_config, write_timeout_ms), 0, INT32_MAX,
+	 "time a single write to a client can block, 0 for no limit"},
+	{"header_timeout_ms", HTTP_SERVER_CONFIG_OPTION_UINT64, offsetof(http_server_config, header_timeout_ms), 0, INT32_MAX,
+	 "time a client has to send all of a request's headers with an io loop, 0 for no limit"},
+	{"keep_alive_timeout_ms", HTTP_SERVER_CONFIG_OPTION_UINT64, offsetof(http_server_config, keep_alive_timeout_ms), 0, INT32_MAX,
+	 "time an idle connection is kept open with an io loop, 0 to close after every response"},
+	{"max_outbound_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, max_outbound_size), 0, INT32_MAX,
+	 "bytes of a streamed response queued for a client before the handler waits, with an io loop"},
+	{"date_header", HTTP_SERVER_CONFIG_OPTION_BOOL, offsetof(http_server_config, date_header), 0, 1,
+	 "add a Date header to every response"},
+	{"common_headers", HTTP_SERVER_CONFIG_OPTION_STRING, offsetof(http_server_config, common_headers), 0, 0,
+	 "headers added to every response, one \"Name: value\" per line, e.g. Server or security headers"},
+	{"max_concurrency", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, max_concurrency), 0, INT32_MAX,
+	 "most requests admitted at once, the limit adapts below this to latency, 0 to only limit by the queue size"},
+	{"min_concurrency", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, min_concurrency), 0, INT32_MAX,
+	 "lowest the adaptive concurrency limit goes, 0 for num_threads"},
+	{"cpu_affinity", HTTP_SERVER_CONFIG_OPTION_CPU_LIST, offsetof(http_server_config, cpu_affinity), 0, 0,
+	 "cpus to pin worker threads to, e.g. 0-3,8"},
+	{"io_backend", HTTP_SERVER_CONFIG_OPTION_IO_BACKEND, offsetof(http_server_config, io_backend), 0, 0,
+	 "how connections are read and written: auto, io_uring, epoll or blocking"},
+	{"receive_buffers", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, receive_buffers), 1, 32768,
+	 "read_chunk_size buffers io_uring receives into, a power of 2"},
+	{"log_buffer_size", HTTP_SERVER_CONFIG_OPTION_SIZE, offsetof(http_server_config, log_buffer_size), 0, INT32_MAX,
+	 "bytes of log messages each thread can buffer for a background writer, messages are dropped when full, 0 to log synchronously"},
+	{"log_level", HTTP_SERVER_CONFIG_OPTION_LOG_LEVEL, offsetof(http_server_config, log_level), 0, 0,
+	 "lowest level of log message written: trace, debug, info, error or none"},
+	{"access_log", HTTP_SERVER_CONFIG_OPTION_STRING, offsetof(http_server_config, access_log), 0, 0,
+	 "file to log every request to with its timings, reopened on SIGHUP, empty for no access log"},
+	{"access_log_sample", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, access_log_sample), 1, INT32_MAX,
+	 "only log one in every this many requests to the access log"},
+	{"metrics_path", HTTP_SERVER_CONFIG_OPTION_STRING, offsetof(http_server_config, metrics_path), 0, 0,
+	 "path to serve metrics on in the Prometheus text format, e.g. /metrics, empty to not serve them"},
+	{"perf_counters", HTTP_SERVER_CONFIG_OPTION_BOOL, offsetof(http_server_config, perf_counters), 0, 1,
+	 "count cycles, instructions, cache misses and branch misses while parsing, handling and serializing requests"},
+	{"trace_sample", HTTP_SERVER_CONFIG_OPTION_INT, offsetof(http_server_config, trace_sample), 0, INT32_MAX,
+	 "trace one in every this many requests through each stage of the server, 0 to not trace"},
+	{"trace_path", HTTP_SERVER_CONFIG_OPTION_STRING, offsetof(http_server_config, trace_path), 0, 0,
+	 "path to serve the traced requests on as Chrome trace JSON, e.g. /trace, empty to not serve them"},
+};
+
+void http_server_config_init(http_server_config *config) {
+	long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cores < 1) {
+		num_cores = 1;
+	}
+	string_init(&config->address);
+	config->port = 8000;
+	// handlers may block, so never fewer than 2 even on a single core
+	config->num_threads = num_cores < 2 ? 2 : num_cores;
+	config->queue_size = config->num_threads * 64;
+	config->read_chunk_size = HTTP_REQUEST_DEFAULT_READ_CHUNK_SIZE;
+	config->max_header_size = HTTP_REQUEST_DEFAULT_MAX_HEADER_SIZE;
+	config->max_body_size = HTTP_REQUEST_DEFAULT_MAX_BODY_SIZE;
+	config->handler_timeout_ms = 5000;
+	config->read_timeout_ms = 10000;
+	config->write_timeout_ms = 10000;
+	config->header_timeout_ms = 10000;
+	config->keep_alive_timeout_ms = 0;
+	config->max_outbound_size = 1024 * 1024;
+	config->date_header = 1;
+	string_init(&config->common_headers);
+	config->max_concurrency = 0;
+	config->min_concurrency = 0;
+	tcp_socket_wrapper_options_init(&config->socket_options);
+	string_init(&config->cpu_affinity);
+	string_init_cstr(&config->io_backend, "auto");
+	config->receive_buffers = 256;
+	config->log_buffer_size = 64 * 1024;
+	string_init_cstr(&config->log_level, "info");
+	string_init(&config->access_log);
+	config->access_log_sample = 1;
+	string_init(&config->metrics_path);
+	config->perf_counters = 0;
+	config->trace_sample = 0;
+	string_init(&config->trace_path);
+}
+
+void http_server_config_dealloc(http_server_config *config) {
+	string_dealloc(&config->address);
+	string_dealloc(&config->cpu_affinity);
+	string_dealloc(&config->io_backend);
+	string_dealloc(&config->common_headers);
+	string_dealloc(&config->log_level);
+	string_dealloc(&config->access_log);
+	string_dealloc(&config->metrics_path);
+	string_dealloc(&config->trace_path);
+}
+
+void http_server_config_copy(http_server_config *dst, http_server_config *src) {
+	// take the strings out of the way so the plain copy doesn't clobber dst's allocations
+	string address = dst->address;
+	string cpu_affinity = dst->cpu_affinity;
+	string io_backend = dst->io_backend;
+	string common_headers = dst->common_headers;
+	string log_level = dst->log_level;
+	string access_log = dst->access_log;
+	string metrics_path = dst->metrics_path;
+	string trace_path = dst->trace_path;
+	*dst = *src;
+	dst->address = address;
+	dst->cpu_affinity = cpu_affinity;
+	dst->io_backend = io_backend;
+	dst->common_headers = common_headers;
+	dst->log_level = log_level;
+	dst->access_log = access_log;
+	dst->metrics_path = metrics_path;
+	dst->trace_path = trace_path;
+	string_set_str(&dst->address, &src->address);
+	string_set_str(&dst->cpu_affinity, &src->cpu_affinity);
+	string_set_str(&dst->io_backend, &src->io_backend);
+	string_set_str(&dst->common_headers, &src->common_headers);
+	string_set_str(&dst->log_level, &src->log_level);
+	string_set_str(&dst->access_log, &src->access_log);
+	string_set_str(&dst->metrics_path, &src->metrics_path);
+	string_set_str(&dst->trace_path, &src->trace_path);
+}
+
+size_t http_server_config_get_num_options() {
+	return sizeof(http_server_config_options) / sizeof(http_server_config_options[0]);
+}
+
+http_server_config_option *http_server_config_get_option(size_t i) {
+	if (i >= http_server_config_get_num_options()) {
+		return NULL;
+	}
+	return &http_server_config_options[i];
+}
+
+/*
+private
+
+Parses a list of cpus and cpu ranges like "0-3,8". dst may be NULL to just check the list.
+
+Returns 0 on success, non-0 on a malformed list.
+*/
+int http_server_config_parse_cpu_list(char *s, int *dst, size_t capacity, size_t *dst_len) {
+	size_t len = 0;
+	while (*s) {
+		char *end;
+		errno = 0;
+		long first = strtol(s, &end, 10);
+		if (end == s || errno || first < 0 || first >= MAX_CPUS) {
+			return 1;
+		}
+		long last = first;
+		s = end;
+		if (*s == '-') {
+			s++;
+			last = strtol(s, &end, 10);
+			if (end == s || errno || last < first || last >= MAX_CPUS) {
+				return 1;
+			}
+			s = end;
+		}
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (dst) {
+				if (len == capacity) {
+					return 1;
+				}
+				dst[len] = cpu;
+			}
+			len++;
+		}
+		if (*s == ',') {
+			s++;
+			if (!*s) {
+				return 1;
+			}
+		} else if (*s) {
+			return 1;
+		}
+	}
+	*dst_len = len;
+	return 0;
+}
+
+// private
+int http_server_config_parse_int64(char *value, int allow_size_suffix, int64_t *dst) {
+	char *end;
+	errno = 0;
+	long long result = strtoll(value, &end, 10);
+	if (end == value || errno) {
+		return 1;
+	}
+	if (allow_size_suffix && *end) {
+		int64_t multiplier;
+		switch (*end) {
+		case 'k':
+		case 'K':
+			multiplier = 1024;
+			break;
+		case 'm':
+		case 'M':
+			multiplier = 1024 * 1024;
+			break;
+		case 'g':
+		case 'G':
+			multiplier = 1024 * 1024 * 1024;
+			break;
+		default:
+			return 1;
+		}
+		if (result > INT64_MAX / multiplier || result < INT64_MIN / multiplier) {
+			return 1;
+		}
+		result *= multiplier;
+		end++;
+	}
+	if (*end) {
+		return 1;
+	}
+	*dst = result;
+	return 0;
+}
+
+int http_server_config_set_cstr(http_server_config *config, char *name, char *value, string *error) {
+	http_server_config_option *option = NULL;
+	for (size_t i = 0; i < http_server_config_get_num_options(); i++) {
+		if (!strcmp(http_server_config_options[i].name, name)) {
+			option = &http_server_config_options[i];
+			break;
+		}
+	}
+	if (!option) {
+		if (error) {
+			string_set_cstrf(error, "unknown option %s", name);
+		}
+		return 1;
+	}
+
+	void *field = ((char *)config) + option->offset;
+	int64_t number = 0;
+	switch (option->type) {
+	case HTTP_SERVER_CONFIG_OPTION_BOOL:
+		if (!strcasecmp(value, "1") || !strcasecmp(value, "true") || !strcasecmp(value, "yes") || !strcasecmp(value, "on")) {
+			*(int *)field = 1;
+		} else if (!strcasecmp(value, "0") || !strcasecmp(value, "false") || !strcasecmp(value, "no") || !strcasecmp(value, "off")) {
+			*(int *)field = 0;
+		} else {
+			goto INVALID;
+		}
+		return 0;
+	case HTTP_SERVER_CONFIG_OPTION_STRING:
+		string_set_cstr((string *)field, value);
+		return 0;
+	case HTTP_SERVER_CONFIG_OPTION_CPU_LIST: {
+		size_t num_cpus;
+		if (http_server_config_parse_cpu_list(value, NULL, 0, &num_cpus)) {
+			goto INVALID;
+		}
+		string_set_cstr((string *)field, value);
+		return 0;
+	}
+	case HTTP_SERVER_CONFIG_OPTION_IO_BACKEND: {
+		io_loop_backend backend;
+		if (strcmp(value, "blocking") && io_loop_backend_parse_cstr(value, &backend)) {
+			goto INVALID;
+		}
+		string_set_cstr((string *)field, value);
+		return 0;
+	}
+	case HTTP_SERVER_CONFIG_OPTION_LOG_LEVEL: {
+		log_level level;
+		if (log_level_parse_cstr(value, &level)) {
+			goto INVALID;
+		}
+		string_set_cstr((string *)field, value);
+		return 0;
+	}
+	default:
+		break;
+	}
+
+	if (http_server_config_parse_int64(value, option->type == HTTP_SERVER_CONFIG_OPTION_SIZE, &number)) {
+		goto INVALID;
+	}
+	if (number < option->min || number > option->max) {
+		if (error) {
+			string_set_cstrf(error, "option %s must be between %lli and %lli, got %s", name, (long long)option->min, (long long)option->max,
+							 value);
+		}
+		return 1;
+	}
+	switch (option->type) {
+	case HTTP_SERVER_CONFIG_OPTION_INT:
+		*(int *)field = number;
+		break;
+	case HTTP_SERVER_CONFIG_OPTION_PORT:
+		*(uint16_t *)field = number;
+		break;
+	case HTTP_SERVER_CONFIG_OPTION_SIZE:
+		*(size_t *)field = number;
+		break;
+	case HTTP_SERVER_CONFIG_OPTION_UINT64:
+		*(uint64_t *)field = number;
+		break;
+	default:
+		break;
+	}
+	return 0;
+
+INVALID:
+	if (error) {
+		string_set_cstrf(error, "invalid value for option %s: %s", name, value);
+	}
+	return 1;
+}
+
+int http_server_config_load_file_cstr(http_server_config *config, char *path, string *error) {
+	stream file;
+	if (stream_init_file_cstr(&file, path, "rb", error)) {
+		return 1;
+	}
+	buffer contents;
+	buffer_init(&contents);
+	int result = 0;
+	json_document doc;
+	json_document_init(&doc);
+	string value_str;
+	string_init(&value_str);
+	string name_str;
+	string_init(&name_str);
+
+	if (stream_read_all_into_buffer(&file, &contents, MAX_CONFIG_FILE_SIZE, 4096, error) < 0) {
+		result = 1;
+		goto DONE;
+	}
+	json_value root, key, value;
+	json_iterator it;
+	if (json_document_parse(&doc, (char *)contents.data, buffer_get_length(&contents)) || json_document_get_root(&doc, &root) ||
+		json_value_iterate(&root, &it) || json_value_get_type(&root) != JSON_TYPE_OBJECT) {
+		if (error) {
+			string_set_cstrf(error, "config file %s isn't a JSON object", path);
+		}
+		result = 1;
+		goto DONE;
+	}
+	int next;
+	while ((next = json_iterator_next(&it, &key, &value)) > 0) {
+		// otherwise the value would go to the option before it
+		if (json_value_get_str(&key, &name_str)) {
+			next = -1;
+			break;
+		}
+		int64_t i;
+		int b;
+		switch (json_value_get_type(&value)) {
+		case JSON_TYPE_STRING:
+			if (json_value_get_str(&value, &value_str)) {
+				next = -1;
+			}
+			break;
+		case JSON_TYPE_NUMBER:
+			if (json_value_get_int64(&value, &i)) {
+				next = -1;
+			} else {
+				string_set_cstrf(&value_str, "%lli", (long long)i);
+			}
+			break;
+		case JSON_TYPE_TRUE:
+		case JSON_TYPE_FALSE:
+			if (json_value_get_bool(&value, &b)) {
+				next = -1;
+			} else {
+				string_set_cstr(&value_str, b ? "true" : "false");
+			}
+			break;
+		default:
+			next = -1;
+			break;
+		}
+		if (next < 0) {
+			break;
+		}
+		if (http_server_config_set_cstr(config, string_get_cstr(&name_str), string_get_cstr(&value_str), error)) {
+			result = 1;
+			goto DONE;
+		}
+	}
+	if (next < 0) {
+		if (error) {
+			string_set_cstrf(error, "config file %s is malformed", path);
+		}
+		result = 1;
+	}
+
+DONE:
+	string_dealloc(&name_str);
+	string_dealloc(&value_str);
+	json_document_dealloc(&doc);
+	buffer_dealloc(&contents);
+	stream_dealloc(&file, NULL);
+	return result;
+}
+
+int http_server_config_get_cpu_affinity(http_server_config *config, int *cpus, size_t capacity, size_t *num_cpus) {
+	return http_server_config_parse_cpu_list(string_get_cstr(&config->cpu_affinity), cpus, capacity, num_cpus);
+}
+
+int http_server_config_get_io_backend(http_server_config *config, int *use_loop, io_loop_backend *backend) {
+	if (!strcmp(string_get_cstr(&config->io_backend), "blocking")) {
+		*use_loop = 0;
+		return 0;
+	}
+	*use_loop = 1;
+	return io_loop_backend_parse_cstr(string_get_cstr(&config->io_backend), backend);
+}
+
+int http_server_config_get_log_level(http_server_config *config, log_level *level) {
+	return log_level_parse_cstr(string_get_cstr(&config->log_level), level);
+}
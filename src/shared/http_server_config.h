@@ -0,0 +1,159 @@
+/*
+Everything about how the HTTP server runs that can be tuned without recompiling.
+
+Options can be set by name from text, which is how both command line arguments and config files get applied. A config file is a JSON
+object whose member names are option names, e.g. {"num_threads": 8, "max_body_size": "4m"}.
+*/
+
+#ifndef http_server_config_h
+#define http_server_config_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "io_loop.h"
+#include "log.h"
+#include "string.h"
+#include "tcp_socket_wrapper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	// address to listen on, empty for any
+	string address;
+	uint16_t port;
+	// worker threads that run handlers
+	int num_threads;
+	// requests that can be waiting for a worker
+	int queue_size;
+	// how much to read from a socket at once
+	size_t read_chunk_size;
+	// limits on a single request, anything bigger is rejected
+	size_t max_header_size;
+	size_t max_body_size;
+	// how long a handler has before the client gets an error response instead
+	uint64_t handler_timeout_ms;
+	// how long a single read from or write to a client can block, 0 for no limit
+	uint64_t read_timeout_ms;
+	uint64_t write_timeout_ms;
+	// with an io loop, how long a client has to send all of a request's headers, 0 for no limit
+	uint64_t header_timeout_ms;
+	// with an io loop, how long an HTTP/1.1 connection is kept open waiting for the next request, 0 to close after every response
+	uint64_t keep_alive_timeout_ms;
+	// with an io loop, how much of a streamed response can be waiting to be sent before the handler's flush waits for it to drain
+	size_t max_outbound_size;
+	// add a Date header to every response
+	int date_header;
+	// headers added to every response, one "Name: value" per line
+	string common_headers;
+	// the most requests admitted at once, the actual limit adapts between these to the latency, 0 to admit up to the queue size
+	int max_concurrency;
+	// 0 for num_threads
+	int min_concurrency;
+	tcp_socket_wrapper_options socket_options;
+	// cpus to pin worker threads to, e.g. "0-3,8", empty to not pin
+	string cpu_affinity;
+	// "blocking" for an accept thread and blocking reads and writes from the workers, otherwise an io_loop backend name
+	string io_backend;
+	// receives that can be waiting to be handled at once with io_uring, a power of 2
+	int receive_buffers;
+	// bytes of log messages each thread can have waiting for the background log writer, 0 to log synchronously
+	// logging is process wide, so this is up to whatever starts the server to apply with log_start_async
+	size_t log_buffer_size;
+	// the lowest level of log message written, also up to whatever starts the server to apply
+	string log_level;
+	// file each request is logged to, empty for no access log
+	string access_log;
+	// only log every access_log_sample'th request, 1 to log them all
+	int access_log_sample;
+	// answers GET requests for this path with the process's metrics instead of calling the handler, empty to leave every path to it
+	string metrics_path;
+	// read the hardware performance counters around each request's parse, handler and serialize phases into metrics, a couple of
+	// system calls a phase, so off by default
+	int perf_counters;
+	// records the time one in every trace_sample requests spends in each stage, 0 to trace nothing, tracing is process wide
+	int trace_sample;
+	// answers GET requests for this path with the traced requests as Chrome trace JSON, empty to leave every path to the handler
+	string trace_path;
+} http_server_config;
+
+typedef enum {
+	HTTP_SERVER_CONFIG_OPTION_BOOL = 0,
+	HTTP_SERVER_CONFIG_OPTION_INT = 1,
+	HTTP_SERVER_CONFIG_OPTION_PORT = 2,
+	// accepts k, m and g suffixes
+	HTTP_SERVER_CONFIG_OPTION_SIZE = 3,
+	HTTP_SERVER_CONFIG_OPTION_UINT64 = 4,
+	HTTP_SERVER_CONFIG_OPTION_STRING = 5,
+	HTTP_SERVER_CONFIG_OPTION_CPU_LIST = 6,
+	HTTP_SERVER_CONFIG_OPTION_IO_BACKEND = 7,
+	HTTP_SERVER_CONFIG_OPTION_LOG_LEVEL = 8
+} http_server_config_option_type;
+
+typedef struct {
+	char *name;
+	http_server_config_option_type type;
+	// where the value lives in http_server_config
+	size_t offset;
+	// allowed range for numeric options
+	int64_t min;
+	int64_t max;
+	char *description;
+} http_server_config_option;
+
+/**
+ * Fills in defaults, with thread counts and queue sizes based on the number of cores.
+ */
+void http_server_config_init(http_server_config *config);
+void http_server_config_dealloc(http_server_config *config);
+void http_server_config_copy(http_server_config *dst, http_server_config *src);
+
+/**
+ * @returns the number of options that can be set by name
+ */
+size_t http_server_config_get_num_options();
+http_server_config_option *http_server_config_get_option(size_t i);
+
+/**
+ * Parses value according to the option's type and sets it.
+ * @param error optional, if provided and an error occurs the contents are replaced with an error message
+ * @returns 0 on success, non-0 if there's no such option or the value isn't valid for it
+ */
+int http_server_config_set_cstr(http_server_config *config, char *name, char *value, string *error);
+
+/**
+ * Sets every option in a JSON config file. Options not in the file are left as they are.
+ * @param error optional, if provided and an error occurs the contents are replaced with an error message
+ * @returns 0 on success, non-0 if the file can't be read, isn't a JSON object, or has an invalid option
+ */
+int http_server_config_load_file_cstr(http_server_config *config, char *path, string *error);
+
+/**
+ * Parses the cpu_affinity option.
+ * @param cpus filled in with up to capacity cpu numbers
+ * @param num_cpus set to the number of cpus, 0 if no affinity is configured
+ * @returns 0 on success, non-0 if the list is malformed or has more than capacity entries
+ */
+int http_server_config_get_cpu_affinity(http_server_config *config, int *cpus, size_t capacity, size_t *num_cpus);
+
+/**
+ * Parses the io_backend option.
+ * @param use_loop set to 0 for the blocking model, 1 to use an io_loop
+ * @param backend set to the io_loop backend when use_loop is set
+ * @returns 0 on success, non-0 if the option isn't a backend
+ */
+int http_server_config_get_io_backend(http_server_config *config, int *use_loop, io_loop_backend *backend);
+
+/**
+ * Parses the log_level option.
+ * @returns 0 on success, non-0 if the option isn't a level
+ */
+int http_server_config_get_log_level(http_server_config *config, log_level *level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1126 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "io_loop.h"
+#include "log.h"
+#include "metrics.h"
+
+// submission queue entries, the completion queue is bigger since multishot accepts and zero copy sends complete more than once
+#define IO_LOOP_QUEUE_DEPTH 256
+#define IO_LOOP_COMPLETION_QUEUE_DEPTH (IO_LOOP_QUEUE_DEPTH * 4)
+#define IO_LOOP_BUFFER_GROUP 0
+#define IO_LOOP_MAX_EVENTS 64
+// how many connections to accept from one epoll event before getting back to other work
+#define IO_LOOP_MAX_ACCEPTS 64
+
+// what a completion or event is for, kept in the low bits of its user data next to the pointer
+#define IO_LOOP_TAG_MASK 7ull
+#define IO_LOOP_TAG_ACCEPT 0ull
+#define IO_LOOP_TAG_RECV 1ull
+#define IO_LOOP_TAG_SEND 2ull
+#define IO_LOOP_TAG_WAKE 3ull
+#define IO_LOOP_TAG_CLOSE 4ull
+#define IO_LOOP_TAG_IGNORE 5ull
+#define IO_LOOP_TAG_SOCKET 6ull
+
+// io_uring operations on a socket waiting for room in the submission queue
+#define IO_LOOP_PENDING_RECV 1
+#define IO_LOOP_PENDING_SEND 2
+#define IO_LOOP_PENDING_CLOSE 4
+
+// the same metrics as tcp_socket_wrapper's accept thread counts into
+static pthread_once_t io_loop_metrics_once = PTHREAD_ONCE_INIT;
+static metrics_id io_loop_accepted_metric;
+static metrics_id io_loop_accept_errors_metric;
+
+// private
+void io_loop_register_metrics() {
+	metrics_register_cstr("tcp_connections_accepted_total", "Connections accepted.", METRICS_TYPE_COUNTER, &io_loop_accepted_metric);
+	metrics_register_cstr("tcp_accept_errors_total", "Failed accepts.", METRICS_TYPE_COUNTER, &io_loop_accept_errors_metric);
+}
+
+uint64_t io_loop_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// private
+uint64_t io_loop_tag(void *pointer, uint64_t tag) {
+	return (uint64_t)(uintptr_t)pointer | tag;
+}
+
+// private
+void *io_loop_untag(uint64_t user_data) {
+	return (void *)(uintptr_t)(user_data & ~IO_LOOP_TAG_MASK);
+}
+
+// private
+void io_loop_run_posts(io_loop *loop) {
+	pthread_mutex_lock(&loop->post_mutex);
+	io_loop_post_task *task = loop->post_first;
+	loop->post_first = NULL;
+	loop->post_last = NULL;
+	pthread_mutex_unlock(&loop->post_mutex);
+	while (task) {
+		// the callback may reuse the task
+		io_loop_post_task *next = task->next;
+		task->callback(task->data);
+		task = next;
+	}
+}
+
+// private
+uint64_t io_loop_run_timers(io_loop *loop, uint64_t now_ns) {
+	if (!loop->timer_callback) {
+		return UINT64_MAX;
+	}
+	return loop->timer_callback(loop->timer_data, now_ns);
+}
+
+// private
+void io_loop_socket_check_closed(io_loop_socket *sock) {
+	if (sock->closing && !sock->close_submitted && !sock->recv_submitted && !sock->send_submitted && sock->notifications_pending == 0 &&
+		!sock->ready) {
+		sock->closing = 0;
+		sock->closed_callback(sock->data);
+	}
+}
+
+/*
+io_uring backend
+*/
+
+// private
+int io_loop_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+// private
+int io_loop_io_uring_enter_syscall(int ring, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size) {
+	return syscall(__NR_io_uring_enter, ring, to_submit, min_complete, flags, arg, arg_size);
+}
+
+// private
+int io_loop_io_uring_register(int ring, unsigned opcode, void *arg, unsigned num_args) {
+	return syscall(__NR_io_uring_register, ring, opcode, arg, num_args);
+}
+
+/*
+private
+
+Submits everything queued, and if wait is set also waits for at least one completion or the timeout.
+
+Returns 0 on success, non-0 on error.
+*/
+int io_loop_io_uring_enter(io_loop *loop, int wait, uint64_t timeout_ns) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+	unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	unsigned flags = 0;
+	unsigned min_complete = 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		min_complete = 1;
+		if (timeout_ns != UINT64_MAX) {
+			ts.tv_sec = timeout_ns / 1000000000ull;
+			ts.tv_nsec = timeout_ns % 1000000000ull;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+	} else if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & (IORING_SQ_TASKRUN | IORING_SQ_CQ_OVERFLOW)) {
+		// completions are waiting on the kernel to be posted
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	if (to_submit == 0 && flags == 0) {
+		return 0;
+	}
+	int result = io_loop_io_uring_enter_syscall(ring->ring, to_submit, min_complete, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+	if (result < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+		log_error("io_uring_enter failed, %s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+private
+
+Makes room for count more submission queue entries, submitting what's queued first if there isn't enough. An entry is never handed out
+again until the kernel has consumed it, so if submitting fails, or the kernel holds off taking more while its completion queue is
+overflowing, there's no room until a later iteration.
+
+Returns 0 if there's room, non-0 if not.
+*/
+int io_loop_io_uring_reserve(io_loop *loop, unsigned count) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) + count <= ring->sq_entries) {
+		return 0;
+	}
+	io_loop_io_uring_enter(loop, 0, 0);
+	return ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) + count > ring->sq_entries;
+}
+
+/*
+private
+
+Returns a zeroed submission queue entry, or NULL if there's no room for one. Doesn't fail after io_loop_io_uring_reserve for as many.
+*/
+struct io_uring_sqe *io_loop_io_uring_get_sqe(io_loop *loop) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	if (io_loop_io_uring_reserve(loop, 1)) {
+		return NULL;
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ring->sq_local_tail++;
+	return sqe;
+}
+
+// private
+void io_loop_io_uring_recycle_buffer(io_loop *loop, uint16_t buffer_id) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_ring_tail & ring->buf_ring_mask];
+	buf->addr = (uint64_t)(uintptr_t)(loop->buffers + buffer_id * loop->buffer_size);
+	buf->len = loop->buffer_size;
+	buf->bid = buffer_id;
+	ring->buf_ring_tail++;
+	__atomic_store_n(&ring->buf_ring->tail, ring->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+// private
+void io_loop_io_uring_defer(io_loop *loop, io_loop_socket *sock, uint8_t operation) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	sock->pending |= operation;
+	if (sock->ready) {
+		return;
+	}
+	sock->ready = 1;
+	sock->next_ready = NULL;
+	if (ring->pending_last) {
+		ring->pending_last->next_ready = sock;
+	} else {
+		ring->pending_first = sock;
+	}
+	ring->pending_last = sock;
+}
+
+// private
+void io_loop_io_uring_submit_wake(io_loop *loop) {
+	struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+	if (!sqe) {
+		loop->io_uring.wake_pending = 1;
+		return;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = loop->wake_fd;
+	sqe->addr = (uint64_t)(uintptr_t)&loop->io_uring.wake_value;
+	sqe->len = sizeof(loop->io_uring.wake_value);
+	sqe->user_data = io_loop_tag(NULL, IO_LOOP_TAG_WAKE);
+}
+
+// private
+void io_loop_io_uring_submit_accept(io_loop *loop, io_loop_listener *listener) {
+	struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+	if (!sqe) {
+		if (!listener->pending) {
+			listener->pending = 1;
+			listener->next_pending = loop->io_uring.pending_listeners;
+			loop->io_uring.pending_listeners = listener;
+		}
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listener->socket;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = io_loop_tag(listener, IO_LOOP_TAG_ACCEPT);
+}
+
+// private
+void io_loop_io_uring_submit_recv(io_loop *loop, io_loop_socket *sock) {
+	struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+	if (!sqe) {
+		io_loop_io_uring_defer(loop, sock, IO_LOOP_PENDING_RECV);
+		return;
+	}
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = sock->socket;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = IO_LOOP_BUFFER_GROUP;
+	sqe->user_data = io_loop_tag(sock, IO_LOOP_TAG_RECV);
+	sock->recv_submitted = 1;
+}
+
+// private
+void io_loop_io_uring_submit_send(io_loop *loop, io_loop_socket *sock) {
+	size_t remaining = sock->send_length - sock->send_offset;
+	struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+	if (!sqe) {
+		io_loop_io_uring_defer(loop, sock, IO_LOOP_PENDING_SEND);
+		return;
+	}
+	sqe->opcode = remaining >= IO_LOOP_ZERO_COPY_MIN_SIZE ? IORING_OP_SEND_ZC : IORING_OP_SEND;
+	sqe->fd = sock->socket;
+	sqe->addr = (uint64_t)(uintptr_t)(sock->send_data + sock->send_offset);
+	sqe->len = remaining;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = io_loop_tag(sock, IO_LOOP_TAG_SEND);
+	sock->send_submitted = 1;
+}
+
+// private
+void io_loop_io_uring_submit_close(io_loop *loop, io_loop_socket *sock) {
+	// the cancel and the close are linked, so they have to go in together
+	int cancel = sock->recv_submitted || sock->send_submitted;
+	if (io_loop_io_uring_reserve(loop, cancel ? 2 : 1)) {
+		io_loop_io_uring_defer(loop, sock, IO_LOOP_PENDING_CLOSE);
+		return;
+	}
+	if (cancel) {
+		// hard linked so the close still runs when there turns out to be nothing to cancel
+		struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = sock->socket;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->flags = IOSQE_IO_HARDLINK;
+		sqe->user_data = io_loop_tag(NULL, IO_LOOP_TAG_IGNORE);
+	}
+	struct io_uring_sqe *sqe = io_loop_io_uring_get_sqe(loop);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = sock->socket;
+	sqe->user_data = io_loop_tag(sock, IO_LOOP_TAG_CLOSE);
+}
+
+/*
+private
+
+Retries everything that couldn't get a submission queue entry, in the order it was started. Anything there's still no room for waits for
+the next iteration.
+*/
+void io_loop_io_uring_submit_pending(io_loop *loop) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	if (ring->wake_pending) {
+		ring->wake_pending = 0;
+		io_loop_io_uring_submit_wake(loop);
+	}
+	io_loop_listener *listener = ring->pending_listeners;
+	ring->pending_listeners = NULL;
+	while (listener) {
+		io_loop_listener *next = listener->next_pending;
+		listener->pending = 0;
+		io_loop_io_uring_submit_accept(loop, listener);
+		listener = next;
+	}
+	io_loop_socket *sock = ring->pending_first;
+	ring->pending_first = NULL;
+	ring->pending_last = NULL;
+	while (sock) {
+		io_loop_socket *next = sock->next_ready;
+		uint8_t pending = sock->pending;
+		sock->pending = 0;
+		sock->ready = 0;
+		if (pending & IO_LOOP_PENDING_CLOSE) {
+			io_loop_io_uring_submit_close(loop, sock);
+		}
+		if (pending & IO_LOOP_PENDING_RECV) {
+			io_loop_io_uring_submit_recv(loop, sock);
+		}
+		if (pending & IO_LOOP_PENDING_SEND) {
+			io_loop_io_uring_submit_send(loop, sock);
+		}
+		// a close can complete while the socket's still waiting here
+		io_loop_socket_check_closed(sock);
+		sock = next;
+	}
+}
+
+// private
+void io_loop_io_uring_handle_accept(io_loop *loop, io_loop_listener *listener, int result, uint32_t flags) {
+	if (result >= 0) {
+		metrics_add(io_loop_accepted_metric, 1);
+		listener->callback(listener->data, result, NULL);
+	} else if (result != -ECANCELED) {
+		log_error("io_loop accept failed, %s\n", strerror(-result));
+		metrics_add(io_loop_accept_errors_metric, 1);
+	}
+	// a multishot accept stops after errors, so it needs to be started again
+	if (!(flags & IORING_CQE_F_MORE) && loop->running && result != -EBADF && result != -EINVAL && result != -ECANCELED) {
+		io_loop_io_uring_submit_accept(loop, listener);
+	}
+}
+
+// private
+void io_loop_io_uring_handle_recv(io_loop *loop, io_loop_socket *sock, int result, uint32_t flags) {
+	sock->recv_submitted = 0;
+	uint8_t *bytes = NULL;
+	int has_buffer = flags & IORING_CQE_F_BUFFER;
+	uint16_t buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+	if (has_buffer) {
+		bytes = loop->buffers + buffer_id * loop->buffer_size;
+	}
+	if (result == -ENOBUFS && !sock->closing) {
+		// every buffer was in use, they're recycled as each callback finishes so there'll be one by the time this is submitted
+		io_loop_io_uring_submit_recv(loop, sock);
+		return;
+	}
+	if (!sock->closing) {
+		sock->recv_wanted = 0;
+		sock->recv_callback(sock->data, bytes, result);
+	}
+	if (has_buffer) {
+		io_loop_io_uring_recycle_buffer(loop, buffer_id);
+	}
+	io_loop_socket_check_closed(sock);
+}
+
+// private
+void io_loop_io_uring_handle_send(io_loop *loop, io_loop_socket *sock, int result, uint32_t flags) {
+	if (flags & IORING_CQE_F_NOTIF) {
+		// the kernel is done with the data from a zero copy send
+		sock->notifications_pending--;
+	} else {
+		sock->send_submitted = 0;
+		if (flags & IORING_CQE_F_MORE) {
+			sock->notifications_pending++;
+		}
+		if (result < 0) {
+			sock->send_result = result;
+		} else if (result == 0 && sock->send_offset < sock->send_length) {
+			sock->send_result = -EPIPE;
+		} else {
+			sock->send_offset += result;
+		}
+		if (!sock->closing && sock->send_result == 0 && sock->send_offset < sock->send_length) {
+			io_loop_io_uring_submit_send(loop, sock);
+			return;
+		}
+	}
+	if (sock->send_wanted && !sock->send_submitted && !(sock->pending & IO_LOOP_PENDING_SEND) && sock->notifications_pending == 0) {
+		sock->send_wanted = 0;
+		if (!sock->closing) {
+			sock->send_callback(sock->data, sock->send_result);
+		}
+	}
+	io_loop_socket_check_closed(sock);
+}
+
+// private
+void io_loop_io_uring_run_once(io_loop *loop) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	if (ring->wake_pending || ring->pending_listeners || ring->pending_first) {
+		io_loop_io_uring_enter(loop, 0, 0);
+		io_loop_io_uring_submit_pending(loop);
+	}
+	uint64_t now = io_loop_now_ns();
+	uint64_t deadline = io_loop_run_timers(loop, now);
+	uint64_t timeout = deadline == UINT64_MAX ? UINT64_MAX : (deadline > now ? deadline - now : 0);
+	// no need to wait when there are already completions to handle, or when the completions have to be handled to make room to submit
+	int wait = timeout > 0 && *ring->cq_head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) && !ring->wake_pending &&
+			   !ring->pending_listeners && !ring->pending_first;
+	if (io_loop_io_uring_enter(loop, wait, timeout)) {
+		return;
+	}
+
+	uint32_t head = *ring->cq_head;
+	uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+		uint64_t user_data = cqe->user_data;
+		int result = cqe->res;
+		uint32_t flags = cqe->flags;
+		// handlers can submit, so free up the entry first
+		head++;
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+		void *pointer = io_loop_untag(user_data);
+		switch (user_data & IO_LOOP_TAG_MASK) {
+		case IO_LOOP_TAG_ACCEPT:
+			io_loop_io_uring_handle_accept(loop, pointer, result, flags);
+			break;
+		case IO_LOOP_TAG_RECV:
+			io_loop_io_uring_handle_recv(loop, pointer, result, flags);
+			break;
+		case IO_LOOP_TAG_SEND:
+			io_loop_io_uring_handle_send(loop, pointer, result, flags);
+			break;
+		case IO_LOOP_TAG_CLOSE:
+			((io_loop_socket *)pointer)->close_submitted = 0;
+			io_loop_socket_check_closed(pointer);
+			break;
+		case IO_LOOP_TAG_WAKE:
+			io_loop_run_posts(loop);
+			if (loop->running) {
+				io_loop_io_uring_submit_wake(loop);
+			}
+			break;
+		default:
+			break;
+		}
+		if (head == tail) {
+			tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		}
+	}
+}
+
+// private
+void io_loop_io_uring_dealloc(io_loop *loop) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	if (ring->ring >= 0) {
+		close(ring->ring);
+		ring->ring = -1;
+	}
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring) {
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	if (ring->buf_ring) {
+		munmap(ring->buf_ring, ring->buf_ring_size);
+	}
+	ring->sqes = NULL;
+	ring->cq_ring = NULL;
+	ring->sq_ring = NULL;
+	ring->buf_ring = NULL;
+}
+
+// private
+int io_loop_io_uring_supports(struct io_uring_probe *probe, int op) {
+	return probe->last_op >= op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+/*
+private
+
+Sets up the rings and provided buffers. Fails if the kernel is missing anything this needs, which is everything in 6.0 and up.
+*/
+int io_loop_io_uring_init(io_loop *loop) {
+	io_loop_io_uring *ring = &loop->io_uring;
+	memset(ring, 0, sizeof(io_loop_io_uring));
+	ring->ring = -1;
+	int result = 0;
+	struct io_uring_probe *probe = NULL;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_TASKRUN_FLAG;
+	params.cq_entries = IO_LOOP_COMPLETION_QUEUE_DEPTH;
+	ring->ring = io_loop_io_uring_setup(IO_LOOP_QUEUE_DEPTH, &params);
+	if (ring->ring < 0 && errno == EINVAL) {
+		// older kernels don't know about the cooperative task running flags
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = IO_LOOP_COMPLETION_QUEUE_DEPTH;
+		ring->ring = io_loop_io_uring_setup(IO_LOOP_QUEUE_DEPTH, &params);
+	}
+	if (ring->ring < 0) {
+		log_debug("io_uring isn't available, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+	if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+		log_debug("io_uring is missing required features\n");
+		result = 1;
+		goto DONE;
+	}
+
+	size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	probe = malloc(probe_size);
+	memset(probe, 0, probe_size);
+	if (io_loop_io_uring_register(ring->ring, IORING_REGISTER_PROBE, probe, 256) < 0 ||
+		!io_loop_io_uring_supports(probe, IORING_OP_ACCEPT) || !io_loop_io_uring_supports(probe, IORING_OP_RECV) ||
+		!io_loop_io_uring_supports(probe, IORING_OP_SEND) || !io_loop_io_uring_supports(probe, IORING_OP_SEND_ZC) ||
+		!io_loop_io_uring_supports(probe, IORING_OP_READ) || !io_loop_io_uring_supports(probe, IORING_OP_CLOSE) ||
+		!io_loop_io_uring_supports(probe, IORING_OP_ASYNC_CANCEL)) {
+		log_debug("io_uring is missing required operations\n");
+		result = 1;
+		goto DONE;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) {
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		log_error("io_uring failed to map the submission queue, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			log_error("io_uring failed to map the completion queue, %s\n", strerror(errno));
+			result = 1;
+			goto DONE;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		log_error("io_uring failed to map the submission queue entries, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+
+	uint8_t *sq = ring->sq_ring;
+	ring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+	ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+	ring->sq_flags = (uint32_t *)(sq + params.sq_off.flags);
+	ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+	ring->sq_entries = *(uint32_t *)(sq + params.sq_off.ring_entries);
+	ring->sq_local_tail = *ring->sq_tail;
+	// entries are always used in order, so the indirection array never changes
+	uint32_t *array = (uint32_t *)(sq + params.sq_off.array);
+	for (uint32_t i = 0; i < ring->sq_entries; i++) {
+		array[i] = i;
+	}
+	uint8_t *cq = ring->cq_ring;
+	ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+	ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+	ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	ring->buf_ring_size = loop->num_buffers * sizeof(struct io_uring_buf);
+	ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->buf_ring == MAP_FAILED) {
+		ring->buf_ring = NULL;
+		log_error("io_uring failed to allocate the buffer ring, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+	reg.ring_entries = loop->num_buffers;
+	reg.bgid = IO_LOOP_BUFFER_GROUP;
+	if (io_loop_io_uring_register(ring->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		log_debug("io_uring doesn't support provided buffer rings, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+	ring->buf_ring_mask = loop->num_buffers - 1;
+	ring->buf_ring_tail = 0;
+	for (size_t i = 0; i < loop->num_buffers; i++) {
+		io_loop_io_uring_recycle_buffer(loop, i);
+	}
+
+	// reads through io_uring only wait on blocking files
+	loop->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (loop->wake_fd < 0) {
+		log_error("io_loop failed to create the wake eventfd, %s\n", strerror(errno));
+		result = 1;
+		goto DONE;
+	}
+	// the queue is empty, so there's always room for this
+	io_loop_io_uring_submit_wake(loop);
+
+DONE:
+	free(probe);
+	if (result) {
+		io_loop_io_uring_dealloc(loop);
+	}
+	return result;
+}
+
+/*
+epoll backend
+*/
+
+// private
+void io_loop_epoll_mark_ready(io_loop *loop, io_loop_socket *sock) {
+	if (sock->ready || sock->closing) {
+		return;
+	}
+	sock->ready = 1;
+	sock->next_ready = NULL;
+	if (loop->epoll.ready_last) {
+		loop->epoll.ready_last->next_ready = sock;
+	} else {
+		loop->epoll.ready_first = sock;
+	}
+	loop->epoll.ready_last = sock;
+}
+
+// private
+void io_loop_epoll_register(io_loop *loop, io_loop_socket *sock) {
+	if (sock->registered) {
+		return;
+	}
+	sock->registered = 1;
+	// assume the socket is ready, if it isn't the first attempt finds out and edge triggering reports when it becomes ready
+	sock->readable = 1;
+	sock->writable = 1;
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.u64 = io_loop_tag(sock, IO_LOOP_TAG_SOCKET);
+	if (epoll_ctl(loop->epoll.epoll, EPOLL_CTL_ADD, sock->socket, &event)) {
+		log_error("io_loop failed to add socket to epoll, %s\n", strerror(errno));
+	}
+}
+
+// private
+void io_loop_epoll_attempt_send(io_loop_socket *sock) {
+	while (sock->send_offset < sock->send_length) {
+		ssize_t sent = send(sock->socket, sock->send_data + sock->send_offset, sock->send_length - sock->send_offset,
+							MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// the rest is sent once EPOLLOUT says there's room
+				sock->writable = 0;
+				return;
+			}
+			sock->send_result = -errno;
+			break;
+		}
+		sock->send_offset += sent;
+	}
+	sock->send_wanted = 0;
+	sock->send_callback(sock->data, sock->send_result);
+}
+
+// private
+void io_loop_epoll_attempt_recv(io_loop *loop, io_loop_socket *sock) {
+	ssize_t received;
+	do {
+		received = recv(sock->socket, loop->buffers, loop->buffer_size, MSG_DONTWAIT);
+	} while (received < 0 && errno == EINTR);
+	if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		sock->readable = 0;
+		return;
+	}
+	if (received > 0 && (size_t)received < loop->buffer_size && !sock->read_closed) {
+		// a short read means the socket is drained, more data arriving is a new edge. Once the peer has shut down its side no more edges
+		// are coming, the next read returns 0, so it stays readable.
+		sock->readable = 0;
+	}
+	sock->recv_wanted = 0;
+	sock->recv_callback(sock->data, loop->buffers, received < 0 ? -errno : (int)received);
+}
+
+// private
+void io_loop_epoll_run_ready(io_loop *loop) {
+	while (loop->epoll.ready_first) {
+		io_loop_socket *sock = loop->epoll.ready_first;
+		loop->epoll.ready_first = sock->next_ready;
+		if (!loop->epoll.ready_first) {
+			loop->epoll.ready_last = NULL;
+		}
+		sock->ready = 0;
+		if (!sock->closing && sock->send_wanted && sock->writable) {
+			io_loop_epoll_attempt_send(sock);
+		}
+		if (!sock->closing && sock->recv_wanted && sock->readable) {
+			io_loop_epoll_attempt_recv(loop, sock);
+		}
+	}
+}
+
+// private
+void io_loop_epoll_accept(io_loop_listener *listener) {
+	for (int i = 0; i < IO_LOOP_MAX_ACCEPTS; i++) {
+		struct sockaddr_storage address;
+		socklen_t address_len = sizeof(address);
+		int accepted = accept4(listener->socket, (struct sockaddr *)&address, &address_len, SOCK_CLOEXEC);
+		if (accepted < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				log_error("io_loop accept failed, %s\n", strerror(errno));
+				metrics_add(io_loop_accept_errors_metric, 1);
+			}
+			return;
+		}
+		metrics_add(io_loop_accepted_metric, 1);
+		listener->callback(listener->data, accepted, (struct sockaddr *)&address);
+	}
+}
+
+// private
+void io_loop_epoll_run_once(io_loop *loop) {
+	uint64_t now = io_loop_now_ns();
+	uint64_t deadline = io_loop_run_timers(loop, now);
+	int timeout_ms;
+	if (loop->epoll.ready_first || loop->epoll.closed_first || deadline <= now) {
+		timeout_ms = 0;
+	} else if (deadline == UINT64_MAX) {
+		timeout_ms = -1;
+	} else {
+		// round up so a timer isn't woken for early and then spun on
+		uint64_t ms = (deadline - now + 999999) / 1000000;
+		timeout_ms = ms > INT32_MAX ? INT32_MAX : (int)ms;
+	}
+
+	struct epoll_event events[IO_LOOP_MAX_EVENTS];
+	int num_events = epoll_wait(loop->epoll.epoll, events, IO_LOOP_MAX_EVENTS, timeout_ms);
+	if (num_events < 0 && errno != EINTR) {
+		log_error("epoll_wait failed, %s\n", strerror(errno));
+	}
+	for (int i = 0; i < num_events; i++) {
+		uint64_t user_data = events[i].data.u64;
+		uint32_t flags = events[i].events;
+		void *pointer = io_loop_untag(user_data);
+		switch (user_data & IO_LOOP_TAG_MASK) {
+		case IO_LOOP_TAG_ACCEPT:
+			io_loop_epoll_accept(pointer);
+			break;
+		case IO_LOOP_TAG_WAKE: {
+			uint64_t value;
+			if (read(loop->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+				log_error("io_loop failed to read the wake eventfd, %s\n", strerror(errno));
+			}
+			io_loop_run_posts(loop);
+			break;
+		}
+		case IO_LOOP_TAG_SOCKET: {
+			io_loop_socket *sock = pointer;
+			if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+				sock->readable = 1;
+			}
+			if (flags & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+				sock->read_closed = 1;
+			}
+			if (flags & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+				sock->writable = 1;
+			}
+			if ((sock->recv_wanted && sock->readable) || (sock->send_wanted && sock->writable)) {
+				io_loop_epoll_mark_ready(loop, sock);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	io_loop_epoll_run_ready(loop);
+
+	// only now is nothing left that could refer to the closed sockets
+	while (loop->epoll.closed_first) {
+		io_loop_socket *sock = loop->epoll.closed_first;
+		loop->epoll.closed_first = sock->next_closed;
+		sock->closing = 0;
+		sock->closed_callback(sock->data);
+	}
+}
+
+// private
+void io_loop_epoll_dealloc(io_loop *loop) {
+	if (loop->epoll.epoll >= 0) {
+		close(loop->epoll.epoll);
+		loop->epoll.epoll = -1;
+	}
+}
+
+// private
+int io_loop_epoll_init(io_loop *loop) {
+	memset(&loop->epoll, 0, sizeof(io_loop_epoll));
+	loop->epoll.epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll.epoll < 0) {
+		log_error("io_loop failed to create epoll, %s\n", strerror(errno));
+		return 1;
+	}
+	loop->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (loop->wake_fd < 0) {
+		log_error("io_loop failed to create the wake eventfd, %s\n", strerror(errno));
+		io_loop_epoll_dealloc(loop);
+		return 1;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u64 = io_loop_tag(NULL, IO_LOOP_TAG_WAKE);
+	if (epoll_ctl(loop->epoll.epoll, EPOLL_CTL_ADD, loop->wake_fd, &event)) {
+		log_error("io_loop failed to add the wake eventfd to epoll, %s\n", strerror(errno));
+		io_loop_epoll_dealloc(loop);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+public
+*/
+
+int io_loop_init(io_loop *loop, io_loop_backend backend, size_t buffer_size, size_t num_buffers) {
+	pthread_once(&io_loop_metrics_once, io_loop_register_metrics);
+	memset(loop, 0, sizeof(io_loop));
+	loop->wake_fd = -1;
+	if (buffer_size == 0 || buffer_size > INT32_MAX) {
+		log_error("io_loop_init failed, invalid buffer size %zu\n", buffer_size);
+		return 1;
+	}
+	if (num_buffers == 0 || num_buffers > 32768 || (num_buffers & (num_buffers - 1))) {
+		log_error("io_loop_init failed, the number of buffers has to be a power of 2 up to 32768, got %zu\n", num_buffers);
+		return 1;
+	}
+	loop->buffer_size = buffer_size;
+	loop->num_buffers = num_buffers;
+	if (pthread_mutex_init(&loop->post_mutex, NULL)) {
+		log_error("io_loop_init failed, failed to create the post mutex\n");
+		return 1;
+	}
+
+	if (backend == IO_LOOP_BACKEND_AUTO || backend == IO_LOOP_BACKEND_IO_URING) {
+		loop->buffers = malloc(buffer_size * num_buffers);
+		if (loop->buffers && io_loop_io_uring_init(loop) == 0) {
+			loop->backend = IO_LOOP_BACKEND_IO_URING;
+			log_trace("io_loop_init using io_uring\n");
+			return 0;
+		}
+		free(loop->buffers);
+		loop->buffers = NULL;
+		if (backend == IO_LOOP_BACKEND_IO_URING) {
+			log_error("io_loop_init failed, io_uring isn't available\n");
+			pthread_mutex_destroy(&loop->post_mutex);
+			return 1;
+		}
+	}
+
+	// epoll only ever needs one buffer since the receive callback runs straight after each receive
+	loop->buffers = malloc(buffer_size);
+	if (!loop->buffers || io_loop_epoll_init(loop)) {
+		log_error("io_loop_init failed, failed to set up epoll\n");
+		free(loop->buffers);
+		loop->buffers = NULL;
+		pthread_mutex_destroy(&loop->post_mutex);
+		return 1;
+	}
+	loop->backend = IO_LOOP_BACKEND_EPOLL;
+	log_trace("io_loop_init using epoll\n");
+	return 0;
+}
+
+void io_loop_dealloc(io_loop *loop) {
+	io_loop_stop(loop);
+	if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+		io_loop_io_uring_dealloc(loop);
+	} else {
+		io_loop_epoll_dealloc(loop);
+	}
+	if (loop->wake_fd >= 0) {
+		close(loop->wake_fd);
+		loop->wake_fd = -1;
+	}
+	free(loop->buffers);
+	loop->buffers = NULL;
+	pthread_mutex_destroy(&loop->post_mutex);
+}
+
+io_loop_backend io_loop_get_backend(io_loop *loop) {
+	return loop->backend;
+}
+
+char *io_loop_backend_get_name(io_loop_backend backend) {
+	switch (backend) {
+	case IO_LOOP_BACKEND_AUTO:
+		return "auto";
+	case IO_LOOP_BACKEND_EPOLL:
+		return "epoll";
+	case IO_LOOP_BACKEND_IO_URING:
+		return "io_uring";
+	}
+	return "unknown";
+}
+
+int io_loop_backend_parse_cstr(char *name, io_loop_backend *backend) {
+	if (!strcmp(name, "auto")) {
+		*backend = IO_LOOP_BACKEND_AUTO;
+	} else if (!strcmp(name, "epoll")) {
+		*backend = IO_LOOP_BACKEND_EPOLL;
+	} else if (!strcmp(name, "io_uring")) {
+		*backend = IO_LOOP_BACKEND_IO_URING;
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+void io_loop_set_timer_callback(io_loop *loop, io_loop_timer_callback callback, void *data) {
+	loop->timer_callback = callback;
+	loop->timer_data = data;
+}
+
+// private
+void *io_loop_thread(void *data) {
+	io_loop *loop = data;
+	log_trace("io_loop_thread start, %s\n", io_loop_backend_get_name(loop->backend));
+	while (loop->running) {
+		if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+			io_loop_io_uring_run_once(loop);
+		} else {
+			io_loop_epoll_run_once(loop);
+		}
+	}
+	log_trace("io_loop_thread done\n");
+	return NULL;
+}
+
+int io_loop_start(io_loop *loop) {
+	loop->running = 1;
+	if (pthread_create(&loop->thread, NULL, io_loop_thread, loop)) {
+		log_error("io_loop_start failed, failed to make thread\n");
+		loop->running = 0;
+		return 1;
+	}
+	loop->thread_is_init = 1;
+	return 0;
+}
+
+void io_loop_stop(io_loop *loop) {
+	if (!loop->thread_is_init) {
+		return;
+	}
+	loop->running = 0;
+	uint64_t one = 1;
+	if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+		log_error("io_loop_stop failed to wake the loop, %s\n", strerror(errno));
+	}
+	void *result;
+	if (pthread_join(loop->thread, &result)) {
+		log_error("io_loop_stop failed, pthread_join failed\n");
+	}
+	loop->thread_is_init = 0;
+}
+
+void io_loop_post(io_loop *loop, io_loop_post_task *task, io_loop_post_callback callback, void *data) {
+	task->next = NULL;
+	task->callback = callback;
+	task->data = data;
+	pthread_mutex_lock(&loop->post_mutex);
+	// if there's already something queued the loop has been woken and hasn't taken the queue yet
+	int was_empty = loop->post_first == NULL;
+	if (loop->post_last) {
+		loop->post_last->next = task;
+	} else {
+		loop->post_first = task;
+	}
+	loop->post_last = task;
+	pthread_mutex_unlock(&loop->post_mutex);
+	if (was_empty) {
+		uint64_t one = 1;
+		if (write(loop->wake_fd, &one, sizeof(one)) < 0) {
+			log_error("io_loop_post failed to wake the loop, %s\n", strerror(errno));
+		}
+	}
+}
+
+int io_loop_accept(io_loop *loop, io_loop_listener *listener, int socket, io_loop_accept_callback callback, void *data) {
+	listener->socket = socket;
+	listener->callback = callback;
+	listener->data = data;
+	if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+		io_loop_io_uring_submit_accept(loop, listener);
+		return 0;
+	}
+	// accepts are attempted until they'd block, the accepted sockets don't inherit this
+	int flags = fcntl(socket, F_GETFL);
+	if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+		log_error("io_loop_accept failed, failed to make the socket non-blocking, %s\n", strerror(errno));
+		return 1;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.u64 = io_loop_tag(listener, IO_LOOP_TAG_ACCEPT);
+	if (epoll_ctl(loop->epoll.epoll, EPOLL_CTL_ADD, socket, &event)) {
+		log_error("io_loop_accept failed, failed to add the socket to epoll, %s\n", strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+void io_loop_socket_init(io_loop_socket *sock, int socket, io_loop_recv_callback recv_callback, io_loop_send_callback send_callback,
+						 io_loop_closed_callback closed_callback, void *data) {
+	memset(sock, 0, sizeof(io_loop_socket));
+	sock->socket = socket;
+	sock->recv_callback = recv_callback;
+	sock->send_callback = send_callback;
+	sock->closed_callback = closed_callback;
+	sock->data = data;
+}
+
+void io_loop_recv(io_loop *loop, io_loop_socket *sock) {
+	if (sock->closing || sock->recv_wanted) {
+		return;
+	}
+	sock->recv_wanted = 1;
+	if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+		io_loop_io_uring_submit_recv(loop, sock);
+		return;
+	}
+	io_loop_epoll_register(loop, sock);
+	if (sock->readable) {
+		io_loop_epoll_mark_ready(loop, sock);
+	}
+}
+
+void io_loop_send(io_loop *loop, io_loop_socket *sock, uint8_t *data, size_t length) {
+	if (sock->closing || sock->send_wanted) {
+		return;
+	}
+	sock->send_wanted = 1;
+	sock->send_data = data;
+	sock->send_length = length;
+	sock->send_offset = 0;
+	sock->send_result = 0;
+	if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+		io_loop_io_uring_submit_send(loop, sock);
+		return;
+	}
+	io_loop_epoll_register(loop, sock);
+	if (sock->writable) {
+		io_loop_epoll_mark_ready(loop, sock);
+	}
+}
+
+void io_loop_close(io_loop *loop, io_loop_socket *sock) {
+	if (sock->closing) {
+		return;
+	}
+	sock->closing = 1;
+	sock->recv_wanted = 0;
+	sock->send_wanted = 0;
+	if (loop->backend == IO_LOOP_BACKEND_IO_URING) {
+		// anything still waiting to be submitted would only be cancelled
+		sock->pending &= ~(IO_LOOP_PENDING_RECV | IO_LOOP_PENDING_SEND);
+		// set even while the close is waiting to be submitted, so the closed callback waits for it
+		sock->close_submitted = 1;
+		io_loop_io_uring_submit_close(loop, sock);
+		return;
+	}
+	// closing also removes it from epoll
+	if (close(sock->socket)) {
+		log_error("io_loop_close failed to close socket, %s\n", strerror(errno));
+	}
+	sock->next_closed = loop->epoll.closed_first;
+	loop->epoll.closed_first = sock;
+}
@@ -0,0 +1,253 @@
+/*
+An event loop that runs socket I/O on a single thread, using io_uring when the kernel supports what's needed and epoll otherwise.
+
+Operations are started with io_loop_accept, io_loop_recv, io_loop_send and io_loop_close and complete by calling back on the loop thread.
+They can only be started from the loop thread, i.e. from inside a callback, or before io_loop_start. Other threads hand work to the loop
+with io_loop_post.
+
+With io_uring every operation started while handling one batch of completions is submitted together with a single io_uring_enter, which also
+waits for the next completions. Accepts are multishot so one submission accepts every connection, receives pick a buffer from a ring of
+provided buffers so no memory is tied up in idle connections, and large sends are zero copy.
+
+With epoll sockets are registered edge triggered once, operations are attempted directly with non-blocking calls, and only wait on epoll
+when they'd block.
+
+References:
+https://kernel.dk/io_uring.pdf
+https://man7.org/linux/man-pages/man7/io_uring.7.html
+*/
+
+#ifndef io_loop_h
+#define io_loop_h
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	// io_uring if available, otherwise epoll
+	IO_LOOP_BACKEND_AUTO = 0,
+	IO_LOOP_BACKEND_EPOLL = 1,
+	IO_LOOP_BACKEND_IO_URING = 2
+} io_loop_backend;
+
+// sends at least this big use zero copy, below it copying is cheaper than pinning pages and waiting on the extra notification
+#define IO_LOOP_ZERO_COPY_MIN_SIZE 16384
+
+/**
+ * @param socket the accepted socket, owned by the callback
+ * @param address where the connection came from, NULL when the backend doesn't report it
+ */
+typedef void (*io_loop_accept_callback)(void *data, int socket, struct sockaddr *address);
+/**
+ * @param bytes only valid for the duration of the callback
+ * @param result the number of bytes received, 0 when the peer closed the connection, or a negative errno
+ */
+typedef void (*io_loop_recv_callback)(void *data, uint8_t *bytes, int result);
+/**
+ * @param result 0 once everything has been sent and the data can be reused, or a negative errno
+ */
+typedef void (*io_loop_send_callback)(void *data, int result);
+/**
+ * Called once the socket is closed and no operations on it are outstanding, so it can be freed.
+ */
+typedef void (*io_loop_closed_callback)(void *data);
+/**
+ * Called every iteration of the loop.
+ * @param now_ns the current CLOCK_MONOTONIC time
+ * @returns the CLOCK_MONOTONIC time in ns to be called again by, UINT64_MAX if there's nothing waiting
+ */
+typedef uint64_t (*io_loop_timer_callback)(void *data, uint64_t now_ns);
+typedef void (*io_loop_post_callback)(void *data);
+
+typedef struct io_loop_listener {
+	int socket;
+	io_loop_accept_callback callback;
+	void *data;
+	// the rest is private to the loop, io_uring only, set while the accept is waiting for room in the submission queue
+	struct io_loop_listener *next_pending;
+	uint8_t pending;
+} io_loop_listener;
+
+typedef struct io_loop_socket {
+	int socket;
+	io_loop_recv_callback recv_callback;
+	io_loop_send_callback send_callback;
+	io_loop_closed_callback closed_callback;
+	void *data;
+	// the rest is private to the loop
+	// with epoll the sockets with an operation that can be attempted, with io_uring the ones waiting for room in the submission queue
+	struct io_loop_socket *next_ready;
+	struct io_loop_socket *next_closed;
+	uint8_t *send_data;
+	size_t send_length;
+	size_t send_offset;
+	int send_result;
+	// operations started and not completed yet
+	uint8_t recv_wanted;
+	uint8_t send_wanted;
+	// io_uring submissions not completed yet, zero copy sends have a notification as well as a result
+	uint8_t recv_submitted;
+	uint8_t send_submitted;
+	uint32_t notifications_pending;
+	uint8_t closing;
+	uint8_t close_submitted;
+	// io_uring operations that couldn't get a submission queue entry yet, IO_LOOP_PENDING_ flags
+	uint8_t pending;
+	// epoll state
+	uint8_t registered;
+	uint8_t readable;
+	uint8_t writable;
+	// the peer shut down its side, reads return what's left and then 0 without waiting, and there's no edge left to wait for
+	uint8_t read_closed;
+	// on the list through next_ready
+	uint8_t ready;
+} io_loop_socket;
+
+// lets other threads run something on the loop thread without allocating, owned by the caller until the callback runs
+typedef struct io_loop_post_task {
+	struct io_loop_post_task *next;
+	io_loop_post_callback callback;
+	void *data;
+} io_loop_post_task;
+
+typedef struct io_loop_io_uring {
+	int ring;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_flags;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	// tail as far as queued entries go, published to the kernel on submit
+	uint32_t sq_local_tail;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	// provided receive buffers
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	uint32_t buf_ring_mask;
+	uint16_t buf_ring_tail;
+	// the loop keeps a read on the wake eventfd submitted at all times
+	uint64_t wake_value;
+	// operations that couldn't get a submission queue entry, submitted once there's room rather than lost
+	int wake_pending;
+	io_loop_listener *pending_listeners;
+	io_loop_socket *pending_first;
+	io_loop_socket *pending_last;
+} io_loop_io_uring;
+
+typedef struct io_loop_epoll {
+	int epoll;
+	// sockets with an operation that can be attempted without waiting
+	io_loop_socket *ready_first;
+	io_loop_socket *ready_last;
+	// sockets that were closed and need their closed callback
+	io_loop_socket *closed_first;
+} io_loop_epoll;
+
+typedef struct io_loop {
+	io_loop_backend backend;
+	size_t buffer_size;
+	size_t num_buffers;
+	uint8_t *buffers;
+	int wake_fd;
+
+	io_loop_timer_callback timer_callback;
+	void *timer_data;
+
+	pthread_mutex_t post_mutex;
+	io_loop_post_task *post_first;
+	io_loop_post_task *post_last;
+
+	pthread_t thread;
+	int thread_is_init;
+	volatile int running;
+
+	union {
+		io_loop_io_uring io_uring;
+		io_loop_epoll epoll;
+	};
+} io_loop;
+
+/**
+ * @param backend which backend to use, IO_LOOP_BACKEND_AUTO falls back to epoll when io_uring isn't usable
+ * @param buffer_size the most that's received at once
+ * @param num_buffers how many receives can complete before the receive callbacks run, a power of 2, only used by io_uring
+ * @returns 0 on success, non-0 if the requested backend isn't available or on any other error
+ */
+int io_loop_init(io_loop *loop, io_loop_backend backend, size_t buffer_size, size_t num_buffers);
+/**
+ * Stops the loop if it's running. Sockets that weren't closed don't get their closed callback, and aren't closed.
+ */
+void io_loop_dealloc(io_loop *loop);
+io_loop_backend io_loop_get_backend(io_loop *loop);
+char *io_loop_backend_get_name(io_loop_backend backend);
+/**
+ * @param name "auto", "epoll" or "io_uring"
+ * @returns 0 on success, non-0 if the name isn't a backend
+ */
+int io_loop_backend_parse_cstr(char *name, io_loop_backend *backend);
+
+/**
+ * @param callback optional, called every iteration to run timers
+ */
+void io_loop_set_timer_callback(io_loop *loop, io_loop_timer_callback callback, void *data);
+
+/**
+ * Runs the loop on a new thread.
+ * @returns 0 on success, non-0 on failure
+ */
+int io_loop_start(io_loop *loop);
+/**
+ * Stops the loop and waits for its thread to exit. Nothing is cancelled, so the loop can't be started again.
+ */
+void io_loop_stop(io_loop *loop);
+/**
+ * Runs callback on the loop thread. Can be called from any thread.
+ */
+void io_loop_post(io_loop *loop, io_loop_post_task *task, io_loop_post_callback callback, void *data);
+
+/**
+ * Accepts connections on the listening socket until the loop is stopped, calling back for each.
+ * @returns 0 on success, non-0 on failure
+ */
+int io_loop_accept(io_loop *loop, io_loop_listener *listener, int socket, io_loop_accept_callback callback, void *data);
+
+void io_loop_socket_init(io_loop_socket *sock, int socket, io_loop_recv_callback recv_callback, io_loop_send_callback send_callback,
+						 io_loop_closed_callback closed_callback, void *data);
+/**
+ * Receives the next chunk of data, up to the loop's buffer size. Only one receive can be outstanding on a socket at once.
+ */
+void io_loop_recv(io_loop *loop, io_loop_socket *sock);
+/**
+ * Sends all of data, which has to stay valid until the send callback. Only one send can be outstanding on a socket at once.
+ */
+void io_loop_send(io_loop *loop, io_loop_socket *sock, uint8_t *data, size_t length);
+/**
+ * Cancels anything outstanding and closes the socket. The closed callback runs once the socket can be freed.
+ */
+void io_loop_close(io_loop *loop, io_loop_socket *sock);
+
+/**
+ * @returns the current CLOCK_MONOTONIC time in ns
+ */
+uint64_t io_loop_now_ns();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1076 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "json.h"
+#include "log.h"
+
+#define JSON_ARENA_MIN_BLOCK_SIZE 4096
+// numbers longer than this are definitely not going to parse into anything useful
+#define JSON_MAX_NUMBER_LENGTH 512
+
+typedef struct {
+	int in_string;
+	// the position of the character following a backslash inside a string
+	size_t escaped_position;
+	// whether the byte before the current position was whitespace or structural, i.e. whether a scalar value could start here
+	uint32_t prev_is_separator;
+} json_stage1_state;
+
+// private
+int json_is_whitespace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// private
+int json_is_operator(char c) {
+	return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+// private
+void json_document_arena_reset(json_document *doc) {
+	for (json_arena_block *block = doc->arena_first; block; block = block->next) {
+		block->length = 0;
+	}
+	doc->arena_current = doc->arena_first;
+}
+
+// private
+char *json_document_arena_alloc(json_document *doc, size_t size) {
+	json_arena_block *last = NULL;
+	for (json_arena_block *block = doc->arena_current; block; block = block->next) {
+		if (block->capacity - block->length >= size) {
+			doc->arena_current = block;
+			char *result = (char *)block->data + block->length;
+			block->length += size;
+			return result;
+		}
+		last = block;
+	}
+	size_t capacity = JSON_ARENA_MIN_BLOCK_SIZE;
+	if (last && last->capacity * 2 > capacity) {
+		capacity = last->capacity * 2;
+	}
+	if (size > capacity) {
+		capacity = size;
+	}
+	json_arena_block *block = malloc(sizeof(json_arena_block) + capacity);
+	block->next = NULL;
+	block->capacity = capacity;
+	block->length = size;
+	if (last) {
+		last->next = block;
+	} else {
+		doc->arena_first = block;
+	}
+	doc->arena_current = block;
+	return (char *)block->data;
+}
+
+// private
+void json_document_reserve_structurals(json_document *doc, size_t num_structurals) {
+	size_t needed = num_structurals * sizeof(json_structural);
+	size_t capacity = buffer_get_capacity(&doc->structurals);
+	if (needed > capacity) {
+		// grow geometrically, this is called once per block of input
+		buffer_ensure_capacity(&doc->structurals, needed > capacity * 2 ? needed : capacity * 2);
+	}
+}
+
+// private
+json_structural *json_document_get_structural(json_document *doc, size_t index) {
+	return ((json_structural *)doc->structurals.data) + index;
+}
+
+// private
+char json_document_get_char(json_document *doc, size_t index) {
+	return doc->input[json_document_get_structural(doc, index)->position];
+}
+
+/*
+private
+
+Handles a single interesting character found in the first pass. Everything inside strings except for quotes and escapes is ignored, anything
+else gets a new entry in the index.
+*/
+int json_stage1_visit(json_document *doc, json_stage1_state *state, size_t position) {
+	char c = doc->input[position];
+	if (state->in_string) {
+		if (position == state->escaped_position) {
+			return 0;
+		}
+		if (c == '\\') {
+			state->escaped_position = position + 1;
+		} else if (c == '"') {
+			state->in_string = 0;
+		}
+		return 0;
+	}
+
+	uint32_t index = doc->num_structurals;
+	json_structural *s = json_document_get_structural(doc, index);
+	s->position = position;
+	s->match = 0;
+	doc->num_structurals++;
+
+	switch (c) {
+	case '"':
+		state->in_string = 1;
+		break;
+	case '{':
+	case '[':
+		buffer_append_bytes(&doc->stack, &index, sizeof(uint32_t));
+		break;
+	case '}':
+	case ']': {
+		size_t stack_len = buffer_get_length(&doc->stack);
+		if (stack_len == 0) {
+			log_error("json_document_parse failed, unexpected %c at %zu\n", c, position);
+			return 1;
+		}
+		uint32_t open_index = *(uint32_t *)(doc->stack.data + stack_len - sizeof(uint32_t));
+		buffer_set_length(&doc->stack, stack_len - sizeof(uint32_t));
+		char open = json_document_get_char(doc, open_index);
+		if ((c == '}' && open != '{') || (c == ']' && open != '[')) {
+			log_error("json_document_parse failed, mismatched %c at %zu\n", c, position);
+			return 1;
+		}
+		json_document_get_structural(doc, open_index)->match = index;
+		s->match = open_index;
+		break;
+	}
+	}
+	return 0;
+}
+
+void json_document_init(json_document *doc) {
+	doc->input = NULL;
+	doc->input_len = 0;
+	buffer_init(&doc->structurals);
+	doc->num_structurals = 0;
+	buffer_init(&doc->stack);
+	doc->arena_first = NULL;
+	doc->arena_current = NULL;
+}
+
+void json_document_dealloc(json_document *doc) {
+	buffer_dealloc(&doc->structurals);
+	buffer_dealloc(&doc->stack);
+	while (doc->arena_first) {
+		json_arena_block *block = doc->arena_first;
+		doc->arena_first = block->next;
+		free(block);
+	}
+	doc->arena_current = NULL;
+}
+
+int json_document_parse(json_document *doc, char *input, size_t input_len) {
+	if (input_len >= UINT32_MAX) {
+		log_error("json_document_parse failed, input is too large %zu\n", input_len);
+		return 1;
+	}
+	doc->input = input;
+	doc->input_len = input_len;
+	doc->num_structurals = 0;
+	buffer_clear(&doc->stack);
+	json_document_arena_reset(doc);
+
+	json_stage1_state state;
+	state.in_string = 0;
+	state.escaped_position = -1;
+	// the start of the input is as good as whitespace
+	state.prev_is_separator = 1;
+
+	size_t i = 0;
+#ifdef __SSE2__
+	__m128i quote_char = _mm_set1_epi8('"');
+	__m128i backslash_char = _mm_set1_epi8('\\');
+	__m128i open_brace_char = _mm_set1_epi8('{');
+	__m128i close_brace_char = _mm_set1_epi8('}');
+	__m128i open_bracket_char = _mm_set1_epi8('[');
+	__m128i close_bracket_char = _mm_set1_epi8(']');
+	__m128i colon_char = _mm_set1_epi8(':');
+	__m128i comma_char = _mm_set1_epi8(',');
+	__m128i space_char = _mm_set1_epi8(' ');
+	__m128i tab_char = _mm_set1_epi8('\t');
+	__m128i newline_char = _mm_set1_epi8('\n');
+	__m128i carriage_return_char = _mm_set1_epi8('\r');
+	for (; i + 16 <= input_len; i += 16) {
+		// every block can add at most one entry per byte
+		json_document_reserve_structurals(doc, doc->num_structurals + 16);
+
+		__m128i v = _mm_loadu_si128((__m128i *)(input + i));
+		uint32_t quote = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote_char));
+		uint32_t backslash = _mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash_char));
+		__m128i op_v = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, open_brace_char), _mm_cmpeq_epi8(v, close_brace_char)),
+									_mm_or_si128(_mm_cmpeq_epi8(v, open_bracket_char), _mm_cmpeq_epi8(v, close_bracket_char)));
+		op_v = _mm_or_si128(op_v, _mm_or_si128(_mm_cmpeq_epi8(v, colon_char), _mm_cmpeq_epi8(v, comma_char)));
+		uint32_t op = _mm_movemask_epi8(op_v);
+		__m128i ws_v = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space_char), _mm_cmpeq_epi8(v, tab_char)),
+									_mm_or_si128(_mm_cmpeq_epi8(v, newline_char), _mm_cmpeq_epi8(v, carriage_return_char)));
+		uint32_t ws = _mm_movemask_epi8(ws_v);
+
+		// a scalar starts at any other character that follows whitespace or an operator
+		uint32_t separator = op | ws;
+		uint32_t scalar_start = ~(separator | quote) & ((separator << 1) | state.prev_is_separator) & 0xffff;
+		state.prev_is_separator = (separator >> 15) & 1;
+
+		uint32_t mask = quote | backslash | op | scalar_start;
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			mask &= mask - 1;
+			if (json_stage1_visit(doc, &state, i + bit)) {
+				return 1;
+			}
+		}
+	}
+#endif
+	// anything left over that didn't fit in a full block, or everything if there's no SIMD available
+	json_document_reserve_structurals(doc, doc->num_structurals + (input_len - i));
+	for (; i < input_len; i++) {
+		char c = input[i];
+		uint32_t is_separator = json_is_whitespace(c) || json_is_operator(c);
+		int is_scalar_start = !is_separator && c != '"' && state.prev_is_separator;
+		state.prev_is_separator = is_separator;
+		if (c == '"' || c == '\\' || json_is_operator(c) || is_scalar_start) {
+			if (json_stage1_visit(doc, &state, i)) {
+				return 1;
+			}
+		}
+	}
+
+	if (state.in_string) {
+		log_error("json_document_parse failed, unterminated string\n");
+		return 1;
+	}
+	if (buffer_get_length(&doc->stack) > 0) {
+		log_error("json_document_parse failed, unclosed object or array\n");
+		return 1;
+	}
+	buffer_set_length(&doc->structurals, doc->num_structurals * sizeof(json_structural));
+	return 0;
+}
+
+// private
+size_t json_document_skip(json_document *doc, size_t index) {
+	char c = json_document_get_char(doc, index);
+	if (c == '{' || c == '[') {
+		return json_document_get_structural(doc, index)->match + 1;
+	}
+	return index + 1;
+}
+
+int json_document_get_root(json_document *doc, json_value *value) {
+	if (doc->num_structurals == 0) {
+		return 1;
+	}
+	value->doc = doc;
+	value->index = 0;
+	if (json_document_skip(doc, 0) != doc->num_structurals) {
+		return 1;
+	}
+	return 0;
+}
+
+json_type json_value_get_type(json_value *value) {
+	switch (json_document_get_char(value->doc, value->index)) {
+	case '{':
+		return JSON_TYPE_OBJECT;
+	case '[':
+		return JSON_TYPE_ARRAY;
+	case '"':
+		return JSON_TYPE_STRING;
+	case 't':
+		return JSON_TYPE_TRUE;
+	case 'f':
+		return JSON_TYPE_FALSE;
+	case 'n':
+		return JSON_TYPE_NULL;
+	case '-':
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		return JSON_TYPE_NUMBER;
+	default:
+		return JSON_TYPE_INVALID;
+	}
+}
+
+int json_value_iterate(json_value *value, json_iterator *it) {
+	char c = json_document_get_char(value->doc, value->index);
+	if (c != '{' && c != '[') {
+		return 1;
+	}
+	it->doc = value->doc;
+	it->is_object = c == '{';
+	it->index = value->index + 1;
+	it->end = json_document_get_structural(value->doc, value->index)->match;
+	return 0;
+}
+
+int json_iterator_next(json_iterator *it, json_value *key, json_value *value) {
+	if (it->index == it->end) {
+		return 0;
+	}
+	json_document *doc = it->doc;
+	size_t index = it->index;
+	if (it->is_object) {
+		if (json_document_get_char(doc, index) != '"' || index + 1 >= it->end || json_document_get_char(doc, index + 1) != ':') {
+			log_error("json_iterator_next failed, expected a member name at %u\n", json_document_get_structural(doc, index)->position);
+			return -1;
+		}
+		if (key) {
+			key->doc = doc;
+			key->index = index;
+		}
+		index += 2;
+		if (index >= it->end) {
+			log_error("json_iterator_next failed, member is missing a value\n");
+			return -1;
+		}
+	}
+	char c = json_document_get_char(doc, index);
+	if (c == ',' || c == ':' || c == '}' || c == ']') {
+		log_error("json_iterator_next failed, unexpected %c at %u\n", c, json_document_get_structural(doc, index)->position);
+		return -1;
+	}
+	value->doc = doc;
+	value->index = index;
+
+	// find the start of the next element
+	index = json_document_skip(doc, index);
+	if (index == it->end) {
+		it->index = index;
+	} else if (json_document_get_char(doc, index) == ',' && index + 1 < it->end) {
+		it->index = index + 1;
+	} else {
+		log_error("json_iterator_next failed, expected , at %u\n", json_document_get_structural(doc, index)->position);
+		return -1;
+	}
+	return 1;
+}
+
+int json_value_object_get_cstr(json_value *object, char *key, json_value *value) {
+	json_iterator it;
+	if (json_value_iterate(object, &it) || !it.is_object) {
+		return 1;
+	}
+	size_t key_len = strlen(key);
+	json_value k;
+	while (1) {
+		int result = json_iterator_next(&it, &k, value);
+		if (result <= 0) {
+			return 1;
+		}
+		char *k_str;
+		size_t k_len;
+		if (json_value_get_cstr_len(&k, &k_str, &k_len)) {
+			return 1;
+		}
+		if (k_len == key_len && !memcmp(k_str, key, key_len)) {
+			return 0;
+		}
+	}
+}
+
+// private
+int json_parse_hex4(char *src, uint32_t *dst) {
+	uint32_t result = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = src[i];
+		result <<= 4;
+		if (c >= '0' && c <= '9') {
+			result |= c - '0';
+		} else if (c >= 'a' && c <= 'f') {
+			result |= c - 'a' + 10;
+		} else if (c >= 'A' && c <= 'F') {
+			result |= c - 'A' + 10;
+		} else {
+			return 1;
+		}
+	}
+	*dst = result;
+	return 0;
+}
+
+/*
+private
+
+Decodes the escape sequences in src. dst must have room for at least src_len bytes, since no escape sequence is shorter than what it
+decodes to.
+
+Returns the decoded length, or -1 on bad escape sequences.
+*/
+size_t json_unescape(char *dst, char *src, size_t src_len) {
+	char *dst_start = dst;
+	char *end = src + src_len;
+	while (src < end) {
+		char *backslash = memchr(src, '\\', end - src);
+		if (!backslash) {
+			memcpy(dst, src, end - src);
+			dst += end - src;
+			break;
+		}
+		memcpy(dst, src, backslash - src);
+		dst += backslash - src;
+		src = backslash + 1;
+		if (src >= end) {
+			return -1;
+		}
+		switch (*src) {
+		case '"':
+		case '\\':
+		case '/':
+			*dst++ = *src++;
+			break;
+		case 'b':
+			*dst++ = '\b';
+			src++;
+			break;
+		case 'f':
+			*dst++ = '\f';
+			src++;
+			break;
+		case 'n':
+			*dst++ = '\n';
+			src++;
+			break;
+		case 'r':
+			*dst++ = '\r';
+			src++;
+			break;
+		case 't':
+			*dst++ = '\t';
+			src++;
+			break;
+		case 'u': {
+			uint32_t code_point;
+			if (end - src < 5 || json_parse_hex4(src + 1, &code_point)) {
+				return -1;
+			}
+			src += 5;
+			if (code_point >= 0xd800 && code_point <= 0xdbff) {
+				// high surrogate, has to be followed by a low surrogate
+				uint32_t low;
+				if (end - src < 6 || src[0] != '\\' || src[1] != 'u' || json_parse_hex4(src + 2, &low) || low < 0xdc00 || low > 0xdfff) {
+					return -1;
+				}
+				src += 6;
+				code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+			} else if (code_point >= 0xdc00 && code_point <= 0xdfff) {
+				return -1;
+			}
+			if (code_point < 0x80) {
+				*dst++ = code_point;
+			} else if (code_point < 0x800) {
+				*dst++ = 0xc0 | (code_point >> 6);
+				*dst++ = 0x80 | (code_point & 0x3f);
+			} else if (code_point < 0x10000) {
+				*dst++ = 0xe0 | (code_point >> 12);
+				*dst++ = 0x80 | ((code_point >> 6) & 0x3f);
+				*dst++ = 0x80 | (code_point & 0x3f);
+			} else {
+				*dst++ = 0xf0 | (code_point >> 18);
+				*dst++ = 0x80 | ((code_point >> 12) & 0x3f);
+				*dst++ = 0x80 | ((code_point >> 6) & 0x3f);
+				*dst++ = 0x80 | (code_point & 0x3f);
+			}
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+	return dst - dst_start;
+}
+
+int json_value_get_cstr_len(json_value *value, char **dst, size_t *dst_len) {
+	json_document *doc = value->doc;
+	size_t start = json_document_get_structural(doc, value->index)->position;
+	if (doc->input[start] != '"') {
+		return 1;
+	}
+	start++;
+
+	// find the closing quote, skipping any that are escaped
+	char *input = doc->input;
+	size_t end = start;
+	while (1) {
+		char *quote = memchr(input + end, '"', doc->input_len - end);
+		if (!quote) {
+			return 1;
+		}
+		end = quote - input;
+		size_t num_backslashes = 0;
+		while (end - num_backslashes > start && input[end - num_backslashes - 1] == '\\') {
+			num_backslashes++;
+		}
+		if (num_backslashes % 2 == 0) {
+			break;
+		}
+		end++;
+	}
+	if (end + 1 < doc->input_len && !json_is_whitespace(input[end + 1]) && !json_is_operator(input[end + 1])) {
+		return 1;
+	}
+
+	size_t len = end - start;
+	if (!memchr(input + start, '\\', len)) {
+		*dst = input + start;
+		*dst_len = len;
+		return 0;
+	}
+	char *unescaped = json_document_arena_alloc(doc, len + 1);
+	size_t unescaped_len = json_unescape(unescaped, input + start, len);
+	if (unescaped_len == -1) {
+		return 1;
+	}
+	unescaped[unescaped_len] = 0;
+	*dst = unescaped;
+	*dst_len = unescaped_len;
+	return 0;
+}
+
+int json_value_get_str(json_value *value, string *dst) {
+	char *s;
+	size_t len;
+	if (json_value_get_cstr_len(value, &s, &len)) {
+		return 1;
+	}
+	string_set_cstr_len(dst, s, len);
+	return 0;
+}
+
+/*
+private
+
+Finds the extent of the number at this value, and checks it against the JSON number grammar.
+
+Returns 0 on success, non-0 if this isn't a valid number.
+*/
+int json_value_get_number_token(json_value *value, char **dst, size_t *dst_len, int *is_integer) {
+	json_document *doc = value->doc;
+	size_t start = json_document_get_structural(doc, value->index)->position;
+	char *s = doc->input + start;
+	char *end = doc->input + doc->input_len;
+	char *p = s;
+	*is_integer = 1;
+	if (p < end && *p == '-') {
+		p++;
+	}
+	if (p < end && *p == '0') {
+		p++;
+	} else if (p < end && *p >= '1' && *p <= '9') {
+		while (p < end && *p >= '0' && *p <= '9') {
+			p++;
+		}
+	} else {
+		return 1;
+	}
+	if (p < end && *p == '.') {
+		*is_integer = 0;
+		p++;
+		char *digits = p;
+		while (p < end && *p >= '0' && *p <= '9') {
+			p++;
+		}
+		if (p == digits) {
+			return 1;
+		}
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		*is_integer = 0;
+		p++;
+		if (p < end && (*p == '+' || *p == '-')) {
+			p++;
+		}
+		char *digits = p;
+		while (p < end && *p >= '0' && *p <= '9') {
+			p++;
+		}
+		if (p == digits) {
+			return 1;
+		}
+	}
+	if (p < end && !json_is_whitespace(*p) && !json_is_operator(*p)) {
+		return 1;
+	}
+	*dst = s;
+	*dst_len = p - s;
+	return 0;
+}
+
+int json_value_get_int64(json_value *value, int64_t *dst) {
+	char *s;
+	size_t len;
+	int is_integer;
+	if (json_value_get_number_token(value, &s, &len, &is_integer) || !is_integer) {
+		return 1;
+	}
+	int negative = s[0] == '-';
+	size_t i = negative;
+	// accumulate as a negative number so that INT64_MIN fits
+	int64_t result = 0;
+	for (; i < len; i++) {
+		int digit = s[i] - '0';
+		if (result < (INT64_MIN + digit) / 10) {
+			return 1;
+		}
+		result = result * 10 - digit;
+	}
+	if (!negative) {
+		if (result == INT64_MIN) {
+			return 1;
+		}
+		result = -result;
+	}
+	*dst = result;
+	return 0;
+}
+
+int json_value_get_double(json_value *value, double *dst) {
+	char *s;
+	size_t len;
+	int is_integer;
+	if (json_value_get_number_token(value, &s, &len, &is_integer)) {
+		return 1;
+	}
+	/*
+	When the digits fit exactly in a double and the power of 10 does too, a single multiply or divide is correctly rounded, so there's no
+	need for strtod. That covers most numbers seen in practice.
+	*/
+	static const double powers_of_10[] = {1e0,	1e1,  1e2,	1e3,  1e4,	1e5,  1e6,	1e7,  1e8,	1e9,  1e10, 1e11,
+										  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	int negative = s[0] == '-';
+	size_t i = negative;
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+	for (; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+		mantissa = mantissa * 10 + (s[i] - '0');
+		num_digits += mantissa > 0;
+	}
+	if (i < len && s[i] == '.') {
+		for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+			mantissa = mantissa * 10 + (s[i] - '0');
+			num_digits += mantissa > 0;
+			exponent--;
+		}
+	}
+	if (i < len && num_digits <= 19) {
+		// skip the e and sign, the grammar has already been checked
+		i++;
+		int exponent_negative = s[i] == '-';
+		i += s[i] == '-' || s[i] == '+';
+		int e = 0;
+		for (; i < len && e < 10000; i++) {
+			e = e * 10 + (s[i] - '0');
+		}
+		exponent += exponent_negative ? -e : e;
+	}
+	if (num_digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22) {
+		double d = (double)mantissa;
+		d = exponent < 0 ? d / powers_of_10[-exponent] : d * powers_of_10[exponent];
+		*dst = negative ? -d : d;
+		return 0;
+	}
+	if (len > JSON_MAX_NUMBER_LENGTH) {
+		return 1;
+	}
+	// strtod needs a 0-terminator, which the input doesn't have
+	char tmp[JSON_MAX_NUMBER_LENGTH + 1];
+	memcpy(tmp, s, len);
+	tmp[len] = 0;
+	*dst = strtod(tmp, NULL);
+	return 0;
+}
+
+// private
+int json_value_is_literal(json_value *value, char *literal, size_t literal_len) {
+	json_document *doc = value->doc;
+	size_t start = json_document_get_structural(doc, value->index)->position;
+	if (doc->input_len - start < literal_len || memcmp(doc->input + start, literal, literal_len)) {
+		return 0;
+	}
+	size_t end = start + literal_len;
+	return end == doc->input_len || json_is_whitespace(doc->input[end]) || json_is_operator(doc->input[end]);
+}
+
+int json_value_get_bool(json_value *value, int *dst) {
+	if (json_value_is_literal(value, "true", 4)) {
+		*dst = 1;
+		return 0;
+	}
+	if (json_value_is_literal(value, "false", 5)) {
+		*dst = 0;
+		return 0;
+	}
+	return 1;
+}
+
+int json_value_is_null(json_value *value) {
+	return json_value_is_literal(value, "null", 4);
+}
+
+// private
+char *json_writer_reserve(json_writer *w, size_t n) {
+	size_t length = buffer_get_length(&w->pending);
+	size_t capacity = buffer_get_capacity(&w->pending);
+	if (length + n > capacity) {
+		// grow geometrically, most writes are a few bytes
+		size_t new_capacity = capacity * 2 > 256 ? capacity * 2 : 256;
+		buffer_ensure_capacity(&w->pending, length + n > new_capacity ? length + n : new_capacity);
+	}
+	return (char *)w->pending.data + length;
+}
+
+// private
+void json_writer_append(json_writer *w, char *src, size_t n) {
+	char *dst = json_writer_reserve(w, n);
+	memcpy(dst, src, n);
+	w->pending.length += n;
+}
+
+// private
+int json_writer_fail(json_writer *w, char *message) {
+	log_error("json_writer failed, %s\n", message);
+	w->failed = 1;
+	return 1;
+}
+
+// private
+int json_writer_write_pending(json_writer *w, string *error) {
+	size_t length = buffer_get_length(&w->pending);
+	size_t written = 0;
+	while (written < length) {
+		int result = stream_write(w->output, w->pending.data + written, length - written, error);
+		if (result <= 0) {
+			w->failed = 1;
+			return 1;
+		}
+		written += result;
+	}
+	buffer_clear(&w->pending);
+	return 0;
+}
+
+/*
+private
+
+Adds the comma before a value if needed, after checking that a value is allowed here.
+*/
+int json_writer_begin_value(json_writer *w) {
+	if (w->failed) {
+		return 1;
+	}
+	if (w->depth == 0) {
+		if (w->has_element) {
+			return json_writer_fail(w, "the document already has a value");
+		}
+	} else if (w->is_object[w->depth - 1] && !w->after_key) {
+		return json_writer_fail(w, "object member is missing a key");
+	}
+	if (w->has_element && !w->after_key) {
+		json_writer_append(w, ",", 1);
+	}
+	w->after_key = 0;
+	return 0;
+}
+
+// private
+int json_writer_end_value(json_writer *w) {
+	w->has_element = 1;
+	if (w->flush_threshold > 0 && buffer_get_length(&w->pending) >= w->flush_threshold) {
+		return json_writer_write_pending(w, NULL);
+	}
+	return 0;
+}
+
+// private
+int json_writer_begin_container(json_writer *w, char open, int is_object) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	if (w->depth == JSON_WRITER_MAX_DEPTH) {
+		return json_writer_fail(w, "nested too deeply");
+	}
+	json_writer_append(w, &open, 1);
+	w->is_object[w->depth] = is_object;
+	w->depth++;
+	w->has_element = 0;
+	return 0;
+}
+
+// private
+int json_writer_end_container(json_writer *w, char close, int is_object) {
+	if (w->failed) {
+		return 1;
+	}
+	if (w->depth == 0 || w->is_object[w->depth - 1] != is_object) {
+		return json_writer_fail(w, is_object ? "no object to end" : "no array to end");
+	}
+	if (w->after_key) {
+		return json_writer_fail(w, "object member is missing a value");
+	}
+	json_writer_append(w, &close, 1);
+	w->depth--;
+	return json_writer_end_value(w);
+}
+
+// private
+size_t json_find_escape(char *s, size_t start, size_t len) {
+	size_t i = start;
+#ifdef __SSE2__
+	__m128i quote_char = _mm_set1_epi8('"');
+	__m128i backslash_char = _mm_set1_epi8('\\');
+	__m128i control_max = _mm_set1_epi8(0x1f);
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)(s + i));
+		// unsigned v <= 0x1f
+		__m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, control_max), control_max);
+		__m128i needs_escape = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote_char), _mm_cmpeq_epi8(v, backslash_char)), control);
+		uint32_t mask = _mm_movemask_epi8(needs_escape);
+		if (mask) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\' || c < 0x20) {
+			return i;
+		}
+	}
+	return len;
+}
+
+// private
+void json_writer_append_escaped(json_writer *w, char *s, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+	json_writer_append(w, "\"", 1);
+	size_t i = 0;
+	while (i < len) {
+		size_t next = json_find_escape(s, i, len);
+		json_writer_append(w, s + i, next - i);
+		if (next == len) {
+			break;
+		}
+		unsigned char c = s[next];
+		switch (c) {
+		case '"':
+			json_writer_append(w, "\\\"", 2);
+			break;
+		case '\\':
+			json_writer_append(w, "\\\\", 2);
+			break;
+		case '\b':
+			json_writer_append(w, "\\b", 2);
+			break;
+		case '\f':
+			json_writer_append(w, "\\f", 2);
+			break;
+		case '\n':
+			json_writer_append(w, "\\n", 2);
+			break;
+		case '\r':
+			json_writer_append(w, "\\r", 2);
+			break;
+		case '\t':
+			json_writer_append(w, "\\t", 2);
+			break;
+		default: {
+			char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+			json_writer_append(w, escaped, 6);
+			break;
+		}
+		}
+		i = next + 1;
+	}
+	json_writer_append(w, "\"", 1);
+}
+
+void json_writer_init(json_writer *w, stream *output, size_t flush_threshold) {
+	w->output = output;
+	buffer_init(&w->pending);
+	w->flush_threshold = flush_threshold;
+	w->depth = 0;
+	w->has_element = 0;
+	w->after_key = 0;
+	w->failed = 0;
+}
+
+void json_writer_dealloc(json_writer *w) {
+	buffer_dealloc(&w->pending);
+}
+
+int json_writer_flush(json_writer *w, string *error) {
+	if (w->failed) {
+		if (error) {
+			string_set_cstr(error, "json_writer previously failed");
+		}
+		return 1;
+	}
+	return json_writer_write_pending(w, error);
+}
+
+int json_writer_begin_object(json_writer *w) {
+	return json_writer_begin_container(w, '{', 1);
+}
+
+int json_writer_end_object(json_writer *w) {
+	return json_writer_end_container(w, '}', 1);
+}
+
+int json_writer_begin_array(json_writer *w) {
+	return json_writer_begin_container(w, '[', 0);
+}
+
+int json_writer_end_array(json_writer *w) {
+	return json_writer_end_container(w, ']', 0);
+}
+
+int json_writer_key_cstr_len(json_writer *w, char *key, size_t key_len) {
+	if (w->failed) {
+		return 1;
+	}
+	if (w->depth == 0 || !w->is_object[w->depth - 1]) {
+		return json_writer_fail(w, "key outside of an object");
+	}
+	if (w->after_key) {
+		return json_writer_fail(w, "object member is missing a value");
+	}
+	if (w->has_element) {
+		json_writer_append(w, ",", 1);
+	}
+	json_writer_append_escaped(w, key, key_len);
+	json_writer_append(w, ":", 1);
+	w->after_key = 1;
+	return 0;
+}
+
+int json_writer_key_cstr(json_writer *w, char *key) {
+	return json_writer_key_cstr_len(w, key, strlen(key));
+}
+
+int json_writer_cstr_len(json_writer *w, char *s, size_t len) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	json_writer_append_escaped(w, s, len);
+	return json_writer_end_value(w);
+}
+
+int json_writer_cstr(json_writer *w, char *s) {
+	return json_writer_cstr_len(w, s, strlen(s));
+}
+
+int json_writer_str(json_writer *w, string *s) {
+	return json_writer_cstr_len(w, string_get_cstr(s), string_get_length(s));
+}
+
+int json_writer_int64(json_writer *w, int64_t i) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	char tmp[STRING_MAX_INT64_LENGTH];
+	char *end = tmp + sizeof(tmp);
+	char *start = string_format_int64(end, i);
+	json_writer_append(w, start, end - start);
+	return json_writer_end_value(w);
+}
+
+int json_writer_uint64(json_writer *w, uint64_t i) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	char tmp[STRING_MAX_INT64_LENGTH];
+	char *end = tmp + sizeof(tmp);
+	char *start = string_format_uint64(end, i);
+	json_writer_append(w, start, end - start);
+	return json_writer_end_value(w);
+}
+
+int json_writer_double(json_writer *w, double d) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	if (d != d || d - d != 0) {
+		json_writer_append(w, "null", 4);
+		return json_writer_end_value(w);
+	}
+	static const double powers_of_10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17};
+	char tmp[48];
+	char *end = tmp + sizeof(tmp);
+	int negative = d < 0 || (d == 0 && 1 / d < 0);
+	double magnitude = negative ? -d : d;
+	/*
+	Look for the fewest decimal places k where the digits are an integer m that fits exactly in a double and m / 10^k gives back the same
+	double. The division is correctly rounded, same as parsing, so that's a round trip. This covers integers and most decimals seen in
+	practice.
+	*/
+	for (int k = 0; k < (int)(sizeof(powers_of_10) / sizeof(powers_of_10[0])); k++) {
+		double scaled = magnitude * powers_of_10[k];
+		if (scaled >= 9007199254740992.0) {
+			break;
+		}
+		uint64_t m = (uint64_t)(scaled + 0.5);
+		if ((double)m / powers_of_10[k] != magnitude) {
+			continue;
+		}
+		char *start = string_format_uint64(end, m);
+		if (k > 0) {
+			// pad with leading zeros so there's at least one digit before the decimal point, then insert it
+			while (end - start <= k) {
+				*--start = '0';
+			}
+			memmove(start - 1, start, end - start - k);
+			start--;
+			end[-k - 1] = '.';
+		}
+		if (negative) {
+			*--start = '-';
+		}
+		json_writer_append(w, start, end - start);
+		return json_writer_end_value(w);
+	}
+	// very large or very small, the shortest %g precision that round trips
+	for (int precision = 15; precision <= 17; precision++) {
+		int len = snprintf(tmp, sizeof(tmp), "%.*g", precision, d);
+		if (precision == 17 || strtod(tmp, NULL) == d) {
+			json_writer_append(w, tmp, len);
+			break;
+		}
+	}
+	return json_writer_end_value(w);
+}
+
+int json_writer_bool(json_writer *w, int b) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	if (b) {
+		json_writer_append(w, "true", 4);
+	} else {
+		json_writer_append(w, "false", 5);
+	}
+	return json_writer_end_value(w);
+}
+
+int json_writer_null(json_writer *w) {
+	if (json_writer_begin_value(w)) {
+		return 1;
+	}
+	json_writer_append(w, "null", 4);
+	return json_writer_end_value(w);
+}
@@ -0,0 +1,226 @@
+/*
+JSON parsing.
+
+Parsing happens in two stages. json_document_parse makes a single pass over the input, using SIMD where available, and records the position
+of every structural character ({}[]:,), the start of every string, and the start of every other scalar value. Brackets are matched up in
+that same pass so that skipping over a nested value later is a single lookup.
+
+Nothing else is parsed up front. Values are read on demand through json_value, which is just a position in that index. Strings without
+escapes are returned as pointers directly into the input. Strings that need unescaping are decoded into an arena owned by the document,
+which is reset and reused on the next parse.
+
+The input must outlive the document, or at least any values read from it.
+
+Writing goes through json_writer, which formats directly into a buffer and hands that to a stream, either all at once when done or in
+chunks as it fills up. Numbers are formatted without printf, and strings are scanned for characters that need escaping a block at a time.
+
+References:
+https://datatracker.ietf.org/doc/html/rfc8259
+https://arxiv.org/abs/1902.08318
+*/
+
+#ifndef json_h
+#define json_h
+
+#include <stdint.h>
+
+#include "buffer.h"
+#include "stream.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// how deeply objects and arrays can be nested when writing
+#define JSON_WRITER_MAX_DEPTH 64
+
+typedef enum {
+	JSON_TYPE_INVALID = 0,
+	JSON_TYPE_OBJECT = 1,
+	JSON_TYPE_ARRAY = 2,
+	JSON_TYPE_STRING = 3,
+	JSON_TYPE_NUMBER = 4,
+	JSON_TYPE_TRUE = 5,
+	JSON_TYPE_FALSE = 6,
+	JSON_TYPE_NULL = 7
+} json_type;
+
+typedef struct {
+	// offset into the input
+	uint32_t position;
+	// for brackets the index of the matching bracket, unused otherwise
+	uint32_t match;
+} json_structural;
+
+struct json_arena_block;
+typedef struct json_arena_block {
+	struct json_arena_block *next;
+	size_t capacity;
+	size_t length;
+	uint8_t data[];
+} json_arena_block;
+
+typedef struct {
+	char *input;
+	size_t input_len;
+	// array of json_structural
+	buffer structurals;
+	size_t num_structurals;
+	// used while matching brackets
+	buffer stack;
+	// unescaped strings, blocks are kept between parses
+	json_arena_block *arena_first;
+	json_arena_block *arena_current;
+} json_document;
+
+typedef struct {
+	json_document *doc;
+	// index into the document's structurals
+	size_t index;
+} json_value;
+
+typedef struct {
+	json_document *doc;
+	int is_object;
+	// the index of the next element, or of the closing bracket when done
+	size_t index;
+	// the index of the closing bracket
+	size_t end;
+} json_iterator;
+
+typedef struct {
+	stream *output;
+	// formatted output that hasn't been written to the stream yet
+	buffer pending;
+	// write to the stream whenever this much is pending, 0 to only write on flush
+	size_t flush_threshold;
+	// for each open object or array, whether it's an object
+	uint8_t is_object[JSON_WRITER_MAX_DEPTH];
+	size_t depth;
+	// whether the current object or array already has an element, so the next one needs a comma
+	int has_element;
+	// whether a key was just written, so a value has to come next
+	int after_key;
+	// set on the first error, after which everything else fails
+	int failed;
+} json_writer;
+
+void json_document_init(json_document *doc);
+void json_document_dealloc(json_document *doc);
+
+/**
+ * Indexes the input. Any previous contents of the document are discarded. Catches unterminated strings and mismatched brackets, everything
+ * else is checked as values are read.
+ * @param input doesn't have to be 0-terminated, must remain valid as long as values from this document are in use
+ * @returns 0 on success, non-0 if the input is obviously malformed
+ */
+int json_document_parse(json_document *doc, char *input, size_t input_len);
+
+/**
+ * @param value set to the top level value of the document
+ * @returns 0 on success, non-0 if the document doesn't consist of exactly one value
+ */
+int json_document_get_root(json_document *doc, json_value *value);
+
+/**
+ * @returns the type of the value, based only on its first character
+ */
+json_type json_value_get_type(json_value *value);
+
+/**
+ * Starts iterating over the elements of an array or the members of an object.
+ * @returns 0 on success, non-0 if the value isn't an array or object
+ */
+int json_value_iterate(json_value *value, json_iterator *it);
+
+/**
+ * Gets the next element of an array or member of an object.
+ * @param key for objects set to the member name, which is always a string value, ignored for arrays and may be NULL
+ * @param value set to the next element or member value
+ * @returns as per stream_read, positive when a value was produced, 0 when there are no more, negative when the input is malformed
+ */
+int json_iterator_next(json_iterator *it, json_value *key, json_value *value);
+
+/**
+ * Finds the first member of an object with the given name. This is a linear search over the members.
+ * @returns 0 on success, non-0 if not found or if the object is malformed
+ */
+int json_value_object_get_cstr(json_value *object, char *key, json_value *value);
+
+/**
+ * Gets the contents of a string value. If the string has no escape sequences dst points directly into the input and is not 0-terminated.
+ * Otherwise the string is unescaped into the document's arena, and is 0-terminated. Either way dst remains valid until the next parse.
+ * @returns 0 on success, non-0 if the value isn't a valid string
+ */
+int json_value_get_cstr_len(json_value *value, char **dst, size_t *dst_len);
+/**
+ * As json_value_get_cstr_len, but replaces the contents of dst with a copy.
+ */
+int json_value_get_str(json_value *value, string *dst);
+/**
+ * @returns 0 on success, non-0 if the value isn't a number, isn't an integer, or doesn't fit
+ */
+int json_value_get_int64(json_value *value, int64_t *dst);
+/**
+ * @returns 0 on success, non-0 if the value isn't a number
+ */
+int json_value_get_double(json_value *value, double *dst);
+/**
+ * @returns 0 on success, non-0 if the value isn't true or false
+ */
+int json_value_get_bool(json_value *value, int *dst);
+/**
+ * @returns non-0 if the value is null
+ */
+int json_value_is_null(json_value *value);
+
+/**
+ * @param output where the formatted JSON goes, e.g. http_response_get_body
+ * @param flush_threshold if non-0, pending output is written to the stream whenever at least this many bytes have built up, otherwise
+ * nothing is written until json_writer_flush
+ */
+void json_writer_init(json_writer *w, stream *output, size_t flush_threshold);
+void json_writer_dealloc(json_writer *w);
+
+/**
+ * Writes any pending output to the stream.
+ * @param error optional, if provided and an error occurs the contents are replaced with an error message
+ * @returns 0 on success, non-0 if writing failed or anything previously written to this writer was invalid
+ */
+int json_writer_flush(json_writer *w, string *error);
+
+/*
+Each of these returns 0 on success, non-0 if the value isn't valid at this point (e.g. a value in an object without a key, or closing an
+array that isn't open) or if flushing to the stream failed. Once anything fails the writer stops producing output.
+*/
+int json_writer_begin_object(json_writer *w);
+int json_writer_end_object(json_writer *w);
+int json_writer_begin_array(json_writer *w);
+int json_writer_end_array(json_writer *w);
+/**
+ * Writes the name of the next member of an object.
+ */
+int json_writer_key_cstr_len(json_writer *w, char *key, size_t key_len);
+int json_writer_key_cstr(json_writer *w, char *key);
+/**
+ * Writes a string value, escaping as needed. The input is assumed to be UTF-8 and is otherwise written as is.
+ */
+int json_writer_cstr_len(json_writer *w, char *s, size_t len);
+int json_writer_cstr(json_writer *w, char *s);
+int json_writer_str(json_writer *w, string *s);
+int json_writer_int64(json_writer *w, int64_t i);
+int json_writer_uint64(json_writer *w, uint64_t i);
+/**
+ * Writes the shortest representation that reads back as the same double. NaN and infinity can't be represented in JSON, so they're
+ * written as null.
+ */
+int json_writer_double(json_writer *w, double d);
+int json_writer_bool(json_writer *w, int b);
+int json_writer_null(json_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,43 +1,346 @@
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "log.h"
+#include "string.h"
 
-// TODO needs sync around logging
 // TODO timestamps
 
-void log_trace(char *format, ...) {
-	va_list args;
-	va_start(args, format);
-	fprintf(stdout, "TRACE ");
-	vfprintf(stdout, format, args);
-	fflush(stdout);
-	va_end(args);
+// how often the background thread checks for messages when nobody has asked it to
+#define LOG_DRAIN_INTERVAL_MS 10
+#define LOG_MIN_RING_SIZE 256
+// marks the rest of a ring up to its end as unused, the next record is at the start
+#define LOG_RECORD_WRAP UINT32_MAX
+
+static char *log_level_prefixes[] = {"TRACE ", "DEBUG ", "INFO ", "ERROR "};
+static char *log_level_names[] = {"trace", "debug", "info", "error", "none"};
+
+log_level log_runtime_level = LOG_LEVEL_TRACE;
+
+// each message in a ring is one of these followed by its text, padded out to a multiple of 8 bytes
+typedef struct {
+	uint32_t length;
+	uint32_t level;
+} log_record;
+
+/*
+A single producer, single consumer ring of records. Only the thread that owns it writes records and moves head, only the background thread
+reads them and moves tail. Both count up forever, the offset into data is the count modulo capacity.
+*/
+typedef struct log_ring {
+	struct log_ring *next;
+	char *data;
+	size_t capacity;
+	size_t head;
+	size_t tail;
+	// the owning thread has exited, the ring is freed once it's been drained
+	int abandoned;
+	// the owning thread formats into this before copying into the ring
+	string scratch;
+} log_ring;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+// signalled to stop the background thread or to have it drain early
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+// the rings of every thread that's logged since async logging was first started, guarded by log_mutex
+static log_ring *log_rings;
+static size_t log_ring_size;
+static pthread_t log_thread;
+static int log_running;
+static int log_stopping;
+static uint64_t log_num_dropped;
+
+static pthread_once_t log_ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_ring_key;
+static __thread log_ring *log_thread_ring;
+
+// private
+size_t log_record_size(size_t length) {
+	return sizeof(log_record) + ((length + 7) & ~(size_t)7);
 }
 
-void log_debug(char *format, ...) {
-	va_list args;
-	va_start(args, format);
-	fprintf(stdout, "DEBUG ");
-	vfprintf(stdout, format, args);
-	fflush(stdout);
-	va_end(args);
+/*
+private
+
+Appends every record waiting in ring to out or err depending on its level. Only called with log_mutex held.
+*/
+void log_ring_drain(log_ring *ring, string *out, string *err) {
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t tail = ring->tail;
+	while (tail != head) {
+		size_t offset = tail % ring->capacity;
+		log_record *record = (log_record *)(ring->data + offset);
+		if (record->length == LOG_RECORD_WRAP) {
+			tail += ring->capacity - offset;
+			continue;
+		}
+		string *dst = record->level == LOG_LEVEL_ERROR ? err : out;
+		string_append_cstr(dst, log_level_prefixes[record->level]);
+		string_append_cstr_len(dst, (char *)(record + 1), record->length);
+		tail += log_record_size(record->length);
+	}
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
 }
 
-void log_info(char *format, ...) {
-	va_list args;
-	va_start(args, format);
-	fprintf(stdout, "INFO ");
-	vfprintf(stdout, format, args);
-	fflush(stdout);
-	va_end(args);
+// private
+void log_ring_free(log_ring *ring) {
+	free(ring->data);
+	string_dealloc(&ring->scratch);
+	free(ring);
+}
+
+// private
+void log_write_out(string *out, string *err) {
+	if (string_get_length(out) > 0) {
+		fwrite(string_get_cstr(out), 1, string_get_length(out), stdout);
+		fflush(stdout);
+		string_clear(out);
+	}
+	if (string_get_length(err) > 0) {
+		fwrite(string_get_cstr(err), 1, string_get_length(err), stderr);
+		fflush(stderr);
+		string_clear(err);
+	}
 }
 
-void log_error(char *format, ...) {
+/*
+private
+
+Drains every ring, freeing the ones whose threads have gone. Only called with log_mutex held.
+*/
+void log_drain_all(string *out, string *err) {
+	log_ring **link = &log_rings;
+	while (*link) {
+		log_ring *ring = *link;
+		log_ring_drain(ring, out, err);
+		if (ring->abandoned) {
+			*link = ring->next;
+			log_ring_free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+}
+
+// private
+void *log_thread_main(void *data) {
+	string out, err;
+	string_init(&out);
+	string_init(&err);
+	uint64_t reported_dropped = 0;
+	pthread_mutex_lock(&log_mutex);
+	while (1) {
+		log_drain_all(&out, &err);
+		uint64_t dropped = __atomic_load_n(&log_num_dropped, __ATOMIC_RELAXED);
+		if (dropped != reported_dropped) {
+			string_append_cstrf(&err, "%s%llu log messages dropped\n", log_level_prefixes[LOG_LEVEL_ERROR],
+								(unsigned long long)(dropped - reported_dropped));
+			reported_dropped = dropped;
+		}
+		int stopping = log_stopping;
+		// writing can block, so let threads that are starting up or exiting get at the list meanwhile
+		pthread_mutex_unlock(&log_mutex);
+		log_write_out(&out, &err);
+		pthread_mutex_lock(&log_mutex);
+		if (stopping) {
+			break;
+		}
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		if (!log_stopping) {
+			pthread_cond_timedwait(&log_cond, &log_mutex, &deadline);
+		}
+	}
+	pthread_mutex_unlock(&log_mutex);
+	string_dealloc(&out);
+	string_dealloc(&err);
+	return NULL;
+}
+
+// private
+void log_ring_abandon(void *data) {
+	log_ring *ring = data;
+	pthread_mutex_lock(&log_mutex);
+	if (log_running) {
+		// the background thread frees it once everything in it is written
+		ring->abandoned = 1;
+		pthread_mutex_unlock(&log_mutex);
+		return;
+	}
+	string out, err;
+	string_init(&out);
+	string_init(&err);
+	log_ring **link = &log_rings;
+	while (*link != ring) {
+		link = &(*link)->next;
+	}
+	*link = ring->next;
+	log_ring_drain(ring, &out, &err);
+	pthread_mutex_unlock(&log_mutex);
+	log_write_out(&out, &err);
+	string_dealloc(&out);
+	string_dealloc(&err);
+	log_ring_free(ring);
+}
+
+// private
+void log_create_ring_key() {
+	pthread_key_create(&log_ring_key, log_ring_abandon);
+}
+
+/*
+private
+
+Gets the calling thread's ring, making it the first time the thread logs.
+*/
+log_ring *log_get_thread_ring() {
+	if (log_thread_ring) {
+		return log_thread_ring;
+	}
+	pthread_once(&log_ring_key_once, log_create_ring_key);
+	log_ring *ring = malloc(sizeof(log_ring));
+	pthread_mutex_lock(&log_mutex);
+	ring->capacity = log_ring_size;
+	ring->data = malloc(ring->capacity);
+	ring->head = 0;
+	ring->tail = 0;
+	ring->abandoned = 0;
+	string_init(&ring->scratch);
+	ring->next = log_rings;
+	log_rings = ring;
+	pthread_mutex_unlock(&log_mutex);
+	pthread_setspecific(log_ring_key, ring);
+	log_thread_ring = ring;
+	return ring;
+}
+
+/*
+private
+
+Copies a formatted message into the ring, dropping it if there isn't room.
+*/
+void log_ring_push(log_ring *ring, log_level level, char *text, size_t length) {
+	// a message can't take so much of the ring that nothing else fits
+	size_t max_length = ring->capacity / 4 - sizeof(log_record);
+	if (length > max_length) {
+		length = max_length;
+	}
+	size_t size = log_record_size(length);
+	size_t head = ring->head;
+	size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	size_t offset = head % ring->capacity;
+	// records don't wrap around the end, the space left there is skipped instead
+	size_t skip = offset + size > ring->capacity ? ring->capacity - offset : 0;
+	size_t used = head - tail;
+	if (used + skip + size > ring->capacity) {
+		__atomic_fetch_add(&log_num_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (skip) {
+		((log_record *)(ring->data + offset))->length = LOG_RECORD_WRAP;
+		offset = 0;
+	}
+	log_record *record = (log_record *)(ring->data + offset);
+	record->length = length;
+	record->level = level;
+	memcpy(record + 1, text, length);
+	__atomic_store_n(&ring->head, head + skip + size, __ATOMIC_RELEASE);
+	// the background thread would get to it soon anyway, but wake it before the ring gets close to full
+	if (used < ring->capacity / 2 && used + skip + size >= ring->capacity / 2) {
+		pthread_cond_signal(&log_cond);
+	}
+}
+
+// private
+void log_writev(log_level level, char *format, va_list args) {
+	if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		log_ring *ring = log_get_thread_ring();
+		string_clear(&ring->scratch);
+		string_append_cstrvf(&ring->scratch, format, args);
+		log_ring_push(ring, level, string_get_cstr(&ring->scratch), string_get_length(&ring->scratch));
+		return;
+	}
+	FILE *file = level == LOG_LEVEL_ERROR ? stderr : stdout;
+	// so that messages from different threads don't interleave
+	flockfile(file);
+	fputs(log_level_prefixes[level], file);
+	vfprintf(file, format, args);
+	fflush(file);
+	funlockfile(file);
+}
+
+void log_write(log_level level, char *format, ...) {
 	va_list args;
 	va_start(args, format);
-	fprintf(stderr, "ERROR ");
-	vfprintf(stderr, format, args);
-	fflush(stderr);
+	log_writev(level, format, args);
 	va_end(args);
-}
\ No newline at end of file
+}
+
+void log_set_level(log_level level) {
+	__atomic_store_n(&log_runtime_level, level, __ATOMIC_RELAXED);
+}
+
+log_level log_get_level() {
+	return __atomic_load_n(&log_runtime_level, __ATOMIC_RELAXED);
+}
+
+int log_level_parse_cstr(char *name, log_level *level) {
+	for (size_t i = 0; i < sizeof(log_level_names) / sizeof(log_level_names[0]); i++) {
+		if (!strcasecmp(name, log_level_names[i])) {
+			*level = i;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int log_start_async(size_t ring_size) {
+	// whole records only, so the space left at the end of the ring always fits a wrap marker
+	ring_size &= ~(size_t)7;
+	if (ring_size < LOG_MIN_RING_SIZE) {
+		return 1;
+	}
+	pthread_mutex_lock(&log_mutex);
+	if (log_running) {
+		pthread_mutex_unlock(&log_mutex);
+		return 1;
+	}
+	// rings from before keep their size
+	log_ring_size = ring_size;
+	log_stopping = 0;
+	if (pthread_create(&log_thread, NULL, log_thread_main, NULL)) {
+		pthread_mutex_unlock(&log_mutex);
+		return 1;
+	}
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&log_mutex);
+	return 0;
+}
+
+void log_stop_async() {
+	pthread_mutex_lock(&log_mutex);
+	if (!log_running) {
+		pthread_mutex_unlock(&log_mutex);
+		return;
+	}
+	__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+	log_stopping = 1;
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_mutex);
+	// it drains everything once more before it exits
+	pthread_join(log_thread, NULL);
+}
+
+uint64_t log_get_num_dropped() {
+	return __atomic_load_n(&log_num_dropped, __ATOMIC_RELAXED);
+}
@@ -1,19 +1,92 @@
-#ifndef base64_h
-#define base64_h
+/*
+Logging to stdout, and to stderr for errors.
+
+By default every call writes and flushes straight away on the calling thread. Once log_start_async is called, messages are instead
+formatted into a ring buffer owned by the calling thread and a background thread writes them out in batches, so logging costs a format and
+a copy rather than a locked, flushed write. Each thread's ring is a fixed size, and when one fills up its messages are dropped and counted
+rather than blocking the thread.
+
+The log_ macros only evaluate their arguments when the level is enabled, so a message that isn't going to be written costs a load and a
+comparison. Levels below LOG_MIN_LEVEL, which can be set when compiling e.g. -DLOG_MIN_LEVEL=LOG_LEVEL_INFO, compile to nothing at all.
+Anything expensive done only to build a message, like dumping headers, should check log_is_enabled first.
+*/
+
+#ifndef log_h
+#define log_h
+
+#include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// TODO disable log levels based on a preprocessor or runtime config
+typedef enum {
+	LOG_LEVEL_TRACE = 0,
+	LOG_LEVEL_DEBUG = 1,
+	LOG_LEVEL_INFO = 2,
+	LOG_LEVEL_ERROR = 3,
+	// only for log_set_level, turns off everything
+	LOG_LEVEL_NONE = 4
+} log_level;
+
+// levels below this are compiled out
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_TRACE
+#endif
+
+// read through log_is_enabled, set through log_set_level
+extern log_level log_runtime_level;
 
-void log_trace(char *format, ...);
-void log_debug(char *format, ...);
-void log_info(char *format, ...);
-void log_error(char *format, ...);
+#define log_is_enabled(level) ((level) >= LOG_MIN_LEVEL && (level) >= __atomic_load_n(&log_runtime_level, __ATOMIC_RELAXED))
+
+#define LOG_AT(level, ...)                                                                                                                 \
+	do {                                                                                                                                   \
+		if (log_is_enabled(level)) {                                                                                                       \
+			log_write(level, __VA_ARGS__);                                                                                                 \
+		}                                                                                                                                  \
+	} while (0)
+
+#define log_trace(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * Writes a message regardless of the level, use the log_ macros to check the level first.
+ */
+void log_write(log_level level, char *format, ...);
+
+/**
+ * Sets the lowest level written from now on, from any thread. Everything is written until this is called.
+ */
+void log_set_level(log_level level);
+log_level log_get_level();
+/**
+ * Parses a level name: trace, debug, info, error or none.
+ * @returns 0 on success, non-0 if name isn't a level
+ */
+int log_level_parse_cstr(char *name, log_level *level);
+
+/**
+ * Moves writing log messages onto a background thread.
+ * @param ring_size bytes of messages each logging thread can have waiting to be written, a message can take up to a quarter of it and is
+ * cut short beyond that
+ * @returns 0 on success, non-0 if already started, ring_size is too small, or the thread can't be started
+ */
+int log_start_async(size_t ring_size);
+/**
+ * Writes out everything waiting and goes back to logging synchronously. Other threads shouldn't be logging while this runs, anything they
+ * log from now until it returns may not be written until logging is next started.
+ */
+void log_stop_async();
+/**
+ * @returns how many messages have been dropped because a thread's ring was full
+ */
+uint64_t log_get_num_dropped();
 
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,341 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+typedef struct {
+	string name;
+	string help;
+	metrics_type type;
+	// which of the histograms a histogram is, 0 is never handed out so METRICS_DISCARD records go nowhere
+	size_t histogram_index;
+} metrics_metric;
+
+// a thread's values, aligned so no two threads' shards share a cache line
+typedef struct metrics_shard {
+	struct metrics_shard *next;
+	int64_t values[METRICS_MAX_METRICS];
+	// made the first time the thread records into each one
+	histogram *histograms[METRICS_MAX_HISTOGRAMS];
+} __attribute__((aligned(64))) metrics_shard;
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+// guarded by metrics_mutex, but a metric's entry doesn't change once it's registered
+static metrics_metric metrics_metrics[METRICS_MAX_METRICS];
+// METRICS_DISCARD is never handed out for a real metric
+static size_t metrics_num = 1;
+static size_t metrics_num_histograms = 1;
+// the shards of every running thread that's updated a metric, guarded by metrics_mutex
+static metrics_shard *metrics_shards;
+// what threads that have exited added, guarded by metrics_mutex
+static int64_t metrics_exited[METRICS_MAX_METRICS];
+static histogram *metrics_exited_histograms[METRICS_MAX_HISTOGRAMS];
+
+static pthread_once_t metrics_shard_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t metrics_shard_key;
+static __thread metrics_shard *metrics_thread_shard;
+
+int metrics_register_cstr(char *name, char *help, metrics_type type, metrics_id *id) {
+	pthread_mutex_lock(&metrics_mutex);
+	for (size_t i = 1; i < metrics_num; i++) {
+		if (!strcmp(string_get_cstr(&metrics_metrics[i].name), name)) {
+			int result = metrics_metrics[i].type != type;
+			*id = result ? METRICS_DISCARD : i;
+			pthread_mutex_unlock(&metrics_mutex);
+			return result;
+		}
+	}
+	if (metrics_num == METRICS_MAX_METRICS || (type == METRICS_TYPE_HISTOGRAM && metrics_num_histograms == METRICS_MAX_HISTOGRAMS)) {
+		pthread_mutex_unlock(&metrics_mutex);
+		*id = METRICS_DISCARD;
+		return 1;
+	}
+	metrics_metric *metric = &metrics_metrics[metrics_num];
+	string_init_cstr(&metric->name, name);
+	string_init_cstr(&metric->help, help);
+	metric->type = type;
+	if (type == METRICS_TYPE_HISTOGRAM) {
+		metric->histogram_index = metrics_num_histograms++;
+	}
+	*id = metrics_num;
+	// updates don't take the lock, but nothing updates a metric before registering it gives the id out
+	__atomic_store_n(&metrics_num, metrics_num + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&metrics_mutex);
+	return 0;
+}
+
+/*
+private
+
+Folds an exiting thread's values into metrics_exited so they still count.
+*/
+void metrics_shard_exit(void *data) {
+	metrics_shard *shard = data;
+	pthread_mutex_lock(&metrics_mutex);
+	metrics_shard **link = &metrics_shards;
+	while (*link != shard) {
+		link = &(*link)->next;
+	}
+	*link = shard->next;
+	for (size_t i = 0; i < METRICS_MAX_METRICS; i++) {
+		metrics_exited[i] += shard->values[i];
+	}
+	for (size_t i = 0; i < METRICS_MAX_HISTOGRAMS; i++) {
+		if (!shard->histograms[i]) {
+			continue;
+		}
+		if (!metrics_exited_histograms[i]) {
+			// the first thread to exit having recorded into it hands its histogram over
+			metrics_exited_histograms[i] = shard->histograms[i];
+			continue;
+		}
+		histogram_merge(metrics_exited_histograms[i], shard->histograms[i]);
+		free(shard->histograms[i]);
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+	free(shard);
+	// anything the thread updates from here on, in some other key's destructor, gets a new shard
+	metrics_thread_shard = NULL;
+}
+
+// private
+void metrics_create_shard_key() {
+	pthread_key_create(&metrics_shard_key, metrics_shard_exit);
+}
+
+/*
+private
+
+Gets the calling thread's shard, making it the first time the thread updates a metric.
+*/
+metrics_shard *metrics_get_thread_shard() {
+	if (metrics_thread_shard) {
+		return metrics_thread_shard;
+	}
+	pthread_once(&metrics_shard_key_once, metrics_create_shard_key);
+	metrics_shard *shard;
+	if (posix_memalign((void **)&shard, 64, sizeof(metrics_shard))) {
+		abort();
+	}
+	memset(shard, 0, sizeof(metrics_shard));
+	pthread_mutex_lock(&metrics_mutex);
+	shard->next = metrics_shards;
+	metrics_shards = shard;
+	pthread_mutex_unlock(&metrics_mutex);
+	pthread_setspecific(metrics_shard_key, shard);
+	metrics_thread_shard = shard;
+	return shard;
+}
+
+void metrics_add(metrics_id id, int64_t n) {
+	metrics_shard *shard = metrics_get_thread_shard();
+	// only this thread writes to its shard, readers only need the value not to tear
+	__atomic_store_n(&shard->values[id], shard->values[id] + n, __ATOMIC_RELAXED);
+}
+
+void metrics_record(metrics_id id, uint64_t ns) {
+	metrics_shard *shard = metrics_get_thread_shard();
+	size_t index = metrics_metrics[id].histogram_index;
+	histogram *h = shard->histograms[index];
+	if (!h) {
+		h = malloc(sizeof(histogram));
+		if (!h) {
+			abort();
+		}
+		histogram_init(h);
+		// readers only see it once it's been cleared
+		__atomic_store_n(&shard->histograms[index], h, __ATOMIC_RELEASE);
+	}
+	histogram_record(h, ns);
+}
+
+/*
+private
+
+Only called with metrics_mutex held.
+*/
+int64_t metrics_sum(metrics_id id) {
+	int64_t value = metrics_exited[id];
+	for (metrics_shard *shard = metrics_shards; shard; shard = shard->next) {
+		value += __atomic_load_n(&shard->values[id], __ATOMIC_RELAXED);
+	}
+	return value;
+}
+
+int64_t metrics_get(metrics_id id) {
+	pthread_mutex_lock(&metrics_mutex);
+	int64_t value = metrics_sum(id);
+	pthread_mutex_unlock(&metrics_mutex);
+	return value;
+}
+
+/*
+private
+
+Only called with metrics_mutex held.
+*/
+void metrics_merge_histogram(metrics_id id, histogram *dst) {
+	size_t index = metrics_metrics[id].histogram_index;
+	if (metrics_exited_histograms[index]) {
+		histogram_merge(dst, metrics_exited_histograms[index]);
+	}
+	for (metrics_shard *shard = metrics_shards; shard; shard = shard->next) {
+		histogram *h = __atomic_load_n(&shard->histograms[index], __ATOMIC_ACQUIRE);
+		if (h) {
+			histogram_merge(dst, h);
+		}
+	}
+}
+
+void metrics_get_histogram(metrics_id id, histogram *dst) {
+	pthread_mutex_lock(&metrics_mutex);
+	metrics_merge_histogram(id, dst);
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+// private
+size_t metrics_family_length(string *name) {
+	char *labels = strchr(string_get_cstr(name), '{');
+	return labels ? (size_t)(labels - string_get_cstr(name)) : string_get_length(name);
+}
+
+/*
+private
+
+Appends ns divided by 10^digits, with that many digits after the point, e.g. seconds with 9 digits or microseconds with 3.
+*/
+void metrics_append_ns(string *dst, uint64_t ns, int digits) {
+	uint64_t scale = 1;
+	for (int i = 0; i < digits; i++) {
+		scale *= 10;
+	}
+	string_append_uint64(dst, ns / scale);
+	char fraction[STRING_MAX_INT64_LENGTH + 1];
+	char *end = fraction + sizeof(fraction);
+	char *start = string_format_uint64(end, scale + ns % scale);
+	// the leading 1 of scale keeps the fraction's leading zeros, and becomes the point
+	*start = '.';
+	string_append_cstr_len(dst, start, end - start);
+}
+
+/*
+private
+
+Appends a histogram metric's name with another label added, e.g. name{phase="parse"} and quantile="0.5" give
+name{phase="parse",quantile="0.5"}.
+*/
+void metrics_append_labelled(string *dst, string *name, char *label) {
+	char *cstr = string_get_cstr(name);
+	size_t length = string_get_length(name);
+	if (length > 0 && cstr[length - 1] == '}') {
+		string_append_cstr_len(dst, cstr, length - 1);
+		string_append_cstr(dst, ",");
+	} else {
+		string_append_str(dst, name);
+		string_append_cstr(dst, "{");
+	}
+	string_append_cstr(dst, label);
+	string_append_cstr(dst, "}");
+}
+
+/*
+private
+
+Appends a histogram metric's name with a suffix on the family, e.g. name{phase="parse"} and _sum give name_sum{phase="parse"}.
+*/
+void metrics_append_suffixed(string *dst, string *name, size_t family_length, char *suffix) {
+	string_append_cstr_len(dst, string_get_cstr(name), family_length);
+	string_append_cstr(dst, suffix);
+	string_append_cstr_len(dst, string_get_cstr(name) + family_length, string_get_length(name) - family_length);
+}
+
+// private
+void metrics_write_summary(string *dst, metrics_metric *metric, size_t family_length, histogram *h) {
+	static char *quantile_labels[] = {"quantile=\"0.5\"", "quantile=\"0.9\"", "quantile=\"0.99\"", "quantile=\"0.999\""};
+	static double percentiles[] = {50, 90, 99, 99.9};
+	for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+		metrics_append_labelled(dst, &metric->name, quantile_labels[i]);
+		string_append_cstr(dst, " ");
+		metrics_append_ns(dst, histogram_get_percentile(h, percentiles[i]), 9);
+		string_append_cstr(dst, "\n");
+	}
+	metrics_append_suffixed(dst, &metric->name, family_length, "_sum");
+	string_append_cstr(dst, " ");
+	metrics_append_ns(dst, histogram_get_sum(h), 9);
+	string_append_cstr(dst, "\n");
+	metrics_append_suffixed(dst, &metric->name, family_length, "_count");
+	string_append_cstr(dst, " ");
+	string_append_uint64(dst, histogram_get_count(h));
+	string_append_cstr(dst, "\n");
+}
+
+void metrics_write_prometheus(string *dst) {
+	static char *type_names[] = {"counter", "gauge", "summary"};
+	// merged into one at a time
+	histogram *h = malloc(sizeof(histogram));
+	if (!h) {
+		abort();
+	}
+	pthread_mutex_lock(&metrics_mutex);
+	for (size_t i = 1; i < metrics_num; i++) {
+		metrics_metric *metric = &metrics_metrics[i];
+		size_t family_length = metrics_family_length(&metric->name);
+		// HELP and TYPE only come once for each family
+		string *previous = i > 1 ? &metrics_metrics[i - 1].name : NULL;
+		if (!previous || metrics_family_length(previous) != family_length ||
+			memcmp(string_get_cstr(previous), string_get_cstr(&metric->name), family_length)) {
+			string_append_cstr(dst, "# HELP ");
+			string_append_cstr_len(dst, string_get_cstr(&metric->name), family_length);
+			string_append_cstr(dst, " ");
+			string_append_str(dst, &metric->help);
+			string_append_cstr(dst, "\n# TYPE ");
+			string_append_cstr_len(dst, string_get_cstr(&metric->name), family_length);
+			string_append_cstr(dst, " ");
+			string_append_cstr(dst, type_names[metric->type]);
+			string_append_cstr(dst, "\n");
+		}
+		if (metric->type == METRICS_TYPE_HISTOGRAM) {
+			histogram_init(h);
+			metrics_merge_histogram(i, h);
+			metrics_write_summary(dst, metric, family_length, h);
+			continue;
+		}
+		string_append_str(dst, &metric->name);
+		string_append_cstr(dst, " ");
+		string_append_int64(dst, metrics_sum(i));
+		string_append_cstr(dst, "\n");
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+	free(h);
+}
+
+void metrics_write_histograms(string *dst) {
+	static char *percentile_names[] = {" p50_us=", " p90_us=", " p99_us=", " p999_us="};
+	static double percentiles[] = {50, 90, 99, 99.9};
+	histogram *h = malloc(sizeof(histogram));
+	if (!h) {
+		abort();
+	}
+	pthread_mutex_lock(&metrics_mutex);
+	for (size_t i = 1; i < metrics_num; i++) {
+		metrics_metric *metric = &metrics_metrics[i];
+		if (metric->type != METRICS_TYPE_HISTOGRAM) {
+			continue;
+		}
+		histogram_init(h);
+		metrics_merge_histogram(i, h);
+		string_append_str(dst, &metric->name);
+		string_append_cstr(dst, " count=");
+		string_append_uint64(dst, histogram_get_count(h));
+		for (size_t j = 0; j < sizeof(percentiles) / sizeof(percentiles[0]); j++) {
+			string_append_cstr(dst, percentile_names[j]);
+			metrics_append_ns(dst, histogram_get_percentile(h, percentiles[j]), 3);
+		}
+		string_append_cstr(dst, " max_us=");
+		metrics_append_ns(dst, histogram_get_max(h), 3);
+		string_append_cstr(dst, "\n");
+	}
+	pthread_mutex_unlock(&metrics_mutex);
+	free(h);
+}
@@ -0,0 +1,80 @@
+/*
+Process wide counters and gauges, exposed in the Prometheus text format.
+
+Metrics are registered by name, and registering a name that's already registered gets the same metric back, so everything that counts the
+same thing shares it and what's exposed is the total for the process. Names can have Prometheus labels, e.g.
+http_responses_total{class="2xx"}, and metrics that only differ by their labels should be registered one after another so they're written
+out as one family.
+
+Each thread updates its own shard of every metric's value, so threads counting the same thing never write to the same cache line and an
+update is a plain add rather than an atomic one. Reading a metric sums the shards. Gauges are spread over the shards the same way, so they
+go up and down by adding, e.g. +1 when something's queued and -1 when it's taken off the queue, rather than being set.
+
+Histograms are durations in nanoseconds, recorded into the calling thread's own histogram and merged on read the same way. They're written
+out as Prometheus summaries in seconds, with the 50th, 90th, 99th and 99.9th percentiles.
+*/
+
+#ifndef metrics_h
+#define metrics_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_MAX_METRICS 256
+#define METRICS_MAX_HISTOGRAMS 16
+// what registering gives back when there's no room, updates to it go nowhere
+#define METRICS_DISCARD 0
+
+typedef enum { METRICS_TYPE_COUNTER = 0, METRICS_TYPE_GAUGE = 1, METRICS_TYPE_HISTOGRAM = 2 } metrics_type;
+
+typedef size_t metrics_id;
+
+/**
+ * Registers a metric, or finds the one already registered with this name. Safe from any thread.
+ * @param id set to the metric, or to METRICS_DISCARD on failure
+ * @returns 0 on success, non-0 if there's no room for another metric or the name is registered with a different type
+ */
+int metrics_register_cstr(char *name, char *help, metrics_type type, metrics_id *id);
+
+/**
+ * Adds to the calling thread's shard of a counter or gauge, n can be negative for a gauge.
+ */
+void metrics_add(metrics_id id, int64_t n);
+
+/**
+ * Records a duration into the calling thread's shard of a histogram.
+ */
+void metrics_record(metrics_id id, uint64_t ns);
+
+/**
+ * @returns the counter or gauge summed over every thread, including threads that have exited
+ */
+int64_t metrics_get(metrics_id id);
+
+/**
+ * Merges a histogram from every thread, including threads that have exited, into dst.
+ */
+void metrics_get_histogram(metrics_id id, histogram *dst);
+
+/**
+ * Appends every metric in the Prometheus text exposition format.
+ */
+void metrics_write_prometheus(string *dst);
+
+/**
+ * Appends a line for each histogram with its count, percentiles and max in microseconds, to be read by people rather than scraped.
+ */
+void metrics_write_histograms(string *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
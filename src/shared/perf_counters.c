@@ -0,0 +1,224 @@
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "perf_counters.h"
+
+typedef struct {
+	// prefix{labels}, for perf_counters_write
+	string name;
+	metrics_id count;
+	metrics_id totals[PERF_COUNTERS_NUM_COUNTERS];
+} perf_counters_phase;
+
+// a thread's counters, read all at once through the leader
+typedef struct {
+	int leader;
+	int fds[PERF_COUNTERS_NUM_COUNTERS];
+	// where each counter is in a read of the group, -1 if it couldn't be opened
+	int index[PERF_COUNTERS_NUM_COUNTERS];
+	size_t num_open;
+} perf_counters_group;
+
+static uint64_t perf_counters_configs[PERF_COUNTERS_NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+																	  PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+static char *perf_counters_names[PERF_COUNTERS_NUM_COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static char *perf_counters_help[PERF_COUNTERS_NUM_COUNTERS] = {
+	"CPU cycles in user space, summed over the times counted.", "Instructions retired in user space, summed over the times counted.",
+	"Last level cache misses in user space, summed over the times counted.",
+	"Mispredicted branches in user space, summed over the times counted."};
+
+static int perf_counters_enabled;
+static pthread_mutex_t perf_counters_mutex = PTHREAD_MUTEX_INITIALIZER;
+// guarded by perf_counters_mutex, but a phase's entry doesn't change once it's registered
+static perf_counters_phase perf_counters_phases[PERF_COUNTERS_MAX_PHASES];
+// PERF_COUNTERS_DISCARD is never handed out for a real phase
+static size_t perf_counters_num_phases = 1;
+
+static pthread_once_t perf_counters_group_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t perf_counters_group_key;
+static __thread perf_counters_group *perf_counters_thread_group;
+
+// private
+void perf_counters_group_exit(void *data) {
+	perf_counters_group *group = data;
+	for (size_t i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		if (group->index[i] >= 0) {
+			close(group->fds[i]);
+		}
+	}
+	free(group);
+	perf_counters_thread_group = NULL;
+}
+
+// private
+void perf_counters_create_group_key() {
+	pthread_key_create(&perf_counters_group_key, perf_counters_group_exit);
+}
+
+/*
+private
+
+Gets the calling thread's counters, opening them the first time. A thread where none of them could be opened keeps an empty group, so it
+only tries once.
+*/
+perf_counters_group *perf_counters_get_thread_group() {
+	if (perf_counters_thread_group) {
+		return perf_counters_thread_group;
+	}
+	pthread_once(&perf_counters_group_key_once, perf_counters_create_group_key);
+	perf_counters_group *group = malloc(sizeof(perf_counters_group));
+	group->leader = -1;
+	group->num_open = 0;
+	for (size_t i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = perf_counters_configs[i];
+		attr.read_format = PERF_FORMAT_GROUP;
+		// user space only, which is all that's allowed at the default perf_event_paranoid of 2
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// this thread on any cpu, the first counter opened leads the group
+		int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group->leader, PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			log_debug("perf counter %s isn't available\n", perf_counters_names[i]);
+			group->index[i] = -1;
+			continue;
+		}
+		if (group->leader < 0) {
+			group->leader = fd;
+		}
+		group->fds[i] = fd;
+		group->index[i] = group->num_open++;
+	}
+	pthread_setspecific(perf_counters_group_key, group);
+	perf_counters_thread_group = group;
+	return group;
+}
+
+int perf_counters_enable() {
+	if (!perf_counters_get_thread_group()->num_open) {
+		return 1;
+	}
+	__atomic_store_n(&perf_counters_enabled, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int perf_counters_is_enabled() {
+	return __atomic_load_n(&perf_counters_enabled, __ATOMIC_RELAXED);
+}
+
+void perf_counters_read(perf_counters_sample *sample) {
+	memset(sample, 0, sizeof(perf_counters_sample));
+	if (!perf_counters_is_enabled()) {
+		return;
+	}
+	perf_counters_group *group = perf_counters_get_thread_group();
+	if (!group->num_open) {
+		return;
+	}
+	// the number of counters, then each one's value in the order they were opened
+	uint64_t values[1 + PERF_COUNTERS_NUM_COUNTERS];
+	ssize_t length = read(group->leader, values, sizeof(values));
+	if (length < (ssize_t)((1 + group->num_open) * sizeof(uint64_t))) {
+		return;
+	}
+	for (size_t i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		if (group->index[i] >= 0) {
+			sample->values[i] = values[1 + group->index[i]];
+		}
+	}
+}
+
+int perf_counters_register_phases_cstr(char *prefix, char **labels, size_t num_phases, perf_counters_phase_id *ids) {
+	int result = 0;
+	string name;
+	string_init(&name);
+	pthread_mutex_lock(&perf_counters_mutex);
+	// find or make the phases first, then register their metrics a kind at a time so each family is together
+	size_t first_new = perf_counters_num_phases;
+	size_t num = first_new;
+	char *new_labels[PERF_COUNTERS_MAX_PHASES];
+	for (size_t i = 0; i < num_phases; i++) {
+		string_set_cstrf(&name, "%s{%s}", prefix, labels[i]);
+		ids[i] = PERF_COUNTERS_DISCARD;
+		for (size_t j = 1; j < num; j++) {
+			if (!string_compare_str(&perf_counters_phases[j].name, &name, STRING_COMPARE_CASE_SENSITIVE)) {
+				ids[i] = j;
+				break;
+			}
+		}
+		if (ids[i] != PERF_COUNTERS_DISCARD) {
+			continue;
+		}
+		if (num == PERF_COUNTERS_MAX_PHASES) {
+			result = 1;
+			continue;
+		}
+		ids[i] = num++;
+		new_labels[ids[i]] = labels[i];
+		string_init(&perf_counters_phases[ids[i]].name);
+		string_set_str(&perf_counters_phases[ids[i]].name, &name);
+	}
+	for (size_t i = first_new; i < num; i++) {
+		string_set_cstrf(&name, "%s_counted_total{%s}", prefix, new_labels[i]);
+		metrics_register_cstr(string_get_cstr(&name), "Times hardware counters were read around each phase.", METRICS_TYPE_COUNTER,
+							  &perf_counters_phases[i].count);
+	}
+	for (size_t counter = 0; counter < PERF_COUNTERS_NUM_COUNTERS; counter++) {
+		for (size_t i = first_new; i < num; i++) {
+			string_set_cstrf(&name, "%s_%s_total{%s}", prefix, perf_counters_names[counter], new_labels[i]);
+			metrics_register_cstr(string_get_cstr(&name), perf_counters_help[counter], METRICS_TYPE_COUNTER,
+								  &perf_counters_phases[i].totals[counter]);
+		}
+	}
+	// perf_counters_write doesn't take the lock, so the new phases are only counted once they're all filled in
+	__atomic_store_n(&perf_counters_num_phases, num, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&perf_counters_mutex);
+	string_dealloc(&name);
+	return result;
+}
+
+void perf_counters_add(perf_counters_phase_id id, perf_counters_sample *start, perf_counters_sample *end) {
+	if (!perf_counters_is_enabled() || id == PERF_COUNTERS_DISCARD) {
+		return;
+	}
+	perf_counters_phase *phase = &perf_counters_phases[id];
+	metrics_add(phase->count, 1);
+	for (size_t i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		metrics_add(phase->totals[i], end->values[i] - start->values[i]);
+	}
+}
+
+void perf_counters_get(perf_counters_phase_id id, uint64_t *count, perf_counters_sample *totals) {
+	perf_counters_phase *phase = &perf_counters_phases[id];
+	*count = id == PERF_COUNTERS_DISCARD ? 0 : metrics_get(phase->count);
+	for (size_t i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		totals->values[i] = id == PERF_COUNTERS_DISCARD ? 0 : metrics_get(phase->totals[i]);
+	}
+}
+
+void perf_counters_write(string *dst) {
+	if (!perf_counters_is_enabled()) {
+		return;
+	}
+	size_t num_phases = __atomic_load_n(&perf_counters_num_phases, __ATOMIC_ACQUIRE);
+	for (size_t i = 1; i < num_phases; i++) {
+		uint64_t count;
+		perf_counters_sample totals;
+		perf_counters_get(i, &count, &totals);
+		double divisor = count ? count : 1;
+		double cycles = totals.values[PERF_COUNTERS_CYCLES];
+		double instructions = totals.values[PERF_COUNTERS_INSTRUCTIONS];
+		string_append_cstrf(dst, "%s count=%llu cycles=%.1f instructions=%.1f ipc=%.2f cache_misses=%.1f branch_misses=%.1f\n",
+							string_get_cstr(&perf_counters_phases[i].name), (unsigned long long)count, cycles / divisor,
+							instructions / divisor, cycles ? instructions / cycles : 0,
+							totals.values[PERF_COUNTERS_CACHE_MISSES] / divisor, totals.values[PERF_COUNTERS_BRANCH_MISSES] / divisor);
+	}
+}
@@ -0,0 +1,96 @@
+/*
+Hardware performance counters, cycles, instructions, cache misses and branch misses, read around a phase of work on the calling thread and
+added up per phase in the metrics registry, so they come out on the metrics endpoint next to the latency histograms.
+
+Each thread opens its own perf_event_open group the first time it reads, counting only that thread in user space, so reading is one read
+of the group with no locking. It's still a system call, around a microsecond, so counting is off until perf_counters_enable is called and
+everything here costs a branch until then. Where the counters can't be opened, e.g. in a container, a VM without a virtual PMU, or with
+kernel.perf_event_paranoid above 2, perf_counters_enable fails and counting stays off. A counter the CPU doesn't have reads as 0 and the
+others are still counted.
+
+Phases are registered by name like metrics, registering the same one again gets the same id. Each phase is a metrics counter for how many
+times it was counted, and one for the total of each hardware counter over them, so they're per thread and summed on read the same way.
+
+References:
+https://man7.org/linux/man-pages/man2/perf_event_open.2.html
+*/
+
+#ifndef perf_counters_h
+#define perf_counters_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "metrics.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PERF_COUNTERS_MAX_PHASES 16
+
+typedef enum {
+	PERF_COUNTERS_CYCLES = 0,
+	PERF_COUNTERS_INSTRUCTIONS = 1,
+	PERF_COUNTERS_CACHE_MISSES = 2,
+	PERF_COUNTERS_BRANCH_MISSES = 3,
+	PERF_COUNTERS_NUM_COUNTERS = 4,
+} perf_counters_counter;
+
+typedef struct {
+	uint64_t values[PERF_COUNTERS_NUM_COUNTERS];
+} perf_counters_sample;
+
+// 0 is never handed out, so adding to it goes nowhere
+typedef size_t perf_counters_phase_id;
+#define PERF_COUNTERS_DISCARD 0
+
+/**
+ * Turns counting on for the process, checking the counters can be opened on the calling thread.
+ * @returns 0 on success, non-0 if no hardware counters are available, in which case counting stays off
+ */
+int perf_counters_enable();
+
+/**
+ * @returns non-0 if counting is on
+ */
+int perf_counters_is_enabled();
+
+/**
+ * Reads the calling thread's counters, opening them the first time. Only differences between two reads on the same thread mean anything.
+ * All 0 when counting is off.
+ */
+void perf_counters_read(perf_counters_sample *sample);
+
+/**
+ * Registers phases that are counted the same way, with metrics named like prefix_cycles_total{labels}. The phases are registered
+ * together so each metric's family is written out in one piece.
+ * @param labels for each phase, Prometheus labels without the braces, e.g. phase="parse"
+ * @param ids set to each phase's id, or to PERF_COUNTERS_DISCARD where there's no room for it
+ * @returns 0 on success, non-0 if any of them couldn't be registered
+ */
+int perf_counters_register_phases_cstr(char *prefix, char **labels, size_t num_phases, perf_counters_phase_id *ids);
+
+/**
+ * Counts the phase once, with what the counters went up by from start to end. Does nothing when counting is off.
+ */
+void perf_counters_add(perf_counters_phase_id id, perf_counters_sample *start, perf_counters_sample *end);
+
+/**
+ * Gets how many times a phase has been counted, and the totals over them.
+ */
+void perf_counters_get(perf_counters_phase_id id, uint64_t *count, perf_counters_sample *totals);
+
+/**
+ * Appends a line for each phase with the averages each time it was counted, and instructions per cycle, e.g.
+ * http_request_phase{phase="parse"} count=1000 cycles=8512.3 instructions=20411.0 ipc=2.40 cache_misses=3.1 branch_misses=40.2
+ * Nothing when counting is off.
+ */
+void perf_counters_write(string *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,427 @@
+#include <string.h>
+
+#include "log.h"
+#include "router.h"
+
+// private
+void router_node_init(router_node *node, router_node_type type) {
+	node->type = type;
+	string_init(&node->prefix);
+	string_init(&node->static_indices);
+	node->static_children_len = 0;
+	node->static_children = NULL;
+	node->param_child = NULL;
+	node->wildcard_child = NULL;
+	node->routes = NULL;
+}
+
+// private
+router_node *router_node_new(router_node_type type) {
+	router_node *node = malloc(sizeof(router_node));
+	router_node_init(node, type);
+	return node;
+}
+
+// private
+void router_node_dealloc(router_node *node) {
+	for (size_t i = 0; i < node->static_children_len; i++) {
+		router_node_dealloc(node->static_children[i]);
+		free(node->static_children[i]);
+	}
+	free(node->static_children);
+	if (node->param_child) {
+		router_node_dealloc(node->param_child);
+		free(node->param_child);
+	}
+	if (node->wildcard_child) {
+		router_node_dealloc(node->wildcard_child);
+		free(node->wildcard_child);
+	}
+	string_dealloc(&node->prefix);
+	string_dealloc(&node->static_indices);
+}
+
+// private
+router_node *router_node_get_static_child(router_node *node, char c) {
+	char *indices = string_get_cstr(&node->static_indices);
+	char *found = memchr(indices, c, string_get_length(&node->static_indices));
+	if (!found) {
+		return NULL;
+	}
+	return node->static_children[found - indices];
+}
+
+// private
+void router_node_add_static_child(router_node *node, router_node *child) {
+	node->static_children = realloc(node->static_children, sizeof(router_node *) * (node->static_children_len + 1));
+	node->static_children[node->static_children_len] = child;
+	node->static_children_len++;
+	string_append_cstr_len(&node->static_indices, string_get_cstr(&child->prefix), 1);
+}
+
+/*
+private
+
+Adds the static text below node, splitting existing nodes where they only partially share a prefix with the new text.
+
+Returns the node that ends at the last character of text.
+*/
+router_node *router_node_insert_static(router_node *node, char *text, size_t text_len) {
+	while (text_len > 0) {
+		router_node *child = router_node_get_static_child(node, text[0]);
+		if (!child) {
+			child = router_node_new(ROUTER_NODE_STATIC);
+			string_set_cstr_len(&child->prefix, text, text_len);
+			router_node_add_static_child(node, child);
+			return child;
+		}
+		size_t prefix_len = string_get_length(&child->prefix);
+		char *prefix = string_get_cstr(&child->prefix);
+		size_t common = 0;
+		while (common < prefix_len && common < text_len && prefix[common] == text[common]) {
+			common++;
+		}
+		if (common < prefix_len) {
+			// the new text diverges part way through this child, so the child keeps the common part and everything else moves down a level
+			router_node *tail = malloc(sizeof(router_node));
+			*tail = *child;
+			router_node_init(child, ROUTER_NODE_STATIC);
+			string_set_cstr_len(&child->prefix, string_get_cstr(&tail->prefix), common);
+			string_set_substr(&tail->prefix, &tail->prefix, common, prefix_len);
+			router_node_add_static_child(child, tail);
+		}
+		node = child;
+		text += common;
+		text_len -= common;
+	}
+	return node;
+}
+
+// private
+router_route *router_node_find_route(router_node *node, char *method, size_t method_len) {
+	for (router_route *route = node->routes; route; route = route->next_on_node) {
+		if (string_get_length(&route->method) == 0 ||
+			!string_compare_cstr_len(&route->method, method, method_len, STRING_COMPARE_CASE_SENSITIVE)) {
+			return route;
+		}
+	}
+	return NULL;
+}
+
+void router_init(router *r) {
+	router_node_init(&r->root, ROUTER_NODE_STATIC);
+	r->routes = NULL;
+}
+
+void router_dealloc(router *r) {
+	router_node_dealloc(&r->root);
+	while (r->routes) {
+		router_route *route = r->routes;
+		r->routes = route->next_in_router;
+		string_dealloc(&route->method);
+		string_dealloc(&route->pattern);
+		free(route);
+	}
+}
+
+/*
+private
+
+Checks the pattern against the syntax at the top of router.h without touching the tree, so a bad pattern never leaves nodes behind.
+
+Fills in the start and end of each parameter name. Returns non-0 if the pattern is malformed.
+*/
+int router_parse_pattern(char *pattern, size_t pattern_len, size_t *param_names, size_t *num_param_names) {
+	*num_param_names = 0;
+	for (size_t i = 0; i < pattern_len; i++) {
+		if (pattern[i] != ':' && pattern[i] != '*') {
+			continue;
+		}
+		int is_wildcard = pattern[i] == '*';
+		size_t name_start = i + 1;
+		size_t name_end = name_start;
+		while (name_end < pattern_len && pattern[name_end] != '/' && pattern[name_end] != ':' && pattern[name_end] != '*') {
+			name_end++;
+		}
+		if (is_wildcard && name_end != pattern_len) {
+			log_error("router_add_cstr failed, wildcard must be at the end of the pattern: %s\n", pattern);
+			return 1;
+		}
+		if (!is_wildcard && name_end == name_start) {
+			log_error("router_add_cstr failed, parameter is missing a name: %s\n", pattern);
+			return 1;
+		}
+		if (!is_wildcard && name_end < pattern_len && pattern[name_end] != '/') {
+			// a parameter consumes up to the next "/" so anything else after it could never match
+			log_error("router_add_cstr failed, parameter must be followed by \"/\" or the end of the pattern: %s\n", pattern);
+			return 1;
+		}
+		if (*num_param_names == ROUTER_MAX_PARAMS) {
+			log_error("router_add_cstr failed, too many parameters, max is %i: %s\n", ROUTER_MAX_PARAMS, pattern);
+			return 1;
+		}
+		param_names[*num_param_names * 2 + 0] = name_start;
+		param_names[*num_param_names * 2 + 1] = name_end;
+		(*num_param_names)++;
+		i = name_end - 1;
+	}
+	return 0;
+}
+
+/*
+private
+
+Walks a pattern that's already been checked by router_parse_pattern down from the root.
+
+Returns the node the pattern ends at. If create is set any missing nodes are added, otherwise returns NULL if any are missing.
+*/
+router_node *router_walk_pattern(router *r, char *pattern, size_t pattern_len, int create) {
+	router_node *node = &r->root;
+	size_t i = 0;
+	while (node && i < pattern_len) {
+		if (pattern[i] == ':' || pattern[i] == '*') {
+			router_node **child = pattern[i] == '*' ? &node->wildcard_child : &node->param_child;
+			if (!*child && create) {
+				*child = router_node_new(pattern[i] == '*' ? ROUTER_NODE_WILDCARD : ROUTER_NODE_PARAM);
+			}
+			node = *child;
+			while (i < pattern_len && pattern[i] != '/') {
+				i++;
+			}
+			continue;
+		}
+		size_t static_end = i;
+		while (static_end < pattern_len && pattern[static_end] != ':' && pattern[static_end] != '*') {
+			static_end++;
+		}
+		if (create) {
+			node = router_node_insert_static(node, pattern + i, static_end - i);
+			i = static_end;
+			continue;
+		}
+		// only whole prefixes, a path that ends part way through a node would need a split to add
+		while (node && i < static_end) {
+			router_node *child = router_node_get_static_child(node, pattern[i]);
+			size_t prefix_len = child ? string_get_length(&child->prefix) : 0;
+			if (!child || prefix_len > static_end - i || memcmp(string_get_cstr(&child->prefix), pattern + i, prefix_len)) {
+				return NULL;
+			}
+			node = child;
+			i += prefix_len;
+		}
+	}
+	return node;
+}
+
+int router_add_cstr(router *r, char *method, char *pattern, router_func callback, void *callback_data) {
+	if (!callback) {
+		log_error("router_add_cstr failed, callback is required\n");
+		return 1;
+	}
+	size_t pattern_len = strlen(pattern);
+	if (pattern_len == 0) {
+		log_error("router_add_cstr failed, pattern is empty\n");
+		return 1;
+	}
+	size_t num_param_names;
+	size_t param_names[ROUTER_MAX_PARAMS * 2];
+	if (router_parse_pattern(pattern, pattern_len, param_names, &num_param_names)) {
+		return 1;
+	}
+
+	if (!method) {
+		method = "";
+	}
+	router_node *node = router_walk_pattern(r, pattern, pattern_len, 0);
+	for (router_route *existing = node ? node->routes : NULL; existing; existing = existing->next_on_node) {
+		if (!string_compare_cstr(&existing->method, method, STRING_COMPARE_CASE_SENSITIVE)) {
+			log_error("router_add_cstr failed, route already exists: %s %s\n", method, pattern);
+			return 1;
+		}
+	}
+	// nothing can fail from here on
+	node = router_walk_pattern(r, pattern, pattern_len, 1);
+
+	router_route *route = malloc(sizeof(router_route));
+	string_init_cstr(&route->method, method);
+	string_init_cstr_len(&route->pattern, pattern, pattern_len);
+	route->num_param_names = num_param_names;
+	memcpy(route->param_names, param_names, sizeof(size_t) * num_param_names * 2);
+	route->callback = callback;
+	route->callback_data = callback_data;
+
+	// routes that match any method go last so that a specific method always takes precedence
+	router_route **tail = &node->routes;
+	if (method[0]) {
+		while (*tail && string_get_length(&(*tail)->method) > 0) {
+			tail = &(*tail)->next_on_node;
+		}
+	} else {
+		while (*tail) {
+			tail = &(*tail)->next_on_node;
+		}
+	}
+	route->next_on_node = *tail;
+	*tail = route;
+
+	route->next_in_router = r->routes;
+	r->routes = route;
+
+	return 0;
+}
+
+/*
+private
+
+Matches the remaining path against everything below node. The node itself has already been matched.
+
+Static children are tried first, then parameters, then wildcards. If a more specific branch fails further down we back up and try the less
+specific ones.
+
+Returns non-0 on a match.
+*/
+int router_node_match(router_node *node, char *method, size_t method_len, char *path, size_t path_len, router_match *match,
+					  int *path_matched) {
+	if (path_len == 0) {
+		if (node->routes) {
+			*path_matched = 1;
+			router_route *route = router_node_find_route(node, method, method_len);
+			if (route) {
+				match->route = route;
+				return 1;
+			}
+		}
+	} else {
+		router_node *child = router_node_get_static_child(node, path[0]);
+		if (child) {
+			size_t prefix_len = string_get_length(&child->prefix);
+			if (prefix_len <= path_len && !memcmp(string_get_cstr(&child->prefix), path, prefix_len)) {
+				if (router_node_match(child, method, method_len, path + prefix_len, path_len - prefix_len, match, path_matched)) {
+					return 1;
+				}
+			}
+		}
+
+		if (node->param_child && match->num_params < ROUTER_MAX_PARAMS) {
+			char *segment_end = memchr(path, '/', path_len);
+			size_t segment_len = segment_end ? segment_end - path : path_len;
+			if (segment_len > 0) {
+				router_param *param = &match->params[match->num_params];
+				param->value = path;
+				param->value_len = segment_len;
+				match->num_params++;
+				if (router_node_match(node->param_child, method, method_len, path + segment_len, path_len - segment_len, match,
+									  path_matched)) {
+					return 1;
+				}
+				match->num_params--;
+			}
+		}
+	}
+
+	if (node->wildcard_child && node->wildcard_child->routes && match->num_params < ROUTER_MAX_PARAMS) {
+		*path_matched = 1;
+		router_route *route = router_node_find_route(node->wildcard_child, method, method_len);
+		if (route) {
+			router_param *param = &match->params[match->num_params];
+			param->value = path;
+			param->value_len = path_len;
+			match->num_params++;
+			match->route = route;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+private
+
+Adds the method of every route whose pattern matches the path to allow, once each, following the same branches as router_node_match.
+*/
+void router_node_append_methods(router_node *node, char *path, size_t path_len, http_header *allow) {
+	router_route *routes = NULL;
+	if (path_len == 0) {
+		routes = node->routes;
+	} else {
+		router_node *child = router_node_get_static_child(node, path[0]);
+		if (child) {
+			size_t prefix_len = string_get_length(&child->prefix);
+			if (prefix_len <= path_len && !memcmp(string_get_cstr(&child->prefix), path, prefix_len)) {
+				router_node_append_methods(child, path + prefix_len, path_len - prefix_len, allow);
+			}
+		}
+		if (node->param_child) {
+			char *segment_end = memchr(path, '/', path_len);
+			size_t segment_len = segment_end ? segment_end - path : path_len;
+			if (segment_len > 0) {
+				router_node_append_methods(node->param_child, path + segment_len, path_len - segment_len, allow);
+			}
+		}
+	}
+	if (node->wildcard_child) {
+		router_node_append_methods(node->wildcard_child, "", 0, allow);
+	}
+	for (router_route *route = routes; route; route = route->next_on_node) {
+		size_t i = 0;
+		while (i < http_header_get_num_values(allow) &&
+			   string_compare_str(http_header_get_value(allow, i), &route->method, STRING_COMPARE_CASE_SENSITIVE)) {
+			i++;
+		}
+		// a route for any method would have matched, so there are none here
+		if (i == http_header_get_num_values(allow) && string_get_length(&route->method) > 0) {
+			string_set_str(http_header_append_value(allow), &route->method);
+		}
+	}
+}
+
+router_match_result router_match_cstr_len(router *r, char *method, size_t method_len, char *path, size_t path_len, router_match *match) {
+	match->route = NULL;
+	match->num_params = 0;
+	int path_matched = 0;
+	if (!router_node_match(&r->root, method, method_len, path, path_len, match, &path_matched)) {
+		match->num_params = 0;
+		return path_matched ? ROUTER_MATCH_METHOD_NOT_ALLOWED : ROUTER_MATCH_NOT_FOUND;
+	}
+	// names come from the route rather than the tree, since different routes can name the same parameter position differently
+	char *pattern = string_get_cstr(&match->route->pattern);
+	for (size_t i = 0; i < match->num_params; i++) {
+		match->params[i].name = pattern + match->route->param_names[i * 2 + 0];
+		match->params[i].name_len = match->route->param_names[i * 2 + 1] - match->route->param_names[i * 2 + 0];
+	}
+	return ROUTER_MATCH_SUCCESS;
+}
+
+router_param *router_match_get_param_cstr(router_match *match, char *name) {
+	size_t name_len = strlen(name);
+	for (size_t i = 0; i < match->num_params; i++) {
+		if (match->params[i].name_len == name_len && !memcmp(match->params[i].name, name, name_len)) {
+			return &match->params[i];
+		}
+	}
+	return NULL;
+}
+
+int router_handle_request(void *data, http_request *request, http_response *response) {
+	router *r = data;
+	string *method = http_request_get_method(request);
+	string *uri = http_request_get_uri(request);
+	char *path = string_get_cstr(uri);
+	size_t path_len = strcspn(path, "?#");
+	router_match match;
+	switch (router_match_cstr_len(r, string_get_cstr(method), string_get_length(method), path, path_len, &match)) {
+	case ROUTER_MATCH_SUCCESS:
+		return match.route->callback(match.route->callback_data, request, response, &match);
+	case ROUTER_MATCH_METHOD_NOT_ALLOWED:
+		log_trace("router_handle_request, method not allowed %s %s\n", string_get_cstr(method), path);
+		http_response_set_status_code(response, 405);
+		// RFC 7231 section 6.5.5, a 405 has to say which methods would have worked
+		router_node_append_methods(&r->root, path, path_len, http_headers_get_cstr(http_response_get_headers(response), "Allow", 1));
+		return 0;
+	default:
+		log_trace("router_handle_request, no route for %s %s\n", string_get_cstr(method), path);
+		http_response_set_status_code(response, 404);
+		return 0;
+	}
+}
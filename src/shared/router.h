@@ -0,0 +1,129 @@
+/*
+Matches HTTP requests to handlers by method and path.
+
+Registered patterns are compiled into a compressed radix tree. Matching walks the tree one path character at a time, so the cost depends
+on the length of the path and not on how many routes are registered. Matching never allocates, parameter values are reported as slices of
+the input path.
+
+Pattern syntax:
+/exact/path      matches only that path
+/users/:id       ":name" matches a single non-empty path segment, i.e. anything up to the next "/"
+/static/*rest    "*name" matches everything remaining in the path, including "/" and the empty string, and must be last in the pattern
+
+When several routes could match the same path static text is preferred over parameters, and parameters are preferred over wildcards.
+*/
+
+#ifndef router_h
+#define router_h
+
+#include "http.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROUTER_MAX_PARAMS 16
+
+typedef enum {
+	ROUTER_MATCH_SUCCESS = 0,
+	ROUTER_MATCH_NOT_FOUND = 1,
+	// the path matched at least one route, but not for the requested method
+	ROUTER_MATCH_METHOD_NOT_ALLOWED = 2
+} router_match_result;
+
+typedef struct {
+	// points into the registered pattern, not 0-terminated
+	char *name;
+	size_t name_len;
+	// points into the path that was matched, not 0-terminated
+	char *value;
+	size_t value_len;
+} router_param;
+
+struct router_route;
+
+typedef struct {
+	struct router_route *route;
+	size_t num_params;
+	router_param params[ROUTER_MAX_PARAMS];
+} router_match;
+
+typedef int (*router_func)(void *data, http_request *request, http_response *response, router_match *match);
+
+typedef struct router_route {
+	// all routes registered on the same node
+	struct router_route *next_on_node;
+	// all routes in the router, for cleanup
+	struct router_route *next_in_router;
+	// empty matches any method
+	string method;
+	string pattern;
+	size_t num_param_names;
+	// offsets into pattern, start and end of each parameter name in order
+	size_t param_names[ROUTER_MAX_PARAMS * 2];
+	router_func callback;
+	void *callback_data;
+} router_route;
+
+typedef enum {
+	ROUTER_NODE_STATIC = 0,
+	ROUTER_NODE_PARAM = 1,
+	ROUTER_NODE_WILDCARD = 2
+} router_node_type;
+
+typedef struct router_node {
+	router_node_type type;
+	// only for static nodes, the compressed run of characters this node matches
+	string prefix;
+	// the first character of each static child's prefix, in the same order as static_children
+	string static_indices;
+	size_t static_children_len;
+	struct router_node **static_children;
+	struct router_node *param_child;
+	struct router_node *wildcard_child;
+	router_route *routes;
+} router_node;
+
+typedef struct {
+	router_node root;
+	router_route *routes;
+} router;
+
+void router_init(router *r);
+void router_dealloc(router *r);
+
+/**
+ * Registers a new route.
+ * @param method the method to match, e.g. "GET", or NULL to match any method
+ * @param pattern the path pattern to match, see the syntax at the top of this file
+ * @param callback invoked by router_handle_request when this route matches
+ * @returns 0 on success, non-0 if the pattern is malformed or if the method and pattern are already registered
+ */
+int router_add_cstr(router *r, char *method, char *pattern, router_func callback, void *callback_data);
+
+/**
+ * Finds the route for the given method and path. Doesn't allocate.
+ * @param path the path to match, doesn't have to be 0-terminated, should not include any query string or fragment
+ * @param match filled in with the route and any parameters on success, parameter values point into path
+ * @returns ROUTER_MATCH_SUCCESS or the reason there was no match
+ */
+router_match_result router_match_cstr_len(router *r, char *method, size_t method_len, char *path, size_t path_len, router_match *match);
+
+/**
+ * @returns the parameter with the given name, or NULL if no such parameter was matched
+ */
+router_param *router_match_get_param_cstr(router_match *match, char *name);
+
+/**
+ * An http_server_func that dispatches to the matching route. Responds with 404 or 405 when there is no matching route. The query string and
+ * fragment are ignored for matching.
+ * @param data the router
+ */
+int router_handle_request(void *data, http_request *request, http_response *response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
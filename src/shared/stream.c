@@ -1,10 +1,18 @@
 #include "stream.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+// the scratch space for stream_write_cstrf is given back after a write bigger than this
+#define STREAM_MAX_FORMAT_SCRATCH_CAPACITY 65536
+
+static pthread_key_t stream_format_scratch_key;
+static pthread_once_t stream_format_scratch_once = PTHREAD_ONCE_INIT;
+
 int stream_file_descriptor_close(stream *stream, string *error) {
 	if (stream->file_descriptor.should_close) {
 		close(stream->file_descriptor.file_descriptor);
@@ -270,21 +278,36 @@ int stream_write_cstr(stream *stream, char *src, string *error) {
 	return stream_write(stream, src, strlen(src), error);
 }
 
+// private
+void stream_free_format_scratch(void *scratch) {
+	string_dealloc(scratch);
+	free(scratch);
+}
+
+// private
+void stream_create_format_scratch_key() {
+	pthread_key_create(&stream_format_scratch_key, stream_free_format_scratch);
+}
+
 int stream_write_cstrf(stream *stream, string *error, char *fmt, ...) {
-	buffer b;
-	buffer_init(&b);
-	// check how much more space we need
+	// formatted into a string kept per thread, so there's nothing to allocate once it's grown to fit
+	pthread_once(&stream_format_scratch_once, stream_create_format_scratch_key);
+	string *scratch = pthread_getspecific(stream_format_scratch_key);
+	if (!scratch) {
+		scratch = malloc(sizeof(string));
+		string_init(scratch);
+		pthread_setspecific(stream_format_scratch_key, scratch);
+	}
+	string_clear(scratch);
 	va_list args;
 	va_start(args, fmt);
-	size_t n = vsnprintf(NULL, 0, fmt, args);
-	va_end(args);
-	// resize to fit
-	buffer_set_length(&b, n + 1);
-	// write the string here
-	va_start(args, fmt);
-	vsnprintf(b.data, n + 1, fmt, args);
+	string_append_cstrvf(scratch, fmt, args);
 	va_end(args);
-	int result = stream_write(stream, b.data, n, error);
-	buffer_dealloc(&b);
+	int result = stream_write(stream, string_get_cstr(scratch), string_get_length(scratch), error);
+	// don't hang on to the memory for a one-off huge write
+	if (buffer_get_capacity(&scratch->b) > STREAM_MAX_FORMAT_SCRATCH_CAPACITY) {
+		string_clear(scratch);
+		buffer_set_capacity(&scratch->b, 1);
+	}
 	return result;
-}
\ No newline at end of file
+}
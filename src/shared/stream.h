@@ -113,7 +113,8 @@ int stream_write_str(stream *stream, string *src, string *error);
  */
 int stream_write_cstr(stream *stream, char *src, string *error);
 /**
- * As stream_write, but from a temporary string produced and filled with the formatting c-string.
+ * As stream_write, but from a string filled with the formatting c-string. The string is kept per thread and reused, so this doesn't
+ * allocate once it's big enough.
  *
  * Note that the optional return error is before the format string, to leave the format string next to the varargs.
  */
@@ -100,35 +100,44 @@ void string_set_cstr_len(string *s, char *other, size_t other_len) {
 	string_append_cstr_len(s, other, other_len);
 }
 
+void string_append_cstrvf(string *s, char *fmt, va_list args) {
+	size_t current_length = string_get_length(s);
+	// format straight into whatever room is already there, it's only when that's too small that it has to go round again
+	size_t available = buffer_get_capacity(&s->b) - current_length;
+	va_list attempt_args;
+	va_copy(attempt_args, args);
+	int n = vsnprintf(s->b.data + current_length, available, fmt, attempt_args);
+	va_end(attempt_args);
+	if (n < 0) {
+		// bad format, leave the string as it was
+		s->b.data[current_length] = 0;
+		return;
+	}
+	if ((size_t)n >= available) {
+		// grow by at least double so that repeated appends don't keep going round twice
+		size_t capacity = buffer_get_capacity(&s->b) * 2;
+		buffer_ensure_capacity(&s->b, current_length + n + 1 > capacity ? current_length + n + 1 : capacity);
+		vsnprintf(s->b.data + current_length, n + 1, fmt, args);
+	}
+	buffer_set_length(&s->b, current_length + n + 1);
+}
+
+void string_set_cstrvf(string *s, char *fmt, va_list args) {
+	string_clear(s);
+	string_append_cstrvf(s, fmt, args);
+}
+
 void string_append_cstrf(string *s, char *fmt, ...) {
-	// check how much more space we need
 	va_list args;
 	va_start(args, fmt);
-	size_t n = vsnprintf(NULL, 0, fmt, args);
+	string_append_cstrvf(s, fmt, args);
 	va_end(args);
-	// resize to fit
-	size_t current_length = string_get_length(s);
-	buffer_ensure_capacity(&s->b, current_length + n + 1);
-	// chop off the trailing 0 from this string
-	buffer_set_length(&s->b, current_length);
-	// write the string here
-	va_start(args, fmt);
-	vsnprintf(s->b.data + current_length, n + 1, fmt, args);
-	va_end(args);
-	buffer_set_length(&s->b, current_length + n + 1);
 }
 
 void string_set_cstrf(string *s, char *fmt, ...) {
-	// check how much more space we need
 	va_list args;
 	va_start(args, fmt);
-	size_t n = vsnprintf(NULL, 0, fmt, args);
-	va_end(args);
-	// resize to fit
-	buffer_set_length(&s->b, n + 1);
-	// write the string here
-	va_start(args, fmt);
-	vsnprintf(s->b.data, n + 1, fmt, args);
+	string_set_cstrvf(s, fmt, args);
 	va_end(args);
 }
 
@@ -172,6 +181,117 @@ void string_set_substr(string *dst, string *src, size_t start, size_t end) {
 	}
 }
 
+// two digits at a time when formatting integers
+static const char string_digit_pairs[] = "00010203040506070809"
+										 "10111213141516171819"
+										 "20212223242526272829"
+										 "30313233343536373839"
+										 "40414243444546474849"
+										 "50515253545556575859"
+										 "60616263646566676869"
+										 "70717273747576777879"
+										 "80818283848586878889"
+										 "90919293949596979899";
+
+char *string_format_uint64(char *end, uint64_t i) {
+	char *p = end;
+	while (i >= 100) {
+		p -= 2;
+		memcpy(p, string_digit_pairs + (i % 100) * 2, 2);
+		i /= 100;
+	}
+	if (i >= 10) {
+		p -= 2;
+		memcpy(p, string_digit_pairs + i * 2, 2);
+	} else {
+		*--p = '0' + i;
+	}
+	return p;
+}
+
+char *string_format_int64(char *end, int64_t i) {
+	// negate as unsigned so that INT64_MIN works
+	char *p = string_format_uint64(end, i < 0 ? -(uint64_t)i : (uint64_t)i);
+	if (i < 0) {
+		*--p = '-';
+	}
+	return p;
+}
+
+char *string_format_hex_uint64(char *end, uint64_t i) {
+	char *p = end;
+	do {
+		*--p = "0123456789abcdef"[i & 0xf];
+		i >>= 4;
+	} while (i);
+	return p;
+}
+
+void string_append_uint64(string *s, uint64_t i) {
+	char tmp[STRING_MAX_INT64_LENGTH];
+	char *end = tmp + sizeof(tmp);
+	char *start = string_format_uint64(end, i);
+	string_append_cstr_len(s, start, end - start);
+}
+
+void string_set_uint64(string *s, uint64_t i) {
+	string_clear(s);
+	string_append_uint64(s, i);
+}
+
+void string_append_int64(string *s, int64_t i) {
+	char tmp[STRING_MAX_INT64_LENGTH];
+	char *end = tmp + sizeof(tmp);
+	char *start = string_format_int64(end, i);
+	string_append_cstr_len(s, start, end - start);
+}
+
+void string_set_int64(string *s, int64_t i) {
+	string_clear(s);
+	string_append_int64(s, i);
+}
+
+int string_parse_uint64_cstr_len(char *s, size_t len, uint64_t *dst) {
+	if (len == 0) {
+		return 1;
+	}
+	uint64_t result = 0;
+	for (size_t i = 0; i < len; i++) {
+		// anything below '0' wraps around, so one comparison rejects every non-digit
+		uint64_t digit = (unsigned char)s[i] - (unsigned char)'0';
+		if (digit > 9) {
+			return 1;
+		}
+		// 19 digits always fit, only the 20th can overflow
+		if (i < 19) {
+			result = result * 10 + digit;
+		} else if (__builtin_mul_overflow(result, 10, &result) || __builtin_add_overflow(result, digit, &result)) {
+			return 1;
+		}
+	}
+	*dst = result;
+	return 0;
+}
+
+int string_parse_uint64(string *s, uint64_t *dst) {
+	return string_parse_uint64_cstr_len(string_get_cstr(s), string_get_length(s), dst);
+}
+
+int string_parse_int64_cstr_len(char *s, size_t len, int64_t *dst) {
+	int negative = len > 0 && s[0] == '-';
+	uint64_t magnitude;
+	if (string_parse_uint64_cstr_len(s + negative, len - negative, &magnitude) ||
+		magnitude > (negative ? -(uint64_t)INT64_MIN : (uint64_t)INT64_MAX)) {
+		return 1;
+	}
+	*dst = negative ? (int64_t)-magnitude : (int64_t)magnitude;
+	return 0;
+}
+
+int string_parse_int64(string *s, int64_t *dst) {
+	return string_parse_int64_cstr_len(string_get_cstr(s), string_get_length(s), dst);
+}
+
 size_t string_index_of_str(string *s, string *find, size_t start) {
 	size_t s_len = string_get_length(s);
 	size_t find_len = string_get_length(find);
@@ -1,6 +1,9 @@
 #ifndef string_h
 #define string_h
 
+#include <stdarg.h>
+#include <stdint.h>
+
 #include "buffer.h"
 
 #ifdef __cplusplus
@@ -63,13 +66,22 @@ void string_append_cstr_len(string *s, char *other, size_t other_len);
  */
 void string_set_cstr_len(string *s, char *other, size_t other_len);
 /**
- * Adds the contents of the formatted string to s.
+ * Adds the contents of the formatted string to s. The string is formatted straight into any spare capacity s already has, so it's only
+ * formatted twice if that isn't enough.
  */
 void string_append_cstrf(string *s, char *fmt, ...);
 /**
  * Replaces the contents of s with the formatted string.
  */
 void string_set_cstrf(string *s, char *fmt, ...);
+/**
+ * As string_append_cstrf, with the arguments already collected. args can't be used again afterwards.
+ */
+void string_append_cstrvf(string *s, char *fmt, va_list args);
+/**
+ * As string_set_cstrf, with the arguments already collected. args can't be used again afterwards.
+ */
+void string_set_cstrvf(string *s, char *fmt, va_list args);
 /**
  * Appends a portion of src to dst.
  * @param dst the string to add to
@@ -87,6 +99,72 @@ void string_append_substr(string *dst, string *src, size_t start, size_t end);
  */
 void string_set_substr(string *dst, string *src, size_t start, size_t end);
 
+// the most characters a formatted 64-bit integer can take, including a minus sign but not a 0-terminator
+#define STRING_MAX_INT64_LENGTH 20
+
+/**
+ * Formats i in decimal, right-aligned so that it ends just before end, with no 0-terminator. Two digits are done at a time from a table,
+ * without going through printf.
+ * @param end one past where the last digit goes, there must be room for up to STRING_MAX_INT64_LENGTH characters before it
+ * @returns the start of the formatted digits
+ */
+char *string_format_uint64(char *end, uint64_t i);
+/**
+ * Formats i in decimal, right-aligned so that it ends just before end, with no 0-terminator.
+ * @param end one past where the last character goes, there must be room for up to STRING_MAX_INT64_LENGTH characters before it
+ * @returns the start of the formatted characters, which is the minus sign if i is negative
+ */
+char *string_format_int64(char *end, int64_t i);
+/**
+ * Formats i in lower case hexadecimal, right-aligned so that it ends just before end, with no 0-terminator.
+ * @param end one past where the last digit goes, there must be room for up to 16 characters before it
+ * @returns the start of the formatted digits
+ */
+char *string_format_hex_uint64(char *end, uint64_t i);
+/**
+ * Adds i in decimal to s.
+ */
+void string_append_uint64(string *s, uint64_t i);
+/**
+ * Replaces the contents of s with i in decimal.
+ */
+void string_set_uint64(string *s, uint64_t i);
+/**
+ * Adds i in decimal to s.
+ */
+void string_append_int64(string *s, int64_t i);
+/**
+ * Replaces the contents of s with i in decimal.
+ */
+void string_set_int64(string *s, int64_t i);
+
+/**
+ * Parses the whole of s as a decimal integer. Unlike scanf nothing else is allowed, no whitespace, sign or trailing characters.
+ * @param s doesn't have to be 0-terminated
+ * @param len the length of s
+ * @param dst set to the value only if parsing succeeds
+ * @returns 0 on success, non-0 if s is empty, has anything but digits in it or is too big for 64 bits
+ */
+int string_parse_uint64_cstr_len(char *s, size_t len, uint64_t *dst);
+/**
+ * Parses the whole of s as a decimal integer, see string_parse_uint64_cstr_len.
+ * @returns 0 on success, non-0 if s isn't a valid integer or is too big for 64 bits
+ */
+int string_parse_uint64(string *s, uint64_t *dst);
+/**
+ * Parses the whole of s as a decimal integer with an optional leading minus sign. Nothing else is allowed.
+ * @param s doesn't have to be 0-terminated
+ * @param len the length of s
+ * @param dst set to the value only if parsing succeeds
+ * @returns 0 on success, non-0 if s isn't a valid integer or doesn't fit in 64 bits
+ */
+int string_parse_int64_cstr_len(char *s, size_t len, int64_t *dst);
+/**
+ * Parses the whole of s as a decimal integer with an optional leading minus sign, see string_parse_int64_cstr_len.
+ * @returns 0 on success, non-0 if s isn't a valid integer or doesn't fit in 64 bits
+ */
+int string_parse_int64(string *s, int64_t *dst);
+
 /**
  * Looks for the first occurance of another string in this one.
  * @param s the string to search in
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
@@ -12,6 +13,19 @@
 #include "tcp_socket_wrapper.h"
 
 #include "../shared/log.h"
+#include "../shared/metrics.h"
+
+static pthread_once_t tcp_socket_wrapper_metrics_once = PTHREAD_ONCE_INIT;
+static metrics_id tcp_socket_wrapper_accepted_metric;
+static metrics_id tcp_socket_wrapper_accept_errors_metric;
+
+// private
+void tcp_socket_wrapper_register_metrics() {
+	// io_loop counts the connections it accepts into the same metrics
+	metrics_register_cstr("tcp_connections_accepted_total", "Connections accepted.", METRICS_TYPE_COUNTER,
+						  &tcp_socket_wrapper_accepted_metric);
+	metrics_register_cstr("tcp_accept_errors_total", "Failed accepts.", METRICS_TYPE_COUNTER, &tcp_socket_wrapper_accept_errors_metric);
+}
 
 // private
 void get_inaddr_4_str(struct in_addr *addr, string *result) {
@@ -79,6 +93,28 @@ int get_address_for_hostname_str(string *hostname, string *address) {
 	return result;
 }
 
+// private
+int tcp_socket_wrapper_set_option(int socket, int level, int option, int value, char *name) {
+	if (setsockopt(socket, level, option, &value, sizeof(value))) {
+		log_error("failed to set %s to %i, %s\n", name, value, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+void tcp_socket_wrapper_configure_accepted(tcp_socket_wrapper *sock_wrap, int socket) {
+	tcp_socket_wrapper_options *options = &sock_wrap->options;
+	if (options->no_delay) {
+		tcp_socket_wrapper_set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+	}
+	if (options->quick_ack) {
+		tcp_socket_wrapper_set_option(socket, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+	}
+	if (options->busy_poll_microseconds > 0) {
+		tcp_socket_wrapper_set_option(socket, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll_microseconds, "SO_BUSY_POLL");
+	}
+}
+
 // private
 void *tcp_socket_wrapper_thread(void *data) {
 	log_trace("tcp_socket_wrapper_thread start\n");
@@ -121,8 +157,10 @@ void *tcp_socket_wrapper_thread(void *data) {
 		// some basic error checking
 		if (accepted_socket == -1) {
 			log_error("accepting incoming connection failed with %i\n", errno);
+			metrics_add(tcp_socket_wrapper_accept_errors_metric, 1);
 			continue;
 		}
+		metrics_add(tcp_socket_wrapper_accepted_metric, 1);
 
 		if (get_sockaddr_info_str((struct sockaddr *)&request_address, &address, &port)) {
 			log_error("error parsing address for incoming connection\n");
@@ -130,6 +168,7 @@ void *tcp_socket_wrapper_thread(void *data) {
 			continue;
 		}
 		log_trace("incoming request from %s:%i\n", string_get_cstr(&address), port);
+		tcp_socket_wrapper_configure_accepted(sock_wrap, accepted_socket);
 
 		sock_wrap->callback(sock_wrap->callback_data, &address, port, accepted_socket);
 	}
@@ -140,9 +179,29 @@ void *tcp_socket_wrapper_thread(void *data) {
 	return NULL;
 }
 
-int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16_t port, tcp_socket_wrapper_callback callback,
-							void *callback_data) {
+void tcp_socket_wrapper_options_init(tcp_socket_wrapper_options *options) {
+	options->backlog = SOMAXCONN;
+	options->reuse_address = 1;
+	// responses are usually written in several small pieces, so waiting to coalesce them only adds latency
+	options->no_delay = 1;
+	options->defer_accept_seconds = 0;
+	options->fast_open_queue_length = 0;
+	options->receive_buffer_size = 0;
+	options->send_buffer_size = 0;
+	options->quick_ack = 0;
+	options->busy_poll_microseconds = 0;
+}
+
+int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16_t port, tcp_socket_wrapper_options *options,
+							tcp_socket_wrapper_callback callback, void *callback_data) {
+	pthread_once(&tcp_socket_wrapper_metrics_once, tcp_socket_wrapper_register_metrics);
 	memset(sock_wrap, 0, sizeof(tcp_socket_wrapper));
+	tcp_socket_wrapper_options default_options;
+	if (!options) {
+		tcp_socket_wrapper_options_init(&default_options);
+		options = &default_options;
+	}
+	sock_wrap->options = *options;
 
 	int result = 0;
 
@@ -182,11 +241,6 @@ int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16
 	}
 	log_trace("tcp_socket_wrapper_init %s:%i\n", string_get_cstr(&sock_wrap->address), sock_wrap->port);
 
-	if (!callback) {
-		log_error("tcp_socket_wrapper_init failed, callback is required\n");
-		result = 1;
-		goto DONE;
-	}
 	sock_wrap->callback = callback;
 	sock_wrap->callback_data = callback_data;
 
@@ -196,9 +250,16 @@ int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16
 		result = 1;
 		goto DONE;
 	}
-	int option = 1;
-	if (setsockopt(sock_wrap->socket, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option))) {
-		log_error("tcp_socket_wrapper_init failed, failed to set socket options %s\n", strerror(errno));
+	if (tcp_socket_wrapper_set_option(sock_wrap->socket, SOL_SOCKET, SO_REUSEADDR, options->reuse_address ? 1 : 0, "SO_REUSEADDR") ||
+		(options->receive_buffer_size > 0 &&
+		 tcp_socket_wrapper_set_option(sock_wrap->socket, SOL_SOCKET, SO_RCVBUF, (int)options->receive_buffer_size, "SO_RCVBUF")) ||
+		(options->send_buffer_size > 0 &&
+		 tcp_socket_wrapper_set_option(sock_wrap->socket, SOL_SOCKET, SO_SNDBUF, (int)options->send_buffer_size, "SO_SNDBUF")) ||
+		(options->defer_accept_seconds > 0 && tcp_socket_wrapper_set_option(sock_wrap->socket, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+																			  options->defer_accept_seconds, "TCP_DEFER_ACCEPT")) ||
+		(options->fast_open_queue_length > 0 && tcp_socket_wrapper_set_option(sock_wrap->socket, IPPROTO_TCP, TCP_FASTOPEN,
+																				options->fast_open_queue_length, "TCP_FASTOPEN"))) {
+		log_error("tcp_socket_wrapper_init failed, failed to set socket options\n");
 		result = 1;
 		goto DONE;
 	}
@@ -207,13 +268,27 @@ int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16
 		result = 1;
 		goto DONE;
 	}
+	if (port == 0) {
+		// find out which port we actually got
+		if (getsockname(sock_wrap->socket, &addr.addr, &addr_len) ||
+			get_sockaddr_info_str((struct sockaddr *)&addr, &sock_wrap->address, &sock_wrap->port)) {
+			log_error("tcp_socket_wrapper_init failed, failed to get the bound port, %s\n", strerror(errno));
+			result = 1;
+			goto DONE;
+		}
+	}
 	// 2nd arg is number of connections that can be blocked waiting for the next accept
-	if (listen(sock_wrap->socket, 10) < 0) {
+	if (listen(sock_wrap->socket, options->backlog) < 0) {
 		log_error("tcp_socket_wrapper_init failed, failed to listen on socket, %s\n", strerror(errno));
 		result = 1;
 		goto DONE;
 	}
 
+	if (!callback) {
+		// the caller accepts connections itself
+		log_trace("tcp_socket_wrapper_init success, without an accept thread\n");
+		goto DONE;
+	}
 	sock_wrap->running = 1;
 	if (pthread_create(&sock_wrap->thread, NULL, tcp_socket_wrapper_thread, sock_wrap)) {
 		log_error("tcp_socket_wrapper_init failed, failed to make thread\n");
@@ -256,4 +331,8 @@ string *tcp_socket_wrapper_get_address(tcp_socket_wrapper *sock_wrap) {
 
 uint16_t tcp_socket_wrapper_get_port(tcp_socket_wrapper *sock_wrap) {
 	return sock_wrap->port;
+}
+
+int tcp_socket_wrapper_get_socket(tcp_socket_wrapper *sock_wrap) {
+	return sock_wrap->socket;
 }
\ No newline at end of file
@@ -16,9 +16,31 @@ extern "C" {
  */
 typedef void (*tcp_socket_wrapper_callback)(void *data, string *address, uint16_t port, int socket);
 
+typedef struct {
+	// how many connections can be waiting on accept, passed to listen
+	int backlog;
+	// SO_REUSEADDR on the listening socket
+	int reuse_address;
+	// TCP_NODELAY on accepted sockets, sends small writes immediately instead of waiting to coalesce them (Nagle)
+	int no_delay;
+	// TCP_DEFER_ACCEPT on the listening socket, only wakes on a connection once it has data or this many seconds pass, 0 to disable
+	int defer_accept_seconds;
+	// TCP_FASTOPEN on the listening socket, the max number of pending fast open requests, 0 to disable
+	int fast_open_queue_length;
+	// SO_RCVBUF and SO_SNDBUF on the listening socket, inherited by accepted sockets, 0 to leave the system default
+	size_t receive_buffer_size;
+	size_t send_buffer_size;
+	// TCP_QUICKACK on accepted sockets, acknowledges the request immediately instead of waiting to piggyback on the response. It's set
+	// once after accept and isn't sticky, the kernel leaves quick ack mode again on its own, so it mostly helps the first requests.
+	int quick_ack;
+	// SO_BUSY_POLL on accepted sockets, microseconds to busy poll the device queue on blocking reads, 0 to disable
+	int busy_poll_microseconds;
+} tcp_socket_wrapper_options;
+
 typedef struct {
 	tcp_socket_wrapper_callback callback;
 	void *callback_data;
+	tcp_socket_wrapper_options options;
 	int socket;
 	string address;
 	uint16_t port;
@@ -47,16 +69,32 @@ int get_hostname_str(string *hostname);
  */
 int get_address_for_hostname_str(string *hostname, string *address);
 
+/**
+ * Fills in the default options.
+ */
+void tcp_socket_wrapper_options_init(tcp_socket_wrapper_options *options);
+
 /**
  * @param address the address to bind to which may be NULL or "0.0.0.0" to indicate binding to any address
- * @param port the port to bind to
- * @param callback the function to call on incoming TCP connections
+ * @param port the port to bind to, 0 picks any available port which is then reported by tcp_socket_wrapper_get_port
+ * @param options optional, NULL uses the defaults
+ * @param callback the function to call on incoming TCP connections, NULL to not start an accept thread so the caller can accept on
+ * tcp_socket_wrapper_get_socket instead
  */
-int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16_t port, tcp_socket_wrapper_callback callback,
-							void *callback_data);
+int tcp_socket_wrapper_init(tcp_socket_wrapper *sock_wrap, char *address, uint16_t port, tcp_socket_wrapper_options *options,
+							tcp_socket_wrapper_callback callback, void *callback_data);
 int tcp_socket_wrapper_dealloc(tcp_socket_wrapper *sock_wrap);
 string *tcp_socket_wrapper_get_address(tcp_socket_wrapper *sock_wrap);
 uint16_t tcp_socket_wrapper_get_port(tcp_socket_wrapper *sock_wrap);
+/**
+ * @return the listening socket
+ */
+int tcp_socket_wrapper_get_socket(tcp_socket_wrapper *sock_wrap);
+/**
+ * Applies the options that don't carry over from the listening socket to a newly accepted one. These are all latency tweaks, so a
+ * failure is logged and the connection is still usable. The accept thread does this itself, it's only needed when accepting some other way.
+ */
+void tcp_socket_wrapper_configure_accepted(tcp_socket_wrapper *sock_wrap, int socket);
 
 #ifdef __cplusplus
 }
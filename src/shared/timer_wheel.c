@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "timer_wheel.h"
+
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+int timer_wheel_init(timer_wheel *wheel, uint64_t resolution_ns, uint64_t now_ns) {
+	if (resolution_ns == 0) {
+		return 1;
+	}
+	memset(wheel, 0, sizeof(timer_wheel));
+	wheel->resolution_ns = resolution_ns;
+	wheel->start_ns = now_ns;
+	return 0;
+}
+
+void timer_wheel_dealloc(timer_wheel *wheel) {
+	for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (size_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			for (timer_wheel_timer *timer = wheel->slots[level][slot]; timer; timer = timer->next) {
+				timer->pending = 0;
+			}
+			wheel->slots[level][slot] = NULL;
+		}
+		wheel->occupied[level] = 0;
+	}
+	wheel->num_timers = 0;
+}
+
+size_t timer_wheel_get_num_timers(timer_wheel *wheel) {
+	return wheel->num_timers;
+}
+
+void timer_wheel_timer_init(timer_wheel_timer *timer, timer_wheel_callback callback, void *data) {
+	timer->prev = NULL;
+	timer->next = NULL;
+	timer->callback = callback;
+	timer->data = data;
+	timer->expires_tick = 0;
+	timer->pending = 0;
+	timer->level = 0;
+	timer->slot = 0;
+}
+
+int timer_wheel_timer_is_pending(timer_wheel_timer *timer) {
+	return timer->pending;
+}
+
+// private
+void timer_wheel_link(timer_wheel *wheel, timer_wheel_timer *timer) {
+	// the highest 6 bit group where the expiry differs from now picks the level, everything above it already matches
+	uint64_t difference = timer->expires_tick ^ wheel->tick;
+	size_t level = difference < TIMER_WHEEL_SLOTS ? 0 : (63 - __builtin_clzll(difference)) / TIMER_WHEEL_SLOT_BITS;
+	size_t slot = (timer->expires_tick >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_SLOT_MASK;
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = wheel->slots[level][slot];
+	if (timer->next) {
+		timer->next->prev = timer;
+	}
+	wheel->slots[level][slot] = timer;
+	wheel->occupied[level] |= 1ull << slot;
+}
+
+// private
+void timer_wheel_unlink(timer_wheel *wheel, timer_wheel_timer *timer) {
+	if (timer->prev) {
+		timer->prev->next = timer->next;
+	} else {
+		wheel->slots[timer->level][timer->slot] = timer->next;
+		if (!timer->next) {
+			wheel->occupied[timer->level] &= ~(1ull << timer->slot);
+		}
+	}
+	if (timer->next) {
+		timer->next->prev = timer->prev;
+	}
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+void timer_wheel_schedule(timer_wheel *wheel, timer_wheel_timer *timer, uint64_t deadline_ns) {
+	if (timer->pending) {
+		timer_wheel_unlink(wheel, timer);
+	} else {
+		timer->pending = 1;
+		wheel->num_timers++;
+	}
+	// round up so a timer never fires early
+	uint64_t expires_tick = 0;
+	if (deadline_ns > wheel->start_ns) {
+		uint64_t elapsed_ns = deadline_ns - wheel->start_ns;
+		expires_tick = elapsed_ns / wheel->resolution_ns + (elapsed_ns % wheel->resolution_ns != 0);
+	}
+	timer->expires_tick = expires_tick < wheel->tick ? wheel->tick : expires_tick;
+	timer_wheel_link(wheel, timer);
+}
+
+void timer_wheel_cancel(timer_wheel *wheel, timer_wheel_timer *timer) {
+	if (!timer->pending) {
+		return;
+	}
+	timer_wheel_unlink(wheel, timer);
+	timer->pending = 0;
+	wheel->num_timers--;
+}
+
+/*
+Returns the next tick that needs processing, either because a timer on the lowest level expires then or because a higher level slot needs
+to be moved down, UINT64_MAX if there are no timers.
+
+Timers on a lower level always expire before any on a higher level, and every occupied slot is at or after the current tick's slot on its
+level, so the first occupied slot on the lowest occupied level is the answer.
+*/
+// private
+uint64_t timer_wheel_get_next_tick(timer_wheel *wheel) {
+	if (wheel->occupied[0]) {
+		uint64_t slot = wheel->tick & TIMER_WHEEL_SLOT_MASK;
+		return (wheel->tick & ~(uint64_t)TIMER_WHEEL_SLOT_MASK) + slot + __builtin_ctzll(wheel->occupied[0] >> slot);
+	}
+	for (size_t level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		if (!wheel->occupied[level]) {
+			continue;
+		}
+		size_t shift = level * TIMER_WHEEL_SLOT_BITS;
+		size_t upper_shift = shift + TIMER_WHEEL_SLOT_BITS;
+		uint64_t upper = upper_shift >= 64 ? 0 : wheel->tick >> upper_shift << upper_shift;
+		return upper + ((uint64_t)__builtin_ctzll(wheel->occupied[level]) << shift);
+	}
+	return UINT64_MAX;
+}
+
+/*
+Moves timers down out of any higher level slots that start at the current tick. This happens whenever the tick changes, so the slots before
+and at the current tick's slot on every level above the lowest are always empty.
+*/
+// private
+void timer_wheel_cascade(timer_wheel *wheel) {
+	if (wheel->tick & TIMER_WHEEL_SLOT_MASK) {
+		return;
+	}
+	// from the top down, so timers moved out of a higher level can be moved again out of a lower one that's also starting a new slot
+	for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+		size_t shift = level * TIMER_WHEEL_SLOT_BITS;
+		if (wheel->tick & ((1ull << shift) - 1)) {
+			continue;
+		}
+		size_t slot = (wheel->tick >> shift) & TIMER_WHEEL_SLOT_MASK;
+		timer_wheel_timer *timer = wheel->slots[level][slot];
+		wheel->slots[level][slot] = NULL;
+		wheel->occupied[level] &= ~(1ull << slot);
+		while (timer) {
+			timer_wheel_timer *next = timer->next;
+			timer_wheel_link(wheel, timer);
+			timer = next;
+		}
+	}
+}
+
+size_t timer_wheel_advance(timer_wheel *wheel, uint64_t now_ns) {
+	if (now_ns < wheel->start_ns) {
+		return 0;
+	}
+	uint64_t now_tick = (now_ns - wheel->start_ns) / wheel->resolution_ns;
+	size_t num_called = 0;
+	while (wheel->tick <= now_tick) {
+		// skip straight over ticks with nothing to do, nothing needs moving down in between either
+		uint64_t next_tick = timer_wheel_get_next_tick(wheel);
+		if (next_tick > now_tick) {
+			wheel->tick = now_tick + 1;
+			timer_wheel_cascade(wheel);
+			break;
+		}
+		wheel->tick = next_tick;
+		timer_wheel_cascade(wheel);
+		// callbacks can schedule more timers into this slot, they're due as well
+		size_t slot = wheel->tick & TIMER_WHEEL_SLOT_MASK;
+		timer_wheel_timer *timer;
+		while ((timer = wheel->slots[0][slot])) {
+			timer_wheel_unlink(wheel, timer);
+			timer->pending = 0;
+			wheel->num_timers--;
+			timer->callback(timer->data);
+			num_called++;
+		}
+		wheel->tick++;
+		timer_wheel_cascade(wheel);
+	}
+	return num_called;
+}
+
+uint64_t timer_wheel_get_next_deadline_ns(timer_wheel *wheel) {
+	uint64_t next_tick = timer_wheel_get_next_tick(wheel);
+	if (next_tick == UINT64_MAX || next_tick > (UINT64_MAX - wheel->start_ns) / wheel->resolution_ns) {
+		return UINT64_MAX;
+	}
+	return wheel->start_ns + next_tick * wheel->resolution_ns;
+}
@@ -0,0 +1,98 @@
+/*
+A hierarchical timer wheel. Time is divided into ticks of a fixed resolution, and each level of the wheel has 64 slots, each slot covering
+64 times as many ticks as a slot in the level below. A timer goes in the lowest level where its expiry and the current tick only differ
+within that level's bits, so scheduling and cancelling are a list insert or unlink. When the current tick crosses into a slot of a higher
+level its timers are redistributed into the levels below, so each timer is touched at most once per level before it expires.
+
+There are enough levels to cover every 64 bit tick, so no expiry ever needs to be clamped, and a bitmap per level finds the next occupied
+slot without scanning.
+
+Timers are intrusive, they're embedded in whatever they time out, so nothing is allocated. The wheel isn't thread safe, it's meant to be
+driven by a single loop thread.
+
+References:
+http://www.cs.columbia.edu/~nahum/w6998/papers/sosp87-timing-wheels.pdf
+https://lwn.net/Articles/646950/
+*/
+
+#ifndef timer_wheel_h
+#define timer_wheel_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+// enough levels of 6 bits to cover a 64 bit tick
+#define TIMER_WHEEL_LEVELS 11
+
+typedef void (*timer_wheel_callback)(void *data);
+
+typedef struct timer_wheel_timer {
+	struct timer_wheel_timer *prev;
+	struct timer_wheel_timer *next;
+	timer_wheel_callback callback;
+	void *data;
+	// the rest is private to the wheel
+	uint64_t expires_tick;
+	uint8_t pending;
+	uint8_t level;
+	uint8_t slot;
+} timer_wheel_timer;
+
+typedef struct timer_wheel {
+	uint64_t resolution_ns;
+	uint64_t start_ns;
+	// every tick before this has been run
+	uint64_t tick;
+	size_t num_timers;
+	uint64_t occupied[TIMER_WHEEL_LEVELS];
+	timer_wheel_timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel;
+
+/**
+ * @param resolution_ns how long a tick is, timers fire up to this late but never early
+ * @param now_ns the current time, in whatever clock the wheel will be advanced with
+ * @returns 0 on success, non-0 on bad arguments
+ */
+int timer_wheel_init(timer_wheel *wheel, uint64_t resolution_ns, uint64_t now_ns);
+/**
+ * Forgets every timer without calling them.
+ */
+void timer_wheel_dealloc(timer_wheel *wheel);
+size_t timer_wheel_get_num_timers(timer_wheel *wheel);
+
+void timer_wheel_timer_init(timer_wheel_timer *timer, timer_wheel_callback callback, void *data);
+int timer_wheel_timer_is_pending(timer_wheel_timer *timer);
+
+/**
+ * Schedules the timer, moving it if it's already pending. Deadlines that have already passed are due at the next tick.
+ * @param deadline_ns when to call the timer, UINT64_MAX works but will never come
+ */
+void timer_wheel_schedule(timer_wheel *wheel, timer_wheel_timer *timer, uint64_t deadline_ns);
+/**
+ * Stops the timer if it's pending, does nothing otherwise.
+ */
+void timer_wheel_cancel(timer_wheel *wheel, timer_wheel_timer *timer);
+
+/**
+ * Calls every timer that's due by now_ns, in expiry order to within a tick. Callbacks can schedule and cancel any timer, including
+ * their own.
+ * @returns how many timers were called
+ */
+size_t timer_wheel_advance(timer_wheel *wheel, uint64_t now_ns);
+/**
+ * @returns the time by which timer_wheel_advance has to be called next, UINT64_MAX if nothing is pending. This can be earlier than the
+ * first timer expires, when timers need to move down a level first.
+ */
+uint64_t timer_wheel_get_next_deadline_ns(timer_wheel *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "trace.h"
+
+typedef struct {
+	// odd while the span's being written, 0 if nothing's been written to the slot
+	uint64_t sequence;
+	uint64_t request_id;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	char *name;
+	int wait;
+} trace_span;
+
+typedef struct trace_ring {
+	struct trace_ring *next;
+	int thread_id;
+	// spans ever recorded, the next one goes at written % TRACE_RING_SIZE
+	uint64_t written;
+	trace_span spans[TRACE_RING_SIZE];
+} trace_ring;
+
+static uint32_t trace_sample_every;
+static uint64_t trace_last_id;
+// spans that ended before this are left out, so clearing doesn't have to touch the rings while they're being written
+static uint64_t trace_cleared_ns;
+static __thread uint32_t trace_thread_requests;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the rings of every running thread that's recorded a span, guarded by trace_mutex
+static trace_ring *trace_rings;
+
+static pthread_once_t trace_ring_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_ring_key;
+static __thread trace_ring *trace_thread_ring;
+
+void trace_set_sample(uint32_t every) {
+	__atomic_store_n(&trace_sample_every, every, __ATOMIC_RELAXED);
+}
+
+uint64_t trace_sample() {
+	uint32_t every = __atomic_load_n(&trace_sample_every, __ATOMIC_RELAXED);
+	if (!every || ++trace_thread_requests % every) {
+		return 0;
+	}
+	return __atomic_add_fetch(&trace_last_id, 1, __ATOMIC_RELAXED);
+}
+
+// private
+void trace_ring_exit(void *data) {
+	trace_ring *ring = data;
+	pthread_mutex_lock(&trace_mutex);
+	trace_ring **link = &trace_rings;
+	while (*link != ring) {
+		link = &(*link)->next;
+	}
+	*link = ring->next;
+	pthread_mutex_unlock(&trace_mutex);
+	free(ring);
+	trace_thread_ring = NULL;
+}
+
+// private
+void trace_create_ring_key() {
+	pthread_key_create(&trace_ring_key, trace_ring_exit);
+}
+
+/*
+private
+
+Gets the calling thread's ring, making it the first time the thread records a span.
+*/
+trace_ring *trace_get_thread_ring() {
+	if (trace_thread_ring) {
+		return trace_thread_ring;
+	}
+	pthread_once(&trace_ring_key_once, trace_create_ring_key);
+	trace_ring *ring = calloc(1, sizeof(trace_ring));
+	if (!ring) {
+		abort();
+	}
+	ring->thread_id = syscall(SYS_gettid);
+	pthread_mutex_lock(&trace_mutex);
+	ring->next = trace_rings;
+	trace_rings = ring;
+	pthread_mutex_unlock(&trace_mutex);
+	pthread_setspecific(trace_ring_key, ring);
+	trace_thread_ring = ring;
+	return ring;
+}
+
+// private
+void trace_record_span(uint64_t request_id, char *name, uint64_t start_ns, uint64_t end_ns, int wait) {
+	trace_ring *ring = trace_get_thread_ring();
+	trace_span *span = &ring->spans[ring->written % TRACE_RING_SIZE];
+	// only this thread writes to its ring, readers check the sequence is the same and even before and after they read a span
+	uint64_t sequence = span->sequence;
+	__atomic_store_n(&span->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&span->request_id, request_id, __ATOMIC_RELAXED);
+	__atomic_store_n(&span->start_ns, start_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&span->end_ns, end_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&span->name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&span->wait, wait, __ATOMIC_RELAXED);
+	__atomic_store_n(&span->sequence, sequence + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->written, ring->written + 1, __ATOMIC_RELAXED);
+}
+
+void trace_record(uint64_t request_id, char *name, uint64_t start_ns, uint64_t end_ns) {
+	if (request_id) {
+		trace_record_span(request_id, name, start_ns, end_ns, 0);
+	}
+}
+
+void trace_record_wait(uint64_t request_id, char *name, uint64_t start_ns, uint64_t end_ns) {
+	if (request_id) {
+		trace_record_span(request_id, name, start_ns, end_ns, 1);
+	}
+}
+
+/*
+private
+
+Copies a span out of a ring that may be writing to it.
+@returns 0 on success, non-0 if the slot is empty or was written to while it was being copied
+*/
+int trace_read_span(trace_span *src, trace_span *dst) {
+	uint64_t sequence = __atomic_load_n(&src->sequence, __ATOMIC_ACQUIRE);
+	if (!sequence || sequence % 2) {
+		return 1;
+	}
+	dst->request_id = __atomic_load_n(&src->request_id, __ATOMIC_RELAXED);
+	dst->start_ns = __atomic_load_n(&src->start_ns, __ATOMIC_RELAXED);
+	dst->end_ns = __atomic_load_n(&src->end_ns, __ATOMIC_RELAXED);
+	dst->name = __atomic_load_n(&src->name, __ATOMIC_RELAXED);
+	dst->wait = __atomic_load_n(&src->wait, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&src->sequence, __ATOMIC_RELAXED) != sequence;
+}
+
+// private
+void trace_write_event(json_writer *w, trace_span *span, char *phase, uint64_t ns, int pid, int tid) {
+	json_writer_begin_object(w);
+	json_writer_key_cstr(w, "name");
+	json_writer_cstr(w, span->name);
+	json_writer_key_cstr(w, "cat");
+	json_writer_cstr(w, "request");
+	json_writer_key_cstr(w, "ph");
+	json_writer_cstr(w, phase);
+	// microseconds, the most precise Chrome shows
+	json_writer_key_cstr(w, "ts");
+	json_writer_double(w, ns / 1e3);
+	if (!strcmp(phase, "X")) {
+		json_writer_key_cstr(w, "dur");
+		json_writer_double(w, (span->end_ns - span->start_ns) / 1e3);
+	} else {
+		// async events are matched up by id
+		json_writer_key_cstr(w, "id");
+		json_writer_uint64(w, span->request_id);
+	}
+	json_writer_key_cstr(w, "pid");
+	json_writer_int64(w, pid);
+	json_writer_key_cstr(w, "tid");
+	json_writer_int64(w, tid);
+	json_writer_key_cstr(w, "args");
+	json_writer_begin_object(w);
+	json_writer_key_cstr(w, "request_id");
+	json_writer_uint64(w, span->request_id);
+	json_writer_end_object(w);
+	json_writer_end_object(w);
+}
+
+int trace_write_chrome(stream *output, string *error) {
+	json_writer w;
+	json_writer_init(&w, output, 64 * 1024);
+	int pid = getpid();
+	uint64_t cleared_ns = __atomic_load_n(&trace_cleared_ns, __ATOMIC_RELAXED);
+	json_writer_begin_object(&w);
+	json_writer_key_cstr(&w, "traceEvents");
+	json_writer_begin_array(&w);
+	pthread_mutex_lock(&trace_mutex);
+	for (trace_ring *ring = trace_rings; ring; ring = ring->next) {
+		for (size_t i = 0; i < TRACE_RING_SIZE; i++) {
+			trace_span span;
+			if (trace_read_span(&ring->spans[i], &span) || span.end_ns < cleared_ns) {
+				continue;
+			}
+			if (span.wait) {
+				trace_write_event(&w, &span, "b", span.start_ns, pid, ring->thread_id);
+				trace_write_event(&w, &span, "e", span.end_ns, pid, ring->thread_id);
+			} else {
+				trace_write_event(&w, &span, "X", span.start_ns, pid, ring->thread_id);
+			}
+		}
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	json_writer_end_array(&w);
+	json_writer_key_cstr(&w, "displayTimeUnit");
+	json_writer_cstr(&w, "ns");
+	json_writer_end_object(&w);
+	int result = json_writer_flush(&w, error);
+	json_writer_dealloc(&w);
+	return result;
+}
+
+void trace_clear() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	__atomic_store_n(&trace_cleared_ns, now.tv_sec * 1000000000ull + now.tv_nsec, __ATOMIC_RELAXED);
+}
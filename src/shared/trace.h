@@ -0,0 +1,76 @@
+/*
+Spans of time a sample of requests spent in each stage, for seeing where a single slow request went across the threads it passed through.
+
+Which requests are traced is decided once, when they arrive, by trace_sample, which gives a sampled request an id for all its spans and
+every other request 0. Recording a span with id 0 is a branch, so tracing can stay on with a low sample rate, and with sampling off
+trace_sample is a load and a branch.
+
+Each thread records its spans into its own ring of the last TRACE_RING_SIZE spans, overwriting the oldest, with no locking. Writing the
+trace out reads every thread's ring while they're still being written. Each slot has a sequence number that's odd while it's being written,
+so a span that's overwritten while it's being read is skipped rather than torn. Spans in the rings of threads that have exited are lost.
+
+The trace is written in the Chrome trace event format, which chrome://tracing and https://ui.perfetto.dev open. Spans are complete events
+on the track of the thread that recorded them, with the request id as an argument. Waits that aren't on any thread, like a request sitting
+in a queue, are async events, which get a track of their own per request id.
+
+References:
+https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+*/
+
+#ifndef trace_h
+#define trace_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+#include "string.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// spans kept per thread, a power of 2
+#define TRACE_RING_SIZE 4096
+
+/**
+ * Sets how many requests are traced, process wide.
+ * @param every one in every this many calls to trace_sample on each thread is sampled, 0 for none
+ */
+void trace_set_sample(uint32_t every);
+
+/**
+ * Decides whether to trace a new request.
+ * @returns a new id, unique in the process and never 0, if the request is sampled, otherwise 0
+ */
+uint64_t trace_sample();
+
+/**
+ * Records a span on the calling thread's track. Does nothing if request_id is 0.
+ * @param name a string constant, only the pointer is kept
+ * @param start_ns from io_loop_now_ns, or anything else on CLOCK_MONOTONIC
+ */
+void trace_record(uint64_t request_id, char *name, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * As trace_record, for a span that isn't time spent on the calling thread, e.g. waiting in a queue for it.
+ */
+void trace_record_wait(uint64_t request_id, char *name, uint64_t start_ns, uint64_t end_ns);
+
+/**
+ * Writes every span in every running thread's ring as a Chrome trace JSON object.
+ * @param error optional, if provided and an error occurs the contents are replaced with an error message
+ * @returns 0 on success, non-0 if writing to the stream failed
+ */
+int trace_write_chrome(stream *output, string *error);
+
+/**
+ * Forgets every span recorded so far.
+ */
+void trace_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,6 @@
 #include "uri.h"
 #include "log.h"
 
-#include <stdio.h>
 #include <string.h>
 
 void uri_append_decoded_str(string *dst, string *src) {
@@ -288,9 +287,9 @@ int uri_parse_cstr_len(uri *u, char *input, size_t input_length) {
 		// https://datatracker.ietf.org/doc/html/rfc3986#section-3.2.3
 		if (u->has_host && port_separator != -1 && i - port_separator >= 1) {
 			string_set_cstr_len(&u->port_str, input + port_separator + 1, i - port_separator - 1);
-			int n;
-			if (sscanf(string_get_cstr(&u->port_str), "%i%n", &u->port, &n) == 1 && u->port >= 0 && u->port < 65536 &&
-				n == string_get_length(&u->port_str)) {
+			uint64_t port;
+			if (!string_parse_uint64(&u->port_str, &port) && port < 65536) {
+				u->port = port;
 				u->has_port = 1;
 			} else {
 				host_end = i;
@@ -442,7 +441,8 @@ void uri_append_to_string(uri *u, string *s) {
 		string_append_str(s, &u->host);
 	}
 	if (u->has_port) {
-		string_append_cstrf(s, ":%d", u->port);
+		string_append_cstr(s, ":");
+		string_append_int64(s, u->port);
 	}
 	if (u->has_path) {
 		uri_append_encoded_str(s, &u->path);
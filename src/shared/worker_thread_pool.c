@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -5,8 +7,35 @@
 #include <time.h>
 
 #include "log.h"
+#include "metrics.h"
 #include "worker_thread_pool.h"
 
+// shared by every pool in the process
+static pthread_once_t worker_thread_pool_metrics_once = PTHREAD_ONCE_INIT;
+static metrics_id worker_thread_pool_queued_metric;
+static metrics_id worker_thread_pool_pooled_metric;
+static metrics_id worker_thread_pool_busy_metric;
+static metrics_id worker_thread_pool_completed_metric;
+static metrics_id worker_thread_pool_queue_full_metric;
+static metrics_id worker_thread_pool_timeouts_metric;
+
+// private
+void worker_thread_pool_register_metrics() {
+	// one that can't be registered is discarded, which isn't worth failing over
+	metrics_register_cstr("worker_thread_pool_tasks_queued", "Tasks waiting for a worker thread.", METRICS_TYPE_GAUGE,
+						  &worker_thread_pool_queued_metric);
+	metrics_register_cstr("worker_thread_pool_tasks_pooled", "Allocated tasks waiting to be reused.", METRICS_TYPE_GAUGE,
+						  &worker_thread_pool_pooled_metric);
+	metrics_register_cstr("worker_thread_pool_threads_busy", "Worker threads running a task.", METRICS_TYPE_GAUGE,
+						  &worker_thread_pool_busy_metric);
+	metrics_register_cstr("worker_thread_pool_tasks_completed_total", "Tasks run to completion.", METRICS_TYPE_COUNTER,
+						  &worker_thread_pool_completed_metric);
+	metrics_register_cstr("worker_thread_pool_queue_full_total", "Tasks turned away because the queue was full.", METRICS_TYPE_COUNTER,
+						  &worker_thread_pool_queue_full_metric);
+	metrics_register_cstr("worker_thread_pool_timeouts_total", "Tasks the caller stopped waiting for.", METRICS_TYPE_COUNTER,
+						  &worker_thread_pool_timeouts_metric);
+}
+
 void *worker_thread_pool_pthread_callback(void *data) {
 	worker_thread_pool_context *context = data;
 	log_trace("worker_thread_pool_pthread_callback start, thread id %i\n", context->id);
@@ -18,7 +47,7 @@ void *worker_thread_pool_pthread_callback(void *data) {
 			struct timespec timeout;
 			timespec_get(&timeout, TIME_UTC);
 			timeout.tv_sec += 5;
-			int semaphore_error;
+			int semaphore_error = 0;
 			if (sem_timedwait(&context->pool->tasks_semaphore, &timeout)) {
 				semaphore_error = errno;
 			}
@@ -52,13 +81,17 @@ void *worker_thread_pool_pthread_callback(void *data) {
 			context->pool->task_pending_last = NULL;
 		}
 		context->pool->task_pending_len--;
+		metrics_add(worker_thread_pool_queued_metric, -1);
 		log_trace("worker_thread_pool_pthread_callback dequeued task, new task len %i\n", context->pool->task_pending_len);
 
 		// intentionally not blocking the actual callback, that might take a while
 		pthread_mutex_unlock(&context->pool->tasks_mutex);
 
 		// actually do the work
+		metrics_add(worker_thread_pool_busy_metric, 1);
 		int callback_result = task->callback(context->id, task->data);
+		metrics_add(worker_thread_pool_busy_metric, -1);
+		metrics_add(worker_thread_pool_completed_metric, 1);
 		if (task->result) {
 			*task->result = callback_result;
 		}
@@ -72,6 +105,7 @@ void *worker_thread_pool_pthread_callback(void *data) {
 			task->next = context->pool->task_pool_first;
 			context->pool->task_pool_first = task;
 			context->pool->task_pool_len++;
+			metrics_add(worker_thread_pool_pooled_metric, 1);
 			log_trace("worker_thread_pool_pthread_callback task timed out, returned completed task to pool, new pool size %i\n",
 					  context->pool->task_pool_len);
 		} else {
@@ -96,6 +130,7 @@ worker_thread_pool_error worker_thread_pool_init(worker_thread_pool *pool, int n
 		log_error("worker_thread_pool_init failed, queue_size must be positive\n");
 		return WORKER_THREAD_POOL_ERROR;
 	}
+	pthread_once(&worker_thread_pool_metrics_once, worker_thread_pool_register_metrics);
 	memset(pool, 0, sizeof(worker_thread_pool));
 	pool->num_threads = num_threads;
 	pool->max_queue_size = queue_size;
@@ -131,6 +166,29 @@ worker_thread_pool_error worker_thread_pool_init(worker_thread_pool *pool, int n
 	return WORKER_THREAD_POOL_SUCCESS;
 }
 
+worker_thread_pool_error worker_thread_pool_set_cpu_affinity(worker_thread_pool *pool, int *cpus, size_t num_cpus) {
+	if (num_cpus == 0) {
+		log_error("worker_thread_pool_set_cpu_affinity failed, no cpus given\n");
+		return WORKER_THREAD_POOL_ERROR;
+	}
+	for (int i = 0; i < pool->num_threads; i++) {
+		int cpu = cpus[i % num_cpus];
+		if (cpu < 0 || cpu >= CPU_SETSIZE) {
+			log_error("worker_thread_pool_set_cpu_affinity failed, invalid cpu %i\n", cpu);
+			return WORKER_THREAD_POOL_ERROR;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		int error = pthread_setaffinity_np(pool->threads[i].thread, sizeof(set), &set);
+		if (error) {
+			log_error("worker_thread_pool_set_cpu_affinity failed, thread %i cpu %i, %s\n", i, cpu, strerror(error));
+			return WORKER_THREAD_POOL_ERROR;
+		}
+	}
+	return WORKER_THREAD_POOL_SUCCESS;
+}
+
 worker_thread_pool_error worker_thread_pool_dealloc(worker_thread_pool *pool) {
 	log_trace("worker_thread_pool_dealloc start\n");
 	// all threads should be exiting
@@ -161,6 +219,8 @@ worker_thread_pool_error worker_thread_pool_dealloc(worker_thread_pool *pool) {
 		log_error("worker_thread_pool_dealloc failed, pthread_mutex_destroy failed on task mutex\n");
 	}
 	pool->tasks_mutex_is_init = 0;
+	metrics_add(worker_thread_pool_pooled_metric, -pool->task_pool_len);
+	metrics_add(worker_thread_pool_queued_metric, -pool->task_pending_len);
 	for (worker_thread_pool_task *t = pool->task_pool_first; t;) {
 		worker_thread_pool_task *t2 = t;
 		t = t->next;
@@ -199,6 +259,7 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 	if (pool->task_pending_len >= pool->max_queue_size) {
 		log_error("worker_thread_pool_enqueue failed, queue is full\n");
 		pthread_mutex_unlock(&pool->tasks_mutex);
+		metrics_add(worker_thread_pool_queue_full_metric, 1);
 		return WORKER_THREAD_POOL_ERROR_QUEUE_FULL;
 	}
 
@@ -220,6 +281,7 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 		pool->task_pool_first = pool->task_pool_first->next;
 		task->next = NULL;
 		pool->task_pool_len--;
+		metrics_add(worker_thread_pool_pooled_metric, -1);
 		log_trace("worker_thread_pool_enqueue got task from pool, new pool size %i\n", pool->task_pool_len);
 	}
 
@@ -229,6 +291,11 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 	task->result = callback_result;
 	task->timedout = 0;
 	task->completed = 0;
+	if (timeout == 0) {
+		// nobody is waiting, so the worker puts the task back on the pool as though it timed out, and can't write the result
+		task->result = NULL;
+		task->timedout = 1;
+	}
 
 	// stick the new task on the end of the queue
 	if (pool->task_pending_len > 0) {
@@ -239,6 +306,7 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 		pool->task_pending_last = task;
 	}
 	pool->task_pending_len++;
+	metrics_add(worker_thread_pool_queued_metric, 1);
 	log_trace("worker_thread_pool_enqueue new task queue length %i\n", pool->task_pending_len);
 
 	// no longer blocking, and wake up a thread
@@ -277,6 +345,7 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 			task->result = NULL;
 			task->timedout = 1;
 			log_error("worker_thread_pool_enqueue failed, task timed out\n");
+			metrics_add(worker_thread_pool_timeouts_metric, 1);
 			exit_with_error = WORKER_THREAD_POOL_ERROR_TIMEOUT;
 			add_task_back_to_pool = 0;
 		} else {
@@ -288,6 +357,7 @@ worker_thread_pool_error worker_thread_pool_enqueue(worker_thread_pool *pool, wo
 			task->next = pool->task_pool_first;
 			pool->task_pool_first = task;
 			pool->task_pool_len++;
+			metrics_add(worker_thread_pool_pooled_metric, 1);
 			log_trace("worker_thread_pool_enqueue, returned timed out task to pool, new pool size %i\n", pool->task_pool_len);
 		}
 		pthread_mutex_unlock(&pool->tasks_mutex);
@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -82,12 +83,20 @@ Returns WORKER_THREAD_POOL_SUCCESS on success, WORKER_THREAD_POOL_ERROR on failu
 */
 worker_thread_pool_error worker_thread_pool_dealloc(worker_thread_pool *pool);
 
+/*
+Pins the worker threads to the given CPUs, thread i runs on cpus[i % num_cpus].
+
+Returns WORKER_THREAD_POOL_SUCCESS on success, WORKER_THREAD_POOL_ERROR on failure.
+*/
+worker_thread_pool_error worker_thread_pool_set_cpu_affinity(worker_thread_pool *pool, int *cpus, size_t num_cpus);
+
 /*
 Enqueues a new job in the queue and blocks until it is complete.
 
 If callback_result is provided and the task completes it's set to the result of the callback.
 
-timeout is given in nanoseconds. A value of 0 means no timeout, timeout of -1 means infinite timeout.
+timeout is given in nanoseconds. A value of 0 means don't wait, the task runs without the caller finding out when or with what result,
+timeout of -1 means infinite timeout.
 
 Returns WORKER_THREAD_POOL_SUCCESS on success.
 
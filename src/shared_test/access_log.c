@@ -0,0 +1,264 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/access_log.h"
+#include "../shared/string.h"
+
+#define NUM_THREADS 4
+#define NUM_ENTRIES 5000
+
+void read_file(char *path, string *contents) {
+	FILE *file = fopen(path, "r");
+	assert(file);
+	string_clear(contents);
+	char chunk[4096];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		string_append_cstr_len(contents, chunk, read);
+	}
+	fclose(file);
+}
+
+size_t count_lines(string *contents) {
+	size_t num_lines = 0;
+	for (size_t i = 0; i < string_get_length(contents); i++) {
+		num_lines += string_get_cstr(contents)[i] == '\n';
+	}
+	return num_lines;
+}
+
+void make_path(char *path, size_t capacity, char *name) {
+	snprintf(path, capacity, "/tmp/test_access_log_%i_%s", (int)getpid(), name);
+	unlink(path);
+}
+
+void format() {
+	char path[256];
+	make_path(path, sizeof(path), "format");
+	string error;
+	string_init(&error);
+	access_log log;
+	assert(access_log_init(&log, "/nonexistent/dir/log", 1, 1, &error) != 0);
+	assert(string_get_length(&error) > 0);
+	assert(access_log_init(&log, path, 0, 1, NULL) != 0);
+	assert(access_log_init(&log, path, 2, 1, &error) == 0);
+
+	string address, method, uri;
+	string_init_cstr(&address, "127.0.0.1");
+	string_init_cstr(&method, "GET");
+	string_init_cstr(&uri, "/a b\"c\\\x01");
+	access_log_entry entry = {0};
+	entry.address = &address;
+	entry.port = 8080;
+	entry.method = &method;
+	entry.uri = &uri;
+	entry.status_code = 200;
+	entry.bytes = 1234;
+	entry.parse_ns = 1500;
+	entry.queue_ns = 20;
+	entry.handler_ns = 3000000;
+	entry.write_ns = 999;
+	access_log_write(&log, 0, &entry);
+	// the parser turns these away, but a method that got through still can't start a line of its own
+	string forged;
+	string_init_cstr(&forged, "GET\ntime=x remote=10.0.0.1\x7f");
+	entry.method = &forged;
+	access_log_write(&log, 0, &entry);
+	string_dealloc(&forged);
+	// nothing is known about a connection that was turned away
+	access_log_entry shed = {0};
+	shed.status_code = 503;
+	access_log_write(&log, 1, &shed);
+	access_log_flush(&log);
+
+	string contents;
+	string_init(&contents);
+	read_file(path, &contents);
+	char *line = string_get_cstr(&contents);
+	// the time is the only part that changes
+	assert(!strncmp(line, "time=", 5));
+	char *after_time = strchr(line, ' ');
+	assert(after_time && after_time - line == strlen("time=2026-10-19T12:34:56.789Z"));
+	assert(line[after_time - line - 1] == 'Z');
+	char *expected = " remote=127.0.0.1:8080 method=GET uri=\"/a b\\x22c\\x5c\\x01\" status=200 bytes=1234 parse_us=1.500 queue_us=0.020 "
+					 "handler_us=3000.000 write_us=0.999\n";
+	assert(!strncmp(after_time, expected, strlen(expected)));
+	line = strchr(line, '\n') + 1;
+	after_time = strchr(line, ' ');
+	expected = " remote=127.0.0.1:8080 method=GET\\x0atime\\x3dx\\x20remote\\x3d10.0.0.1\\x7f uri=";
+	assert(!strncmp(after_time, expected, strlen(expected)));
+	line = strchr(line, '\n') + 1;
+	after_time = strchr(line, ' ');
+	expected = " remote=- method=- uri=- status=503 bytes=0 parse_us=0.000 queue_us=0.000 handler_us=0.000 write_us=0.000\n";
+	assert(!strcmp(after_time, expected));
+
+	access_log_dealloc(&log);
+	unlink(path);
+	string_dealloc(&contents);
+	string_dealloc(&address);
+	string_dealloc(&method);
+	string_dealloc(&uri);
+	string_dealloc(&error);
+}
+
+typedef struct {
+	access_log *log;
+	size_t slot;
+} writer_data;
+
+void *write_entries(void *data) {
+	writer_data *writer = data;
+	string uri;
+	string_init(&uri);
+	access_log_entry entry = {0};
+	entry.uri = &uri;
+	entry.status_code = 200;
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		string_set_cstrf(&uri, "/%zu/%i", writer->slot, i);
+		entry.bytes = i;
+		access_log_write(writer->log, writer->slot, &entry);
+	}
+	string_dealloc(&uri);
+	return NULL;
+}
+
+void threads() {
+	char path[256];
+	make_path(path, sizeof(path), "threads");
+	access_log log;
+	assert(access_log_init(&log, path, NUM_THREADS, 1, NULL) == 0);
+	pthread_t threads[NUM_THREADS];
+	writer_data writers[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		writers[i].log = &log;
+		writers[i].slot = i;
+		assert(pthread_create(&threads[i], NULL, write_entries, &writers[i]) == 0);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	// dealloc writes out whatever the background thread hasn't got to
+	access_log_dealloc(&log);
+
+	// every entry is whole, and each slot's come out in order
+	string contents;
+	string_init(&contents);
+	read_file(path, &contents);
+	int next[NUM_THREADS] = {0};
+	char *line = string_get_cstr(&contents);
+	while (*line) {
+		char *end = strchr(line, '\n');
+		assert(end);
+		int slot, i;
+		char *uri = strstr(line, " uri=\"/");
+		assert(uri && uri < end && sscanf(uri, " uri=\"/%i/%i\"", &slot, &i) == 2);
+		assert(slot >= 0 && slot < NUM_THREADS && i == next[slot]);
+		next[slot]++;
+		line = end + 1;
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		assert(next[i] == NUM_ENTRIES);
+	}
+	unlink(path);
+	string_dealloc(&contents);
+}
+
+void sampling() {
+	char path[256];
+	make_path(path, sizeof(path), "sampling");
+	access_log log;
+	assert(access_log_init(&log, path, 2, 10, NULL) == 0);
+	access_log_entry entry = {0};
+	entry.status_code = 200;
+	// each slot counts on its own, so this is every 10th of 100 twice over
+	for (int i = 0; i < 100; i++) {
+		access_log_write(&log, 0, &entry);
+		access_log_write(&log, 1, &entry);
+	}
+	access_log_flush(&log);
+	string contents;
+	string_init(&contents);
+	read_file(path, &contents);
+	assert(count_lines(&contents) == 20);
+	access_log_dealloc(&log);
+	unlink(path);
+	string_dealloc(&contents);
+}
+
+void reopen() {
+	char path[256], rotated[256];
+	make_path(path, sizeof(path), "reopen");
+	make_path(rotated, sizeof(rotated), "reopen.1");
+	access_log log;
+	assert(access_log_init(&log, path, 1, 1, NULL) == 0);
+	access_log_entry entry = {0};
+	entry.status_code = 200;
+	access_log_write(&log, 0, &entry);
+	access_log_write(&log, 0, &entry);
+	// moved aside by rotation, entries keep going to the moved file until it's reopened
+	assert(rename(path, rotated) == 0);
+	access_log_write(&log, 0, &entry);
+	access_log_reopen(&log);
+	// the reopen is done on the background thread
+	for (int i = 0; i < 200 && access(path, F_OK); i++) {
+		usleep(10000);
+	}
+	access_log_write(&log, 0, &entry);
+	access_log_dealloc(&log);
+
+	string contents;
+	string_init(&contents);
+	read_file(rotated, &contents);
+	assert(count_lines(&contents) == 3);
+	read_file(path, &contents);
+	assert(count_lines(&contents) == 1);
+	unlink(path);
+	unlink(rotated);
+	string_dealloc(&contents);
+}
+
+void dropping() {
+	char path[256];
+	make_path(path, sizeof(path), "dropping");
+	access_log log;
+	assert(access_log_init(&log, path, 1, 1, NULL) == 0);
+	string uri;
+	string_init(&uri);
+	string_set_length(&uri, 1000, 'x');
+	access_log_entry entry = {0};
+	entry.uri = &uri;
+	entry.status_code = 200;
+	// with the background thread held up the slot fills, and from then on entries are dropped rather than waited on
+	pthread_mutex_lock(&log.mutex);
+	int num_written = 0;
+	while (access_log_get_num_dropped(&log) == 0) {
+		access_log_write(&log, 0, &entry);
+		num_written++;
+		assert(num_written < 10000);
+	}
+	access_log_write(&log, 0, &entry);
+	assert(access_log_get_num_dropped(&log) == 2);
+	pthread_mutex_unlock(&log.mutex);
+	access_log_dealloc(&log);
+
+	string contents;
+	string_init(&contents);
+	read_file(path, &contents);
+	assert(count_lines(&contents) == num_written - 1);
+	unlink(path);
+	string_dealloc(&contents);
+	string_dealloc(&uri);
+}
+
+int main() {
+	format();
+	threads();
+	sampling();
+	reopen();
+	dropping();
+	return 0;
+}
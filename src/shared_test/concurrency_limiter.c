@@ -0,0 +1,121 @@
+#include <assert.h>
+
+#include "../shared/concurrency_limiter.h"
+
+// requests take 1ms until there are more of them in flight than this, then they queue and take proportionally longer
+#define CAPACITY 10
+#define BASE_LATENCY_NS 1000000
+#define SECOND_NS 1000000000ull
+
+// the rounds run on a pretend clock so the probes, which are timed in seconds, come round without waiting
+uint64_t now_ns = 0;
+
+void admission() {
+	concurrency_limiter limiter;
+	assert(concurrency_limiter_init(&limiter, 0, 1, 10) != 0);
+	assert(concurrency_limiter_init(&limiter, 5, 5, 4) != 0);
+	// the initial limit is kept between the minimum and maximum
+	assert(concurrency_limiter_init(&limiter, 2, 8, 4) == 0);
+	assert(concurrency_limiter_get_limit(&limiter) == 4);
+	concurrency_limiter_dealloc(&limiter);
+	assert(concurrency_limiter_init(&limiter, 2, 0, 4) == 0);
+	assert(concurrency_limiter_get_limit(&limiter) == 2);
+	for (int i = 0; i < 2; i++) {
+		assert(!concurrency_limiter_is_full(&limiter));
+		assert(concurrency_limiter_try_acquire(&limiter) == 0);
+	}
+	assert(concurrency_limiter_get_in_flight(&limiter) == 2);
+	assert(concurrency_limiter_try_acquire(&limiter) != 0);
+	assert(concurrency_limiter_is_full(&limiter));
+	assert(concurrency_limiter_get_num_rejected(&limiter) == 2);
+	// drops never take it below the minimum
+	concurrency_limiter_release(&limiter, 0, 0, 1);
+	concurrency_limiter_release(&limiter, 0, 0, 1);
+	assert(concurrency_limiter_get_limit(&limiter) == 2);
+	assert(concurrency_limiter_get_in_flight(&limiter) == 0);
+	concurrency_limiter_dealloc(&limiter);
+}
+
+/*
+Runs rounds of as many requests as the limiter admits, with latency going up once there are more than CAPACITY at once.
+
+Returns the highest limit during the rounds, as it halves now and again to probe the latency, and the lowest in lowest_limit if it's not
+NULL.
+*/
+size_t run_rounds(concurrency_limiter *limiter, size_t num_rounds, size_t max_requests, uint64_t base_latency_ns, size_t *lowest_limit) {
+	size_t highest_limit = 0;
+	if (lowest_limit) {
+		*lowest_limit = SIZE_MAX;
+	}
+	for (size_t round = 0; round < num_rounds; round++) {
+		size_t limit = concurrency_limiter_get_limit(limiter);
+		if (limit > highest_limit) {
+			highest_limit = limit;
+		}
+		if (lowest_limit && limit < *lowest_limit) {
+			*lowest_limit = limit;
+		}
+		size_t admitted = 0;
+		while (admitted < max_requests && !concurrency_limiter_try_acquire(limiter)) {
+			admitted++;
+		}
+		uint64_t latency_ns = admitted <= CAPACITY ? base_latency_ns : base_latency_ns * admitted / CAPACITY;
+		for (size_t i = 0; i < admitted; i++) {
+			concurrency_limiter_release(limiter, now_ns, now_ns + latency_ns, 0);
+		}
+		now_ns += latency_ns;
+	}
+	return highest_limit;
+}
+
+void converges() {
+	concurrency_limiter limiter;
+	assert(concurrency_limiter_init(&limiter, 1, 1, 1000) == 0);
+	// grows from the minimum and settles a bit over what can run without queueing
+	run_rounds(&limiter, 1000, SIZE_MAX, BASE_LATENCY_NS, NULL);
+	size_t limit = run_rounds(&limiter, 1000, SIZE_MAX, BASE_LATENCY_NS, NULL);
+	assert(limit > CAPACITY && limit < CAPACITY * 3);
+
+	// a quiet period only using a little of the limit doesn't grow it
+	assert(run_rounds(&limiter, 1000, 2, BASE_LATENCY_NS, NULL) <= limit);
+
+	// drops back off straight away
+	size_t before_drop = concurrency_limiter_get_limit(&limiter);
+	assert(concurrency_limiter_try_acquire(&limiter) == 0);
+	concurrency_limiter_release(&limiter, 0, 0, 1);
+	assert(before_drop > 1 && concurrency_limiter_get_limit(&limiter) < before_drop);
+
+	// requests getting slower for good looks like queueing at first, but the limit recovers once the new latency is relearnt
+	run_rounds(&limiter, 30 * SECOND_NS / (BASE_LATENCY_NS * 4), SIZE_MAX, BASE_LATENCY_NS * 4, NULL);
+	limit = run_rounds(&limiter, 1000, SIZE_MAX, BASE_LATENCY_NS * 4, NULL);
+	assert(limit > CAPACITY && limit < CAPACITY * 3);
+	assert(concurrency_limiter_get_in_flight(&limiter) == 0);
+	concurrency_limiter_dealloc(&limiter);
+}
+
+void below_capacity() {
+	concurrency_limiter limiter;
+	assert(concurrency_limiter_init(&limiter, 1, 1, 1000) == 0);
+	// once it's grown to fit a steady load it can keep up with, a minute of it, probes included, sheds nothing
+	run_rounds(&limiter, 1000, CAPACITY - 2, BASE_LATENCY_NS, NULL);
+	uint64_t num_rejected = concurrency_limiter_get_num_rejected(&limiter);
+	size_t lowest_limit;
+	size_t highest_limit = run_rounds(&limiter, 60 * SECOND_NS / BASE_LATENCY_NS, CAPACITY - 2, BASE_LATENCY_NS, &lowest_limit);
+	assert(lowest_limit < highest_limit);
+	assert(concurrency_limiter_get_num_rejected(&limiter) == num_rejected);
+	concurrency_limiter_dealloc(&limiter);
+
+	// and starting at a sane limit there's nothing to grow into, so nothing's shed at all
+	assert(concurrency_limiter_init(&limiter, 1, 100, 1000) == 0);
+	run_rounds(&limiter, 60 * SECOND_NS / BASE_LATENCY_NS, CAPACITY - 2, BASE_LATENCY_NS, NULL);
+	assert(concurrency_limiter_get_num_rejected(&limiter) == 0);
+	assert(concurrency_limiter_get_limit(&limiter) == 100);
+	concurrency_limiter_dealloc(&limiter);
+}
+
+int main() {
+	admission();
+	converges();
+	below_capacity();
+	return 0;
+}
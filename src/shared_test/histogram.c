@@ -0,0 +1,92 @@
+#include <assert.h>
+#include <pthread.h>
+
+#include "../shared/histogram.h"
+
+#define NUM_VALUES 100000
+
+void buckets() {
+	// small values are exact
+	for (uint64_t i = 0; i < HISTOGRAM_SUB_BUCKETS; i++) {
+		assert(histogram_get_bucket(i) == i);
+		assert(histogram_get_bucket_max(i) == i);
+	}
+	// from there buckets are contiguous, each starts right after the one before ends, and none is wider than 1/32 of its values
+	uint64_t start = HISTOGRAM_SUB_BUCKETS;
+	for (size_t bucket = HISTOGRAM_SUB_BUCKETS; bucket < HISTOGRAM_NUM_BUCKETS; bucket++) {
+		uint64_t max = histogram_get_bucket_max(bucket);
+		assert(max >= start);
+		assert(histogram_get_bucket(start) == bucket);
+		assert(histogram_get_bucket(max) == bucket);
+		assert((max - start + 1) * (HISTOGRAM_SUB_BUCKETS / 2) <= start);
+		start = max + 1;
+	}
+	assert(start - 1 == HISTOGRAM_MAX_VALUE);
+	// anything bigger goes in the last one
+	assert(histogram_get_bucket(HISTOGRAM_MAX_VALUE + 1) == HISTOGRAM_NUM_BUCKETS - 1);
+	assert(histogram_get_bucket(UINT64_MAX) == HISTOGRAM_NUM_BUCKETS - 1);
+}
+
+void percentiles() {
+	histogram h;
+	histogram_init(&h);
+	assert(histogram_get_count(&h) == 0 && histogram_get_percentile(&h, 50) == 0);
+	// 1us to 1ms
+	for (uint64_t i = 1; i <= 1000; i++) {
+		histogram_record(&h, i * 1000);
+	}
+	assert(histogram_get_count(&h) == 1000);
+	assert(histogram_get_sum(&h) == 500500000);
+	assert(histogram_get_max(&h) == 1000000);
+	uint64_t p50 = histogram_get_percentile(&h, 50);
+	assert(p50 >= 500000 && p50 <= 500000 + 500000 / 32);
+	uint64_t p99 = histogram_get_percentile(&h, 99);
+	assert(p99 >= 990000 && p99 <= 990000 + 990000 / 32);
+	uint64_t p999 = histogram_get_percentile(&h, 99.9);
+	assert(p999 >= 999000 && p999 <= 1000000);
+	// never past the max
+	assert(histogram_get_percentile(&h, 100) == 1000000);
+	uint64_t p0 = histogram_get_percentile(&h, 0);
+	assert(p0 >= 1000 && p0 <= 1000 + 1000 / 32);
+	histogram_clear(&h);
+	assert(histogram_get_count(&h) == 0 && histogram_get_max(&h) == 0);
+}
+
+histogram shared;
+int done;
+
+void *record_values(void *data) {
+	for (uint64_t i = 0; i < NUM_VALUES; i++) {
+		histogram_record(&shared, i % 5000);
+	}
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void merging() {
+	// merging while the writer records only ever sees whole counts, and once it's done sees all of them
+	histogram_init(&shared);
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, record_values, NULL) == 0);
+	histogram merged;
+	uint64_t last_count = 0;
+	while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		histogram_init(&merged);
+		histogram_merge(&merged, &shared);
+		assert(histogram_get_count(&merged) >= last_count && histogram_get_count(&merged) <= NUM_VALUES);
+		last_count = histogram_get_count(&merged);
+	}
+	pthread_join(thread, NULL);
+	histogram_init(&merged);
+	histogram_merge(&merged, &shared);
+	histogram_merge(&merged, &shared);
+	assert(histogram_get_count(&merged) == 2 * NUM_VALUES);
+	assert(histogram_get_max(&merged) == 4999);
+}
+
+int main() {
+	buckets();
+	percentiles();
+	merging();
+	return 0;
+}
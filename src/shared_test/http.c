@@ -3,12 +3,20 @@ Generating sample data;
 curl example.com -X POST  -H "Content-Type: text/plain" --data-binary @input --trace trace.log
 */
 
+#include <arpa/inet.h>
 #include <assert.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "../shared/http.h"
 #include "../shared/log.h"
+#include "../shared/perf_counters.h"
+#include "../shared/trace.h"
 
 void header() {
 	http_header header;
@@ -96,6 +104,15 @@ void assert_parses_successfully(http_request *request, char *input) {
 	stream_dealloc(&input_io, NULL);
 }
 
+void assert_parse_fails(http_request *request, char *input) {
+	buffer input_buffer;
+	buffer_init_copy(&input_buffer, input, strlen(input));
+	stream input_io;
+	stream_init_buffer(&input_io, &input_buffer, 1);
+	assert(http_request_parse(request, &input_io) != 0);
+	stream_dealloc(&input_io, NULL);
+}
+
 void assert_method(http_request *request, char *expected) {
 	assert(string_compare_cstr(&request->method, expected, STRING_COMPARE_CASE_SENSITIVE) == 0);
 }
@@ -138,6 +155,7 @@ void parse_request_get() {
 										 "\r\n");
 	assert_method(&request, "GET");
 	assert_uri(&request, "/");
+	assert(!strcmp(string_get_cstr(http_request_get_protocol_version(&request)), "HTTP/1.1"));
 	assert_header(&request, "Host", 1, "example.com");
 	assert_header(&request, "User-Agent", 1, "curl/7.68.0");
 	assert_header(&request, "Accept", 1, "*/*");
@@ -225,6 +243,12 @@ void parse_request_post_with_body_json() {
 						  "\t\t]\n"
 						  "\t}\n"
 						  "}\n");
+	json_value root, value;
+	assert(http_request_get_body_json(&request, &root) == 0);
+	assert(json_value_object_get_cstr(&root, "baz", &value) == 0);
+	int64_t baz;
+	assert(json_value_get_int64(&value, &baz) == 0);
+	assert(baz == 42);
 	http_request_dealloc(&request);
 }
 
@@ -293,6 +317,66 @@ void parse_request_delete_no_body() {
 	http_request_dealloc(&request);
 }
 
+void parse_request_limits() {
+	http_request request;
+	http_request_init(&request);
+	// small chunks so the body arrives over several reads
+	http_request_set_limits(&request, 64, 128, 16);
+	assert_parses_successfully(&request, "POST /some/api HTTP/1.1\r\n"
+										 "Host: example.com\r\n"
+										 "Content-Length: 16\r\n"
+										 "\r\n"
+										 "0123456789abcdef");
+	assert_body(&request, "0123456789abcdef");
+	assert_parse_fails(&request, "POST /some/api HTTP/1.1\r\n"
+								 "Host: example.com\r\n"
+								 "Content-Length: 17\r\n"
+								 "\r\n"
+								 "0123456789abcdefg");
+	assert_parse_fails(&request, "GET /some/api HTTP/1.1\r\n"
+								 "Host: example.com\r\n"
+								 "User-Agent: a user agent string that pushes the headers past the limit of 128 bytes\r\n"
+								 "\r\n");
+	http_request_dealloc(&request);
+}
+
+void parse_request_framing() {
+	http_request request;
+	http_request_init(&request);
+	// only Content-Length bodies are supported, anything a proxy could frame differently is rejected
+	assert_parse_fails(&request, "POST / HTTP/1.1\r\n"
+								 "Transfer-Encoding: chunked\r\n"
+								 "\r\n"
+								 "0\r\n\r\n");
+	assert_parse_fails(&request, "POST / HTTP/1.1\r\n"
+								 "Content-Length: 4\r\n"
+								 "Transfer-Encoding: chunked\r\n"
+								 "\r\n"
+								 "0\r\n\r\n");
+	assert_parse_fails(&request, "POST / HTTP/1.1\r\n"
+								 "Content-Length: 4\r\n"
+								 "Content-Length: 5\r\n"
+								 "\r\n"
+								 "body!");
+	assert_parse_fails(&request, "POST / HTTP/1.1\r\n"
+								 "Transfer-Encoding : chunked\r\n"
+								 "\r\n"
+								 "0\r\n\r\n");
+	http_request_dealloc(&request);
+}
+
+void parse_request_method() {
+	http_request request;
+	http_request_init(&request);
+	assert_parses_successfully(&request, "M-SEARCH * HTTP/1.1\r\n\r\n");
+	assert_method(&request, "M-SEARCH");
+	// the method ends at the first space, so anything else that isn't a token would go into the logs as it is
+	assert_parse_fails(&request, "GET\ntime=forged /a HTTP/1.1\r\n\r\n");
+	assert_parse_fails(&request, "G\x01T /a HTTP/1.1\r\n\r\n");
+	assert_parse_fails(&request, "GET\t/a HTTP/1.1\r\n\r\n");
+	http_request_dealloc(&request);
+}
+
 void assert_response_writes_to(http_response *response, char *expected) {
 	size_t expected_len = strlen(expected);
 	buffer b;
@@ -316,6 +400,57 @@ void response_no_headers_no_body() {
 	http_response_dealloc(&response);
 }
 
+void response_reason_phrase() {
+	http_response response;
+	http_response_init(&response);
+	http_response_set_status_code(&response, 404);
+	assert(!strcmp(string_get_cstr(http_response_get_reason_phrase(&response)), "Not Found"));
+	string_set_cstr(http_response_get_reason_phrase(&response), "Nowhere");
+	assert_response_writes_to(&response, "HTTP/1.1 404 Nowhere\r\nContent-Length: 0\r\n\r\n");
+	// setting the status again goes back to the standard one
+	http_response_set_status_code(&response, 503);
+	assert_response_writes_to(&response, "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+	http_response_set_status_code(&response, 299);
+	assert_response_writes_to(&response, "HTTP/1.1 299 Other\r\nContent-Length: 0\r\n\r\n");
+	http_response_set_status_code(&response, 1000);
+	assert_response_writes_to(&response, "HTTP/1.1 1000 Other\r\nContent-Length: 0\r\n\r\n");
+	http_response_dealloc(&response);
+}
+
+void response_common_headers() {
+	http_common_headers common_headers;
+	assert(http_common_headers_init(&common_headers, 0, "Server: test\nNo colon") != 0);
+	assert(http_common_headers_init(&common_headers, 0, "Bad name: test") != 0);
+	assert(http_common_headers_init(&common_headers, 0, "Server: test\r\n\nX-Frame-Options: DENY\n") == 0);
+	http_response response;
+	http_response_init(&response);
+	http_response_set_common_headers(&response, &common_headers);
+	string_set_cstr(http_header_append_value(http_headers_get_cstr(http_response_get_headers(&response), "foo", 1)), "bar");
+	assert_response_writes_to(&response,
+							  "HTTP/1.1 200 OK\r\nServer: test\r\nX-Frame-Options: DENY\r\nfoo: bar\r\nContent-Length: 0\r\n\r\n");
+	http_common_headers_dealloc(&common_headers);
+
+	// the date comes before everything else, unless the response has its own
+	assert(http_common_headers_init(&common_headers, 1, "") == 0);
+	http_response_clear(&response);
+	buffer b;
+	stream s;
+	buffer_init(&b);
+	stream_init_buffer(&s, &b, 1);
+	assert(http_response_write(&response, &s) == 0);
+	buffer_append_bytes(&b, "", 1);
+	char *expected_start = "HTTP/1.1 200 OK\r\nDate: ";
+	assert(!strncmp((char *)b.data, expected_start, strlen(expected_start)));
+	char *date = (char *)b.data + strlen("HTTP/1.1 200 OK\r\n");
+	assert(!strcmp(date + strlen("Date: Sun, 06 Nov 1994 08:49:37 GMT"), "\r\nContent-Length: 0\r\n\r\n"));
+	assert(date[9] == ',' && !strncmp(date + 31, " GMT", 4));
+	stream_dealloc(&s, NULL);
+	string_set_cstr(http_header_append_value(http_headers_get_cstr(http_response_get_headers(&response), "Date", 1)), "then");
+	assert_response_writes_to(&response, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nDate: then\r\n\r\n");
+	http_common_headers_dealloc(&common_headers);
+	http_response_dealloc(&response);
+}
+
 void response_headers_no_body() {
 	http_response response;
 	http_response_init(&response);
@@ -381,6 +516,509 @@ void response_headers_content_length_multiple() {
 	http_response_dealloc(&response);
 }
 
+void find_end() {
+	size_t length;
+	char *get = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	assert(http_request_find_end((uint8_t *)get, strlen(get), 1024, 1024, &length) == 0);
+	assert(length == strlen(get));
+	assert(http_request_find_end((uint8_t *)get, strlen(get) - 1, 1024, 1024, &length) > 0);
+	// over the header limit without finding the end
+	assert(http_request_find_end((uint8_t *)get, strlen(get) - 1, 16, 1024, &length) < 0);
+
+	char *post = "POST / HTTP/1.1\r\nCONTENT-LENGTH:  4\r\n\r\nbodyGET";
+	assert(http_request_find_end((uint8_t *)post, strlen(post), 1024, 1024, &length) == 0);
+	// pipelined data after the body isn't part of the request
+	assert(length == strlen(post) - 3);
+	assert(http_request_find_end((uint8_t *)post, strlen(post) - 4, 1024, 1024, &length) > 0);
+	assert(http_request_find_end((uint8_t *)post, strlen(post), 1024, 3, &length) < 0);
+
+	char *bad_length = "POST / HTTP/1.1\r\nContent-Length: four\r\n\r\n";
+	assert(http_request_find_end((uint8_t *)bad_length, strlen(bad_length), 1024, 1024, &length) < 0);
+
+	// anything a proxy could frame differently from the Content-Length is malformed rather than left for the parse to catch
+	char *chunked = "POST / HTTP/1.1\r\ntransfer-encoding: chunked\r\n\r\n0\r\n\r\n";
+	assert(http_request_find_end((uint8_t *)chunked, strlen(chunked), 1024, 1024, &length) < 0);
+	char *chunked_space = "POST / HTTP/1.1\r\nTransfer-Encoding : chunked\r\n\r\n0\r\n\r\n";
+	assert(http_request_find_end((uint8_t *)chunked_space, strlen(chunked_space), 1024, 1024, &length) < 0);
+	char *two_lengths = "POST / HTTP/1.1\r\nContent-Length: 4\r\nContent-Length: 5\r\n\r\nbody!";
+	assert(http_request_find_end((uint8_t *)two_lengths, strlen(two_lengths), 1024, 1024, &length) < 0);
+	char *length_list = "POST / HTTP/1.1\r\nContent-Length: 4, 5\r\n\r\nbody!";
+	assert(http_request_find_end((uint8_t *)length_list, strlen(length_list), 1024, 1024, &length) < 0);
+	char *length_space = "POST / HTTP/1.1\r\nContent-Length : 4\r\n\r\nbody";
+	assert(http_request_find_end((uint8_t *)length_space, strlen(length_space), 1024, 1024, &length) < 0);
+	// a header that only starts with the name is some other header
+	char *other = "POST / HTTP/1.1\r\nContent-Length-Hint: 9\r\nContent-Length: 4 \r\n\r\nbody";
+	assert(http_request_find_end((uint8_t *)other, strlen(other), 1024, 1024, &length) == 0);
+	assert(length == strlen(other));
+}
+
+// lets a test hold a request in the handler for as long as it needs
+typedef struct {
+	sem_t entered;
+	sem_t release;
+} handler_gate;
+
+/*
+Responds with the method and uri. "/fail" fails, "/sleep" sleeps first, and "/wait" posts to the handler_gate in data and waits to be
+released.
+*/
+int server_handler(void *data, http_request *request, http_response *response) {
+	if (!string_compare_cstr(http_request_get_uri(request), "/fail", STRING_COMPARE_CASE_SENSITIVE)) {
+		return 1;
+	}
+	if (!string_compare_cstr(http_request_get_uri(request), "/sleep", STRING_COMPARE_CASE_SENSITIVE)) {
+		usleep(200000);
+	}
+	if (!string_compare_cstr(http_request_get_uri(request), "/wait", STRING_COMPARE_CASE_SENSITIVE)) {
+		handler_gate *gate = data;
+		sem_post(&gate->entered);
+		sem_wait(&gate->release);
+	}
+	http_response_set_status_code(response, 200);
+	stream_write_cstrf(http_response_get_body(response), NULL, "%s %s", string_get_cstr(http_request_get_method(request)),
+					   string_get_cstr(http_request_get_uri(request)));
+	return 0;
+}
+
+// whether the kernel supports everything the io_uring backend needs, when it doesn't the io_uring tests are skipped
+int io_uring_available() {
+	io_loop loop;
+	if (io_loop_init(&loop, IO_LOOP_BACKEND_IO_URING, 4096, 64)) {
+		return 0;
+	}
+	io_loop_dealloc(&loop);
+	return 1;
+}
+
+/*
+Starts a server listening on 127.0.0.1 on any free port, with no Date header so responses can be compared exactly. Options are pairs of
+option names and values for http_server_config_set_cstr, ending with NULL, applied after those.
+@returns the port, or 0 if the backend is io_uring and the kernel doesn't support it
+*/
+uint16_t start_server(http_server *server, char *io_backend, http_server_func handler, void *handler_data, ...) {
+	if (!strcmp(io_backend, "io_uring") && !io_uring_available()) {
+		printf("io_uring isn't available, skipping\n");
+		return 0;
+	}
+	http_server_config config;
+	http_server_config_init(&config);
+	assert(http_server_config_set_cstr(&config, "address", "127.0.0.1", NULL) == 0);
+	assert(http_server_config_set_cstr(&config, "port", "0", NULL) == 0);
+	assert(http_server_config_set_cstr(&config, "io_backend", io_backend, NULL) == 0);
+	assert(http_server_config_set_cstr(&config, "date_header", "false", NULL) == 0);
+	va_list args;
+	va_start(args, handler_data);
+	char *name;
+	while ((name = va_arg(args, char *))) {
+		assert(http_server_config_set_cstr(&config, name, va_arg(args, char *), NULL) == 0);
+	}
+	va_end(args);
+	assert(http_server_init(server, handler, handler_data, &config) == 0);
+	http_server_config_dealloc(&config);
+	uint16_t port = tcp_socket_wrapper_get_port(&server->socket);
+	assert(port != 0);
+	return port;
+}
+
+// @returns a socket connected to the server on port
+int connect_to(uint16_t port) {
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	assert(s >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	assert(connect(s, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	return s;
+}
+
+// reads until the server closes the connection
+void read_response(int s, string *response) {
+	string_clear(response);
+	char chunk[1024];
+	ssize_t result;
+	while ((result = read(s, chunk, sizeof(chunk))) > 0) {
+		string_append_cstr_len(response, chunk, result);
+	}
+	close(s);
+}
+
+void send_request(uint16_t port, char *request, string *response) {
+	int s = connect_to(port);
+	assert(write(s, request, strlen(request)) == strlen(request));
+	// the server closes the connection after responding
+	read_response(s, response);
+}
+
+void server_round_trip(char *io_backend) {
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "num_threads", "2", "read_timeout_ms", "200",
+								 "header_timeout_ms", "200", NULL);
+	if (!port) {
+		return;
+	}
+	assert(port != 0);
+
+	string response;
+	string_init(&response);
+	send_request(port, "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nGET /hello"));
+	send_request(port, "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n\r\nbody", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nPOST /echo"));
+	send_request(port, "GET /fail HTTP/1.1\r\nHost: localhost\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	send_request(port, "nonsense\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	// a body split across several reads
+	string request;
+	string_init(&request);
+	string_set_cstr(&request, "POST /big HTTP/1.1\r\nHost: localhost\r\ncontent-length: 100000\r\n\r\n");
+	for (int i = 0; i < 100000; i++) {
+		string_append_cstr(&request, "x");
+	}
+	send_request(port, string_get_cstr(&request), &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nPOST /big"));
+	string_dealloc(&request);
+	// the headers never finish, 408 from a loop and 400 from the blocking model, which only sees a failed read
+	send_request(port, "GET /slow HTTP/1.1\r\n", &response);
+	assert(!strncmp(string_get_cstr(&response), !strcmp(io_backend, "blocking") ? "HTTP/1.1 400 " : "HTTP/1.1 408 ", 13));
+	string_dealloc(&response);
+
+	assert(http_server_dealloc(&server) == 0);
+}
+
+void server_keep_alive(char *io_backend) {
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "keep_alive_timeout_ms", "100", NULL);
+	if (!port) {
+		return;
+	}
+
+	string response;
+	string_init(&response);
+	// pipelined, and the last one asks for the connection to be closed
+	send_request(port,
+				 "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 1\r\n\r\nxGET /c HTTP/1.1\r\nConnection: close\r\n\r\n",
+				 &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nGET /a"
+											   "HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\nPOST /b"
+											   "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nGET /c"));
+	// kept open until it's been idle for the keep alive timeout
+	send_request(port, "GET /idle HTTP/1.1\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nGET /idle"));
+	// HTTP/1.0 isn't persistent
+	send_request(port, "GET /old HTTP/1.0\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 8\r\n\r\nGET /old"));
+	// a chunked body would be read as the next request, so the connection is closed instead of it being dispatched
+	send_request(port, "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n1a\r\nGET /smuggled HTTP/1.1\r\n\r\n0\r\n\r\n",
+				 &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	// and so is a request with two lengths, after the one before it on the connection is answered
+	send_request(port, "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 26\r\n\r\n"
+					   "GET /smuggled HTTP/1.1\r\n\r\n",
+				 &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nGET /a"
+											   "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	string_dealloc(&response);
+	assert(http_server_dealloc(&server) == 0);
+}
+
+void server_slow_client(char *io_backend) {
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "num_threads", "1", "date_header", "true", NULL);
+	if (!port) {
+		return;
+	}
+
+	// more clients stuck part way through their headers than there are workers
+	int slow[4];
+	for (int i = 0; i < 4; i++) {
+		slow[i] = connect_to(port);
+		assert(write(slow[i], "GET /slow HTTP/1.1\r\nHo", 23) == 23);
+	}
+	// still get served straight away
+	string response;
+	string_init(&response);
+	send_request(port, "GET /fast HTTP/1.1\r\n\r\n", &response);
+	// with the date the loop's timer keeps up to date
+	char *expected_start = "HTTP/1.1 200 OK\r\nDate: ";
+	char *expected_end = " GMT\r\nContent-Length: 9\r\n\r\nGET /fast";
+	assert(string_get_length(&response) == strlen("HTTP/1.1 200 OK\r\nDate: Sun, 06 Nov 1994 08:49:37") + strlen(expected_end));
+	assert(!strncmp(string_get_cstr(&response), expected_start, strlen(expected_start)));
+	assert(!strcmp(string_get_cstr(&response) + string_get_length(&response) - strlen(expected_end), expected_end));
+	string_dealloc(&response);
+	for (int i = 0; i < 4; i++) {
+		close(slow[i]);
+	}
+	assert(http_server_dealloc(&server) == 0);
+}
+
+void server_load_shedding(char *io_backend) {
+	handler_gate gate;
+	sem_init(&gate.entered, 0, 0);
+	sem_init(&gate.release, 0, 0);
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, &gate, "num_threads", "2", "max_concurrency", "1", NULL);
+	if (!port) {
+		return;
+	}
+	assert(concurrency_limiter_get_limit(&server.limiter) == 1);
+
+	// one request in the handler takes up the whole limit
+	// only with a loop, the blocking model's accept thread waits on each handler so there's never more than one anyway
+	int s = connect_to(port);
+	char *wait_request = "GET /wait HTTP/1.1\r\n\r\n";
+	assert(write(s, wait_request, strlen(wait_request)) == strlen(wait_request));
+	sem_wait(&gate.entered);
+
+	// so the next is turned away, even though there's a worker free
+	string response;
+	string_init(&response);
+	send_request(port, "GET /shed HTTP/1.1\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+	assert(concurrency_limiter_get_num_rejected(&server.limiter) == 1);
+
+	sem_post(&gate.release);
+	read_response(s, &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\nGET /wait"));
+	// and once it's done there's room again
+	send_request(port, "GET /after HTTP/1.1\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nGET /after"));
+	string_dealloc(&response);
+	assert(http_server_dealloc(&server) == 0);
+	sem_destroy(&gate.entered);
+	sem_destroy(&gate.release);
+}
+
+#define STREAM_CHUNKS 100
+#define STREAM_CHUNK_SIZE 1000
+
+void server_access_log(char *io_backend) {
+	char path[256];
+	snprintf(path, sizeof(path), "/tmp/test_http_access_log_%i_%s", (int)getpid(), io_backend);
+	unlink(path);
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "access_log", path, NULL);
+	if (!port) {
+		return;
+	}
+
+	string response;
+	string_init(&response);
+	send_request(port, "GET /hello?x=\"1\" HTTP/1.1\r\n\r\n", &response);
+	size_t hello_length = string_get_length(&response);
+	send_request(port, "GET /fail HTTP/1.1\r\n\r\n", &response);
+	size_t fail_length = string_get_length(&response);
+	send_request(port, "nonsense\r\n\r\n", &response);
+	size_t nonsense_length = string_get_length(&response);
+	// everything is written out by the time the server's gone
+	assert(http_server_dealloc(&server) == 0);
+
+	// with the blocking model the lines come from different workers, so they can be in any order
+	string log;
+	string_init(&log);
+	FILE *file = fopen(path, "r");
+	assert(file);
+	char chunk[1024];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+		string_append_cstr_len(&log, chunk, read);
+	}
+	fclose(file);
+	char expected[256];
+	// the quotes in the uri are escaped
+	snprintf(expected, sizeof(expected), " method=GET uri=\"/hello?x=\\x221\\x22\" status=200 bytes=%zu parse_us=", hello_length);
+	char *line = strstr(string_get_cstr(&log), expected);
+	assert(line && strstr(line, " write_us="));
+	assert(strstr(string_get_cstr(&log), " remote=127.0.0.1:"));
+	snprintf(expected, sizeof(expected), " method=GET uri=\"/fail\" status=500 bytes=%zu ", fail_length);
+	assert(strstr(string_get_cstr(&log), expected));
+	snprintf(expected, sizeof(expected), " method=- uri=- status=400 bytes=%zu ", nonsense_length);
+	assert(strstr(string_get_cstr(&log), expected));
+	size_t num_lines = 0;
+	for (char *c = string_get_cstr(&log); *c; c++) {
+		num_lines += *c == '\n';
+	}
+	assert(num_lines == 3);
+	string_dealloc(&log);
+	unlink(path);
+	string_dealloc(&response);
+}
+
+void server_metrics(char *io_backend) {
+	// the server runs either way, with nothing counted where the hardware counters aren't available
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "metrics_path", "/metrics", "perf_counters", "true", NULL);
+	if (!port) {
+		return;
+	}
+
+	// the metrics are for the whole process, so earlier tests have counted too, only what this one adds is checked
+	string response;
+	string_init(&response);
+	send_request(port, "GET /metrics HTTP/1.1\r\n\r\n", &response);
+	char *body = strstr(string_get_cstr(&response), "\r\n\r\n");
+	assert(!strncmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\n", 17) && body);
+	assert(strstr(string_get_cstr(&response), "Content-Type: text/plain; version=0.0.4\r\n"));
+	char *line = strstr(body, "\nhttp_responses_total{class=\"5xx\"} ");
+	assert(line && strstr(body, "# TYPE http_responses_total counter\n") && strstr(body, "\ntcp_connections_accepted_total "));
+	long long errors = atoll(strchr(line, '}') + 2);
+	send_request(port, "GET /fail HTTP/1.1\r\n\r\n", &response);
+	// a query string doesn't stop it being the metrics path
+	send_request(port, "GET /metrics?x=1 HTTP/1.1\r\n\r\n", &response);
+	body = strstr(string_get_cstr(&response), "\r\n\r\n");
+	line = strstr(body, "\nhttp_responses_total{class=\"5xx\"} ");
+	assert(line && atoll(strchr(line, '}') + 2) == errors + 1);
+	// every phase of a request is timed
+	assert(strstr(body, "# TYPE http_request_phase_seconds summary\n"));
+	assert(strstr(body, "\nhttp_request_phase_seconds{phase=\"handler\",quantile=\"0.99\"} "));
+	line = strstr(body, "\nhttp_request_phase_seconds_count{phase=\"write\"} ");
+	assert(line && atoll(strchr(line, '}') + 2) > 0);
+	line = strstr(body, "\nhttp_request_phase_counted_total{phase=\"serialize\"} ");
+	assert(perf_counters_is_enabled() ? line && atoll(strchr(line, '}') + 2) > 0 : !line);
+	// only GET is the metrics endpoint, anything else goes to the handler
+	send_request(port, "POST /metrics HTTP/1.1\r\nContent-Length: 0\r\n\r\n", &response);
+	assert(!strcmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\nContent-Length: 13\r\n\r\nPOST /metrics"));
+	string_dealloc(&response);
+	assert(http_server_dealloc(&server) == 0);
+}
+
+/*
+Finds the spans the first request in a trace has.
+@returns 0 if every one of names is there, non-0 if any are missing
+*/
+int trace_has_spans(char *body, char **names, size_t num_names) {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, events, event, value;
+	json_iterator it;
+	assert(json_document_parse(&doc, body, strlen(body)) == 0 && json_document_get_root(&doc, &root) == 0);
+	assert(json_value_object_get_cstr(&root, "traceEvents", &events) == 0 && json_value_iterate(&events, &it) == 0);
+	int64_t first = INT64_MAX;
+	while (json_iterator_next(&it, NULL, &event) > 0) {
+		int64_t id;
+		assert(json_value_object_get_cstr(&event, "args", &value) == 0 && json_value_object_get_cstr(&value, "request_id", &value) == 0);
+		assert(json_value_get_int64(&value, &id) == 0);
+		first = id < first ? id : first;
+	}
+	size_t found = 0;
+	for (size_t i = 0; i < num_names; i++) {
+		assert(json_value_iterate(&events, &it) == 0);
+		while (json_iterator_next(&it, NULL, &event) > 0) {
+			int64_t id;
+			char *name;
+			size_t name_len;
+			json_value_object_get_cstr(&event, "args", &value);
+			json_value_object_get_cstr(&value, "request_id", &value);
+			json_value_get_int64(&value, &id);
+			json_value_object_get_cstr(&event, "name", &value);
+			json_value_get_cstr_len(&value, &name, &name_len);
+			if (id == first && name_len == strlen(names[i]) && !memcmp(name, names[i], name_len)) {
+				found++;
+				break;
+			}
+		}
+	}
+	json_document_dealloc(&doc);
+	return found != num_names;
+}
+
+void server_trace(char *io_backend) {
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, server_handler, NULL, "trace_sample", "1", "trace_path", "/trace", NULL);
+	if (!port) {
+		return;
+	}
+	// tracing is process wide, so anything earlier tests traced is left out
+	trace_clear();
+
+	string response;
+	string_init(&response);
+	send_request(port, "GET /traced HTTP/1.1\r\n\r\n", &response);
+	assert(!strncmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\n", 17));
+	// every stage of the request has a span, with the ones on the accept thread or loop different between the models
+	char *blocking_names[] = {"socket_accept", "enqueue", "queue", "task", "finalize"};
+	char *loop_names[] = {"receive", "dispatch", "enqueue", "queue", "task", "finalize", "write"};
+	int blocking = !strcmp(io_backend, "blocking");
+	int missing = 1;
+	// a worker can still be recording the end of finalize after the client has its response
+	for (int i = 0; i < 100 && missing; i++) {
+		send_request(port, "GET /trace HTTP/1.1\r\n\r\n", &response);
+		char *body = strstr(string_get_cstr(&response), "\r\n\r\n");
+		assert(!strncmp(string_get_cstr(&response), "HTTP/1.1 200 OK\r\n", 17) && body);
+		assert(strstr(string_get_cstr(&response), "Content-Type: application/json\r\n"));
+		missing = blocking ? trace_has_spans(body + 4, blocking_names, 5) : trace_has_spans(body + 4, loop_names, 7);
+		if (missing) {
+			usleep(10000);
+		}
+	}
+	assert(!missing);
+	string_dealloc(&response);
+	assert(http_server_dealloc(&server) == 0);
+	trace_set_sample(0);
+}
+
+int streaming_handler(void *data, http_request *request, http_response *response) {
+	http_response_set_status_code(response, 200);
+	char chunk[STREAM_CHUNK_SIZE];
+	for (int i = 0; i < STREAM_CHUNKS; i++) {
+		memset(chunk, 'a' + i % 26, sizeof(chunk));
+		stream_write(http_response_get_body(response), chunk, sizeof(chunk), NULL);
+		if (http_response_flush(response)) {
+			return 1;
+		}
+		if (i == STREAM_CHUNKS / 2 && !string_compare_cstr(http_request_get_uri(request), "/fail", STRING_COMPARE_CASE_SENSITIVE)) {
+			return 1;
+		}
+	}
+	// some left over for the last chunk
+	stream_write(http_response_get_body(response), "end", 3, NULL);
+	return 0;
+}
+
+void server_streaming(char *io_backend) {
+	// smaller than the whole body, so the handler has to wait on the client
+	http_server server;
+	uint16_t port = start_server(&server, io_backend, streaming_handler, NULL, "max_outbound_size", "4096", NULL);
+	if (!port) {
+		return;
+	}
+
+	string response, expected;
+	string_init(&response);
+	string_init(&expected);
+	string_set_cstr(&expected, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+	char chunk[STREAM_CHUNK_SIZE + 1];
+	for (int i = 0; i < STREAM_CHUNKS; i++) {
+		memset(chunk, 'a' + i % 26, STREAM_CHUNK_SIZE);
+		chunk[STREAM_CHUNK_SIZE] = '\0';
+		string_append_cstrf(&expected, "%x\r\n%s\r\n", STREAM_CHUNK_SIZE, chunk);
+	}
+	string_append_cstr(&expected, "3\r\nend\r\n0\r\n\r\n");
+	send_request(port, "GET /stream HTTP/1.1\r\n\r\n", &response);
+	assert(!string_compare_str(&response, &expected, STRING_COMPARE_CASE_SENSITIVE));
+
+	// failing part way through can only cut the response off
+	send_request(port, "GET /fail HTTP/1.1\r\n\r\n", &response);
+	assert(string_get_length(&response) > 0 && string_get_length(&response) < string_get_length(&expected));
+	assert(!strncmp(string_get_cstr(&response), string_get_cstr(&expected), string_get_length(&response)));
+
+	// HTTP/1.0 doesn't know chunks, so the body goes out as it is and closing the connection ends it
+	string_set_cstr(&expected, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+	for (int i = 0; i < STREAM_CHUNKS; i++) {
+		memset(chunk, 'a' + i % 26, STREAM_CHUNK_SIZE);
+		chunk[STREAM_CHUNK_SIZE] = '\0';
+		string_append_cstr(&expected, chunk);
+	}
+	string_append_cstr(&expected, "end");
+	send_request(port, "GET /stream HTTP/1.0\r\n\r\n", &response);
+	assert(!string_compare_str(&response, &expected, STRING_COMPARE_CASE_SENSITIVE));
+	string_dealloc(&response);
+	string_dealloc(&expected);
+	assert(http_server_dealloc(&server) == 0);
+}
+
 int main() {
 	header();
 	headers();
@@ -391,12 +1029,39 @@ int main() {
 	parse_request_put_no_body();
 	parse_request_put_with_body_text();
 	parse_request_delete_no_body();
+	parse_request_limits();
+	parse_request_framing();
+	parse_request_method();
 	response_no_headers_no_body();
+	response_reason_phrase();
+	response_common_headers();
 	response_headers_no_body();
 	response_headers_content_length_matches_body();
 	response_headers_content_length_missing();
 	response_headers_content_length_wrong();
 	response_headers_content_length_not_integer();
 	response_headers_content_length_multiple();
+	find_end();
+	server_round_trip("blocking");
+	server_round_trip("epoll");
+	server_round_trip("io_uring");
+	server_keep_alive("epoll");
+	server_keep_alive("io_uring");
+	server_slow_client("epoll");
+	server_slow_client("io_uring");
+	server_streaming("blocking");
+	server_streaming("epoll");
+	server_streaming("io_uring");
+	server_load_shedding("epoll");
+	server_load_shedding("io_uring");
+	server_access_log("blocking");
+	server_access_log("epoll");
+	server_access_log("io_uring");
+	server_metrics("blocking");
+	server_metrics("epoll");
+	server_metrics("io_uring");
+	server_trace("blocking");
+	server_trace("epoll");
+	server_trace("io_uring");
 	return 0;
 }
\ No newline at end of file
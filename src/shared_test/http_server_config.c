@@ -0,0 +1,200 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/http_server_config.h"
+
+void defaults() {
+	http_server_config config;
+	http_server_config_init(&config);
+	assert(string_get_length(&config.address) == 0);
+	assert(config.port == 8000);
+	assert(config.num_threads >= 2);
+	assert(config.num_threads >= sysconf(_SC_NPROCESSORS_ONLN));
+	assert(config.queue_size >= config.num_threads);
+	assert(config.socket_options.backlog > 10);
+	assert(config.handler_timeout_ms == 5000);
+	size_t num_cpus;
+	assert(http_server_config_get_cpu_affinity(&config, NULL, 0, &num_cpus) == 0);
+	assert(num_cpus == 0);
+	http_server_config_dealloc(&config);
+}
+
+void set_options() {
+	http_server_config config;
+	http_server_config_init(&config);
+	string error;
+	string_init(&error);
+
+	assert(http_server_config_set_cstr(&config, "address", "127.0.0.1", &error) == 0);
+	assert(!strcmp(string_get_cstr(&config.address), "127.0.0.1"));
+	assert(http_server_config_set_cstr(&config, "port", "0", &error) == 0);
+	assert(config.port == 0);
+	assert(http_server_config_set_cstr(&config, "port", "65535", &error) == 0);
+	assert(config.port == 65535);
+	assert(http_server_config_set_cstr(&config, "port", "65536", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "num_threads", "16", &error) == 0);
+	assert(config.num_threads == 16);
+	assert(http_server_config_set_cstr(&config, "num_threads", "0", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "num_threads", "-1", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "num_threads", "abc", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "num_threads", "12abc", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "num_threads", "", &error) != 0);
+	assert(config.num_threads == 16);
+	assert(http_server_config_set_cstr(&config, "listen_backlog", "1024", &error) == 0);
+	assert(config.socket_options.backlog == 1024);
+	assert(http_server_config_set_cstr(&config, "reuse_address", "false", &error) == 0);
+	assert(config.socket_options.reuse_address == 0);
+	assert(http_server_config_set_cstr(&config, "reuse_address", "ON", &error) == 0);
+	assert(config.socket_options.reuse_address == 1);
+	assert(http_server_config_set_cstr(&config, "reuse_address", "maybe", &error) != 0);
+	assert(config.socket_options.no_delay == 1);
+	assert(http_server_config_set_cstr(&config, "tcp_no_delay", "no", &error) == 0);
+	assert(config.socket_options.no_delay == 0);
+	assert(http_server_config_set_cstr(&config, "busy_poll_us", "50", &error) == 0);
+	assert(config.socket_options.busy_poll_microseconds == 50);
+	assert(http_server_config_set_cstr(&config, "tcp_defer_accept_s", "-1", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "receive_buffer_size", "256k", &error) == 0);
+	assert(config.socket_options.receive_buffer_size == 256 * 1024);
+	assert(config.socket_options.send_buffer_size == 0);
+	assert(http_server_config_set_cstr(&config, "max_body_size", "4m", &error) == 0);
+	assert(config.max_body_size == 4 * 1024 * 1024);
+	assert(http_server_config_set_cstr(&config, "read_chunk_size", "16K", &error) == 0);
+	assert(config.read_chunk_size == 16 * 1024);
+	assert(http_server_config_set_cstr(&config, "read_chunk_size", "16x", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "max_header_size", "9999999g", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "handler_timeout_ms", "250", &error) == 0);
+	assert(config.handler_timeout_ms == 250);
+	// sizes are only for sizes
+	assert(http_server_config_set_cstr(&config, "handler_timeout_ms", "1k", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "no_such_option", "1", &error) != 0);
+	assert(strstr(string_get_cstr(&error), "no_such_option"));
+
+	int cpus[8];
+	size_t num_cpus;
+	assert(http_server_config_set_cstr(&config, "cpu_affinity", "0-2,5", &error) == 0);
+	assert(http_server_config_get_cpu_affinity(&config, cpus, 8, &num_cpus) == 0);
+	assert(num_cpus == 4);
+	assert(cpus[0] == 0 && cpus[1] == 1 && cpus[2] == 2 && cpus[3] == 5);
+	assert(http_server_config_get_cpu_affinity(&config, cpus, 3, &num_cpus) != 0);
+	assert(http_server_config_set_cstr(&config, "cpu_affinity", "3-1", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "cpu_affinity", "1,", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "cpu_affinity", "a", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "cpu_affinity", "", &error) == 0);
+	assert(http_server_config_get_cpu_affinity(&config, cpus, 8, &num_cpus) == 0);
+	assert(num_cpus == 0);
+
+	int use_loop;
+	io_loop_backend backend;
+	assert(http_server_config_get_io_backend(&config, &use_loop, &backend) == 0);
+	assert(use_loop && backend == IO_LOOP_BACKEND_AUTO);
+	assert(http_server_config_set_cstr(&config, "io_backend", "blocking", &error) == 0);
+	assert(http_server_config_get_io_backend(&config, &use_loop, &backend) == 0);
+	assert(!use_loop);
+	assert(http_server_config_set_cstr(&config, "io_backend", "epoll", &error) == 0);
+	assert(http_server_config_get_io_backend(&config, &use_loop, &backend) == 0);
+	assert(use_loop && backend == IO_LOOP_BACKEND_EPOLL);
+	assert(http_server_config_set_cstr(&config, "io_backend", "kqueue", &error) != 0);
+	assert(!strcmp(string_get_cstr(&config.io_backend), "epoll"));
+
+	log_level level;
+	assert(http_server_config_get_log_level(&config, &level) == 0);
+	assert(level == LOG_LEVEL_INFO);
+	assert(http_server_config_set_cstr(&config, "log_level", "TRACE", &error) == 0);
+	assert(http_server_config_get_log_level(&config, &level) == 0);
+	assert(level == LOG_LEVEL_TRACE);
+	assert(http_server_config_set_cstr(&config, "log_level", "verbose", &error) != 0);
+	assert(!strcmp(string_get_cstr(&config.log_level), "TRACE"));
+
+	assert(string_get_length(&config.access_log) == 0 && config.access_log_sample == 1);
+	assert(http_server_config_set_cstr(&config, "access_log", "/var/log/access.log", &error) == 0);
+	assert(http_server_config_set_cstr(&config, "access_log_sample", "0", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "access_log_sample", "100", &error) == 0);
+	assert(string_get_length(&config.metrics_path) == 0);
+	assert(http_server_config_set_cstr(&config, "metrics_path", "/metrics", &error) == 0);
+	assert(config.perf_counters == 0);
+	assert(http_server_config_set_cstr(&config, "perf_counters", "true", &error) == 0);
+	assert(config.trace_sample == 0 && string_get_length(&config.trace_path) == 0);
+	assert(http_server_config_set_cstr(&config, "trace_sample", "-1", &error) != 0);
+	assert(http_server_config_set_cstr(&config, "trace_sample", "1000", &error) == 0);
+	assert(http_server_config_set_cstr(&config, "trace_path", "/trace", &error) == 0);
+
+	http_server_config copy;
+	http_server_config_init(&copy);
+	http_server_config_copy(&copy, &config);
+	assert(copy.num_threads == 16);
+	assert(!strcmp(string_get_cstr(&copy.address), "127.0.0.1"));
+	assert(!strcmp(string_get_cstr(&copy.io_backend), "epoll"));
+	assert(!strcmp(string_get_cstr(&copy.access_log), "/var/log/access.log") && copy.access_log_sample == 100);
+	assert(!strcmp(string_get_cstr(&copy.metrics_path), "/metrics"));
+	assert(copy.perf_counters == 1);
+	assert(copy.trace_sample == 1000 && !strcmp(string_get_cstr(&copy.trace_path), "/trace"));
+	assert(string_get_cstr(&copy.address) != string_get_cstr(&config.address));
+	http_server_config_dealloc(&copy);
+
+	string_dealloc(&error);
+	http_server_config_dealloc(&config);
+}
+
+void write_file(char *path, char *contents) {
+	FILE *f = fopen(path, "wb");
+	assert(f);
+	fputs(contents, f);
+	fclose(f);
+}
+
+void load_file() {
+	char path[] = "/tmp/test_http_server_config_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	http_server_config config;
+	http_server_config_init(&config);
+	string error;
+	string_init(&error);
+
+	write_file(path, "{\n"
+					 "\t\"num_threads\": 3,\n"
+					 "\t\"max_body_size\": \"2k\",\n"
+					 "\t\"reuse_address\": false,\n"
+					 "\t\"cpu_affinity\": \"0\"\n"
+					 "}\n");
+	assert(http_server_config_load_file_cstr(&config, path, &error) == 0);
+	assert(config.num_threads == 3);
+	assert(config.max_body_size == 2048);
+	assert(config.socket_options.reuse_address == 0);
+	assert(!strcmp(string_get_cstr(&config.cpu_affinity), "0"));
+	// untouched
+	assert(config.port == 8000);
+
+	write_file(path, "{\"num_threads\": 0}");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	write_file(path, "{\"num_threads\": 1.5}");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	write_file(path, "{\"num_threads\": null}");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	write_file(path, "[1, 2]");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	write_file(path, "{\"num_threads\": 4");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	assert(config.num_threads == 3);
+	// a key that can't be decoded isn't taken for the one before it
+	write_file(path, "{\"num_threads\": 5, \"\\q\": 6}");
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+	assert(strstr(string_get_cstr(&error), "malformed"));
+	assert(config.num_threads == 5);
+	unlink(path);
+	assert(http_server_config_load_file_cstr(&config, path, &error) != 0);
+
+	string_dealloc(&error);
+	http_server_config_dealloc(&config);
+}
+
+int main() {
+	defaults();
+	set_options();
+	load_file();
+	return 0;
+}
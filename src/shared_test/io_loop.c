@@ -0,0 +1,266 @@
+/*
+Runs an echo server on each backend the kernel supports. Each connection is read until a newline, the whole message is sent back, and then
+the connection is closed, so both small sends and ones big enough to be zero copy get exercised.
+*/
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/tcp.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "../shared/buffer.h"
+#include "../shared/io_loop.h"
+#include "../shared/tcp_socket_wrapper.h"
+
+typedef struct {
+	io_loop *loop;
+	int accepted;
+	int closed;
+	int timer_calls;
+	int posted;
+	sem_t posted_semaphore;
+} echo_server;
+
+typedef struct {
+	echo_server *server;
+	io_loop_socket socket;
+	buffer received;
+} echo_connection;
+
+void echo_closed(void *data) {
+	echo_connection *connection = data;
+	connection->server->closed++;
+	buffer_dealloc(&connection->received);
+	free(connection);
+}
+
+void echo_sent(void *data, int result) {
+	echo_connection *connection = data;
+	assert(result == 0);
+	io_loop_close(connection->server->loop, &connection->socket);
+}
+
+void echo_received(void *data, uint8_t *bytes, int result) {
+	echo_connection *connection = data;
+	if (result <= 0) {
+		io_loop_close(connection->server->loop, &connection->socket);
+		return;
+	}
+	buffer_append_bytes(&connection->received, bytes, result);
+	if (connection->received.data[buffer_get_length(&connection->received) - 1] == '\n') {
+		io_loop_send(connection->server->loop, &connection->socket, connection->received.data, buffer_get_length(&connection->received));
+	} else {
+		io_loop_recv(connection->server->loop, &connection->socket);
+	}
+}
+
+void echo_accept(void *data, int socket, struct sockaddr *address) {
+	echo_server *server = data;
+	server->accepted++;
+	echo_connection *connection = malloc(sizeof(echo_connection));
+	connection->server = server;
+	buffer_init(&connection->received);
+	io_loop_socket_init(&connection->socket, socket, echo_received, echo_sent, echo_closed, connection);
+	io_loop_recv(server->loop, &connection->socket);
+}
+
+uint64_t echo_timer(void *data, uint64_t now_ns) {
+	echo_server *server = data;
+	server->timer_calls++;
+	return now_ns + 1000000;
+}
+
+void echo_posted(void *data) {
+	echo_server *server = data;
+	server->posted++;
+	sem_post(&server->posted_semaphore);
+}
+
+void echo_round_trip(uint16_t port, size_t length) {
+	uint8_t *message = malloc(length);
+	for (size_t i = 0; i < length - 1; i++) {
+		message[i] = 'a' + i % 26;
+	}
+	message[length - 1] = '\n';
+
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	assert(s >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	assert(connect(s, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	size_t sent = 0;
+	while (sent < length) {
+		ssize_t result = write(s, message + sent, length - sent);
+		assert(result > 0);
+		sent += result;
+	}
+
+	uint8_t *response = malloc(length + 1);
+	size_t received = 0;
+	ssize_t result;
+	while ((result = read(s, response + received, length + 1 - received)) > 0) {
+		received += result;
+	}
+	assert(result == 0);
+	assert(received == length);
+	assert(!memcmp(response, message, length));
+	close(s);
+	free(response);
+	free(message);
+}
+
+/*
+Sends a message with no newline and shuts down the sending side, with the data and the FIN in one segment, to a connection the server is
+already waiting to read from. The server only sees one edge for both, and has to notice the FIN after reading the data to close.
+*/
+void half_close(uint16_t port) {
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	assert(s >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	assert(connect(s, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	struct timeval timeout = {2, 0};
+	assert(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+	// long enough for the server to find nothing to read and wait
+	usleep(50000);
+	// corked, the FIN goes out with the data
+	int one = 1;
+	assert(setsockopt(s, IPPROTO_TCP, TCP_CORK, &one, sizeof(one)) == 0);
+	assert(write(s, "partial", 7) == 7);
+	assert(shutdown(s, SHUT_WR) == 0);
+	char response[16];
+	assert(read(s, response, sizeof(response)) == 0);
+	close(s);
+}
+
+void run_backend(io_loop_backend backend) {
+	io_loop loop;
+	if (io_loop_init(&loop, backend, 4096, 64)) {
+		assert(backend == IO_LOOP_BACKEND_IO_URING);
+		printf("io_uring isn't available, skipping\n");
+		return;
+	}
+	assert(io_loop_get_backend(&loop) == backend);
+	printf("testing %s\n", io_loop_backend_get_name(backend));
+
+	tcp_socket_wrapper listener;
+	assert(tcp_socket_wrapper_init(&listener, "127.0.0.1", 0, NULL, NULL, NULL) == 0);
+
+	echo_server server;
+	memset(&server, 0, sizeof(server));
+	server.loop = &loop;
+	sem_init(&server.posted_semaphore, 0, 0);
+	io_loop_listener loop_listener;
+	assert(io_loop_accept(&loop, &loop_listener, tcp_socket_wrapper_get_socket(&listener), echo_accept, &server) == 0);
+	io_loop_set_timer_callback(&loop, echo_timer, &server);
+	assert(io_loop_start(&loop) == 0);
+
+	uint16_t port = tcp_socket_wrapper_get_port(&listener);
+	for (int i = 0; i < 20; i++) {
+		echo_round_trip(port, 1 + rand() % 100);
+	}
+	// spans lots of receives, and is sent zero copy with io_uring
+	echo_round_trip(port, 1000000);
+	half_close(port);
+
+	io_loop_post_task task;
+	io_loop_post(&loop, &task, echo_posted, &server);
+	sem_wait(&server.posted_semaphore);
+	assert(server.posted == 1);
+
+	usleep(20000);
+	io_loop_stop(&loop);
+	assert(server.accepted == 22);
+	assert(server.closed == 22);
+	// roughly every ms
+	assert(server.timer_calls > 5);
+
+	io_loop_dealloc(&loop);
+	tcp_socket_wrapper_dealloc(&listener);
+	sem_destroy(&server.posted_semaphore);
+}
+
+void queue_received(void *data, uint8_t *bytes, int result) {
+	assert(result == 1 && bytes[0] == 'x');
+	__atomic_add_fetch((int *)data, 1, __ATOMIC_RELAXED);
+}
+
+void queue_closed(void *data) {
+}
+
+/*
+Starts more operations at once than the submission queue has room for, so some have to wait for the kernel to take the earlier ones, and
+checks none of them are lost.
+*/
+void full_queue(io_loop_backend backend) {
+	io_loop loop;
+	if (io_loop_init(&loop, backend, 4096, 1024)) {
+		return;
+	}
+	int num_sockets = 600;
+	int (*pairs)[2] = malloc(sizeof(int[2]) * num_sockets);
+	io_loop_socket *sockets = malloc(sizeof(io_loop_socket) * num_sockets);
+	int received = 0;
+	for (int i = 0; i < num_sockets; i++) {
+		assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pairs[i]) == 0);
+		assert(write(pairs[i][1], "x", 1) == 1);
+		io_loop_socket_init(&sockets[i], pairs[i][0], queue_received, NULL, queue_closed, &received);
+		io_loop_recv(&loop, &sockets[i]);
+	}
+	assert(io_loop_start(&loop) == 0);
+	for (int i = 0; i < 200 && __atomic_load_n(&received, __ATOMIC_RELAXED) < num_sockets; i++) {
+		usleep(10000);
+	}
+	io_loop_stop(&loop);
+	assert(received == num_sockets);
+	io_loop_dealloc(&loop);
+	for (int i = 0; i < num_sockets; i++) {
+		close(pairs[i][0]);
+		close(pairs[i][1]);
+	}
+	free(sockets);
+	free(pairs);
+}
+
+void backend_names() {
+	io_loop_backend backend;
+	assert(io_loop_backend_parse_cstr("epoll", &backend) == 0);
+	assert(backend == IO_LOOP_BACKEND_EPOLL);
+	assert(io_loop_backend_parse_cstr("io_uring", &backend) == 0);
+	assert(backend == IO_LOOP_BACKEND_IO_URING);
+	assert(io_loop_backend_parse_cstr("auto", &backend) == 0);
+	assert(backend == IO_LOOP_BACKEND_AUTO);
+	assert(io_loop_backend_parse_cstr("select", &backend) != 0);
+	assert(!strcmp(io_loop_backend_get_name(IO_LOOP_BACKEND_IO_URING), "io_uring"));
+}
+
+void bad_arguments() {
+	io_loop loop;
+	assert(io_loop_init(&loop, IO_LOOP_BACKEND_EPOLL, 0, 64) != 0);
+	assert(io_loop_init(&loop, IO_LOOP_BACKEND_EPOLL, 4096, 0) != 0);
+	assert(io_loop_init(&loop, IO_LOOP_BACKEND_EPOLL, 4096, 48) != 0);
+	assert(io_loop_init(&loop, IO_LOOP_BACKEND_AUTO, 4096, 64) == 0);
+	assert(io_loop_get_backend(&loop) != IO_LOOP_BACKEND_AUTO);
+	io_loop_dealloc(&loop);
+}
+
+int main() {
+	backend_names();
+	bad_arguments();
+	run_backend(IO_LOOP_BACKEND_EPOLL);
+	run_backend(IO_LOOP_BACKEND_IO_URING);
+	full_queue(IO_LOOP_BACKEND_EPOLL);
+	full_queue(IO_LOOP_BACKEND_IO_URING);
+	return 0;
+}
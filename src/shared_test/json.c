@@ -0,0 +1,493 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../shared/json.h"
+
+void parse(json_document *doc, char *input, json_value *root) {
+	assert(json_document_parse(doc, input, strlen(input)) == 0);
+	assert(json_document_get_root(doc, root) == 0);
+}
+
+void assert_fails(json_document *doc, char *input) {
+	json_value root;
+	assert(json_document_parse(doc, input, strlen(input)) != 0 || json_document_get_root(doc, &root) != 0);
+}
+
+void assert_string(json_value *value, char *expected) {
+	char *s;
+	size_t len;
+	assert(json_value_get_type(value) == JSON_TYPE_STRING);
+	assert(json_value_get_cstr_len(value, &s, &len) == 0);
+	assert(len == strlen(expected));
+	assert(!memcmp(s, expected, len));
+}
+
+void assert_int64(json_value *value, int64_t expected) {
+	int64_t i;
+	assert(json_value_get_type(value) == JSON_TYPE_NUMBER);
+	assert(json_value_get_int64(value, &i) == 0);
+	assert(i == expected);
+}
+
+void scalars() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root;
+	int b;
+	double d;
+	int64_t i;
+
+	parse(&doc, "true", &root);
+	assert(json_value_get_type(&root) == JSON_TYPE_TRUE);
+	assert(json_value_get_bool(&root, &b) == 0 && b == 1);
+	assert(!json_value_is_null(&root));
+
+	parse(&doc, " false ", &root);
+	assert(json_value_get_type(&root) == JSON_TYPE_FALSE);
+	assert(json_value_get_bool(&root, &b) == 0 && b == 0);
+
+	parse(&doc, "\nnull\n", &root);
+	assert(json_value_get_type(&root) == JSON_TYPE_NULL);
+	assert(json_value_is_null(&root));
+	assert(json_value_get_bool(&root, &b) != 0);
+
+	parse(&doc, "nul", &root);
+	assert(!json_value_is_null(&root));
+	parse(&doc, "truex", &root);
+	assert(json_value_get_bool(&root, &b) != 0);
+
+	parse(&doc, "0", &root);
+	assert_int64(&root, 0);
+	parse(&doc, "-42", &root);
+	assert_int64(&root, -42);
+	parse(&doc, "9223372036854775807", &root);
+	assert_int64(&root, INT64_MAX);
+	parse(&doc, "-9223372036854775808", &root);
+	assert_int64(&root, INT64_MIN);
+	parse(&doc, "9223372036854775808", &root);
+	assert(json_value_get_int64(&root, &i) != 0);
+	assert(json_value_get_double(&root, &d) == 0 && d == 9223372036854775808.0);
+	parse(&doc, "1.5", &root);
+	assert(json_value_get_int64(&root, &i) != 0);
+	assert(json_value_get_double(&root, &d) == 0 && d == 1.5);
+	parse(&doc, "-2.5e-3", &root);
+	assert(json_value_get_double(&root, &d) == 0 && fabs(d - -0.0025) < 1e-12);
+	parse(&doc, "1E10", &root);
+	assert(json_value_get_double(&root, &d) == 0 && d == 1e10);
+	// exact in the fast path and in strtod
+	char *doubles[] = {"0.1", "1.1", "-0.0", "3.14159", "1e22", "1e23", "123456789.123456789", "2.2250738585072014e-308",
+					   "1.7976931348623157e308", "0.000001234", "98765432109876543210"};
+	for (size_t j = 0; j < sizeof(doubles) / sizeof(doubles[0]); j++) {
+		parse(&doc, doubles[j], &root);
+		assert(json_value_get_double(&root, &d) == 0 && d == strtod(doubles[j], NULL));
+	}
+	parse(&doc, "01", &root);
+	assert(json_value_get_double(&root, &d) != 0);
+	parse(&doc, "1.", &root);
+	assert(json_value_get_double(&root, &d) != 0);
+	parse(&doc, "-", &root);
+	assert(json_value_get_double(&root, &d) != 0);
+	parse(&doc, "1e+", &root);
+	assert(json_value_get_double(&root, &d) != 0);
+
+	assert_fails(&doc, "");
+	assert_fails(&doc, "   ");
+	assert_fails(&doc, "1 2");
+	assert_fails(&doc, "true false");
+
+	json_document_dealloc(&doc);
+}
+
+void strings() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root;
+	char *s;
+	size_t len;
+
+	char *input = "\"Hello, World!\"";
+	parse(&doc, input, &root);
+	assert_string(&root, "Hello, World!");
+	// no escapes so this points into the input
+	assert(json_value_get_cstr_len(&root, &s, &len) == 0);
+	assert(s == input + 1);
+
+	input = "\"a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\"";
+	parse(&doc, input, &root);
+	assert_string(&root, "a\"b\\c/d\b\f\n\r\t");
+	assert(json_value_get_cstr_len(&root, &s, &len) == 0);
+	assert(s < input || s > input + strlen(input));
+	assert(s[len] == 0);
+
+	parse(&doc, "\"\\u0041\\u00e9\\u20ac\\ud83d\\ude00\"", &root);
+	assert_string(&root, "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+
+	parse(&doc, "\"\\\\\"", &root);
+	assert_string(&root, "\\");
+	parse(&doc, "\"\"", &root);
+	assert_string(&root, "");
+
+	parse(&doc, "\"\\x\"", &root);
+	assert(json_value_get_cstr_len(&root, &s, &len) != 0);
+	parse(&doc, "\"\\ud83d\"", &root);
+	assert(json_value_get_cstr_len(&root, &s, &len) != 0);
+	parse(&doc, "\"\\u12\"", &root);
+	assert(json_value_get_cstr_len(&root, &s, &len) != 0);
+
+	string str;
+	string_init(&str);
+	parse(&doc, "\"foo\\nbar\"", &root);
+	assert(json_value_get_str(&root, &str) == 0);
+	assert(!strcmp(string_get_cstr(&str), "foo\nbar"));
+	string_dealloc(&str);
+
+	assert_fails(&doc, "\"unterminated");
+	assert_fails(&doc, "\"escaped end\\\"");
+
+	json_document_dealloc(&doc);
+}
+
+void containers() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, key, value, inner;
+	json_iterator it, it2;
+
+	parse(&doc,
+		  "{\n"
+		  "\t\"foo\": \"bar\",\n"
+		  "\t\"baz\": 42,\n"
+		  "\t\"blarg\": {\n"
+		  "\t\t\"array\": [1, 2, 3, [], {}, [[\"nested\"]]],\n"
+		  "\t\t\"empty\": {}\n"
+		  "\t},\n"
+		  "\t\"esc\\u0061ped\": null\n"
+		  "}\n",
+		  &root);
+	assert(json_value_get_type(&root) == JSON_TYPE_OBJECT);
+
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, &key, &value) == 1);
+	assert_string(&key, "foo");
+	assert_string(&value, "bar");
+	assert(json_iterator_next(&it, &key, &value) == 1);
+	assert_string(&key, "baz");
+	assert_int64(&value, 42);
+	assert(json_iterator_next(&it, &key, &value) == 1);
+	assert_string(&key, "blarg");
+	assert(json_value_get_type(&value) == JSON_TYPE_OBJECT);
+	assert(json_iterator_next(&it, &key, &value) == 1);
+	assert_string(&key, "escaped");
+	assert(json_value_is_null(&value));
+	assert(json_iterator_next(&it, &key, &value) == 0);
+	assert(json_iterator_next(&it, &key, &value) == 0);
+
+	assert(json_value_object_get_cstr(&root, "baz", &value) == 0);
+	assert_int64(&value, 42);
+	assert(json_value_object_get_cstr(&root, "escaped", &value) == 0);
+	assert(json_value_is_null(&value));
+	assert(json_value_object_get_cstr(&root, "missing", &value) != 0);
+	assert(json_value_object_get_cstr(&root, "blarg", &value) == 0);
+	assert(json_value_object_get_cstr(&value, "array", &inner) == 0);
+	assert(json_value_get_type(&inner) == JSON_TYPE_ARRAY);
+	assert(json_value_object_get_cstr(&inner, "array", &value) != 0);
+
+	assert(json_value_iterate(&inner, &it) == 0);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert_int64(&value, 1);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert_int64(&value, 2);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert_int64(&value, 3);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert(json_value_get_type(&value) == JSON_TYPE_ARRAY);
+	assert(json_value_iterate(&value, &it2) == 0);
+	assert(json_iterator_next(&it2, NULL, &value) == 0);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert(json_value_get_type(&value) == JSON_TYPE_OBJECT);
+	assert(json_value_iterate(&value, &it2) == 0);
+	assert(json_iterator_next(&it2, &key, &value) == 0);
+	assert(json_iterator_next(&it, NULL, &value) == 1);
+	assert(json_value_iterate(&value, &it2) == 0);
+	assert(json_iterator_next(&it2, NULL, &value) == 1);
+	assert(json_value_iterate(&value, &it2) == 0);
+	assert(json_iterator_next(&it2, NULL, &value) == 1);
+	assert_string(&value, "nested");
+	assert(json_iterator_next(&it, NULL, &value) == 0);
+
+	assert(json_value_iterate(&value, &it) != 0);
+
+	json_document_dealloc(&doc);
+}
+
+void malformed() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, key, value;
+	json_iterator it;
+
+	assert_fails(&doc, "[");
+	assert_fails(&doc, "]");
+	assert_fails(&doc, "{]");
+	assert_fails(&doc, "[}");
+	assert_fails(&doc, "[1]]");
+	assert_fails(&doc, "{} {}");
+
+	parse(&doc, "[1 2]", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, NULL, &value) < 0);
+
+	parse(&doc, "[1,]", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, NULL, &value) < 0);
+
+	parse(&doc, "[,1]", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, NULL, &value) < 0);
+
+	parse(&doc, "{\"a\" 1}", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, &key, &value) < 0);
+
+	parse(&doc, "{\"a\":}", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, &key, &value) < 0);
+
+	parse(&doc, "{1:2}", &root);
+	assert(json_value_iterate(&root, &it) == 0);
+	assert(json_iterator_next(&it, &key, &value) < 0);
+
+	json_document_dealloc(&doc);
+}
+
+/*
+The first pass works on blocks of input at a time, so shift the same document around to make sure that strings, escapes and scalars that
+cross block boundaries are handled the same as those that don't.
+*/
+void block_boundaries() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, value;
+	json_iterator it;
+	string input;
+	string_init(&input);
+	for (int offset = 0; offset < 40; offset++) {
+		string_clear(&input);
+		string_set_length(&input, offset, ' ');
+		string_append_cstr(&input, "[\"abc\\\\\", \"d\\\"e,f]\", 1234567890123, true, \"\\\\\\\"\", -0.5, null, [\"x\"], \"long string "
+								   "with [brackets] and {braces} and \\\"quotes\\\" inside\"]");
+		parse(&doc, string_get_cstr(&input), &root);
+		assert(json_value_iterate(&root, &it) == 0);
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_string(&value, "abc\\");
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_string(&value, "d\"e,f]");
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_int64(&value, 1234567890123ll);
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert(json_value_get_type(&value) == JSON_TYPE_TRUE);
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_string(&value, "\\\"");
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		double d;
+		assert(json_value_get_double(&value, &d) == 0 && d == -0.5);
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert(json_value_is_null(&value));
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert(json_value_get_type(&value) == JSON_TYPE_ARRAY);
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_string(&value, "long string with [brackets] and {braces} and \"quotes\" inside");
+		assert(json_iterator_next(&it, NULL, &value) == 0);
+	}
+	string_dealloc(&input);
+	json_document_dealloc(&doc);
+}
+
+void reuse() {
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, value;
+	json_iterator it;
+	string input;
+	string_init(&input);
+	// enough escaped strings to need more than one arena block
+	string_set_cstr(&input, "[");
+	for (int i = 0; i < 1000; i++) {
+		string_append_cstrf(&input, "%s\"value\\t%i\"", i > 0 ? "," : "", i);
+	}
+	string_append_cstr(&input, "]");
+	string expected;
+	string_init(&expected);
+	for (int round = 0; round < 3; round++) {
+		parse(&doc, string_get_cstr(&input), &root);
+		assert(json_value_iterate(&root, &it) == 0);
+		for (int i = 0; i < 1000; i++) {
+			assert(json_iterator_next(&it, NULL, &value) == 1);
+			string_set_cstrf(&expected, "value\t%i", i);
+			assert_string(&value, string_get_cstr(&expected));
+		}
+		assert(json_iterator_next(&it, NULL, &value) == 0);
+	}
+	string_dealloc(&expected);
+	string_dealloc(&input);
+	json_document_dealloc(&doc);
+}
+
+void assert_written(json_writer *w, buffer *b, char *expected) {
+	assert(json_writer_flush(w, NULL) == 0);
+	assert(buffer_get_length(b) == strlen(expected));
+	assert(!memcmp(b->data, expected, buffer_get_length(b)));
+}
+
+void writer() {
+	buffer b;
+	buffer_init(&b);
+	stream s;
+	stream_init_buffer(&s, &b, 0);
+	json_writer w;
+
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_object(&w) == 0);
+	assert(json_writer_key_cstr(&w, "foo") == 0);
+	assert(json_writer_cstr(&w, "bar") == 0);
+	assert(json_writer_key_cstr(&w, "numbers") == 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_int64(&w, 0) == 0);
+	assert(json_writer_int64(&w, -42) == 0);
+	assert(json_writer_int64(&w, INT64_MIN) == 0);
+	assert(json_writer_uint64(&w, UINT64_MAX) == 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert(json_writer_key_cstr(&w, "empty") == 0);
+	assert(json_writer_begin_object(&w) == 0);
+	assert(json_writer_end_object(&w) == 0);
+	assert(json_writer_key_cstr(&w, "literals") == 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_bool(&w, 1) == 0);
+	assert(json_writer_bool(&w, 0) == 0);
+	assert(json_writer_null(&w) == 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert(json_writer_end_object(&w) == 0);
+	// nothing is written until flushed
+	assert(buffer_get_length(&b) == 0);
+	assert_written(&w, &b, "{\"foo\":\"bar\",\"numbers\":[0,-42,-9223372036854775808,18446744073709551615],\"empty\":{},"
+						   "\"literals\":[true,false,null,[]]}");
+	json_writer_dealloc(&w);
+
+	// escaping, with the long string covering both the block and tail paths
+	buffer_clear(&b);
+	stream_set_position(&s, 0);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_cstr(&w, "a\"b\\c/d\b\f\n\r\t\x01\x1f \xc3\xa9") == 0);
+	assert(json_writer_cstr(&w, "a long string with no escapes at all until right at the end\n") == 0);
+	assert(json_writer_cstr_len(&w, "nul\0l", 5) == 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert_written(&w, &b, "[\"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001\\u001f \xc3\xa9\","
+						   "\"a long string with no escapes at all until right at the end\\n\",\"nul\\u0000l\"]");
+	json_writer_dealloc(&w);
+
+	// doubles
+	double doubles[] = {0.0, -0.0, 1.0, -1.5, 0.1, 3.14159, 1e22, 1e-7, 123456.789, 1.0 / 3.0,
+						2.2250738585072014e-308, 1.7976931348623157e308, 5e-324, 9007199254740993.0};
+	char *expected_doubles[] = {"0", "-0", "1", "-1.5", "0.1", "3.14159", "1e+22", "0.0000001", "123456.789", NULL, NULL, NULL, NULL, NULL};
+	for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+		buffer_clear(&b);
+		stream_set_position(&s, 0);
+		json_writer_init(&w, &s, 0);
+		assert(json_writer_double(&w, doubles[i]) == 0);
+		assert(json_writer_flush(&w, NULL) == 0);
+		if (expected_doubles[i]) {
+			assert(buffer_get_length(&b) == strlen(expected_doubles[i]));
+			assert(!memcmp(b.data, expected_doubles[i], buffer_get_length(&b)));
+		}
+		// whatever the format it has to read back exactly
+		json_document doc;
+		json_document_init(&doc);
+		json_value root;
+		double d;
+		assert(json_document_parse(&doc, (char *)b.data, buffer_get_length(&b)) == 0);
+		assert(json_document_get_root(&doc, &root) == 0);
+		assert(json_value_get_double(&root, &d) == 0);
+		assert(d == doubles[i]);
+		json_document_dealloc(&doc);
+		json_writer_dealloc(&w);
+	}
+	buffer_clear(&b);
+	stream_set_position(&s, 0);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_double(&w, NAN) == 0);
+	assert(json_writer_double(&w, -INFINITY) == 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert_written(&w, &b, "[null,null]");
+	json_writer_dealloc(&w);
+
+	// misuse
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_key_cstr(&w, "no object") != 0);
+	assert(json_writer_null(&w) != 0);
+	assert(json_writer_flush(&w, NULL) != 0);
+	json_writer_dealloc(&w);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_object(&w) == 0);
+	assert(json_writer_int64(&w, 1) != 0);
+	json_writer_dealloc(&w);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_object(&w) == 0);
+	assert(json_writer_key_cstr(&w, "a") == 0);
+	assert(json_writer_end_object(&w) != 0);
+	json_writer_dealloc(&w);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_begin_array(&w) == 0);
+	assert(json_writer_end_object(&w) != 0);
+	json_writer_dealloc(&w);
+	json_writer_init(&w, &s, 0);
+	assert(json_writer_null(&w) == 0);
+	assert(json_writer_null(&w) != 0);
+	json_writer_dealloc(&w);
+
+	// flushing in chunks as the output builds up
+	buffer_clear(&b);
+	stream_set_position(&s, 0);
+	json_writer_init(&w, &s, 64);
+	assert(json_writer_begin_array(&w) == 0);
+	for (int i = 0; i < 1000; i++) {
+		assert(json_writer_int64(&w, i) == 0);
+		assert(buffer_get_length(&w.pending) < 64);
+	}
+	assert(buffer_get_length(&b) > 0);
+	assert(json_writer_end_array(&w) == 0);
+	assert(json_writer_flush(&w, NULL) == 0);
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, value;
+	json_iterator it;
+	assert(json_document_parse(&doc, (char *)b.data, buffer_get_length(&b)) == 0);
+	assert(json_document_get_root(&doc, &root) == 0);
+	assert(json_value_iterate(&root, &it) == 0);
+	for (int i = 0; i < 1000; i++) {
+		assert(json_iterator_next(&it, NULL, &value) == 1);
+		assert_int64(&value, i);
+	}
+	assert(json_iterator_next(&it, NULL, &value) == 0);
+	json_document_dealloc(&doc);
+	json_writer_dealloc(&w);
+
+	stream_dealloc(&s, NULL);
+	buffer_dealloc(&b);
+}
+
+int main() {
+	scalars();
+	strings();
+	containers();
+	malformed();
+	block_boundaries();
+	reuse();
+	writer();
+	return 0;
+}
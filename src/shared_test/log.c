@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../shared/log.h"
+#include "../shared/string.h"
+
+#define NUM_THREADS 4
+#define NUM_MESSAGES 2000
+
+typedef struct {
+	int saved_fd;
+	FILE *file;
+} captured_output;
+
+// points stdout at a temporary file until release_stdout
+void capture_stdout(captured_output *captured) {
+	fflush(stdout);
+	captured->file = tmpfile();
+	assert(captured->file);
+	captured->saved_fd = dup(STDOUT_FILENO);
+	assert(dup2(fileno(captured->file), STDOUT_FILENO) >= 0);
+}
+
+// puts stdout back and reads everything written meanwhile into output
+void release_stdout(captured_output *captured, string *output) {
+	fflush(stdout);
+	assert(dup2(captured->saved_fd, STDOUT_FILENO) >= 0);
+	close(captured->saved_fd);
+	fseek(captured->file, 0, SEEK_END);
+	long length = ftell(captured->file);
+	rewind(captured->file);
+	string_set_length(output, length, 0);
+	assert(fread(string_get_cstr(output), 1, length, captured->file) == (size_t)length);
+	fclose(captured->file);
+}
+
+void *log_messages(void *data) {
+	int id = *(int *)data;
+	for (int i = 0; i < NUM_MESSAGES; i++) {
+		log_info("thread %i message %i\n", id, i);
+	}
+	return NULL;
+}
+
+void sync_logging() {
+	captured_output captured;
+	string output;
+	string_init(&output);
+	capture_stdout(&captured);
+	log_info("hello %s %i\n", "world", 42);
+	log_debug("second\n");
+	release_stdout(&captured, &output);
+	assert(!strcmp(string_get_cstr(&output), "INFO hello world 42\nDEBUG second\n"));
+	string_dealloc(&output);
+}
+
+int num_evaluated;
+
+char *evaluated(char *s) {
+	num_evaluated++;
+	return s;
+}
+
+void levels() {
+	log_level level;
+	assert(log_level_parse_cstr("debug", &level) == 0 && level == LOG_LEVEL_DEBUG);
+	assert(log_level_parse_cstr("None", &level) == 0 && level == LOG_LEVEL_NONE);
+	assert(log_level_parse_cstr("loud", &level) != 0);
+	assert(log_get_level() == LOG_LEVEL_TRACE);
+
+	captured_output captured;
+	string output;
+	string_init(&output);
+	capture_stdout(&captured);
+	log_set_level(LOG_LEVEL_INFO);
+	assert(!log_is_enabled(LOG_LEVEL_DEBUG) && log_is_enabled(LOG_LEVEL_INFO));
+	// the arguments of a message below the level aren't even evaluated
+	num_evaluated = 0;
+	log_trace("%s\n", evaluated("trace"));
+	log_debug("%s\n", evaluated("debug"));
+	assert(num_evaluated == 0);
+	log_info("%s\n", evaluated("info"));
+	assert(num_evaluated == 1);
+	log_set_level(LOG_LEVEL_NONE);
+	log_info("%s\n", evaluated("info"));
+	assert(num_evaluated == 1);
+	log_set_level(LOG_LEVEL_TRACE);
+	log_trace("%s\n", evaluated("trace"));
+	assert(num_evaluated == 2);
+	release_stdout(&captured, &output);
+	assert(!strcmp(string_get_cstr(&output), "INFO info\nTRACE trace\n"));
+	string_dealloc(&output);
+}
+
+void async_logging() {
+	assert(log_start_async(16) != 0);
+	assert(log_start_async(4096) == 0);
+	assert(log_start_async(4096) != 0);
+
+	captured_output captured;
+	string output;
+	string_init(&output);
+	capture_stdout(&captured);
+	uint64_t dropped_before = log_get_num_dropped();
+	pthread_t threads[NUM_THREADS];
+	int ids[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		ids[i] = i;
+		assert(pthread_create(&threads[i], NULL, log_messages, &ids[i]) == 0);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	log_stop_async();
+	release_stdout(&captured, &output);
+	uint64_t dropped = log_get_num_dropped() - dropped_before;
+
+	// every message that wasn't dropped comes out whole and in order for its thread
+	int next[NUM_THREADS] = {0};
+	size_t num_written = 0;
+	char *line = string_get_cstr(&output);
+	while (*line) {
+		char *end = strchr(line, '\n');
+		int id, i;
+		assert(end && sscanf(line, "INFO thread %i message %i\n", &id, &i) == 2);
+		assert(id >= 0 && id < NUM_THREADS && i >= next[id]);
+		next[id] = i + 1;
+		num_written++;
+		line = end + 1;
+	}
+	assert(num_written + dropped == NUM_THREADS * NUM_MESSAGES);
+	assert(num_written > 0);
+
+	// too long for a quarter of the ring, so it's cut short
+	assert(log_start_async(4096) == 0);
+	capture_stdout(&captured);
+	char long_message[2048];
+	memset(long_message, 'x', sizeof(long_message) - 2);
+	long_message[sizeof(long_message) - 2] = '\n';
+	long_message[sizeof(long_message) - 1] = 0;
+	log_info("%s", long_message);
+	log_stop_async();
+	release_stdout(&captured, &output);
+	assert(string_get_length(&output) == strlen("INFO ") + 1024 - 8);
+	assert(!strncmp(string_get_cstr(&output), "INFO xxxx", 9) && string_get_cstr(&output)[string_get_length(&output) - 1] == 'x');
+
+	// back to synchronous
+	capture_stdout(&captured);
+	log_info("after\n");
+	release_stdout(&captured, &output);
+	assert(!strcmp(string_get_cstr(&output), "INFO after\n"));
+	string_dealloc(&output);
+}
+
+int main() {
+	sync_logging();
+	levels();
+	async_logging();
+	// starting again reuses the rings of threads that are still around
+	async_logging();
+	return 0;
+}
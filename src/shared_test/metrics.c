@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../shared/metrics.h"
+
+#define NUM_THREADS 4
+#define NUM_ADDS 100000
+
+metrics_id counter;
+metrics_id gauge;
+
+void registering() {
+	assert(metrics_register_cstr("test_events_total", "Events seen.", METRICS_TYPE_COUNTER, &counter) == 0);
+	assert(counter != METRICS_DISCARD);
+	assert(metrics_register_cstr("test_queued", "Things queued.", METRICS_TYPE_GAUGE, &gauge) == 0);
+	assert(gauge != counter);
+	// the same name is the same metric
+	metrics_id again;
+	assert(metrics_register_cstr("test_events_total", "Events seen.", METRICS_TYPE_COUNTER, &again) == 0);
+	assert(again == counter);
+	assert(metrics_register_cstr("test_events_total", "Events seen.", METRICS_TYPE_GAUGE, &again) != 0);
+	assert(again == METRICS_DISCARD);
+	assert(metrics_get(counter) == 0);
+}
+
+void *add_to_metrics(void *data) {
+	for (int i = 0; i < NUM_ADDS; i++) {
+		metrics_add(counter, 1);
+		// queued here and taken off on another thread
+		metrics_add(gauge, 1);
+	}
+	return NULL;
+}
+
+void *take_from_gauge(void *data) {
+	for (int i = 0; i < NUM_ADDS; i++) {
+		metrics_add(gauge, -1);
+	}
+	return NULL;
+}
+
+void threads() {
+	// every thread's shard is summed, and what's left by threads that have exited still counts
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		assert(pthread_create(&threads[i], NULL, add_to_metrics, NULL) == 0);
+	}
+	metrics_add(counter, 5);
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	assert(metrics_get(counter) == NUM_THREADS * NUM_ADDS + 5);
+	assert(metrics_get(gauge) == NUM_THREADS * NUM_ADDS);
+	for (int i = 0; i < NUM_THREADS; i++) {
+		assert(pthread_create(&threads[i], NULL, take_from_gauge, NULL) == 0);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	assert(metrics_get(gauge) == 0);
+	metrics_add(METRICS_DISCARD, 1);
+}
+
+void prometheus() {
+	metrics_id ok, error;
+	assert(metrics_register_cstr("test_responses_total{class=\"2xx\"}", "Responses.", METRICS_TYPE_COUNTER, &ok) == 0);
+	assert(metrics_register_cstr("test_responses_total{class=\"5xx\"}", "Responses.", METRICS_TYPE_COUNTER, &error) == 0);
+	metrics_add(ok, 3);
+	metrics_add(gauge, -2);
+	string output;
+	string_init(&output);
+	metrics_write_prometheus(&output);
+	char *expected = "# HELP test_events_total Events seen.\n"
+					 "# TYPE test_events_total counter\n"
+					 "test_events_total 400005\n"
+					 "# HELP test_queued Things queued.\n"
+					 "# TYPE test_queued gauge\n"
+					 "test_queued -2\n"
+					 "# HELP test_responses_total Responses.\n"
+					 "# TYPE test_responses_total counter\n"
+					 "test_responses_total{class=\"2xx\"} 3\n"
+					 "test_responses_total{class=\"5xx\"} 0\n";
+	assert(!strcmp(string_get_cstr(&output), expected));
+	string_dealloc(&output);
+}
+
+void *record_latencies(void *data) {
+	metrics_id *latency = data;
+	for (int i = 1; i <= 1000; i++) {
+		metrics_record(*latency, i * 1000);
+	}
+	return NULL;
+}
+
+void histograms() {
+	metrics_id latency;
+	assert(metrics_register_cstr("test_latency_seconds{phase=\"parse\"}", "Latency.", METRICS_TYPE_HISTOGRAM, &latency) == 0);
+	assert(latency != METRICS_DISCARD);
+	// one thread still running and one that's exited
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, record_latencies, &latency) == 0);
+	pthread_join(thread, NULL);
+	record_latencies(&latency);
+	histogram h;
+	histogram_init(&h);
+	metrics_get_histogram(latency, &h);
+	assert(histogram_get_count(&h) == 2000 && histogram_get_max(&h) == 1000000);
+	uint64_t p50 = histogram_get_percentile(&h, 50);
+	assert(p50 >= 500000 && p50 <= 500000 + 500000 / 32);
+	// histograms aren't counters, and records to METRICS_DISCARD go nowhere
+	metrics_record(METRICS_DISCARD, 1);
+	metrics_record(counter, 1);
+	assert(metrics_get(counter) == NUM_THREADS * NUM_ADDS + 5);
+
+	string output;
+	string_init(&output);
+	metrics_write_prometheus(&output);
+	char *summary = strstr(string_get_cstr(&output), "# HELP test_latency_seconds Latency.\n"
+															 "# TYPE test_latency_seconds summary\n"
+															 "test_latency_seconds{phase=\"parse\",quantile=\"0.5\"} 0.0005");
+	assert(summary);
+	assert(strstr(summary, "test_latency_seconds{phase=\"parse\",quantile=\"0.999\"} 0.00100"));
+	assert(strstr(summary, "test_latency_seconds_sum{phase=\"parse\"} 1.001000000\n"));
+	assert(strstr(summary, "test_latency_seconds_count{phase=\"parse\"} 2000\n"));
+	string_clear(&output);
+	metrics_write_histograms(&output);
+	assert(!strncmp(string_get_cstr(&output), "test_latency_seconds{phase=\"parse\"} count=2000 p50_us=5", 55));
+	assert(strstr(string_get_cstr(&output), " max_us=1000.000\n"));
+	string_dealloc(&output);
+}
+
+void full() {
+	char name[32];
+	metrics_id id;
+	int i = 0;
+	// a few are taken already
+	for (; i < METRICS_MAX_METRICS; i++) {
+		snprintf(name, sizeof(name), "test_filler_%i", i);
+		if (metrics_register_cstr(name, "Filler.", METRICS_TYPE_COUNTER, &id)) {
+			break;
+		}
+		assert(id != METRICS_DISCARD);
+	}
+	assert(i < METRICS_MAX_METRICS && id == METRICS_DISCARD);
+	// updating a metric that couldn't be registered goes nowhere
+	metrics_add(id, 1);
+	assert(metrics_register_cstr("test_events_total", "Events seen.", METRICS_TYPE_COUNTER, &id) == 0 && id == counter);
+}
+
+int main() {
+	registering();
+	threads();
+	prometheus();
+	histograms();
+	full();
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../shared/perf_counters.h"
+
+static char *labels[] = {"phase=\"first\"", "phase=\"second\""};
+static perf_counters_phase_id phases[2];
+
+// something for the counters to count that the compiler can't take away
+uint64_t work(uint64_t n) {
+	volatile uint64_t total = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		total += i * i;
+	}
+	return total;
+}
+
+void registering() {
+	assert(perf_counters_register_phases_cstr("test_phase", labels, 2, phases) == 0);
+	assert(phases[0] != PERF_COUNTERS_DISCARD && phases[1] != PERF_COUNTERS_DISCARD && phases[0] != phases[1]);
+	// the same names are the same phases
+	perf_counters_phase_id again[2];
+	assert(perf_counters_register_phases_cstr("test_phase", labels, 2, again) == 0);
+	assert(again[0] == phases[0] && again[1] == phases[1]);
+	// each metric's family is together
+	string output;
+	string_init(&output);
+	metrics_write_prometheus(&output);
+	assert(strstr(string_get_cstr(&output), "# TYPE test_phase_cycles_total counter\n"
+											"test_phase_cycles_total{phase=\"first\"} 0\n"
+											"test_phase_cycles_total{phase=\"second\"} 0\n"));
+	string_dealloc(&output);
+}
+
+void disabled() {
+	// nothing's counted before counting is turned on
+	perf_counters_sample start, end;
+	perf_counters_read(&start);
+	work(1000);
+	perf_counters_read(&end);
+	perf_counters_add(phases[0], &start, &end);
+	uint64_t count;
+	perf_counters_sample totals;
+	perf_counters_get(phases[0], &count, &totals);
+	assert(count == 0 && totals.values[PERF_COUNTERS_CYCLES] == 0);
+	string output;
+	string_init(&output);
+	perf_counters_write(&output);
+	assert(string_get_length(&output) == 0);
+	string_dealloc(&output);
+}
+
+void *count_on_thread(void *data) {
+	perf_counters_sample start, end;
+	perf_counters_read(&start);
+	work(100000);
+	perf_counters_read(&end);
+	perf_counters_add(phases[1], &start, &end);
+	return NULL;
+}
+
+void enabled() {
+	if (perf_counters_enable()) {
+		// in a container or a VM without a PMU, where all that matters is that nothing breaks
+		printf("hardware performance counters aren't available, only checking they stay off\n");
+		assert(!perf_counters_is_enabled());
+		disabled();
+		return;
+	}
+	assert(perf_counters_is_enabled());
+	perf_counters_sample start, end;
+	perf_counters_read(&start);
+	work(100000);
+	perf_counters_read(&end);
+	uint64_t counted = 0;
+	for (int i = 0; i < PERF_COUNTERS_NUM_COUNTERS; i++) {
+		assert(end.values[i] >= start.values[i]);
+		counted += end.values[i] - start.values[i];
+	}
+	assert(counted > 0);
+	perf_counters_add(phases[0], &start, &end);
+
+	// each thread counts itself
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, count_on_thread, NULL) == 0);
+	pthread_join(thread, NULL);
+	uint64_t count;
+	perf_counters_sample totals;
+	perf_counters_get(phases[1], &count, &totals);
+	assert(count == 1);
+	perf_counters_get(phases[0], &count, &totals);
+	assert(count == 1);
+	perf_counters_get(PERF_COUNTERS_DISCARD, &count, &totals);
+	assert(count == 0);
+
+	string output;
+	string_init(&output);
+	perf_counters_write(&output);
+	assert(!strncmp(string_get_cstr(&output), "test_phase{phase=\"first\"} count=1 cycles=", 41));
+	assert(strstr(string_get_cstr(&output), "\ntest_phase{phase=\"second\"} count=1 "));
+	string_dealloc(&output);
+}
+
+int main() {
+	registering();
+	disabled();
+	enabled();
+	return 0;
+}
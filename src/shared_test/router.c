@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "../shared/router.h"
+
+int route_a(void *data, http_request *request, http_response *response, router_match *match) {
+	return 0;
+}
+
+int route_b(void *data, http_request *request, http_response *response, router_match *match) {
+	return 0;
+}
+
+int route_echo(void *data, http_request *request, http_response *response, router_match *match) {
+	*((int *)data) += 1;
+	router_param *param = router_match_get_param_cstr(match, "name");
+	if (!param) {
+		return 1;
+	}
+	stream_write(http_response_get_body(response), param->value, param->value_len, NULL);
+	return 0;
+}
+
+void assert_match(router *r, char *method, char *path, char *expected_pattern, size_t expected_num_params, ...) {
+	router_match match;
+	assert(router_match_cstr_len(r, method, strlen(method), path, strlen(path), &match) == ROUTER_MATCH_SUCCESS);
+	assert(string_compare_cstr(&match.route->pattern, expected_pattern, STRING_COMPARE_CASE_SENSITIVE) == 0);
+	assert(match.num_params == expected_num_params);
+	va_list args;
+	va_start(args, expected_num_params);
+	for (size_t i = 0; i < expected_num_params; i++) {
+		char *expected_name = va_arg(args, char *);
+		char *expected_value = va_arg(args, char *);
+		router_param *param = router_match_get_param_cstr(&match, expected_name);
+		assert(param == &match.params[i]);
+		assert(param->value_len == strlen(expected_value));
+		assert(!memcmp(param->value, expected_value, param->value_len));
+		// values are slices of the input, not copies
+		assert(param->value >= path && param->value + param->value_len <= path + strlen(path));
+	}
+	va_end(args);
+}
+
+void assert_no_match(router *r, char *method, char *path, router_match_result expected) {
+	router_match match;
+	assert(router_match_cstr_len(r, method, strlen(method), path, strlen(path), &match) == expected);
+	assert(match.num_params == 0);
+}
+
+void exact() {
+	router r;
+	router_init(&r);
+	assert(router_add_cstr(&r, "GET", "/", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/foo", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/foobar", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/fob", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "POST", "/foo", route_b, NULL) == 0);
+	assert(router_add_cstr(&r, NULL, "/any", route_b, NULL) == 0);
+
+	assert_match(&r, "GET", "/", "/", 0);
+	assert_match(&r, "GET", "/foo", "/foo", 0);
+	assert_match(&r, "POST", "/foo", "/foo", 0);
+	assert_match(&r, "GET", "/foobar", "/foobar", 0);
+	assert_match(&r, "GET", "/fob", "/fob", 0);
+	assert_match(&r, "GET", "/any", "/any", 0);
+	assert_match(&r, "DELETE", "/any", "/any", 0);
+
+	assert_no_match(&r, "GET", "", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/fo", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/foob", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/foo/", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/foobarbaz", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "DELETE", "/foo", ROUTER_MATCH_METHOD_NOT_ALLOWED);
+	assert_no_match(&r, "get", "/foo", ROUTER_MATCH_METHOD_NOT_ALLOWED);
+
+	// duplicates are rejected, but the same pattern with a different method is fine
+	assert(router_add_cstr(&r, "GET", "/foo", route_b, NULL) != 0);
+	assert(router_add_cstr(&r, NULL, "/any", route_b, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/any", route_a, NULL) == 0);
+	router_match match;
+	assert(router_match_cstr_len(&r, "GET", 3, "/any", 4, &match) == ROUTER_MATCH_SUCCESS);
+	assert(match.route->callback == route_a);
+	assert(router_match_cstr_len(&r, "PUT", 3, "/any", 4, &match) == ROUTER_MATCH_SUCCESS);
+	assert(match.route->callback == route_b);
+
+	router_dealloc(&r);
+}
+
+void params() {
+	router r;
+	router_init(&r);
+	assert(router_add_cstr(&r, "GET", "/users/:id", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/users/new", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/users/:user/posts/:post", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/users/:user/posts", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/a/:x/c", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/a/b/d", route_a, NULL) == 0);
+
+	assert_match(&r, "GET", "/users/42", "/users/:id", 1, "id", "42");
+	assert_match(&r, "GET", "/users/new", "/users/new", 0);
+	assert_match(&r, "GET", "/users/newer", "/users/:id", 1, "id", "newer");
+	assert_match(&r, "GET", "/users/bob/posts", "/users/:user/posts", 1, "user", "bob");
+	assert_match(&r, "GET", "/users/bob/posts/7", "/users/:user/posts/:post", 2, "user", "bob", "post", "7");
+	// static "b" branch fails further down, so this has to back up and try the parameter
+	assert_match(&r, "GET", "/a/b/c", "/a/:x/c", 1, "x", "b");
+	assert_match(&r, "GET", "/a/b/d", "/a/b/d", 0);
+
+	assert_no_match(&r, "GET", "/users/", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/users/42/", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/users/bob/posts/", ROUTER_MATCH_NOT_FOUND);
+	assert_no_match(&r, "GET", "/a/b/e", ROUTER_MATCH_NOT_FOUND);
+
+	router_dealloc(&r);
+}
+
+void wildcards() {
+	router r;
+	router_init(&r);
+	assert(router_add_cstr(&r, "GET", "/static/*path", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/static/index.html", route_b, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/files/:dir/*", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, NULL, "/*", route_b, NULL) == 0);
+
+	assert_match(&r, "GET", "/static/index.html", "/static/index.html", 0);
+	assert_match(&r, "GET", "/static/css/site.css", "/static/*path", 1, "path", "css/site.css");
+	assert_match(&r, "GET", "/static/", "/static/*path", 1, "path", "");
+	assert_match(&r, "GET", "/files/docs/a/b/c", "/files/:dir/*", 2, "dir", "docs", "", "a/b/c");
+	assert_match(&r, "GET", "/something/else", "/*", 1, "", "something/else");
+	assert_match(&r, "GET", "/static", "/*", 1, "", "static");
+	assert_match(&r, "PATCH", "/static/index.html", "/*", 1, "", "static/index.html");
+
+	router_dealloc(&r);
+}
+
+size_t count_nodes(router_node *node) {
+	size_t count = 1;
+	for (size_t i = 0; i < node->static_children_len; i++) {
+		count += count_nodes(node->static_children[i]);
+	}
+	count += node->param_child ? count_nodes(node->param_child) : 0;
+	count += node->wildcard_child ? count_nodes(node->wildcard_child) : 0;
+	return count;
+}
+
+void malformed() {
+	router r;
+	router_init(&r);
+	assert(router_add_cstr(&r, "GET", "", route_a, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/foo", NULL, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/users/:", route_a, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/users/:id*rest", route_a, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/users/:a:b", route_a, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/static/*path/more", route_a, NULL) != 0);
+	// a pattern that's rejected part way through leaves nothing behind for matching to walk
+	assert(count_nodes(&r.root) == 1);
+	assert(router_add_cstr(&r, "GET", "/users/:id", route_a, NULL) == 0);
+	size_t num_nodes = count_nodes(&r.root);
+	assert(router_add_cstr(&r, "GET", "/users/:id/posts/*rest/more", route_a, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/use", route_b, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/use", route_b, NULL) != 0);
+	assert(router_add_cstr(&r, "GET", "/users/:id", route_b, NULL) != 0);
+	// only "/use" splitting "/users/" adds a node
+	assert(count_nodes(&r.root) == num_nodes + 1);
+	assert(router_add_cstr(&r, "GET", "/:a/:b/:c/:d/:e/:f/:g/:h/:i/:j/:k/:l/:m/:n/:o/:p", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "GET", "/:a/:b/:c/:d/:e/:f/:g/:h/:i/:j/:k/:l/:m/:n/:o/:p/:q", route_a, NULL) != 0);
+	router_dealloc(&r);
+}
+
+void handle_request() {
+	router r;
+	router_init(&r);
+	int calls = 0;
+	assert(router_add_cstr(&r, "GET", "/hello/:name", route_echo, &calls) == 0);
+	assert(router_add_cstr(&r, "PUT", "/hello/:name", route_echo, &calls) == 0);
+	assert(router_add_cstr(&r, "PUT", "/hello/world", route_a, NULL) == 0);
+	assert(router_add_cstr(&r, "DELETE", "/hello/*rest", route_a, NULL) == 0);
+
+	http_request request;
+	http_response response;
+	http_request_init(&request);
+	http_response_init(&response);
+
+	string_set_cstr(http_request_get_method(&request), "GET");
+	string_set_cstr(http_request_get_uri(&request), "/hello/world?foo=bar#baz");
+	assert(router_handle_request(&r, &request, &response) == 0);
+	assert(calls == 1);
+	assert(http_response_get_status_code(&response) == 200);
+	assert(buffer_get_length(&response.body_buffer) == 5);
+	assert(!memcmp(response.body_buffer.data, "world", 5));
+
+	http_response_clear(&response);
+	string_set_cstr(http_request_get_method(&request), "POST");
+	assert(router_handle_request(&r, &request, &response) == 0);
+	assert(calls == 1);
+	assert(http_response_get_status_code(&response) == 405);
+	// every route the path matches, each method once
+	http_header *allow = http_headers_get_cstr(http_response_get_headers(&response), "Allow", 0);
+	assert(allow && http_header_get_num_values(allow) == 3);
+	assert(!string_compare_cstr(http_header_get_value(allow, 0), "PUT", STRING_COMPARE_CASE_SENSITIVE));
+	assert(!string_compare_cstr(http_header_get_value(allow, 1), "GET", STRING_COMPARE_CASE_SENSITIVE));
+	assert(!string_compare_cstr(http_header_get_value(allow, 2), "DELETE", STRING_COMPARE_CASE_SENSITIVE));
+
+	http_response_clear(&response);
+	string_set_cstr(http_request_get_uri(&request), "/goodbye/world");
+	assert(router_handle_request(&r, &request, &response) == 0);
+	assert(calls == 1);
+	assert(http_response_get_status_code(&response) == 404);
+
+	http_request_dealloc(&request);
+	http_response_dealloc(&response);
+	router_dealloc(&r);
+}
+
+int main() {
+	exact();
+	params();
+	wildcards();
+	malformed();
+	handle_request();
+	return 0;
+}
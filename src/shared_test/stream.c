@@ -252,6 +252,14 @@ void write_cstrf() {
 
 	assert(stream_write_cstrf(&dst, NULL, "foo %i bar %s", 42, "baz") == 14);
 	assert(memcmp(dst_buf.data, "foo 42 bar baz", 14) == 0);
+	// a shorter write after a longer one reuses the scratch space
+	assert(stream_write_cstrf(&dst, NULL, "%c", 'x') == 1);
+	assert(memcmp(dst_buf.data, "foo 42 bar bazx", 15) == 0);
+	// more than the scratch space is kept for
+	assert(stream_write_cstrf(&dst, NULL, "%100000s", "y") == 100000);
+	assert(buffer_get_length(&dst_buf) == 100015 && dst_buf.data[100014] == 'y' && dst_buf.data[100013] == ' ');
+	assert(stream_write_cstrf(&dst, NULL, "%s", "z") == 1);
+	assert(buffer_get_length(&dst_buf) == 100016 && dst_buf.data[100015] == 'z');
 
 	stream_dealloc(&dst, NULL);
 }
@@ -47,6 +47,16 @@ int main() {
 	string_append_cstrf(&s, " foo-%d-bar %s", 42, "Hello, World!");
 
 	assert(!strcmp(string_get_cstr(&s), "abcd foo-42-bar Hello, World!"));
+	// fits in the spare capacity left behind by clearing
+	string_clear(&s);
+	string_append_cstrf(&s, "%s-%d", "ab", 1);
+	assert(!strcmp(string_get_cstr(&s), "ab-1"));
+	// doesn't fit, so it's formatted again after growing
+	string_append_cstrf(&s, "%64s|", "c");
+	assert(string_get_length(&s) == 69 && s.b.data[67] == 'c' && !strcmp(string_get_cstr(&s) + 67, "c|"));
+	assert(!strncmp(string_get_cstr(&s), "ab-1     ", 9));
+	string_set_cstrf(&s, "%s", "");
+	assert(string_get_length(&s) == 0 && !strcmp(string_get_cstr(&s), ""));
 
 	string_clear(&s);
 	string_append_cstr(&s, "foo %d %zu %s");
@@ -345,5 +355,79 @@ int main() {
 	string_dealloc(&s);
 	string_dealloc(&s2);
 
+	string_init(&s);
+	string_set_uint64(&s, 0);
+	assert(!strcmp(string_get_cstr(&s), "0"));
+	string_set_uint64(&s, 7);
+	assert(!strcmp(string_get_cstr(&s), "7"));
+	string_set_uint64(&s, 10);
+	assert(!strcmp(string_get_cstr(&s), "10"));
+	string_set_uint64(&s, 1234567);
+	assert(!strcmp(string_get_cstr(&s), "1234567"));
+	string_set_uint64(&s, UINT64_MAX);
+	assert(!strcmp(string_get_cstr(&s), "18446744073709551615"));
+	string_set_int64(&s, -42);
+	assert(!strcmp(string_get_cstr(&s), "-42"));
+	string_set_int64(&s, INT64_MIN);
+	assert(!strcmp(string_get_cstr(&s), "-9223372036854775808"));
+	string_set_cstr(&s, "abc");
+	string_append_uint64(&s, 100);
+	string_append_int64(&s, -5);
+	assert(!strcmp(string_get_cstr(&s), "abc100-5"));
+	char hex[16];
+	char *hex_end = hex + sizeof(hex);
+	char *hex_start = string_format_hex_uint64(hex_end, 0);
+	assert(hex_end - hex_start == 1 && !memcmp(hex_start, "0", 1));
+	hex_start = string_format_hex_uint64(hex_end, 0x1f2e);
+	assert(hex_end - hex_start == 4 && !memcmp(hex_start, "1f2e", 4));
+	hex_start = string_format_hex_uint64(hex_end, UINT64_MAX);
+	assert(hex_end - hex_start == 16 && !memcmp(hex_start, "ffffffffffffffff", 16));
+
+	uint64_t u;
+	int64_t i;
+	string_set_cstr(&s, "0");
+	assert(string_parse_uint64(&s, &u) == 0 && u == 0);
+	string_set_cstr(&s, "000123");
+	assert(string_parse_uint64(&s, &u) == 0 && u == 123);
+	string_set_cstr(&s, "18446744073709551615");
+	assert(string_parse_uint64(&s, &u) == 0 && u == UINT64_MAX);
+	string_set_cstr(&s, "00000000000000000000000000042");
+	assert(string_parse_uint64(&s, &u) == 0 && u == 42);
+	u = 99;
+	string_set_cstr(&s, "18446744073709551616");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "99999999999999999999");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, " 1");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "1 ");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "+1");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "-1");
+	assert(string_parse_uint64(&s, &u) != 0);
+	string_set_cstr(&s, "12a");
+	assert(string_parse_uint64(&s, &u) != 0);
+	// failures leave the destination alone
+	assert(u == 99);
+	assert(string_parse_uint64_cstr_len("12345", 3, &u) == 0 && u == 123);
+	string_set_cstr(&s, "-9223372036854775808");
+	assert(string_parse_int64(&s, &i) == 0 && i == INT64_MIN);
+	string_set_cstr(&s, "9223372036854775807");
+	assert(string_parse_int64(&s, &i) == 0 && i == INT64_MAX);
+	string_set_cstr(&s, "-17");
+	assert(string_parse_int64(&s, &i) == 0 && i == -17);
+	string_set_cstr(&s, "9223372036854775808");
+	assert(string_parse_int64(&s, &i) != 0);
+	string_set_cstr(&s, "-9223372036854775809");
+	assert(string_parse_int64(&s, &i) != 0);
+	string_set_cstr(&s, "-");
+	assert(string_parse_int64(&s, &i) != 0);
+	string_set_cstr(&s, "--1");
+	assert(string_parse_int64(&s, &i) != 0);
+	string_dealloc(&s);
+
 	return 0;
 }
\ No newline at end of file
@@ -11,9 +11,28 @@ The data sent is prefixed with a 2-byte length.
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+typedef struct {
+	// always 42, checked by socket_accept
+	int value;
+	// optional, the options the socket was set up with, to check they were applied to each accepted socket
+	tcp_socket_wrapper_options *options;
+	// SO_BUSY_POLL can be compiled out of the kernel
+	int busy_poll_available;
+	int num_checked;
+} accept_data;
+
+int get_option(int socket, int level, int option) {
+	int value = 0;
+	socklen_t value_len = sizeof(value);
+	assert(getsockopt(socket, level, option, &value, &value_len) == 0);
+	return value;
+}
+
 void get_sockaddr_info_4(uint32_t actual_addr, uint16_t actual_port, char *expected_addr, uint16_t expected_port) {
 	struct sockaddr saddr;
 	((struct sockaddr_in *)&saddr)->sin_family = AF_INET;
@@ -29,14 +48,15 @@ void get_sockaddr_info_4(uint32_t actual_addr, uint16_t actual_port, char *expec
 }
 
 void get_sockaddr_info_6(uint8_t actual_addr[16], uint16_t actual_port, char *expected_addr, uint16_t expected_port) {
-	struct sockaddr saddr;
-	((struct sockaddr_in6 *)&saddr)->sin6_family = AF_INET6;
-	memcpy(&((struct sockaddr_in6 *)&saddr)->sin6_addr, actual_addr, 16);
-	((struct sockaddr_in6 *)&saddr)->sin6_port = actual_port;
+	// a plain sockaddr isn't big enough for an IPv6 address
+	struct sockaddr_in6 saddr;
+	saddr.sin6_family = AF_INET6;
+	memcpy(&saddr.sin6_addr, actual_addr, 16);
+	saddr.sin6_port = actual_port;
 	string addr;
 	string_init(&addr);
 	uint16_t port;
-	assert(get_sockaddr_info_str(&saddr, &addr, &port) == 0);
+	assert(get_sockaddr_info_str((struct sockaddr *)&saddr, &addr, &port) == 0);
 	assert(string_compare_cstr(&addr, expected_addr, STRING_COMPARE_CASE_SENSITIVE) == 0);
 	assert(port == expected_port);
 	string_dealloc(&addr);
@@ -53,7 +73,17 @@ void hostname_and_address() {
 }
 
 void socket_accept(void *data, string *address, uint16_t port, int socket) {
-	assert(*((int *)data) == 42);
+	accept_data *d = data;
+	assert(d->value == 42);
+	if (d->options) {
+		// failures to set these are only logged, so read them back
+		assert(get_option(socket, IPPROTO_TCP, TCP_NODELAY) == d->options->no_delay);
+		if (d->busy_poll_available) {
+			assert(get_option(socket, SOL_SOCKET, SO_BUSY_POLL) == d->options->busy_poll_microseconds);
+		}
+		// TCP_QUICKACK isn't checked, the kernel leaves quick ack mode again on its own so reading it back says nothing
+		d->num_checked++;
+	}
 
 	// read the length header
 	uint16_t len;
@@ -116,7 +146,7 @@ void socket_accept(void *data, string *address, uint16_t port, int socket) {
 	close(socket);
 }
 
-int send_test_data() {
+int send_test_data(uint16_t port) {
 	uint16_t test_data_len = rand() % 1000 + 1000;
 	log_trace("generating %i bytes of test data\n", (int)test_data_len);
 	uint8_t *test_data = malloc(test_data_len);
@@ -136,7 +166,7 @@ int send_test_data() {
 	struct sockaddr_in addr;
 	addr.sin_family = AF_INET;
 	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-	addr.sin_port = htons(8000);
+	addr.sin_port = htons(port);
 	if (connect(s, (struct sockaddr *)&addr, sizeof(addr))) {
 		log_error("error connecting client socket, %s\n", strerror(errno));
 		free(test_data);
@@ -208,11 +238,49 @@ int send_test_data() {
 	return 0;
 }
 
-void do_socket_test(char *address, uint16_t port) {
-	int data = 42;
+void do_socket_test(char *address, uint16_t port, tcp_socket_wrapper_options *options) {
+	accept_data data = {42, NULL, 0, 0};
+	tcp_socket_wrapper sock_wrap;
+	assert(tcp_socket_wrapper_init(&sock_wrap, address, port, options, socket_accept, &data) == 0);
+	if (port != 0) {
+		assert(tcp_socket_wrapper_get_port(&sock_wrap) == port);
+	} else {
+		assert(tcp_socket_wrapper_get_port(&sock_wrap) != 0);
+	}
+	assert(send_test_data(tcp_socket_wrapper_get_port(&sock_wrap)) == 0);
+	assert(tcp_socket_wrapper_dealloc(&sock_wrap) == 0);
+}
+
+void socket_options() {
+	tcp_socket_wrapper_options options;
+	tcp_socket_wrapper_options_init(&options);
+	options.no_delay = 1;
+	options.quick_ack = 1;
+	options.defer_accept_seconds = 1;
+	options.fast_open_queue_length = 16;
+	// under the default rmem_max and wmem_max, so they aren't capped
+	options.receive_buffer_size = 96 * 1024;
+	options.send_buffer_size = 96 * 1024;
+	options.busy_poll_microseconds = 50;
+	accept_data data = {42, &options, 0, 0};
+	int probe = socket(AF_INET, SOCK_STREAM, 0);
+	data.busy_poll_available = !setsockopt(probe, SOL_SOCKET, SO_BUSY_POLL, &options.busy_poll_microseconds, sizeof(int));
+	close(probe);
+	if (!data.busy_poll_available) {
+		printf("SO_BUSY_POLL isn't available, %s, not checking it\n", strerror(errno));
+	}
+
 	tcp_socket_wrapper sock_wrap;
-	assert(tcp_socket_wrapper_init(&sock_wrap, address, port, socket_accept, &data) == 0);
-	assert(send_test_data() == 0);
+	assert(tcp_socket_wrapper_init(&sock_wrap, "127.0.0.1", 0, &options, socket_accept, &data) == 0);
+	int listener = tcp_socket_wrapper_get_socket(&sock_wrap);
+	// Linux doubles the buffer sizes to leave room for its own bookkeeping
+	assert(get_option(listener, SOL_SOCKET, SO_RCVBUF) == 2 * 96 * 1024);
+	assert(get_option(listener, SOL_SOCKET, SO_SNDBUF) == 2 * 96 * 1024);
+	assert(get_option(listener, IPPROTO_TCP, TCP_DEFER_ACCEPT) == 1);
+	assert(get_option(listener, IPPROTO_TCP, TCP_FASTOPEN) == 16);
+	assert(send_test_data(tcp_socket_wrapper_get_port(&sock_wrap)) == 0);
+	// the response is only sent once the accepted socket's been checked
+	assert(data.num_checked == 1);
 	assert(tcp_socket_wrapper_dealloc(&sock_wrap) == 0);
 }
 
@@ -231,11 +299,19 @@ int main() {
 
 	hostname_and_address();
 
-	do_socket_test(NULL, 8000);
-	do_socket_test("0.0.0.0", 8000);
-	do_socket_test("127.0.0.1", 8000);
-	do_socket_test("::", 8000);
-	// do_socket_test("::1", 8000);
+	do_socket_test(NULL, 8000, NULL);
+	do_socket_test("0.0.0.0", 8000, NULL);
+	do_socket_test("127.0.0.1", 8000, NULL);
+	do_socket_test("::", 8000, NULL);
+	// do_socket_test("::1", 8000, NULL);
+	do_socket_test("127.0.0.1", 0, NULL);
+
+	tcp_socket_wrapper_options options;
+	tcp_socket_wrapper_options_init(&options);
+	options.backlog = 1;
+	do_socket_test("0.0.0.0", 0, &options);
+
+	socket_options();
 
 	return 0;
 }
\ No newline at end of file
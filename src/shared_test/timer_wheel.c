@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include "../shared/timer_wheel.h"
+
+#define NUM_TIMERS 1000
+#define TICK_NS 1000
+
+typedef struct {
+	timer_wheel_timer timer;
+	uint64_t deadline_ns;
+	int fired;
+} test_timer;
+
+// the time the wheel is being advanced to, and the time it was last advanced to
+static uint64_t now_ns;
+static uint64_t previous_ns;
+static int num_fired;
+
+void test_timer_fired(void *data) {
+	test_timer *timer = data;
+	// never early, and never later than the first advance past the deadline rounded up to a tick
+	assert(now_ns >= timer->deadline_ns);
+	assert(previous_ns / TICK_NS < (timer->deadline_ns + TICK_NS - 1) / TICK_NS);
+	timer->fired++;
+	num_fired++;
+}
+
+void count_fired(void *data) {
+	(*(int *)data)++;
+}
+
+void simple() {
+	timer_wheel wheel;
+	assert(timer_wheel_init(&wheel, 0, 0) != 0);
+	assert(timer_wheel_init(&wheel, TICK_NS, 5000) == 0);
+	assert(timer_wheel_get_next_deadline_ns(&wheel) == UINT64_MAX);
+
+	test_timer a, b, never;
+	timer_wheel_timer_init(&a.timer, test_timer_fired, &a);
+	timer_wheel_timer_init(&b.timer, test_timer_fired, &b);
+	timer_wheel_timer_init(&never.timer, test_timer_fired, &never);
+	a.fired = b.fired = never.fired = 0;
+	a.deadline_ns = 5000 + 10000;
+	b.deadline_ns = 5000 + 1000000;
+	never.deadline_ns = UINT64_MAX;
+	timer_wheel_schedule(&wheel, &a.timer, a.deadline_ns);
+	timer_wheel_schedule(&wheel, &b.timer, b.deadline_ns);
+	timer_wheel_schedule(&wheel, &never.timer, never.deadline_ns);
+	assert(timer_wheel_get_num_timers(&wheel) == 3);
+	assert(timer_wheel_timer_is_pending(&a.timer));
+	assert(timer_wheel_get_next_deadline_ns(&wheel) == a.deadline_ns);
+
+	previous_ns = 5000;
+	now_ns = 14999;
+	assert(timer_wheel_advance(&wheel, now_ns) == 0);
+	now_ns = 15000;
+	assert(timer_wheel_advance(&wheel, now_ns) == 1);
+	assert(a.fired == 1 && !timer_wheel_timer_is_pending(&a.timer));
+	// b is on a higher level, the wheel has to come back to move it down before it's due
+	assert(timer_wheel_get_next_deadline_ns(&wheel) <= b.deadline_ns);
+
+	// rescheduling moves it
+	timer_wheel_schedule(&wheel, &b.timer, 20000);
+	b.deadline_ns = 20000;
+	assert(timer_wheel_get_num_timers(&wheel) == 2);
+	timer_wheel_cancel(&wheel, &never.timer);
+	timer_wheel_cancel(&wheel, &never.timer);
+	assert(timer_wheel_get_num_timers(&wheel) == 1);
+	previous_ns = now_ns;
+	now_ns = 1000000000;
+	assert(timer_wheel_advance(&wheel, now_ns) == 1);
+	assert(b.fired == 1);
+	assert(never.fired == 0);
+	assert(timer_wheel_get_next_deadline_ns(&wheel) == UINT64_MAX);
+
+	// deadlines in the past are due at the next tick
+	int past_fired = 0;
+	timer_wheel_timer past;
+	timer_wheel_timer_init(&past, count_fired, &past_fired);
+	timer_wheel_schedule(&wheel, &past, 0);
+	assert(timer_wheel_get_next_deadline_ns(&wheel) <= now_ns + TICK_NS);
+	assert(timer_wheel_advance(&wheel, now_ns + TICK_NS) == 1);
+	assert(past_fired == 1);
+	timer_wheel_dealloc(&wheel);
+}
+
+// compares against the deadlines directly with timers spread over every level and the wheel advanced by random amounts
+void random_timers() {
+	timer_wheel wheel;
+	assert(timer_wheel_init(&wheel, TICK_NS, 0) == 0);
+	test_timer *timers = malloc(sizeof(test_timer) * NUM_TIMERS);
+	int num_cancelled = 0;
+	now_ns = 0;
+	previous_ns = 0;
+	num_fired = 0;
+	for (int i = 0; i < NUM_TIMERS; i++) {
+		timer_wheel_timer_init(&timers[i].timer, test_timer_fired, &timers[i]);
+		timers[i].fired = 0;
+		// anywhere from under a tick up to about 4 levels up
+		int bits = rand() % 30;
+		timers[i].deadline_ns = 1 + (((uint64_t)rand() << 31 | rand()) & ((1ull << bits) - 1));
+		timer_wheel_schedule(&wheel, &timers[i].timer, timers[i].deadline_ns);
+	}
+	for (int i = 0; i < NUM_TIMERS; i += 7) {
+		timer_wheel_cancel(&wheel, &timers[i].timer);
+		num_cancelled++;
+	}
+	assert(timer_wheel_get_num_timers(&wheel) == NUM_TIMERS - num_cancelled);
+
+	while (timer_wheel_get_num_timers(&wheel) > 0) {
+		uint64_t next_deadline_ns = timer_wheel_get_next_deadline_ns(&wheel);
+		assert(next_deadline_ns > now_ns);
+		previous_ns = now_ns;
+		// either exactly what the wheel asked for, or some random amount that may overshoot it
+		if (rand() % 2) {
+			now_ns = next_deadline_ns;
+		} else {
+			now_ns += rand() % 100000;
+		}
+		timer_wheel_advance(&wheel, now_ns);
+	}
+	assert(num_fired == NUM_TIMERS - num_cancelled);
+	for (int i = 0; i < NUM_TIMERS; i++) {
+		assert(timers[i].fired == (i % 7 != 0));
+	}
+	free(timers);
+	timer_wheel_dealloc(&wheel);
+}
+
+int main() {
+	simple();
+	random_timers();
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "../shared/json.h"
+#include "../shared/trace.h"
+
+#define NUM_WRITES 200000
+
+typedef struct {
+	size_t num_events;
+	// complete events, and async begin and end events
+	size_t num_complete;
+	size_t num_begin;
+	size_t num_end;
+	// set if any event has a span that ends before it starts or a name nothing recorded
+	int invalid;
+} trace_summary;
+
+/*
+Writes the trace and reads it back, only counting events for request_id, or for every request if it's 0.
+*/
+void summarize(uint64_t request_id, trace_summary *summary) {
+	memset(summary, 0, sizeof(trace_summary));
+	buffer output;
+	buffer_init(&output);
+	stream s;
+	stream_init_buffer(&s, &output, 0);
+	assert(trace_write_chrome(&s, NULL) == 0);
+
+	json_document doc;
+	json_document_init(&doc);
+	json_value root, events, event, value;
+	json_iterator it;
+	assert(json_document_parse(&doc, (char *)output.data, buffer_get_length(&output)) == 0);
+	assert(json_document_get_root(&doc, &root) == 0);
+	assert(json_value_object_get_cstr(&root, "traceEvents", &events) == 0);
+	assert(json_value_iterate(&events, &it) == 0);
+	while (json_iterator_next(&it, NULL, &event) > 0) {
+		int64_t id;
+		assert(json_value_object_get_cstr(&event, "args", &value) == 0);
+		assert(json_value_object_get_cstr(&value, "request_id", &value) == 0 && json_value_get_int64(&value, &id) == 0);
+		if (request_id && (uint64_t)id != request_id) {
+			continue;
+		}
+		summary->num_events++;
+		char *name, *phase;
+		size_t name_len, phase_len;
+		assert(json_value_object_get_cstr(&event, "name", &value) == 0 && json_value_get_cstr_len(&value, &name, &name_len) == 0);
+		assert(json_value_object_get_cstr(&event, "ph", &value) == 0 && json_value_get_cstr_len(&value, &phase, &phase_len) == 0);
+		if (name_len != 4 || (memcmp(name, "task", 4) && memcmp(name, "wait", 4))) {
+			summary->invalid = 1;
+		}
+		if (*phase == 'X') {
+			double duration;
+			assert(json_value_object_get_cstr(&event, "dur", &value) == 0 && json_value_get_double(&value, &duration) == 0);
+			// every span here is a few microseconds at most, a torn one would be way off
+			summary->invalid |= duration < 0 || duration > 10;
+			summary->num_complete++;
+		} else {
+			assert(json_value_object_get_cstr(&event, "id", &value) == 0);
+			summary->num_begin += *phase == 'b';
+			summary->num_end += *phase == 'e';
+		}
+	}
+	json_document_dealloc(&doc);
+	buffer_dealloc(&output);
+}
+
+void sampling() {
+	trace_set_sample(0);
+	for (int i = 0; i < 100; i++) {
+		assert(trace_sample() == 0);
+	}
+	trace_set_sample(1);
+	uint64_t first = trace_sample();
+	assert(first != 0 && trace_sample() == first + 1);
+	trace_set_sample(4);
+	int sampled = 0;
+	for (int i = 0; i < 100; i++) {
+		sampled += trace_sample() != 0;
+	}
+	assert(sampled == 25);
+	trace_set_sample(0);
+}
+
+void recording() {
+	trace_summary summary;
+	// request 0 isn't traced
+	trace_record(0, "task", 1, 2);
+	summarize(0, &summary);
+	assert(summary.num_events == 0);
+
+	trace_record(5, "task", 1000, 3000);
+	trace_record_wait(5, "wait", 500, 1000);
+	trace_record(6, "task", 4000, 5000);
+	summarize(5, &summary);
+	// a wait is a pair of async events
+	assert(summary.num_events == 3 && summary.num_complete == 1 && summary.num_begin == 1 && summary.num_end == 1 && !summary.invalid);
+	summarize(0, &summary);
+	assert(summary.num_events == 4);
+}
+
+void wrapping() {
+	trace_clear();
+	trace_summary summary;
+	summarize(0, &summary);
+	assert(summary.num_events == 0);
+	// only the latest are kept
+	uint64_t start_ns = (uint64_t)1 << 62;
+	for (uint64_t i = 0; i < TRACE_RING_SIZE + 10; i++) {
+		trace_record(7 + i / TRACE_RING_SIZE, "task", start_ns + i, start_ns + i + 1);
+	}
+	summarize(7, &summary);
+	assert(summary.num_events == TRACE_RING_SIZE - 10);
+	summarize(8, &summary);
+	assert(summary.num_events == 10);
+}
+
+void *write_spans(void *data) {
+	for (uint64_t i = 0; i < NUM_WRITES; i++) {
+		// each span's end is after its start, a torn span would likely have one from another
+		trace_record(9, "task", ((uint64_t)1 << 62) + i * 2, ((uint64_t)1 << 62) + i * 2 + 1);
+	}
+	return NULL;
+}
+
+void concurrent() {
+	// the rings are read while they're being written, and spans being overwritten are skipped rather than torn
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, write_spans, NULL) == 0);
+	trace_summary summary;
+	for (int i = 0; i < 20; i++) {
+		summarize(0, &summary);
+		assert(!summary.invalid);
+	}
+	pthread_join(thread, NULL);
+	// the thread's ring is gone with it
+	summarize(9, &summary);
+	assert(summary.num_events == 0);
+}
+
+int main() {
+	sampling();
+	recording();
+	wrapping();
+	concurrent();
+	return 0;
+}
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE
+
 #include <assert.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -87,6 +90,11 @@ void test_enqueue_failures(worker_thread_pool *pool, int expected_len, task_data
 	for (int i = 0; i < success_count; i++) {
 		sem_wait(&semaphore);
 	}
+	// tasks nobody waits on still go back on the pool once they finish
+	usleep(100000);
+	pthread_mutex_lock(&pool->tasks_mutex);
+	assert(pool->task_pool_len > 0);
+	pthread_mutex_unlock(&pool->tasks_mutex);
 	for (int i = 0; i < expected_len; i++) {
 		if (tests_that_should_finish[i]) {
 			assert(td[i].result == expected[i].result);
@@ -147,6 +155,16 @@ int main(int argc, char **argv) {
 	if (worker_thread_pool_init(&pool, 2, 10)) {
 		return 1;
 	}
+	// any cpu this process is allowed on, which in a restricted cpuset may not include cpu 0
+	cpu_set_t allowed;
+	assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+	int cpus[] = {0};
+	while (!CPU_ISSET(cpus[0], &allowed)) {
+		cpus[0]++;
+	}
+	assert(worker_thread_pool_set_cpu_affinity(&pool, cpus, 1) == 0);
+	int bad_cpus[] = {-1};
+	assert(worker_thread_pool_set_cpu_affinity(&pool, bad_cpus, 1) != 0);
 
 	srand(time(NULL));
 